@@ -6,19 +6,27 @@ var socket = new Socket(Socket.PF_INET, Socket.SOCK_STREAM, Socket.IPPROTO_TCP);
 socket.setOption(Socket.SO_REUSEADDR, true);
 socket.bind(address, port);
 socket.listen(10);
+socket.setBlocking(false);
 
-while (1) {
-	var connection = socket.accept();
-	var data = "", buffer = "";
-	while (1) {
-		buffer = connection.receive(1000);
-		if (!buffer) { break; }
+/* every connection is handled by readiness callbacks; the event loop runs after this file finishes */
+socket.onReadable(function() {
+	var connection = this.accept();
+	if (!connection) { return; }
+	connection.setBlocking(false);
+
+	var data = "";
+	connection.onReadable(function() {
+		var buffer = this.receive(1000);
+		if (buffer === null) { return; } /* nothing to read yet */
 		data += buffer;
-		if (data.indexOf("\n\n") == data.length-2) { break; }
-		if (data.indexOf("\r\n\r\n") == data.length-4) { break; }
-	}
-	connection.send("HTTP/1.0 200 OK\n\nHello world .)");
-	connection.close();	
-	if (data.match(/quit/i)) { break; }
-}
-socket.close();
+
+		var complete = (!buffer || data.indexOf("\n\n") == data.length-2 || data.indexOf("\r\n\r\n") == data.length-4);
+		if (!complete) { return; }
+
+		this.onReadable(null);
+		this.setBlocking(true);
+		this.send("HTTP/1.0 200 OK\n\nHello world .)");
+		this.close();
+		if (data.match(/quit/i)) { socket.close(); }
+	});
+});
@@ -1,7 +1,6 @@
 /**
- * Currently only supports MySQL
+ * Supports MySQL and SQLite
  */
-var sprintf = require("./sprintf").sprintf;
 
 /* ***** BEGIN LICENSE BLOCK *****
  * 
@@ -5770,9 +5769,10 @@ ActiveRecord.Adapters.v8cgiMySQL = function v8cgiMySQL(){
         executeSQL: function executeSQL(sql)
         {
             ActiveRecord.connection.log("Adapters.v8cgiMySQL.executeSQL: " + sql + " [" + ActiveSupport.arrayFrom(arguments).slice(1).join(',') + "]");
-				var query = sprintf.apply(global, ([sql.replace(/\?/g,"'%s'")]).concat(ActiveSupport.arrayFrom(arguments).slice(1)) );
-				var r = ActiveRecord.Adapters.v8cgiMySQL.db.query( query );
+				var params = ActiveSupport.arrayFrom(arguments).slice(1);
+				var r = ActiveRecord.Adapters.v8cgiMySQL.db.query(sql, params.length ? params : null);
 				r.rows  = r.fetchObjects ? r.fetchObjects() : [];
+				if (r.close) { r.close(); }
             return r;
         },
         getLastInsertedRowId: function getLastInsertedRowId()
@@ -5815,4 +5815,45 @@ ActiveRecord.Adapters.v8cgiMySQL.connect = function connect(options)
 
 })();
 
+(function(){
+
+/**
+ * Adapter for v8cgi configured with SQLite. Values are bound as statement parameters,
+ * so repeated statements are parsed only once per connection.
+ * @alias ActiveRecord.Adapters.v8cgiSQLite
+ * @property {ActiveRecord.Adapter}
+ */ 
+ActiveRecord.Adapters.v8cgiSQLite = function v8cgiSQLite(){
+    ActiveSupport.extend(this,ActiveRecord.Adapters.InstanceMethods);
+    ActiveSupport.extend(this,ActiveRecord.Adapters.SQLite);
+    ActiveSupport.extend(this,{
+        executeSQL: function executeSQL(sql)
+        {
+            var params = ActiveSupport.arrayFrom(arguments).slice(1);
+            ActiveRecord.connection.log("Adapters.v8cgiSQLite.executeSQL: " + sql + " [" + params.join(',') + "]");
+            var r = ActiveRecord.Adapters.v8cgiSQLite.db.query(sql, params.length ? params : null);
+            r.rows = r.fetchObjects();
+            return r;
+        },
+        getLastInsertedRowId: function getLastInsertedRowId()
+        {
+            return ActiveRecord.Adapters.v8cgiSQLite.db.insertId();
+        },
+        iterableFromResultSet: function iterableFromResultSet(result)
+        {
+            result.iterate = ActiveRecord.Adapters.defaultResultSetIterator;
+            return result;
+        }
+    });
+};
+
+ActiveRecord.Adapters.v8cgiSQLite.connect = function connect(path)
+{
+    var SQLite = require("sqlite").SQLite;
+    ActiveRecord.Adapters.v8cgiSQLite.db = new SQLite().open(path || ":memory:");
+    return new ActiveRecord.Adapters.v8cgiSQLite();
+};
+
+})();
+
 exports.ActiveRecord = ActiveRecord;
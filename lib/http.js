@@ -226,6 +226,10 @@ HTTP.ClientRequest = function(url) {
 	this.get = {};
 	this.post = {};
 	this.cookie = {};
+	this.timeout = 30000; /* ms without progress */
+	this.decompress = true; /* ask for and inflate gzip/deflate bodies */
+	this.responseType = "string"; /* or "buffer" */
+	this.onData = null; /* function(chunk) to stream the body instead of collecting it */
 
 	var u = url;
 	var index = u.indexOf("?");
@@ -247,20 +251,20 @@ HTTP.ClientRequest.prototype.header = function(obj) {
 }
 
 HTTP.ClientRequest.prototype.send = function(follow) {
-	var Socket = require("socket").Socket;
+	var pool = require("pool");
+	var client = require("httpclient");
 	
 	var items = this._splitUrl();
 	var host = items[0];
 	var port = items[1];
 	var url = items[2];
-	var ip = Socket.getAddrInfo(host);
 	this.header({"Host":host});
 	
 	/* defaults */
 	this.header({
-		"Connection":"close",
+		"Connection":"keep-alive",
 		"Accept-Charset":"utf-8",
-		"Accept-Encoding":"identity"
+		"Accept-Encoding":(this.decompress ? "gzip, deflate" : "identity")
 	});
 	
 	/* add get data */
@@ -295,26 +299,31 @@ HTTP.ClientRequest.prototype.send = function(follow) {
 		data += p+": "+this._headers[p]+"\r\n";
 	}
 	data += "\r\n";
-	if (post) {
-		data += post+"\r\n";
-		data += "\r\n";
-	}
 
-	var s = new Socket(Socket.PF_INET, Socket.SOCK_STREAM, Socket.IPPROTO_TCP);
-	s.connect(ip, port);
-	s.send(data);
-	
-	var received = "";
-	do {
-		var part = s.receive(1024, true);
-		for (var i=0;i<part.length;i++) {
-			received += String.fromCharCode(part[i]);
+	var options = {
+		method: this.method,
+		timeout: this.timeout,
+		decompress: this.decompress,
+		type: this.responseType,
+		onData: this.onData
+	};
+
+	/* pooled keep-alive connection; a stale one (closed by the server meanwhile) is retried once */
+	var response = null;
+	for (var attempt=0; attempt<2 && !response; attempt++) {
+		var s = pool.acquire(host, port);
+		try {
+			response = client.exchange(s, data, post || null, options);
+		} catch (e) {
+			pool.release(s, false);
+			if (s.reused && e.stale) { continue; }
+			throw e;
 		}
-	} while (part.length > 0);
-	s.close();
-	received = Util.utf8encode(received);
+		pool.release(s, response.reusable);
+	}
+	if (!response) { throw new Error("Cannot read response from " + host + ":" + port); }
 	
-	return this._handleResponse(received, follow);
+	return this._handleResponse(response, follow);
 }
 
 HTTP.ClientRequest.prototype._serialize = function(obj) {
@@ -376,6 +385,16 @@ HTTP.ClientResponse = function(data) {
 	this.statusReason = "";
 	this._headers = {};
 	
+	if (typeof(data) == "object") { /* parsed by the httpclient module */
+		this.status = data.status;
+		this.statusReason = data.reason;
+		for (var i=0;i<data.headers.length;i++) {
+			this._headers[data.headers[i][0].toUpperCase()] = data.headers[i][1];
+		}
+		this.data = data.body;
+		return;
+	}
+	
 	var index = data.indexOf("\r\n\r\n");
 	var body = data.substring(index+4);
 	var h = data.substring(0, index);
@@ -54,7 +54,8 @@ Session.prototype.save = function() {
 		return;
     }
     var str = Util.serialize(this._data);
-    this._file.open("w").write(str).close();
+    /* replaced atomically, durable before save() returns */
+    this._file.writeAtomic(str, {fsync:true});
 }
 
 Session.prototype.getId = function() {
@@ -6,6 +6,9 @@
 #include <vector>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <v8.h>
 
 #ifdef FASTCGI
@@ -109,11 +112,13 @@ int v8cgi_App::prepare(char ** envp) {
 	}
 
 	setup_v8cgi(g);
-	setup_system(g, envp, this->mainfile, this->mainfile_args);
+	setup_system(g, this->mainfile, this->mainfile_args);
 	setup_fs(g);
 	
 	/* default libraries */
+	uint64_t start = Timeline::now();
 	this->autoload();
+	this->timeline.add("autoload", start, Timeline::now());
 	return 0;
 }
 
@@ -140,6 +145,7 @@ void v8cgi_App::autoload() {
  */
 int v8cgi_App::execute(char ** envp) {
 	v8::HandleScope handle_scope;
+	this->timeline.reset();
 	
 	/**
 	 * Context must be clened before reusing
@@ -154,9 +160,11 @@ int v8cgi_App::execute(char ** envp) {
 #endif
 
 	this->terminated = false;
+	this->envp = envp;
 	this->mainModule = v8::Object::New();
 
 	int result = this->prepare(envp);
+	this->timeline.add("prepare", this->timeline.origin(), Timeline::now());
 	if (result) { return result; } /* error with config file or default libs */
 	
 	if (this->mainfile == "") {
@@ -164,8 +172,18 @@ int v8cgi_App::execute(char ** envp) {
 		return 1;
 	}
 
+	this->profiler.start(JS_GLOBAL->Get(JS_STR("Config")));
 	v8::TryCatch try_catch;
+	uint64_t start = Timeline::now();
 	this->require(this->mainfile, path_getcwd()); 
+	this->timeline.add("main", start, Timeline::now());
+
+	/* pending timers and watchers */
+	if (!try_catch.HasCaught() && !this->loop.isIdle()) {
+		start = Timeline::now();
+		this->loop.run();
+		this->timeline.add("loop", start, Timeline::now());
+	}
 	if (try_catch.HasCaught()) { /* error when executing main file */
 		result = 1;
 		std::string error = this->format_exception(&try_catch);
@@ -184,6 +202,8 @@ int v8cgi_App::execute(char ** envp) {
  * End request
  */
 void v8cgi_App::finish() {
+	uint64_t start = Timeline::now();
+
 	/* user callbacks */
 	for (unsigned int i=0; i<this->onexit.size(); i++) {
 		this->onexit[i]->Call(JS_GLOBAL, 0, NULL);
@@ -192,11 +212,30 @@ void v8cgi_App::finish() {
 	}
 	this->onexit.clear();
 
+	/* batched atomic writes */
+	std::string failed = finish_fs();
+	if (failed.length()) {
+		std::string error = "Cannot atomically write file '";
+		error += failed;
+		error += "'";
+		this->error(error.c_str(), __FILE__, __LINE__);
+	}
+
+	/* leftovers after exit() or an uncaught exception */
+	this->loop.clear();
+
 	/* garbage collection */
 	this->gc.finish();
+
+	/* profile of this request */
+	std::string profile = this->profiler.stop();
+	if (profile.length()) { this->error(profile.c_str(), __FILE__, __LINE__); }
 	
 	/* export cache */
 	this->cache.clearExports();
+
+	this->timeline.add("finish", start, Timeline::now());
+	this->write_timeline();
 	
 #ifndef REUSE_CONTEXT
 	/**
@@ -206,6 +245,35 @@ void v8cgi_App::finish() {
 #endif
 }
 
+/**
+ * Look up an environment variable in request's environment
+ */
+const char * v8cgi_App::envValue(const char * name) {
+	if (!this->envp) { return NULL; }
+	size_t length = strlen(name);
+	for (int i = 0; this->envp[i] != NULL; i++) {
+		if (strncmp(this->envp[i], name, length) == 0 && this->envp[i][length] == '=') {
+			return this->envp[i] + length + 1;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * List names of all environment variables
+ */
+void v8cgi_App::envNames(std::vector<std::string> & names) {
+	if (!this->envp) { return; }
+	for (int i = 0; this->envp[i] != NULL; i++) {
+		const char * eq = strchr(this->envp[i], '=');
+		if (eq) {
+			names.push_back(std::string(this->envp[i], eq - this->envp[i]));
+		} else {
+			names.push_back(std::string(this->envp[i]));
+		}
+	}
+}
+
 /**
  * To include a module, we first require it and than populate global object with retrieved data
  * @param {std::string} name
@@ -268,6 +336,7 @@ v8::Handle<v8::Object> v8cgi_App::require(std::string name, std::string relative
 	v8::Handle<v8::Object> module = (name == this->mainfile ? this->mainModule : v8::Object::New());
 	module->Set(JS_STR("id"), JS_STR(modulename.c_str()));
 
+	uint64_t start = Timeline::now();
 	int status = 0;
 	for (unsigned int i=0; i<files.size(); i++) {
 		std::string file = files[i];
@@ -284,6 +353,7 @@ v8::Handle<v8::Object> v8cgi_App::require(std::string name, std::string relative
 		}
 	}
 
+	this->timeline.add("require " + modulename, start, Timeline::now());
 	return handle_scope.Close(exports);
 }
 
@@ -466,12 +536,13 @@ std::string v8cgi_App::format_exception(v8::TryCatch* try_catch) {
 void v8cgi_App::create_context() {
 	v8::HandleScope handle_scope;
 	v8::Handle<v8::ObjectTemplate> globaltemplate = v8::ObjectTemplate::New();
-	globaltemplate->SetInternalFieldCount(2);
+	globaltemplate->SetInternalFieldCount(3);
 	this->context = v8::Context::New(NULL, globaltemplate);
 	this->context->Enter();
 
 	GLOBAL_PROTO->SetInternalField(0, v8::External::New((void *) this)); 
 	GLOBAL_PROTO->SetInternalField(1, v8::External::New((void *) &(this->gc))); 
+	GLOBAL_PROTO->SetInternalField(2, v8::External::New((void *) &(this->loop))); 
 }
 
 /**
@@ -503,6 +574,44 @@ v8::Handle<v8::Value> v8cgi_App::get_config(std::string name) {
 	return config->ToObject()->Get(JS_STR(name.c_str()));
 }
 
+/**
+ * Append request timeline to Config.timelineFile, in Trace Event Format (JSON array, closing bracket omitted)
+ */
+void v8cgi_App::write_timeline() {
+	v8::HandleScope handle_scope;
+	v8::Handle<v8::Value> config = JS_GLOBAL->Get(JS_STR("Config"));
+	if (!config->IsObject()) { return; }
+	v8::Handle<v8::Value> file = config->ToObject()->Get(JS_STR("timelineFile"));
+	if (!file->IsString() || !file->ToString()->Length()) { return; }
+	if (!this->timeline.getEntries().size()) { return; }
+
+	/**
+	 * Many workers share the file: each record goes out in a single write() to an O_APPEND descriptor,
+	 * so records never interleave. Whoever creates the file writes the opening bracket with its record.
+	 */
+	v8::String::Utf8Value name(file);
+	std::string data = ",\n";
+	int fd = open(*name, O_WRONLY | O_APPEND | O_CREAT | O_EXCL, 0644);
+	if (fd != -1) {
+		data = "[\n";
+	} else if (errno == EEXIST) {
+		fd = open(*name, O_WRONLY | O_APPEND);
+	}
+	if (fd == -1) {
+		std::string error = "Cannot open timeline file '";
+		error += *name;
+		error += "'";
+		this->error(error.c_str(), __FILE__, __LINE__);
+		return;
+	}
+
+	data += this->timeline.toTrace(getpid());
+	if (write(fd, data.data(), data.length()) != (ssize_t) data.length()) {
+		this->error("Cannot write timeline file", __FILE__, __LINE__);
+	}
+	close(fd);
+}
+
 /**
  * Build module-specific require or include
  */
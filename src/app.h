@@ -8,6 +8,9 @@
 #include <v8.h>
 #include "cache.h"
 #include "gc.h"
+#include "timeline.h"
+#include "profiler.h"
+#include "loop.h"
 
 /**
  * This class defines a basic v8-based application.
@@ -33,6 +36,9 @@ public:
 	/* list of "onexit" functions */
 	funcvector onexit;
 
+	/* per-request timeline */
+	Timeline timeline;
+
 	/* stdin */
 	virtual size_t reader (char * destination, size_t size) = 0;
 	/* stdout */
@@ -41,6 +47,10 @@ public:
 	virtual void error(const char * data, const char * file, int line) = 0;
 	/* stdout flush */
 	virtual bool flush() = 0;	
+	/* environment variable value, NULL when not defined */
+	virtual const char * envValue(const char * name);
+	/* names of all environment variables */
+	virtual void envNames(std::vector<std::string> & names);
 
 protected:
 	/* env. preparation */
@@ -52,6 +62,8 @@ protected:
 	std::string mainfile; 
 	/* arguments after mainfile */
 	std::vector<std::string> mainfile_args;
+	/* environment of current request */
+	char ** envp;
 	/* create new v8 execution context */
 	void create_context();
 	/* delete existing context */
@@ -66,6 +78,10 @@ private:
 	Cache cache;
 	/* GC notification engine */
 	GC gc;
+	/* timers and descriptor watchers */
+	EventLoop loop;
+	/* sampling CPU profiler */
+	Profiler profiler;
 
 	std::string format_exception(v8::TryCatch* try_catch);
 	void findmain();
@@ -74,6 +90,7 @@ private:
 	void js_error(std::string message);
 	void autoload();
 	void clear_global();
+	void write_timeline();
 	
 	/* instance type info */
 	virtual const char * instanceType() = 0;
@@ -8,7 +8,12 @@
 #include <sys/types.h>
 
 #include <string>
+#include <vector>
+#include <set>
 #include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
 #include "macros.h"
 #include "common.h"
 #include "path.h"
@@ -17,9 +22,23 @@
 #include <dirent.h>
 
 #ifdef windows
+#	include <windows.h>
+#	include <io.h>
 #	define MKDIR(a, b) mkdir(a)
+#	define DATASYNC(fd) _commit(fd)
+#	define RENAME_OVER(a, b) (MoveFileEx(a, b, MOVEFILE_REPLACE_EXISTING) ? 0 : -1)
 #else
 #	define MKDIR mkdir
+#	ifdef darwin
+#		define DATASYNC(fd) fsync(fd)
+#	else
+#		define DATASYNC(fd) fdatasync(fd)
+#	endif
+#	define RENAME_OVER(a, b) rename(a, b)
+#endif
+
+#ifndef O_BINARY
+#	define O_BINARY 0
 #endif
 
 #define TYPE_FILE 0
@@ -27,6 +46,83 @@
 
 namespace {
 
+/**
+ * Atomic write waiting for a batched sync + rename
+ */
+typedef struct {
+	int fd;
+	std::string tmpname;
+	std::string name;
+	std::string dir;
+	bool sync;
+} atomic_write_t;
+
+std::vector<atomic_write_t> atomic_batch;
+unsigned int atomic_counter = 0;
+
+/**
+ * Write whole buffer, restarting after interrupts and partial writes
+ */
+int write_all(int fd, const char * data, size_t size) {
+	while (size) {
+		ssize_t written = write(fd, data, size);
+		if (written == -1) {
+			if (errno == EINTR) { continue; }
+			return -1;
+		}
+		data += written;
+		size -= written;
+	}
+	return 0;
+}
+
+/**
+ * Make a rename within a directory durable
+ */
+int sync_directory(std::string dir) {
+#ifdef windows
+	return 0; /* directories cannot be opened for syncing; NTFS journals metadata */
+#else
+	int fd = open(dir.c_str(), O_RDONLY);
+	if (fd == -1) { return -1; }
+	int result = fsync(fd);
+	close(fd);
+	return result;
+#endif
+}
+
+/**
+ * Finish all queued atomic writes. Data of files written with fsync is synced first, 
+ * then all files are renamed and every affected directory is synced only once.
+ * @returns {std::string} Name of first file which could not be written; empty on success
+ */
+std::string sync_batch() {
+	std::string failed = "";
+	std::set<std::string> dirs;
+	std::vector<bool> synced(atomic_batch.size(), true);
+	
+	for (size_t i=0; i<atomic_batch.size(); i++) {
+		if (atomic_batch[i].sync && DATASYNC(atomic_batch[i].fd) != 0) { synced[i] = false; }
+		if (close(atomic_batch[i].fd) != 0) { synced[i] = false; }
+	}
+	
+	for (size_t i=0; i<atomic_batch.size(); i++) {
+		atomic_write_t & item = atomic_batch[i];
+		if (!synced[i] || RENAME_OVER(item.tmpname.c_str(), item.name.c_str()) != 0) {
+			unlink(item.tmpname.c_str());
+			if (!failed.length()) { failed = item.name; }
+			continue;
+		}
+		if (item.sync) { dirs.insert(item.dir); }
+	}
+	atomic_batch.clear();
+
+	for (std::set<std::string>::iterator it = dirs.begin(); it != dirs.end(); it++) {
+		sync_directory(*it);
+	}
+	return failed;
+}
+
 /**
  * Generic directory lister
  * @param {char *} name Directory name
@@ -229,6 +325,109 @@ JS_METHOD(_write) {
 	return args.This();
 }
 
+/**
+ * Replace file contents atomically: data is written to a temporary file in the same
+ * directory, which is then renamed over this one. Readers see either old or new contents.
+ * @param {string|int[]} data
+ * @param {object} [options] Hash with optional keys:
+ *   fsync: sync data (and directory) to disk, so the new contents survive a crash
+ *   batch: postpone sync + rename to File.syncBatch() or end of request, grouping syncs of many files;
+ *     with fsync, every file is synced then, before its rename
+ * Mode (and owner, where permitted) of an existing file is kept.
+ */
+JS_METHOD(_writeatomic) {
+	if (args.Length() < 1) {
+		return JS_TYPE_ERROR("Bad argument count. Use 'file.writeAtomic(data, [options])'");
+	}
+
+	v8::String::Utf8Value n(LOAD_VALUE(0));
+	std::string name = *n;
+	bool sync = false;
+	bool batch = false;
+	if (args.Length() > 1 && args[1]->IsObject()) {
+		v8::Handle<v8::Object> options = args[1]->ToObject();
+		sync = options->Get(JS_STR("fsync"))->BooleanValue();
+		batch = options->Get(JS_STR("batch"))->BooleanValue();
+	}
+	
+	std::string data;
+	if (args[0]->IsArray()) {
+		v8::Handle<v8::Array> arr = v8::Handle<v8::Array>::Cast(args[0]);
+		uint32_t len = arr->Length();
+		data.reserve(len);
+		for (unsigned int i=0;i<len;i++) {
+			data += (char) arr->Get(JS_INT(i))->IntegerValue();
+		}
+	} else {
+		v8::String::Utf8Value str(args[0]);
+		data.assign(*str, str.length());
+	}
+
+	/* temporary file must live in the same directory (filesystem), otherwise rename is not atomic */
+	size_t slash = path_lastslash(name);
+	std::string dir = (slash == std::string::npos ? "." : (slash ? name.substr(0, slash) : "/"));
+	char suffix[64];
+	snprintf(suffix, sizeof(suffix), ".%d.%u.tmp", (int) getpid(), atomic_counter++);
+	std::string tmpname = dir + "/." + path_filename(name) + suffix;
+
+	int fd = open(tmpname.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0644);
+	if (fd == -1) { return JS_ERROR(strerror(errno)); }
+
+	struct stat st;
+	if (stat(name.c_str(), &st) == 0) {
+#ifdef windows
+		chmod(tmpname.c_str(), st.st_mode & (S_IREAD | S_IWRITE));
+#else
+		if (fchown(fd, st.st_uid, st.st_gid) != 0) {} /* only root may give files away */
+		fchmod(fd, st.st_mode & 07777); /* chown clears setuid/setgid bits */
+#endif
+	}
+
+	if (write_all(fd, data.data(), data.length()) != 0) {
+		int err = errno;
+		close(fd);
+		unlink(tmpname.c_str());
+		return JS_ERROR(strerror(err));
+	}
+	
+	if (batch) {
+		atomic_write_t item;
+		item.fd = fd;
+		item.tmpname = tmpname;
+		item.name = name;
+		item.dir = dir;
+		item.sync = sync;
+		atomic_batch.push_back(item);
+		return args.This();
+	}
+
+	int result = (sync ? DATASYNC(fd) : 0);
+	if (close(fd) != 0) { result = -1; }
+	if (result == 0) { result = RENAME_OVER(tmpname.c_str(), name.c_str()); }
+	if (result != 0) {
+		int err = errno;
+		unlink(tmpname.c_str());
+		return JS_ERROR(strerror(err));
+	}
+	
+	if (sync) { sync_directory(dir); }
+	return args.This();
+}
+
+/**
+ * Sync and rename all files written by writeAtomic(data, {batch:true}) so far
+ */
+JS_METHOD(_syncbatch) {
+	std::string failed = sync_batch();
+	if (failed.length()) {
+		std::string error = "Cannot atomically write file '";
+		error += failed;
+		error += "'";
+		return JS_ERROR(error.c_str());
+	}
+	return JS_BOOL(true);
+}
+
 JS_METHOD(_removefile) {
 	v8::String::Utf8Value name(LOAD_VALUE(0));
 	
@@ -358,6 +557,7 @@ void setup_fs(v8::Handle<v8::Object> target) {
 	pt->Set("rewind", v8::FunctionTemplate::New(_rewind));
 	pt->Set("close", v8::FunctionTemplate::New(_close));
 	pt->Set("write", v8::FunctionTemplate::New(_write));
+	pt->Set("writeAtomic", v8::FunctionTemplate::New(_writeatomic));
 	pt->Set("remove", v8::FunctionTemplate::New(_removefile));
 	pt->Set("toString", v8::FunctionTemplate::New(_tostring));
 	pt->Set("exists", v8::FunctionTemplate::New(_exists));
@@ -366,6 +566,11 @@ void setup_fs(v8::Handle<v8::Object> target) {
 	pt->Set("stat", v8::FunctionTemplate::New(_stat));
 	pt->Set("isFile", v8::FunctionTemplate::New(_isfile));
 
+	/**
+	 * File static methods (File.*)
+	 */
+	ft->Set(JS_STR("syncBatch"), v8::FunctionTemplate::New(_syncbatch)->GetFunction());
+
 	target->Set(JS_STR("File"), ft->GetFunction());			
 	
 	v8::Handle<v8::FunctionTemplate> dt = v8::FunctionTemplate::New(_directory);
@@ -390,3 +595,7 @@ void setup_fs(v8::Handle<v8::Object> target) {
 
 	target->Set(JS_STR("Directory"), dt->GetFunction());
 }
+
+std::string finish_fs() {
+	return sync_batch();
+}
@@ -1,3 +1,7 @@
 #include <v8.h>
+#include <string>
 
 void setup_fs(v8::Handle<v8::Object> target);
+
+/* complete pending batched writes; returns name of the first file that failed */
+std::string finish_fs();
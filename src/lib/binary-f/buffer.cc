@@ -0,0 +1,52 @@
+#include <v8.h>
+#include "macros.h"
+#include "buffer.h"
+
+namespace {
+
+v8::Persistent<v8::Function> buffer;
+v8::Persistent<v8::Value> bufferPrototype;
+
+}
+
+void Buffer_init(v8::Handle<v8::Function> require) {
+	v8::HandleScope handle_scope;
+	/* every request may have a fresh binary-f module (and context) */
+	if (!buffer.IsEmpty()) {
+		buffer.Dispose();
+		buffer.Clear();
+		bufferPrototype.Dispose();
+		bufferPrototype.Clear();
+	}
+
+	v8::Handle<v8::Value> params[] = { JS_STR("binary-f") };
+	v8::Handle<v8::Value> exports = require->Call(JS_GLOBAL, 1, params);
+	if (!exports->IsObject()) { return; }
+
+	v8::Handle<v8::Value> ctor = exports->ToObject()->Get(JS_STR("Buffer"));
+	if (!ctor->IsFunction()) { return; }
+	
+	buffer = v8::Persistent<v8::Function>::New(v8::Handle<v8::Function>::Cast(ctor));
+	bufferPrototype = v8::Persistent<v8::Value>::New(buffer->Get(JS_STR("prototype")));
+}
+
+bool Buffer_isBuffer(v8::Handle<v8::Value> value) {
+	if (buffer.IsEmpty() || !value->IsObject()) { return false; }
+	v8::Handle<v8::Object> obj = value->ToObject();
+	if (obj->InternalFieldCount() != 1) { return false; }
+	return obj->GetPrototype()->StrictEquals(bufferPrototype);
+}
+
+ByteStorage * Buffer_storage(v8::Handle<v8::Value> value) {
+	return reinterpret_cast<ByteStorage *>(value->ToObject()->GetPointerFromInternalField(0));
+}
+
+v8::Handle<v8::Object> Buffer_create(ByteStorage * bs) {
+	if (buffer.IsEmpty()) { /* binary-f could not be loaded */
+		delete bs;
+		JS_ERROR("Buffer constructor is not available");
+		return v8::Handle<v8::Object>();
+	}
+	v8::Handle<v8::Value> newargs[] = { v8::External::New((void *) bs) };
+	return buffer->NewInstance(1, newargs);
+}
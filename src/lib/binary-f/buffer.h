@@ -0,0 +1,21 @@
+/**
+ * Access to binary-f Buffers from other native modules.
+ * A module using these links buffer.cc + bytestorage.cc and calls Buffer_init() from its init().
+ */
+
+#ifndef _BUFFER_H
+#define _BUFFER_H
+
+#include <v8.h>
+#include "bytestorage.h"
+
+/* load the Buffer constructor via module's require */
+void Buffer_init(v8::Handle<v8::Function> require);
+/* is this a Buffer instance? */
+bool Buffer_isBuffer(v8::Handle<v8::Value> value);
+/* storage of a Buffer instance */
+ByteStorage * Buffer_storage(v8::Handle<v8::Value> value);
+/* create a new Buffer; it takes ownership of the storage. Empty handle (exception thrown) when binary-f is not loaded */
+v8::Handle<v8::Object> Buffer_create(ByteStorage * bs);
+
+#endif
@@ -42,6 +42,15 @@ ByteStorage::ByteStorage(ByteStorage * bs, size_t index1, size_t index2) {
 	this->data = bs->getData() + index1;
 }
 
+/**
+ * Use a freshly created storage, e.g. with external data
+ */
+ByteStorage::ByteStorage(ByteStorageData * storage, size_t length) {
+	this->storage = storage;
+	this->length = length;
+	this->data = storage->getData();
+}
+
 ByteStorage::~ByteStorage() {
 	this->data = NULL;
 	size_t inst = this->storage->getInstances();
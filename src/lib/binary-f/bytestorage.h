@@ -7,8 +7,13 @@
 
 class ByteStorageData {
 public:
+	/* releases externally owned memory */
+	typedef void (*release_t)(unsigned char * data, size_t length);
+
 	ByteStorageData(size_t length) {
 		this->instances = 1;
+		this->length = length;
+		this->release = NULL;
 		if (length) {
 			this->data = (unsigned char *) malloc(length);
 			if (!this->data) { throw std::string("Cannot allocate enough memory"); }
@@ -17,8 +22,21 @@ public:
 		}
 	}
 	
+	/* external memory (e.g. a file mapping), released when the last view dies */
+	ByteStorageData(unsigned char * data, size_t length, release_t release) {
+		this->instances = 1;
+		this->length = length;
+		this->release = release;
+		this->data = data;
+	}
+	
 	~ByteStorageData() {
-		if (this->data) { free(this->data); }
+		if (!this->data) { return; }
+		if (this->release) {
+			this->release(this->data, this->length);
+		} else {
+			free(this->data);
+		}
 	}
 	
 	size_t getInstances() {
@@ -35,7 +53,9 @@ public:
 
 private:
 	unsigned char * data;
+	size_t length;
 	size_t instances;
+	release_t release;
 };
 
 /**
@@ -46,6 +66,7 @@ public:
 	ByteStorage(size_t length); /* empty */
 	ByteStorage(unsigned char * data, size_t length); /* with contents (copied) */
 	ByteStorage(ByteStorage * master, size_t index1, size_t index2); /* new view */
+	ByteStorage(ByteStorageData * storage, size_t length); /* atop a fresh storage (not copied) */
 	~ByteStorage();
 	
 	ByteStorageData * getStorage();
@@ -0,0 +1,1136 @@
+/**
+ * Cache clients: memcached (text or meta protocol) and Redis (RESP).
+ * Keys are spread over servers by consistent hashing. Commands for one server are pipelined,
+ * multi-key operations send all requests before reading any reply. Connections are kept
+ * per worker process and reused by later requests.
+ */
+
+#include <v8.h>
+#include <map>
+#include <vector>
+#include <string>
+#include <sstream>
+#include "macros.h"
+#include "gc.h"
+#include "lib/socket/resolver.h"
+#include "lib/binary-f/buffer.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+#ifdef windows
+#  include <winsock2.h>
+#  include <ws2tcpip.h>
+#  define close(s) closesocket(s)
+#else
+#  include <unistd.h>
+#  include <fcntl.h>
+#  include <poll.h>
+#  include <sys/socket.h>
+#  include <sys/un.h>
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#  include <netdb.h>
+#endif
+
+#ifndef INVALID_SOCKET
+#  define INVALID_SOCKET -1
+#endif
+
+#ifndef SOCKET_ERROR
+#  define SOCKET_ERROR -1
+#endif
+
+#define CLIENT_PTR client_t * client = LOAD_PTR(0, client_t *); if (!client) { return JS_ERROR("Client is closed"); }
+#define RING_POINTS 160
+#define RECV_SIZE 16384
+#define MAX_KEY 250
+
+namespace {
+
+/**
+ * Connection with buffered input
+ */
+typedef struct {
+	int fd;
+	std::string in;
+	size_t pos;
+	std::string out;
+} conn_t;
+
+typedef struct {
+	std::vector<std::string> servers;
+	std::map<uint32_t, int> ring;
+	std::string prefix; /* connection key prefix: protocol (and database) */
+	int defaultPort;
+	int timeout; /* ms */
+	bool buffer; /* values as Buffers */
+	bool meta; /* memcached meta protocol */
+	int database; /* redis */
+	std::string password; /* redis */
+} client_t;
+
+typedef std::map<std::string, conn_t *> conns_t;
+conns_t conns; /* per worker */
+
+v8::Persistent<v8::FunctionTemplate> memcachedTemplate;
+v8::Persistent<v8::FunctionTemplate> redisTemplate;
+
+/**
+ * 32-bit FNV-1a with a final avalanche step
+ */
+uint32_t hash(const char * data, size_t length) {
+	uint32_t h = 2166136261U;
+	for (size_t i=0; i<length; i++) {
+		h ^= (unsigned char) data[i];
+		h *= 16777619U;
+	}
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+	return h;
+}
+
+void build_ring(client_t * client) {
+	client->ring.clear();
+	for (size_t i=0; i<client->servers.size(); i++) {
+		for (int j=0; j<RING_POINTS; j++) {
+			std::stringstream ss;
+			ss << client->servers[i] << "-" << j;
+			std::string point = ss.str();
+			client->ring[hash(point.data(), point.length())] = i;
+		}
+	}
+}
+
+/**
+ * Consistent hashing: index of the server owning a key
+ */
+int server_for(client_t * client, const std::string & key) {
+	if (client->servers.size() == 1) { return 0; }
+	std::map<uint32_t, int>::iterator it = client->ring.lower_bound(hash(key.data(), key.length()));
+	if (it == client->ring.end()) { it = client->ring.begin(); }
+	return it->second;
+}
+
+int wait_fd(int fd, bool write, int timeout) {
+#ifdef windows
+	fd_set set;
+	FD_ZERO(&set);
+	FD_SET(fd, &set);
+	struct timeval tv;
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+	return select(0, (write ? NULL : &set), (write ? &set : NULL), NULL, (timeout < 0 ? NULL : &tv));
+#else
+	struct pollfd p;
+	p.fd = fd;
+	p.events = (write ? POLLOUT : POLLIN);
+	p.revents = 0;
+	return poll(&p, 1, timeout);
+#endif
+}
+
+/**
+ * Raw bytes of a Buffer or a string (numbers are converted)
+ */
+void get_bytes(v8::Handle<v8::Value> value, std::string & holder, const char ** data, size_t * length) {
+	if (Buffer_isBuffer(value)) {
+		ByteStorage * bs = Buffer_storage(value);
+		*data = (const char *) bs->getData();
+		*length = bs->getLength();
+		return;
+	}
+	v8::String::Utf8Value str(value);
+	holder.assign(*str, str.length());
+	*data = holder.data();
+	*length = holder.length();
+}
+
+v8::Handle<v8::Value> make_value(client_t * client, const char * data, size_t length) {
+	if (client->buffer) { return Buffer_create(new ByteStorage((unsigned char *) data, length)); }
+	return JS_STR(data, length);
+}
+
+/**
+ * "host:port", "[ipv6]:port", "host" (default port), "/path" or "@abstract"
+ */
+int open_connection(client_t * client, const std::string & server, std::string & error) {
+#ifndef windows
+	if (server[0] == '/' || server[0] == '@') {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		if (server.length() >= sizeof(addr.sun_path)) {
+			error = "Unix socket path too long";
+			return INVALID_SOCKET;
+		}
+		addr.sun_family = AF_UNIX;
+		memcpy(addr.sun_path, server.data(), server.length());
+		socklen_t len = offsetof(struct sockaddr_un, sun_path) + server.length() + 1;
+		if (server[0] == '@') {
+			addr.sun_path[0] = '\0';
+			len--;
+		}
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd == INVALID_SOCKET || connect(fd, (struct sockaddr *) &addr, len) != 0) {
+			error = server + ": " + strerror(errno);
+			if (fd != INVALID_SOCKET) { close(fd); }
+			return INVALID_SOCKET;
+		}
+		return fd;
+	}
+#endif
+
+	std::string host = server;
+	std::stringstream port;
+	port << client->defaultPort;
+	size_t colon = server.rfind(':');
+	if (server[0] == '[') {
+		size_t end = server.find(']');
+		host = server.substr(1, end == std::string::npos ? std::string::npos : end - 1);
+		if (end != std::string::npos && end + 1 < server.length()) {
+			port.str("");
+			port << server.substr(end + 2);
+		}
+	} else if (colon != std::string::npos && server.find(':') == colon) {
+		host = server.substr(0, colon);
+		port.str("");
+		port << server.substr(colon + 1);
+	}
+
+	Resolver::addresses_t addresses;
+	if (!Resolver::resolve(host, addresses, error)) {
+		error = server + ": " + error;
+		return INVALID_SOCKET;
+	}
+	Resolver::preferIPv4(addresses);
+
+	for (size_t i=0; i<addresses.size(); i++) {
+		struct addrinfo hints, * ai;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_NUMERICHOST;
+		if (getaddrinfo(addresses[i].c_str(), port.str().c_str(), &hints, &ai) != 0) { continue; }
+		int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd != INVALID_SOCKET && connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+			freeaddrinfo(ai);
+			int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char *) &one, sizeof(int)); /* small pipelined requests */
+			return fd;
+		}
+		error = server + ": " + strerror(errno);
+		if (fd != INVALID_SOCKET) { close(fd); }
+		freeaddrinfo(ai);
+	}
+	if (!error.length()) { error = server + ": No address to connect to"; }
+	return INVALID_SOCKET;
+}
+
+std::string conn_key(client_t * client, int index) {
+	return client->prefix + client->servers[index];
+}
+
+void drop_conn(client_t * client, int index) {
+	conns_t::iterator it = conns.find(conn_key(client, index));
+	if (it == conns.end()) { return; }
+	close(it->second->fd);
+	delete it->second;
+	conns.erase(it);
+}
+
+/**
+ * Write all pending output
+ */
+bool flush(conn_t * conn, int timeout, std::string & error) {
+	const char * data = conn->out.data();
+	size_t length = conn->out.length();
+	while (length) {
+		if (timeout > 0 && wait_fd(conn->fd, true, timeout) == 0) {
+			error = "Timed out while sending";
+			return false;
+		}
+		ssize_t sent = send(conn->fd, data, length, 0);
+		if (sent == SOCKET_ERROR) {
+			if (errno == EINTR) { continue; }
+			error = strerror(errno);
+			return false;
+		}
+		data += sent;
+		length -= sent;
+	}
+	conn->out.clear();
+	return true;
+}
+
+/**
+ * Read more input
+ */
+bool fill(conn_t * conn, int timeout, std::string & error) {
+	if (conn->pos > 0 && conn->pos >= conn->in.length() / 2) { /* compact consumed input */
+		conn->in.erase(0, conn->pos);
+		conn->pos = 0;
+	}
+	while (1) {
+		if (timeout > 0 && wait_fd(conn->fd, false, timeout) == 0) {
+			error = "Timed out while reading";
+			return false;
+		}
+		char buf[RECV_SIZE];
+		ssize_t count = recv(conn->fd, buf, sizeof(buf), 0);
+		if (count == SOCKET_ERROR) {
+			if (errno == EINTR) { continue; }
+			error = strerror(errno);
+			return false;
+		}
+		if (count == 0) {
+			error = "Connection closed by server";
+			return false;
+		}
+		conn->in.append(buf, count);
+		return true;
+	}
+}
+
+bool read_line(conn_t * conn, std::string & line, int timeout, std::string & error) {
+	size_t scanned = 0; /* relative to pos, input may be compacted by fill() */
+	while (1) {
+		size_t end = conn->in.find("\r\n", conn->pos + scanned);
+		if (end != std::string::npos) {
+			line.assign(conn->in, conn->pos, end - conn->pos);
+			conn->pos = end + 2;
+			return true;
+		}
+		size_t available = conn->in.length() - conn->pos;
+		scanned = (available ? available - 1 : 0);
+		if (!fill(conn, timeout, error)) { return false; }
+	}
+}
+
+/**
+ * Make length bytes (plus the trailing CRLF) available at conn->in[conn->pos]
+ */
+bool read_block(conn_t * conn, size_t length, int timeout, std::string & error) {
+	while (conn->in.length() - conn->pos < length + 2) {
+		if (!fill(conn, timeout, error)) { return false; }
+	}
+	if (conn->in.compare(conn->pos + length, 2, "\r\n") != 0) {
+		error = "Malformed data block";
+		return false;
+	}
+	return true;
+}
+
+/**
+ * A connection is reusable when nothing is waiting to be read (readable = closed by the peer)
+ */
+bool healthy(conn_t * conn) {
+	if (conn->pos != conn->in.length() || conn->out.length()) { return false; }
+	int error = 0;
+	socklen_t len = sizeof(error);
+	if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, (char *) &error, &len) != 0 || error) { return false; }
+	return (wait_fd(conn->fd, false, 0) == 0);
+}
+
+bool redis_handshake(client_t * client, conn_t * conn, std::string & error);
+
+/**
+ * Connection to a server, reused when possible
+ */
+conn_t * get_conn(client_t * client, int index, std::string & error) {
+	std::string key = conn_key(client, index);
+	conns_t::iterator it = conns.find(key);
+	if (it != conns.end()) {
+		if (healthy(it->second)) { return it->second; }
+		drop_conn(client, index);
+	}
+
+	int fd = open_connection(client, client->servers[index], error);
+	if (fd == INVALID_SOCKET) { return NULL; }
+	conn_t * conn = new conn_t();
+	conn->fd = fd;
+	conn->pos = 0;
+	conns[key] = conn;
+
+	if (client->prefix.compare(0, 6, "redis:") == 0 && !redis_handshake(client, conn, error)) {
+		drop_conn(client, index);
+		return NULL;
+	}
+	return conn;
+}
+
+typedef std::map<int, conn_t *> batch_t;
+
+/**
+ * Connection used by a batch of pipelined commands: checked once, then output accumulates
+ */
+conn_t * batch_conn(client_t * client, int index, batch_t & batch, std::string & error) {
+	batch_t::iterator it = batch.find(index);
+	if (it != batch.end()) { return it->second; }
+	conn_t * conn = get_conn(client, index, error);
+	if (conn) { batch[index] = conn; }
+	return conn;
+}
+
+bool valid_key(const std::string & key) {
+	if (!key.length() || key.length() > MAX_KEY) { return false; }
+	for (size_t i=0; i<key.length(); i++) {
+		if ((unsigned char) key[i] <= 32 || key[i] == 127) { return false; }
+	}
+	return true;
+}
+
+/**
+ * Failure: the connection state is unknown, drop it
+ */
+v8::Handle<v8::Value> io_error(client_t * client, int index, const std::string & error) {
+	drop_conn(client, index);
+	std::string message = client->servers[index] + ": " + error;
+	return JS_ERROR(message.c_str());
+}
+
+/**
+ * Failure in a pipelined batch: every connection it used may have replies in flight or unread,
+ * so none of them can be reused
+ */
+v8::Handle<v8::Value> batch_error(client_t * client, batch_t & used, int index, const std::string & error) {
+	for (batch_t::iterator it = used.begin(); it != used.end(); it++) { drop_conn(client, it->first); }
+	if (index == -1) { return JS_ERROR(error.c_str()); } /* connecting failed, error names the server */
+	return io_error(client, index, error);
+}
+
+/**
+ * Common options: {timeout: ms, type: "string" || "buffer"}
+ */
+client_t * create_client(const v8::Arguments & args, const char * prefix, int defaultPort) {
+	client_t * client = new client_t();
+	client->prefix = prefix;
+	client->defaultPort = defaultPort;
+	client->timeout = 1000;
+	client->buffer = false;
+	client->meta = false;
+	client->database = 0;
+
+	if (args.Length() > 0 && args[0]->IsArray()) {
+		v8::Handle<v8::Array> arr = v8::Handle<v8::Array>::Cast(args[0]);
+		for (unsigned int i=0; i<arr->Length(); i++) {
+			client->servers.push_back(*v8::String::Utf8Value(arr->Get(JS_INT(i))));
+		}
+	} else if (args.Length() > 0 && args[0]->IsString()) {
+		client->servers.push_back(*v8::String::Utf8Value(args[0]));
+	}
+
+	if (args.Length() > 1 && args[1]->IsObject()) {
+		v8::Handle<v8::Object> options = args[1]->ToObject();
+		v8::Handle<v8::Value> value = options->Get(JS_STR("timeout"));
+		if (value->IsNumber()) { client->timeout = value->Int32Value(); }
+		value = options->Get(JS_STR("type"));
+		if (value->IsString()) { client->buffer = (strcmp(*v8::String::Utf8Value(value), "buffer") == 0); }
+		value = options->Get(JS_STR("protocol"));
+		if (value->IsString()) { client->meta = (strcmp(*v8::String::Utf8Value(value), "meta") == 0); }
+		value = options->Get(JS_STR("database"));
+		if (value->IsNumber()) { client->database = value->Int32Value(); }
+		value = options->Get(JS_STR("password"));
+		if (value->IsString()) { client->password = *v8::String::Utf8Value(value); }
+	}
+
+	if (client->database) { /* SELECTed connections must not be shared with other databases */
+		std::stringstream ss;
+		ss << client->prefix << client->database << ":";
+		client->prefix = ss.str();
+	}
+	build_ring(client);
+	return client;
+}
+
+void finalize(v8::Handle<v8::Object> obj) {
+	v8::Handle<v8::Function> fun = v8::Handle<v8::Function>::Cast(obj->Get(JS_STR("close")));
+	fun->Call(obj, 0, NULL);
+}
+
+/**
+ * Release the client; connections stay open for later requests
+ */
+JS_METHOD(_close) {
+	client_t * client = LOAD_PTR(0, client_t *);
+	if (client) {
+		delete client;
+		SAVE_PTR(0, NULL);
+	}
+	return args.This();
+}
+
+/**
+ * Server responsible for a key
+ * @param {string} key
+ * @returns {string}
+ */
+JS_METHOD(_server) {
+	CLIENT_PTR;
+	std::string key = *v8::String::Utf8Value(args[0]);
+	return JS_STR(client->servers[server_for(client, key)].c_str());
+}
+
+/**
+ * Close this client's connections
+ */
+JS_METHOD(_disconnect) {
+	CLIENT_PTR;
+	for (size_t i=0; i<client->servers.size(); i++) { drop_conn(client, i); }
+	return args.This();
+}
+
+/* ---------------------------------------------------------------- memcached ---- */
+
+/**
+ * new Memcached(servers, [options])
+ * @param {string || string[]} servers "host:port", "/path/to.sock" or "@abstract"
+ * @param {object} [options] {protocol: "text" || "meta", timeout: ms, type: "string" || "buffer"}
+ */
+JS_METHOD(_memcached) {
+	ASSERT_CONSTRUCTOR;
+	client_t * client = create_client(args, "memcached:", 11211);
+	if (!client->servers.size()) {
+		delete client;
+		return JS_TYPE_ERROR("Invalid call format. Use 'new Memcached(servers, [options])'");
+	}
+	SAVE_PTR(0, client);
+	GC * gc = GC_PTR;
+	gc->add(args.This(), finalize);
+	return args.This();
+}
+
+/**
+ * Read replies of a multi-get; stores hits into result
+ */
+bool mc_read_values(client_t * client, conn_t * conn, v8::Handle<v8::Object> result, std::string & error) {
+	std::string line;
+	while (1) {
+		if (!read_line(conn, line, client->timeout, error)) { return false; }
+
+		std::string key;
+		size_t length;
+		if (client->meta) {
+			if (line == "MN") { return true; }
+			if (line == "EN") { continue; }
+			if (line.compare(0, 3, "VA ") != 0) {
+				error = "Unexpected reply: " + line;
+				return false;
+			}
+			std::istringstream ss(line.substr(3));
+			std::string token;
+			ss >> length;
+			while (ss >> token) {
+				if (token[0] == 'k') { key = token.substr(1); }
+			}
+		} else {
+			if (line == "END") { return true; }
+			if (line.compare(0, 6, "VALUE ") != 0) {
+				error = "Unexpected reply: " + line;
+				return false;
+			}
+			std::istringstream ss(line.substr(6));
+			unsigned int flags;
+			ss >> key >> flags >> length;
+		}
+
+		if (!read_block(conn, length, client->timeout, error)) { return false; }
+		result->Set(JS_STR(key.c_str()), make_value(client, conn->in.data() + conn->pos, length));
+		conn->pos += length + 2;
+	}
+}
+
+/**
+ * Multi-get: one pipelined batch per server, all servers are queried before reading
+ */
+v8::Handle<v8::Value> mc_get(client_t * client, const std::vector<std::string> & keys) {
+	std::map<int, std::vector<std::string> > batches;
+	for (size_t i=0; i<keys.size(); i++) {
+		if (!valid_key(keys[i])) { return JS_ERROR("Invalid key"); }
+		batches[server_for(client, keys[i])].push_back(keys[i]);
+	}
+
+	std::string error;
+	batch_t used;
+	std::map<int, std::vector<std::string> >::iterator it;
+	for (it = batches.begin(); it != batches.end(); it++) {
+		conn_t * conn = batch_conn(client, it->first, used, error);
+		if (!conn) { return batch_error(client, used, -1, error); }
+		std::vector<std::string> & batch = it->second;
+		if (client->meta) {
+			for (size_t i=0; i<batch.size(); i++) { conn->out += "mg " + batch[i] + " v k\r\n"; }
+			conn->out += "mn\r\n";
+		} else {
+			conn->out += "get";
+			for (size_t i=0; i<batch.size(); i++) { conn->out += " " + batch[i]; }
+			conn->out += "\r\n";
+		}
+		if (!flush(conn, client->timeout, error)) { return batch_error(client, used, it->first, error); }
+	}
+
+	v8::Handle<v8::Object> result = v8::Object::New();
+	for (it = batches.begin(); it != batches.end(); it++) {
+		if (!mc_read_values(client, used[it->first], result, error)) { return batch_error(client, used, it->first, error); }
+	}
+	return result;
+}
+
+/**
+ * @param {string} key
+ * @returns {string || Buffer || null}
+ */
+JS_METHOD(_mc_get) {
+	CLIENT_PTR;
+	if (args.Length() < 1) { return JS_TYPE_ERROR("Bad argument count. Use 'memcached.get(key)'"); }
+	std::string key = *v8::String::Utf8Value(args[0]);
+	std::vector<std::string> keys(1, key);
+	v8::Handle<v8::Value> result = mc_get(client, keys);
+	if (result.IsEmpty() || !result->IsObject()) { return result; }
+	v8::Handle<v8::Object> obj = result->ToObject();
+	if (!obj->Has(JS_STR(key.c_str()))) { return JS_NULL; }
+	return obj->Get(JS_STR(key.c_str()));
+}
+
+/**
+ * @param {string[]} keys
+ * @returns {object} key => value for hits only
+ */
+JS_METHOD(_mc_getmulti) {
+	CLIENT_PTR;
+	if (args.Length() < 1 || !args[0]->IsArray()) { return JS_TYPE_ERROR("Bad argument. Use 'memcached.getMulti(keys)'"); }
+	v8::Handle<v8::Array> arr = v8::Handle<v8::Array>::Cast(args[0]);
+	std::vector<std::string> keys;
+	for (unsigned int i=0; i<arr->Length(); i++) { keys.push_back(*v8::String::Utf8Value(arr->Get(JS_INT(i)))); }
+	return mc_get(client, keys);
+}
+
+typedef enum { MODE_SET, MODE_ADD, MODE_REPLACE } store_mode_t;
+
+void mc_store_request(client_t * client, conn_t * conn, store_mode_t mode, const std::string & key, v8::Handle<v8::Value> value, int ttl) {
+	std::string holder;
+	const char * data;
+	size_t length;
+	get_bytes(value, holder, &data, &length);
+
+	std::stringstream ss;
+	if (client->meta) {
+		const char * modes = "SER";
+		ss << "ms " << key << " " << length << " T" << ttl << " M" << modes[mode] << "\r\n";
+	} else {
+		const char * commands[] = {"set", "add", "replace"};
+		ss << commands[mode] << " " << key << " 0 " << ttl << " " << length << "\r\n";
+	}
+	conn->out += ss.str();
+	conn->out.append(data, length);
+	conn->out += "\r\n";
+}
+
+/**
+ * Store reply: 1 stored, 0 not stored, -1 error
+ */
+int mc_store_reply(client_t * client, conn_t * conn, std::string & error) {
+	std::string line;
+	if (!read_line(conn, line, client->timeout, error)) { return -1; }
+	if (line == "STORED" || line == "HD") { return 1; }
+	if (line == "NOT_STORED" || line == "EXISTS" || line == "NOT_FOUND" || line == "NS" || line == "EX" || line == "NF") { return 0; }
+	error = "Unexpected reply: " + line;
+	return -1;
+}
+
+v8::Handle<v8::Value> mc_store(const v8::Arguments & args, store_mode_t mode) {
+	CLIENT_PTR;
+	if (args.Length() < 2) { return JS_TYPE_ERROR("Bad argument count. Use 'memcached.set(key, value, [ttl])'"); }
+	std::string key = *v8::String::Utf8Value(args[0]);
+	if (!valid_key(key)) { return JS_ERROR("Invalid key"); }
+	int ttl = (args.Length() > 2 ? args[2]->Int32Value() : 0);
+
+	std::string error;
+	int index = server_for(client, key);
+	conn_t * conn = get_conn(client, index, error);
+	if (!conn) { return JS_ERROR(error.c_str()); }
+	mc_store_request(client, conn, mode, key, args[1], ttl);
+	if (!flush(conn, client->timeout, error)) { return io_error(client, index, error); }
+	int result = mc_store_reply(client, conn, error);
+	if (result == -1) { return io_error(client, index, error); }
+	return JS_BOOL(result == 1);
+}
+
+/**
+ * @param {string} key
+ * @param {string || Buffer} value
+ * @param {int} [ttl=0] seconds
+ * @returns {bool} stored
+ */
+JS_METHOD(_mc_set) { return mc_store(args, MODE_SET); }
+JS_METHOD(_mc_add) { return mc_store(args, MODE_ADD); }
+JS_METHOD(_mc_replace) { return mc_store(args, MODE_REPLACE); }
+
+/**
+ * Pipelined set of many items
+ * @param {object} items key => value
+ * @param {int} [ttl=0]
+ * @returns {int} number of stored items
+ */
+JS_METHOD(_mc_setmulti) {
+	CLIENT_PTR;
+	if (args.Length() < 1 || !args[0]->IsObject()) { return JS_TYPE_ERROR("Bad argument. Use 'memcached.setMulti(items, [ttl])'"); }
+	v8::Handle<v8::Object> items = args[0]->ToObject();
+	int ttl = (args.Length() > 1 ? args[1]->Int32Value() : 0);
+	v8::Handle<v8::Array> names = items->GetPropertyNames();
+
+	std::string error;
+	batch_t used;
+	std::vector<int> order;
+	for (unsigned int i=0; i<names->Length(); i++) {
+		std::string key = *v8::String::Utf8Value(names->Get(JS_INT(i)));
+		if (!valid_key(key)) { return JS_ERROR("Invalid key"); }
+		int index = server_for(client, key);
+		conn_t * conn = batch_conn(client, index, used, error);
+		if (!conn) { return batch_error(client, used, -1, error); }
+		mc_store_request(client, conn, MODE_SET, key, items->Get(names->Get(JS_INT(i))), ttl);
+		order.push_back(index);
+	}
+
+	for (batch_t::iterator it = used.begin(); it != used.end(); it++) {
+		if (!flush(it->second, client->timeout, error)) { return batch_error(client, used, it->first, error); }
+	}
+
+	int stored = 0;
+	for (size_t i=0; i<order.size(); i++) {
+		int result = mc_store_reply(client, used[order[i]], error);
+		if (result == -1) { return batch_error(client, used, order[i], error); }
+		stored += result;
+	}
+	return JS_INT(stored);
+}
+
+/**
+ * @param {string} key
+ * @returns {bool} deleted
+ */
+JS_METHOD(_mc_delete) {
+	CLIENT_PTR;
+	if (args.Length() < 1) { return JS_TYPE_ERROR("Bad argument count. Use 'memcached.remove(key)'"); }
+	std::string key = *v8::String::Utf8Value(args[0]);
+	if (!valid_key(key)) { return JS_ERROR("Invalid key"); }
+
+	std::string error;
+	int index = server_for(client, key);
+	conn_t * conn = get_conn(client, index, error);
+	if (!conn) { return JS_ERROR(error.c_str()); }
+	conn->out += (client->meta ? "md " : "delete ") + key + "\r\n";
+	std::string line;
+	if (!flush(conn, client->timeout, error) || !read_line(conn, line, client->timeout, error)) { return io_error(client, index, error); }
+	if (line == "DELETED" || line == "HD") { return JS_BOOL(true); }
+	if (line == "NOT_FOUND" || line == "NF") { return JS_BOOL(false); }
+	return io_error(client, index, "Unexpected reply: " + line);
+}
+
+v8::Handle<v8::Value> mc_arithmetic(const v8::Arguments & args, bool incr) {
+	CLIENT_PTR;
+	if (args.Length() < 1) { return JS_TYPE_ERROR("Bad argument count. Use 'memcached.increment(key, [delta])'"); }
+	std::string key = *v8::String::Utf8Value(args[0]);
+	if (!valid_key(key)) { return JS_ERROR("Invalid key"); }
+	double delta = (args.Length() > 1 ? args[1]->NumberValue() : 1);
+
+	std::string error;
+	int index = server_for(client, key);
+	conn_t * conn = get_conn(client, index, error);
+	if (!conn) { return JS_ERROR(error.c_str()); }
+
+	std::stringstream ss;
+	ss.precision(20);
+	if (client->meta) {
+		ss << "ma " << key << " D" << delta << (incr ? "" : " MD") << " v\r\n";
+	} else {
+		ss << (incr ? "incr " : "decr ") << key << " " << delta << "\r\n";
+	}
+	conn->out += ss.str();
+
+	std::string line;
+	if (!flush(conn, client->timeout, error) || !read_line(conn, line, client->timeout, error)) { return io_error(client, index, error); }
+	if (line == "NOT_FOUND" || line == "NF") { return JS_NULL; }
+	if (client->meta) {
+		if (line.compare(0, 3, "VA ") != 0) { return io_error(client, index, "Unexpected reply: " + line); }
+		if (!read_line(conn, line, client->timeout, error)) { return io_error(client, index, error); }
+	}
+	char * end;
+	double value = strtod(line.c_str(), &end);
+	if (end == line.c_str()) { return JS_ERROR(line.c_str()); } /* e.g. CLIENT_ERROR for a non-numeric value */
+	return JS_FLOAT(value);
+}
+
+/**
+ * @param {string} key
+ * @param {int} [delta=1]
+ * @returns {number || null} new value, null for a missing key
+ */
+JS_METHOD(_mc_increment) { return mc_arithmetic(args, true); }
+JS_METHOD(_mc_decrement) { return mc_arithmetic(args, false); }
+
+/* -------------------------------------------------------------------- redis ---- */
+
+void redis_encode(conn_t * conn, const std::vector<std::string> & command) {
+	std::stringstream ss;
+	ss << "*" << command.size() << "\r\n";
+	for (size_t i=0; i<command.size(); i++) {
+		ss << "$" << command[i].length() << "\r\n";
+		ss.write(command[i].data(), command[i].length());
+		ss << "\r\n";
+	}
+	conn->out += ss.str();
+}
+
+/**
+ * Parse one reply. Error replies become Error instances (not thrown), failed is set for a top-level one.
+ */
+bool redis_reply(client_t * client, conn_t * conn, v8::Handle<v8::Value> & result, bool & failed, std::string & error) {
+	std::string line;
+	if (!read_line(conn, line, client->timeout, error)) { return false; }
+	if (!line.length()) {
+		error = "Empty reply";
+		return false;
+	}
+	std::string rest = line.substr(1);
+
+	switch (line[0]) {
+		case '+':
+			result = JS_STR(rest.c_str());
+		return true;
+		case '-':
+			result = v8::Exception::Error(JS_STR(rest.c_str()));
+			failed = true;
+		return true;
+		case ':':
+			result = JS_FLOAT(strtod(rest.c_str(), NULL));
+		return true;
+		case '$': {
+			long length = atol(rest.c_str());
+			if (length < 0) {
+				result = JS_NULL;
+				return true;
+			}
+			if (!read_block(conn, length, client->timeout, error)) { return false; }
+			result = make_value(client, conn->in.data() + conn->pos, length);
+			conn->pos += length + 2;
+		} return true;
+		case '*': {
+			long count = atol(rest.c_str());
+			if (count < 0) {
+				result = JS_NULL;
+				return true;
+			}
+			v8::Handle<v8::Array> arr = v8::Array::New(count);
+			for (long i=0; i<count; i++) {
+				v8::Handle<v8::Value> item;
+				bool nested = false;
+				if (!redis_reply(client, conn, item, nested, error)) { return false; }
+				arr->Set(JS_INT(i), item);
+			}
+			result = arr;
+		} return true;
+	}
+	error = "Unexpected reply: " + line;
+	return false;
+}
+
+bool redis_handshake(client_t * client, conn_t * conn, std::string & error) {
+	int count = 0;
+	if (client->password.length()) {
+		std::vector<std::string> command;
+		command.push_back("AUTH");
+		command.push_back(client->password);
+		redis_encode(conn, command);
+		count++;
+	}
+	if (client->database) {
+		std::stringstream ss;
+		ss << client->database;
+		std::vector<std::string> command;
+		command.push_back("SELECT");
+		command.push_back(ss.str());
+		redis_encode(conn, command);
+		count++;
+	}
+	if (!count) { return true; }
+	if (!flush(conn, client->timeout, error)) { return false; }
+
+	v8::HandleScope handle_scope;
+	for (int i=0; i<count; i++) {
+		v8::Handle<v8::Value> reply;
+		bool failed = false;
+		if (!redis_reply(client, conn, reply, failed, error)) { return false; }
+		if (failed) {
+			error = *v8::String::Utf8Value(reply->ToObject()->Get(JS_STR("message")));
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * new Redis(servers, [options])
+ * @param {string || string[]} servers "host:port", "/path/to.sock" or "@abstract"
+ * @param {object} [options] {database: int, password: string, timeout: ms, type: "string" || "buffer"}
+ */
+JS_METHOD(_redis) {
+	ASSERT_CONSTRUCTOR;
+	client_t * client = create_client(args, "redis:", 6379);
+	if (!client->servers.size()) {
+		delete client;
+		return JS_TYPE_ERROR("Invalid call format. Use 'new Redis(servers, [options])'");
+	}
+	SAVE_PTR(0, client);
+	GC * gc = GC_PTR;
+	gc->add(args.This(), finalize);
+	return args.This();
+}
+
+bool to_command(v8::Handle<v8::Value> value, std::vector<std::string> & command) {
+	if (!value->IsArray()) { return false; }
+	v8::Handle<v8::Array> arr = v8::Handle<v8::Array>::Cast(value);
+	for (unsigned int i=0; i<arr->Length(); i++) {
+		std::string holder;
+		const char * data;
+		size_t length;
+		get_bytes(arr->Get(JS_INT(i)), holder, &data, &length);
+		command.push_back(std::string(data, length));
+	}
+	return command.size() > 0;
+}
+
+typedef enum { REPLY_ARRAY, REPLY_STRICT, REPLY_SINGLE } reply_mode_t;
+
+/**
+ * Pipeline: commands are routed by their first argument (the key), sent all at once,
+ * and replies are collected in the original order.
+ * REPLY_ARRAY keeps error replies as Error instances, REPLY_STRICT throws the first one,
+ * REPLY_SINGLE also unwraps the only reply.
+ */
+v8::Handle<v8::Value> redis_pipeline(client_t * client, const std::vector<std::vector<std::string> > & commands, reply_mode_t mode) {
+	std::string error;
+	batch_t used;
+	std::vector<int> order;
+	for (size_t i=0; i<commands.size(); i++) {
+		int index = (commands[i].size() > 1 ? server_for(client, commands[i][1]) : 0);
+		conn_t * conn = batch_conn(client, index, used, error);
+		if (!conn) { return batch_error(client, used, -1, error); }
+		redis_encode(conn, commands[i]);
+		order.push_back(index);
+	}
+
+	for (batch_t::iterator it = used.begin(); it != used.end(); it++) {
+		if (!flush(it->second, client->timeout, error)) { return batch_error(client, used, it->first, error); }
+	}
+
+	v8::Handle<v8::Array> result = v8::Array::New(order.size());
+	int firstError = -1;
+	for (size_t i=0; i<order.size(); i++) {
+		v8::Handle<v8::Value> reply;
+		bool failed = false;
+		if (!redis_reply(client, used[order[i]], reply, failed, error)) { return batch_error(client, used, order[i], error); }
+		if (failed && firstError == -1) { firstError = i; }
+		result->Set(JS_INT(i), reply);
+	}
+
+	if (mode != REPLY_ARRAY && firstError != -1) { return v8::ThrowException(result->Get(JS_INT(firstError))); }
+	if (mode == REPLY_SINGLE) { return result->Get(JS_INT(0)); }
+	return result;
+}
+
+/**
+ * Any command: redis.command("HSET", "key", "field", "value")
+ * @returns {string || number || Buffer || array || null} Error replies are thrown
+ */
+JS_METHOD(_redis_command) {
+	CLIENT_PTR;
+	std::vector<std::string> command;
+	for (int i=0; i<args.Length(); i++) {
+		std::string holder;
+		const char * data;
+		size_t length;
+		get_bytes(args[i], holder, &data, &length);
+		command.push_back(std::string(data, length));
+	}
+	if (!command.size()) { return JS_TYPE_ERROR("Bad argument count. Use 'redis.command(name, ...)'"); }
+	std::vector<std::vector<std::string> > commands(1, command);
+	return redis_pipeline(client, commands, REPLY_SINGLE);
+}
+
+/**
+ * Many commands in one round-trip per server
+ * @param {array[]} commands e.g. [["SET", "a", 1], ["GET", "a"]]
+ * @returns {array} replies; error replies are returned as Error instances
+ */
+JS_METHOD(_redis_pipeline) {
+	CLIENT_PTR;
+	if (args.Length() < 1 || !args[0]->IsArray()) { return JS_TYPE_ERROR("Bad argument. Use 'redis.pipeline(commands)'"); }
+	v8::Handle<v8::Array> arr = v8::Handle<v8::Array>::Cast(args[0]);
+	std::vector<std::vector<std::string> > commands;
+	for (unsigned int i=0; i<arr->Length(); i++) {
+		std::vector<std::string> command;
+		if (!to_command(arr->Get(JS_INT(i)), command)) { return JS_TYPE_ERROR("Every command must be a non-empty array"); }
+		commands.push_back(command);
+	}
+	return redis_pipeline(client, commands, REPLY_ARRAY);
+}
+
+/**
+ * @param {string} key
+ * @returns {string || Buffer || null}
+ */
+JS_METHOD(_redis_get) {
+	CLIENT_PTR;
+	if (args.Length() < 1) { return JS_TYPE_ERROR("Bad argument count. Use 'redis.get(key)'"); }
+	std::vector<std::string> command;
+	command.push_back("GET");
+	command.push_back(*v8::String::Utf8Value(args[0]));
+	std::vector<std::vector<std::string> > commands(1, command);
+	return redis_pipeline(client, commands, REPLY_SINGLE);
+}
+
+/**
+ * @param {string[]} keys
+ * @returns {object} key => value for hits only
+ */
+JS_METHOD(_redis_getmulti) {
+	CLIENT_PTR;
+	if (args.Length() < 1 || !args[0]->IsArray()) { return JS_TYPE_ERROR("Bad argument. Use 'redis.getMulti(keys)'"); }
+	v8::Handle<v8::Array> keys = v8::Handle<v8::Array>::Cast(args[0]);
+	std::vector<std::vector<std::string> > commands;
+	for (unsigned int i=0; i<keys->Length(); i++) {
+		std::vector<std::string> command;
+		command.push_back("GET");
+		command.push_back(*v8::String::Utf8Value(keys->Get(JS_INT(i))));
+		commands.push_back(command);
+	}
+	v8::Handle<v8::Value> replies = redis_pipeline(client, commands, REPLY_STRICT);
+	if (replies.IsEmpty() || !replies->IsArray()) { return replies; }
+
+	v8::Handle<v8::Array> arr = v8::Handle<v8::Array>::Cast(replies);
+	v8::Handle<v8::Object> result = v8::Object::New();
+	for (unsigned int i=0; i<keys->Length(); i++) {
+		v8::Handle<v8::Value> reply = arr->Get(JS_INT(i));
+		if (!reply->IsNull()) { result->Set(keys->Get(JS_INT(i)), reply); }
+	}
+	return result;
+}
+
+/**
+ * @param {string} key
+ * @param {string || Buffer} value
+ * @param {int} [ttl] seconds
+ * @returns {bool}
+ */
+JS_METHOD(_redis_set) {
+	CLIENT_PTR;
+	if (args.Length() < 2) { return JS_TYPE_ERROR("Bad argument count. Use 'redis.set(key, value, [ttl])'"); }
+	std::vector<std::string> command;
+	std::string holder;
+	const char * data;
+	size_t length;
+	get_bytes(args[1], holder, &data, &length);
+	command.push_back("SET");
+	command.push_back(*v8::String::Utf8Value(args[0]));
+	command.push_back(std::string(data, length));
+	if (args.Length() > 2 && args[2]->Int32Value() > 0) {
+		command.push_back("EX");
+		command.push_back(*v8::String::Utf8Value(args[2]->ToString()));
+	}
+	std::vector<std::vector<std::string> > commands(1, command);
+	v8::Handle<v8::Value> reply = redis_pipeline(client, commands, REPLY_SINGLE);
+	if (reply.IsEmpty()) { return reply; }
+	return JS_BOOL(reply->IsString());
+}
+
+/**
+ * @param {string} key
+ * @returns {bool} deleted
+ */
+JS_METHOD(_redis_delete) {
+	CLIENT_PTR;
+	if (args.Length() < 1) { return JS_TYPE_ERROR("Bad argument count. Use 'redis.remove(key)'"); }
+	std::vector<std::string> command;
+	command.push_back("DEL");
+	command.push_back(*v8::String::Utf8Value(args[0]));
+	std::vector<std::vector<std::string> > commands(1, command);
+	v8::Handle<v8::Value> reply = redis_pipeline(client, commands, REPLY_SINGLE);
+	if (reply.IsEmpty()) { return reply; }
+	return JS_BOOL(reply->NumberValue() > 0);
+}
+
+/**
+ * @param {string} key
+ * @param {int} [delta=1]
+ * @returns {number} new value
+ */
+JS_METHOD(_redis_increment) {
+	CLIENT_PTR;
+	if (args.Length() < 1) { return JS_TYPE_ERROR("Bad argument count. Use 'redis.increment(key, [delta])'"); }
+	std::vector<std::string> command;
+	command.push_back("INCRBY");
+	command.push_back(*v8::String::Utf8Value(args[0]));
+	command.push_back(args.Length() > 1 ? *v8::String::Utf8Value(args[1]->ToString()) : "1");
+	std::vector<std::vector<std::string> > commands(1, command);
+	return redis_pipeline(client, commands, REPLY_SINGLE);
+}
+
+}
+
+SHARED_INIT() {
+	v8::HandleScope handle_scope;
+	Buffer_init(require);
+
+#ifdef windows
+	WSADATA wsaData;
+	WORD wVersionRequested = MAKEWORD(2, 0);
+	WSAStartup(wVersionRequested, &wsaData);
+#endif
+
+	memcachedTemplate = v8::Persistent<v8::FunctionTemplate>::New(v8::FunctionTemplate::New(_memcached));
+	memcachedTemplate->SetClassName(JS_STR("Memcached"));
+	memcachedTemplate->InstanceTemplate()->SetInternalFieldCount(1); /* client */
+
+	/**
+	 * Memcached prototype methods (new Memcached().*)
+	 */
+	v8::Handle<v8::ObjectTemplate> pt = memcachedTemplate->PrototypeTemplate();
+	pt->Set("get", v8::FunctionTemplate::New(_mc_get));
+	pt->Set("getMulti", v8::FunctionTemplate::New(_mc_getmulti));
+	pt->Set("set", v8::FunctionTemplate::New(_mc_set));
+	pt->Set("add", v8::FunctionTemplate::New(_mc_add));
+	pt->Set("replace", v8::FunctionTemplate::New(_mc_replace));
+	pt->Set("setMulti", v8::FunctionTemplate::New(_mc_setmulti));
+	pt->Set("remove", v8::FunctionTemplate::New(_mc_delete));
+	pt->Set("increment", v8::FunctionTemplate::New(_mc_increment));
+	pt->Set("decrement", v8::FunctionTemplate::New(_mc_decrement));
+	pt->Set("server", v8::FunctionTemplate::New(_server));
+	pt->Set("disconnect", v8::FunctionTemplate::New(_disconnect));
+	pt->Set("close", v8::FunctionTemplate::New(_close));
+
+	redisTemplate = v8::Persistent<v8::FunctionTemplate>::New(v8::FunctionTemplate::New(_redis));
+	redisTemplate->SetClassName(JS_STR("Redis"));
+	redisTemplate->InstanceTemplate()->SetInternalFieldCount(1); /* client */
+
+	/**
+	 * Redis prototype methods (new Redis().*)
+	 */
+	pt = redisTemplate->PrototypeTemplate();
+	pt->Set("command", v8::FunctionTemplate::New(_redis_command));
+	pt->Set("pipeline", v8::FunctionTemplate::New(_redis_pipeline));
+	pt->Set("get", v8::FunctionTemplate::New(_redis_get));
+	pt->Set("getMulti", v8::FunctionTemplate::New(_redis_getmulti));
+	pt->Set("set", v8::FunctionTemplate::New(_redis_set));
+	pt->Set("remove", v8::FunctionTemplate::New(_redis_delete));
+	pt->Set("increment", v8::FunctionTemplate::New(_redis_increment));
+	pt->Set("server", v8::FunctionTemplate::New(_server));
+	pt->Set("disconnect", v8::FunctionTemplate::New(_disconnect));
+	pt->Set("close", v8::FunctionTemplate::New(_close));
+
+	exports->Set(JS_STR("Memcached"), memcachedTemplate->GetFunction());
+	exports->Set(JS_STR("Redis"), redisTemplate->GetFunction());
+}
@@ -0,0 +1,85 @@
+#include <v8.h>
+#include "macros.h"
+#include "rows.h"
+
+v8::Handle<v8::String> RowBuilder::name(const char * name) {
+	return v8::String::NewSymbol(name);
+}
+
+v8::Handle<v8::Object> RowBuilder::shape(v8::Handle<v8::Array> names) {
+	v8::Handle<v8::ObjectTemplate> ot = v8::ObjectTemplate::New();
+	int cols = names->Length();
+	for (int i=0; i<cols; i++) {
+		ot->Set(names->Get(JS_INT(i))->ToString(), v8::Null());
+	}
+	return ot->NewInstance();
+}
+
+RowBuilder::RowBuilder(v8::Handle<v8::Array> names, format_t mode, v8::Handle<v8::Object> shape) {
+	int cols = names->Length();
+	this->mode = mode;
+	this->count = 0;
+	this->names.resize(cols);
+	for (int i=0; i<cols; i++) {
+		this->names[i] = names->Get(JS_INT(i));
+	}
+
+	switch (mode) {
+		case OBJECTS:
+			this->proto = (shape.IsEmpty() ? RowBuilder::shape(names) : shape);
+			this->rows = v8::Array::New();
+			break;
+		case ARRAYS:
+			this->rows = v8::Array::New();
+			break;
+		case COLUMNS:
+			this->data = v8::Object::New();
+			this->columns.resize(cols);
+			for (int i=0; i<cols; i++) {
+				this->columns[i] = v8::Array::New();
+				this->data->Set(this->names[i], this->columns[i]);
+			}
+			break;
+	}
+}
+
+void RowBuilder::start() {
+	switch (this->mode) {
+		case OBJECTS:
+			this->current = this->proto->Clone();
+			break;
+		case ARRAYS:
+			this->current = v8::Array::New(this->names.size());
+			break;
+		case COLUMNS:
+			break;
+	}
+}
+
+void RowBuilder::set(int column, v8::Handle<v8::Value> value) {
+	switch (this->mode) {
+		case OBJECTS:
+			this->current->Set(this->names[column], value);
+			break;
+		case ARRAYS:
+			this->current->Set(JS_INT(column), value);
+			break;
+		case COLUMNS:
+			this->columns[column]->Set(JS_INT(this->count), value);
+			break;
+	}
+}
+
+void RowBuilder::end() {
+	if (this->mode != COLUMNS) { this->rows->Set(JS_INT(this->count), this->current); }
+	this->count++;
+}
+
+v8::Handle<v8::Object> RowBuilder::row() {
+	return this->current;
+}
+
+v8::Handle<v8::Value> RowBuilder::result() {
+	if (this->mode == COLUMNS) { return this->data; }
+	return this->rows;
+}
@@ -0,0 +1,53 @@
+/**
+ * Row materialization shared by the database modules.
+ * Column names are interned once per result; object rows are shallow clones of a shape object
+ * (all columns preset to null, built from an ObjectTemplate), so every row shares one map and 
+ * filling it does not add properties. A module using this links rows.cc.
+ */
+
+#ifndef _ROWS_H
+#define _ROWS_H
+
+#include <v8.h>
+#include <vector>
+
+class RowBuilder {
+public:
+	typedef enum {
+		OBJECTS, /* [{name:value, ...}, ...] */
+		ARRAYS, /* [[value, ...], ...] */
+		COLUMNS /* {name:[value, ...], ...} */
+	} format_t;
+
+	/* interned column name */
+	static v8::Handle<v8::String> name(const char * name);
+	/* object with all columns set to null; clone it to create rows */
+	static v8::Handle<v8::Object> shape(v8::Handle<v8::Array> names);
+
+	/* names are interned strings; shape (from shape()) may be reused across results */
+	RowBuilder(v8::Handle<v8::Array> names, format_t mode, v8::Handle<v8::Object> shape = v8::Handle<v8::Object>());
+
+	/* new row */
+	void start();
+	/* value of a column in the current row */
+	void set(int column, v8::Handle<v8::Value> value);
+	/* append the current row to the result */
+	void end();
+
+	/* current row (OBJECTS and ARRAYS), for row-at-a-time consumers */
+	v8::Handle<v8::Object> row();
+	/* all appended rows */
+	v8::Handle<v8::Value> result();
+
+private:
+	format_t mode;
+	int count;
+	std::vector<v8::Handle<v8::Value> > names;
+	std::vector<v8::Handle<v8::Array> > columns;
+	v8::Handle<v8::Object> proto;
+	v8::Handle<v8::Object> current;
+	v8::Handle<v8::Array> rows;
+	v8::Handle<v8::Object> data; /* COLUMNS result */
+};
+
+#endif
@@ -0,0 +1,566 @@
+/**
+ * Native HTTP/1.1 client. Writes a request to a connected Socket and parses the response incrementally:
+ * chunked transfer decoding, optional gzip/deflate decompression (zlib) and keep-alive detection.
+ * Connections are obtained from (and returned to) the pool module by the caller, see lib/http.js.
+ */
+
+#include <v8.h>
+#include <string>
+#include <vector>
+#include "macros.h"
+#include "lib/binary-f/buffer.h"
+
+#include <zlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef windows
+#  include <winsock2.h>
+#else
+#  include <poll.h>
+#  include <sys/socket.h>
+#endif
+
+#ifndef SOCKET_ERROR
+#  define SOCKET_ERROR -1
+#endif
+
+#define RECV_SIZE 16384
+#define INFLATE_SIZE 16384
+
+namespace {
+
+/**
+ * Wait for a descriptor; returns 1 when ready, 0 on timeout
+ */
+int wait_fd(int fd, bool write, int timeout) {
+#ifdef windows
+	fd_set set;
+	FD_ZERO(&set);
+	FD_SET(fd, &set);
+	struct timeval tv;
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+	return select(0, (write ? NULL : &set), (write ? &set : NULL), NULL, (timeout < 0 ? NULL : &tv));
+#else
+	struct pollfd p;
+	p.fd = fd;
+	p.events = (write ? POLLOUT : POLLIN);
+	p.revents = 0;
+	return poll(&p, 1, timeout);
+#endif
+}
+
+bool iequals(const std::string & a, const char * b) {
+	size_t len = strlen(b);
+	if (a.length() != len) { return false; }
+	for (size_t i=0; i<len; i++) {
+		if (tolower(a[i]) != tolower(b[i])) { return false; }
+	}
+	return true;
+}
+
+/* case-insensitive search for a token in a comma-separated header value */
+bool has_token(const std::string & value, const char * token) {
+	size_t start = 0;
+	while (start <= value.length()) {
+		size_t end = value.find(',', start);
+		if (end == std::string::npos) { end = value.length(); }
+		size_t a = start, b = end;
+		while (a < b && (value[a] == ' ' || value[a] == '\t')) { a++; }
+		while (b > a && (value[b-1] == ' ' || value[b-1] == '\t')) { b--; }
+		if (iequals(value.substr(a, b-a), token)) { return true; }
+		start = end + 1;
+	}
+	return false;
+}
+
+/**
+ * Growing body buffer; handed over to a Buffer without copying
+ */
+class Body {
+public:
+	Body() : data(NULL), length(0), capacity(0) {}
+	~Body() { if (this->data) { free(this->data); } }
+
+	void append(const char * bytes, size_t count) {
+		if (this->length + count > this->capacity) {
+			size_t size = MAX(this->capacity * 2, this->length + count);
+			size = MAX(size, (size_t) 4096);
+			unsigned char * tmp = (unsigned char *) realloc(this->data, size);
+			if (!tmp) { throw std::string("Cannot allocate enough memory"); }
+			this->data = tmp;
+			this->capacity = size;
+		}
+		memcpy(this->data + this->length, bytes, count);
+		this->length += count;
+	}
+
+	void clear() { this->length = 0; }
+
+	/* release ownership as a ByteStorage */
+	ByteStorage * detach() {
+		ByteStorage * bs;
+		if (this->length) {
+			bs = new ByteStorage(new ByteStorageData(this->data, this->length, NULL), this->length);
+		} else {
+			bs = new ByteStorage((size_t) 0);
+			if (this->data) { free(this->data); }
+		}
+		this->data = NULL;
+		this->length = this->capacity = 0;
+		return bs;
+	}
+
+	unsigned char * data;
+	size_t length;
+	size_t capacity;
+};
+
+/**
+ * Incremental response parser. Decoded (de-chunked, decompressed) body bytes are appended to body.
+ */
+class Parser {
+public:
+	typedef std::vector<std::pair<std::string, std::string> > headers_t;
+
+	Parser(bool head, bool decompress, Body * body) {
+		this->head = head;
+		this->decompress = decompress;
+		this->body = body;
+		this->state = STATUS;
+		this->inflating = false;
+		this->rawTried = false;
+		this->trailing = false;
+		this->reset();
+	}
+
+	~Parser() {
+		if (this->inflating) { inflateEnd(&this->z); }
+	}
+
+	/**
+	 * Consume received bytes. Returns false on a protocol error (see error).
+	 */
+	bool feed(const char * data, size_t length) {
+		size_t pos = 0;
+		while (pos < length && this->state != DONE && this->state != FAILED) {
+			switch (this->state) {
+				case STATUS:
+				case HEADER:
+				case CHUNK_SIZE:
+				case CHUNK_END:
+				case TRAILER: {
+					const char * nl = (const char *) memchr(data + pos, '\n', length - pos);
+					size_t end = (nl ? nl - data : length);
+					this->line.append(data + pos, end - pos);
+					pos = end;
+					if (!nl) {
+						if (this->line.length() > 65536) { return this->fail("Header line too long"); }
+						break;
+					}
+					pos++;
+					if (this->line.length() && this->line[this->line.length()-1] == '\r') { this->line.erase(this->line.length()-1); }
+					this->onLine();
+					this->line.clear();
+				} break;
+
+				case BODY:
+				case CHUNK_DATA: {
+					size_t count = length - pos;
+					if (this->remaining >= 0 && (size_t) this->remaining < count) { count = (size_t) this->remaining; }
+					if (!this->output(data + pos, count)) { return false; }
+					pos += count;
+					if (this->remaining >= 0) {
+						this->remaining -= count;
+						if (!this->remaining) {
+							if (this->state == BODY) { this->finish(); } else { this->state = CHUNK_END; }
+						}
+					}
+				} break;
+
+				default: break;
+			}
+		}
+		if (this->state == DONE && pos < length) { this->trailing = true; }
+		return (this->state != FAILED);
+	}
+
+	/**
+	 * Connection closed by the peer
+	 */
+	bool eof() {
+		if (this->state == BODY && this->remaining == -1) {
+			this->finish();
+			return true;
+		}
+		if (this->state == DONE) { return true; }
+		return this->fail(this->state == STATUS && !this->line.length() && !this->status ? "Connection closed" : "Connection closed before the response was complete");
+	}
+
+	bool isDone() { return this->state == DONE; }
+	/* the response was delimited, nothing followed it and the server allows another request */
+	bool isReusable() { return this->state == DONE && this->keepAlive && !this->untilEof && !this->trailing; }
+
+	int status;
+	std::string version;
+	std::string reason;
+	headers_t headers;
+	std::string error;
+
+private:
+	typedef enum { STATUS, HEADER, BODY, CHUNK_SIZE, CHUNK_DATA, CHUNK_END, TRAILER, DONE, FAILED } state_t;
+
+	state_t state;
+	std::string line;
+	long long remaining; /* -1 = unknown */
+	long long contentLength;
+	bool chunked;
+	bool keepAlive;
+	bool untilEof;
+	bool head;
+	bool decompress;
+	bool inflating;
+	bool rawTried;
+	bool trailing; /* bytes after the response: the stream is out of sync */
+	z_stream z;
+	std::string pending; /* compressed input seen so far, until the format is known */
+	Body * body;
+
+	void reset() {
+		this->status = 0;
+		this->headers.clear();
+		this->remaining = -1;
+		this->contentLength = -1;
+		this->chunked = false;
+		this->keepAlive = false;
+		this->untilEof = false;
+	}
+
+	bool fail(const char * message) {
+		this->error = message;
+		this->state = FAILED;
+		return false;
+	}
+
+	void finish() {
+		if (this->inflating) {
+			inflateEnd(&this->z);
+			this->inflating = false;
+		}
+		this->state = DONE;
+	}
+
+	void onLine() {
+		switch (this->state) {
+			case STATUS: {
+				if (!this->line.length()) { return; } /* tolerate stray CRLF */
+				size_t sp1 = this->line.find(' ');
+				if (sp1 == std::string::npos || this->line.compare(0, 5, "HTTP/") != 0) { this->fail("Malformed status line"); return; }
+				this->version = this->line.substr(5, sp1 - 5);
+				this->status = atoi(this->line.c_str() + sp1 + 1);
+				size_t sp2 = this->line.find(' ', sp1 + 1);
+				this->reason = (sp2 == std::string::npos ? "" : this->line.substr(sp2 + 1));
+				this->keepAlive = (this->version != "1.0");
+				this->state = HEADER;
+			} break;
+
+			case HEADER: {
+				if (this->line.length()) {
+					size_t colon = this->line.find(':');
+					if (colon == std::string::npos) { return; } /* ignore garbage */
+					std::string name = this->line.substr(0, colon);
+					size_t start = colon + 1;
+					while (start < this->line.length() && (this->line[start] == ' ' || this->line[start] == '\t')) { start++; }
+					std::string value = this->line.substr(start);
+					while (name.length() && name[name.length()-1] == ' ') { name.erase(name.length()-1); }
+					this->headers.push_back(std::make_pair(name, value));
+					this->onHeader(name, value);
+					return;
+				}
+				this->onHeadersEnd();
+			} break;
+
+			case CHUNK_SIZE: {
+				char * end;
+				long long size = strtoll(this->line.c_str(), &end, 16);
+				if (end == this->line.c_str() || size < 0) { this->fail("Malformed chunk size"); return; }
+				if (size) {
+					this->remaining = size;
+					this->state = CHUNK_DATA;
+				} else {
+					this->state = TRAILER;
+				}
+			} break;
+
+			case CHUNK_END:
+				this->state = CHUNK_SIZE;
+			break;
+
+			case TRAILER:
+				if (!this->line.length()) { this->finish(); }
+			break;
+
+			default: break;
+		}
+	}
+
+	void onHeader(const std::string & name, const std::string & value) {
+		if (iequals(name, "Content-Length")) {
+			this->contentLength = strtoll(value.c_str(), NULL, 10);
+		} else if (iequals(name, "Transfer-Encoding")) {
+			this->chunked = has_token(value, "chunked");
+		} else if (iequals(name, "Connection")) {
+			if (has_token(value, "close")) { this->keepAlive = false; }
+			if (has_token(value, "keep-alive")) { this->keepAlive = true; }
+		} else if (iequals(name, "Content-Encoding") && this->decompress) {
+			if (has_token(value, "gzip") || has_token(value, "x-gzip") || has_token(value, "deflate")) {
+				memset(&this->z, 0, sizeof(this->z));
+				/* 15+32: zlib or gzip header, detected automatically */
+				if (inflateInit2(&this->z, 15 + 32) == Z_OK) { this->inflating = true; }
+			}
+		}
+	}
+
+	void onHeadersEnd() {
+		if (this->status >= 100 && this->status < 200) { /* interim response, the real one follows */
+			if (this->inflating) {
+				inflateEnd(&this->z);
+				this->inflating = false;
+			}
+			this->reset();
+			this->state = STATUS;
+			return;
+		}
+
+		if (this->head || this->status == 204 || this->status == 304) {
+			this->finish();
+		} else if (this->chunked) {
+			this->state = CHUNK_SIZE;
+		} else if (this->contentLength >= 0) {
+			this->remaining = this->contentLength;
+			this->state = BODY;
+			if (!this->remaining) { this->finish(); }
+		} else {
+			this->untilEof = true;
+			this->state = BODY;
+		}
+	}
+
+	bool output(const char * data, size_t length) {
+		if (!this->inflating) {
+			this->body->append(data, length);
+			return true;
+		}
+
+		/* keep the input until something inflates, a raw stream is detected only then */
+		if (!this->rawTried && !this->z.total_out) { this->pending.append(data, length); }
+		int result = this->inflateBytes(data, length);
+
+		if (result == Z_DATA_ERROR && !this->rawTried && !this->z.total_out) {
+			/* "deflate" sent as a raw stream without the zlib header */
+			this->rawTried = true;
+			inflateEnd(&this->z);
+			memset(&this->z, 0, sizeof(this->z));
+			if (inflateInit2(&this->z, -15) != Z_OK) {
+				this->inflating = false;
+				return this->fail("Cannot initialize decompression");
+			}
+			result = this->inflateBytes(this->pending.data(), this->pending.length());
+		}
+		if (this->rawTried || this->z.total_out) { this->pending.clear(); }
+		if (result == Z_DATA_ERROR) { return this->fail("Malformed compressed body"); }
+		return true;
+	}
+
+	int inflateBytes(const char * data, size_t length) {
+		char out[INFLATE_SIZE];
+		this->z.next_in = (Bytef *) data;
+		this->z.avail_in = length;
+		while (this->z.avail_in) {
+			this->z.next_out = (Bytef *) out;
+			this->z.avail_out = sizeof(out);
+			int result = inflate(&this->z, Z_NO_FLUSH);
+			if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) { return Z_DATA_ERROR; }
+			this->body->append(out, sizeof(out) - this->z.avail_out);
+			if (result == Z_STREAM_END) { break; } /* ignore anything after the stream */
+			if (result == Z_BUF_ERROR && this->z.avail_out) { break; }
+		}
+		return Z_OK;
+	}
+};
+
+v8::Handle<v8::Value> body_value(Body & body, bool buffer) {
+	if (buffer) { return Buffer_create(body.detach()); }
+	if (!body.length) { return JS_STR(""); }
+	v8::Handle<v8::Value> result = JS_STR((const char *) body.data, body.length);
+	body.clear();
+	return result;
+}
+
+/**
+ * Error the caller may retry on a new connection: a reused one was probably closed by the server
+ */
+v8::Handle<v8::Value> stale_error(const char * message) {
+	v8::Handle<v8::Value> e = v8::Exception::Error(JS_STR(message));
+	e->ToObject()->Set(JS_STR("stale"), JS_BOOL(true));
+	return v8::ThrowException(e);
+}
+
+/**
+ * Send everything; a failed send() (not a timeout) sets stale
+ */
+bool send_all(int fd, const char * data, size_t length, int timeout, std::string & error, bool & stale) {
+	while (length) {
+		if (timeout > 0 && wait_fd(fd, true, timeout) == 0) {
+			error = "Timed out while sending the request";
+			return false;
+		}
+		ssize_t sent = send(fd, data, length, 0);
+		if (sent == SOCKET_ERROR) {
+			if (errno == EINTR) { continue; }
+			error = strerror(errno);
+			stale = true;
+			return false;
+		}
+		data += sent;
+		length -= sent;
+	}
+	return true;
+}
+
+/**
+ * Bytes of a string or a Buffer
+ */
+void get_bytes(v8::Handle<v8::Value> value, std::string & holder, const char ** data, size_t * length) {
+	if (Buffer_isBuffer(value)) {
+		ByteStorage * bs = Buffer_storage(value);
+		*data = (const char *) bs->getData();
+		*length = bs->getLength();
+		return;
+	}
+	v8::String::Utf8Value str(value);
+	holder.assign(*str, str.length());
+	*data = holder.data();
+	*length = holder.length();
+}
+
+}
+
+/**
+ * Send a request and read the response
+ * @param {Socket} socket Connected socket
+ * @param {string || Buffer} request Request line and headers, terminated by an empty line
+ * @param {string || Buffer} [body]
+ * @param {object} [options]
+ *   method: request method ("HEAD" responses have no body)
+ *   timeout: ms without progress before giving up (default 30000, 0 = none)
+ *   decompress: inflate gzip/deflate bodies (default true)
+ *   type: "string" (default, UTF-8) or "buffer"
+ *   onData: function(chunk) receiving the body as it arrives; the result has no body then
+ * @returns {object} {status, version, reason, headers: [[name, value], ...], body, reusable}
+ * Errors after which the request may be retried on a new connection have "stale" set.
+ */
+JS_METHOD(_exchange) {
+	if (args.Length() < 2 || !args[0]->IsObject()) { return JS_TYPE_ERROR("Bad argument count. Use 'exchange(socket, request, [body], [options])'"); }
+	v8::Handle<v8::Object> socket = args[0]->ToObject();
+	if (socket->InternalFieldCount() < 1) { return JS_TYPE_ERROR("First argument must be a Socket"); }
+	int fd = socket->GetInternalField(0)->Int32Value();
+	if (fd < 0) { return JS_ERROR("Socket is closed"); }
+
+	bool head = false;
+	bool decompress = true;
+	bool buffer = false;
+	int timeout = 30000;
+	v8::Handle<v8::Function> onData;
+	if (args.Length() > 3 && args[3]->IsObject()) {
+		v8::Handle<v8::Object> options = args[3]->ToObject();
+		v8::Handle<v8::Value> value = options->Get(JS_STR("method"));
+		if (value->IsString()) { head = (strcmp(*v8::String::Utf8Value(value), "HEAD") == 0); }
+		value = options->Get(JS_STR("timeout"));
+		if (value->IsNumber()) { timeout = value->Int32Value(); }
+		value = options->Get(JS_STR("decompress"));
+		if (!value->IsUndefined()) { decompress = value->BooleanValue(); }
+		value = options->Get(JS_STR("type"));
+		if (value->IsString()) { buffer = (strcmp(*v8::String::Utf8Value(value), "buffer") == 0); }
+		value = options->Get(JS_STR("onData"));
+		if (value->IsFunction()) { onData = v8::Handle<v8::Function>::Cast(value); }
+	}
+
+	std::string error;
+	bool stale = false;
+	std::string holder;
+	const char * data;
+	size_t length;
+	get_bytes(args[1], holder, &data, &length);
+	bool sent = send_all(fd, data, length, timeout, error, stale);
+	if (sent && args.Length() > 2 && !args[2]->IsUndefined() && !args[2]->IsNull()) {
+		get_bytes(args[2], holder, &data, &length);
+		sent = send_all(fd, data, length, timeout, error, stale);
+	}
+	if (!sent) { return (stale ? stale_error(error.c_str()) : JS_ERROR(error.c_str())); }
+
+	Body body;
+	Parser parser(head, decompress, &body);
+	char recvbuf[RECV_SIZE];
+	bool received = false;
+
+	while (!parser.isDone()) {
+		if (timeout > 0 && wait_fd(fd, false, timeout) == 0) { return JS_ERROR("Timed out while reading the response"); }
+		ssize_t count = recv(fd, recvbuf, sizeof(recvbuf), 0);
+		if (count == SOCKET_ERROR) {
+			if (errno == EINTR) { continue; }
+			if (!received) { return stale_error(strerror(errno)); } /* e.g. ECONNRESET on a reused connection */
+			return JS_ERROR(strerror(errno));
+		}
+
+		bool ok;
+		if (count == 0) {
+			ok = parser.eof();
+		} else {
+			received = true;
+			try {
+				ok = parser.feed(recvbuf, count);
+			} catch (std::string e) {
+				return JS_ERROR(e.c_str());
+			}
+		}
+		if (!ok) {
+			/* nothing came back (e.g. a reused connection closed by the server): the caller may retry */
+			if (!received) { return stale_error(parser.error.c_str()); }
+			return JS_ERROR(parser.error.c_str());
+		}
+
+		if (!onData.IsEmpty() && body.length) {
+			v8::HandleScope handle_scope;
+			v8::Handle<v8::Value> argv[1] = { body_value(body, buffer) };
+			v8::Handle<v8::Value> result = onData->Call(JS_GLOBAL, 1, argv);
+			if (result.IsEmpty()) { return v8::Handle<v8::Value>(); } /* exception */
+		}
+	}
+
+	v8::Handle<v8::Object> result = v8::Object::New();
+	result->Set(JS_STR("status"), JS_INT(parser.status));
+	result->Set(JS_STR("version"), JS_STR(parser.version.c_str()));
+	result->Set(JS_STR("reason"), JS_STR(parser.reason.c_str()));
+	v8::Handle<v8::Array> headers = v8::Array::New(parser.headers.size());
+	for (size_t i=0; i<parser.headers.size(); i++) {
+		v8::Handle<v8::Array> pair = v8::Array::New(2);
+		pair->Set(JS_INT(0), JS_STR(parser.headers[i].first.c_str()));
+		pair->Set(JS_INT(1), JS_STR(parser.headers[i].second.c_str()));
+		headers->Set(JS_INT(i), pair);
+	}
+	result->Set(JS_STR("headers"), headers);
+	v8::Handle<v8::Value> content = JS_NULL;
+	if (onData.IsEmpty()) { content = body_value(body, buffer); }
+	result->Set(JS_STR("body"), content);
+	result->Set(JS_STR("reusable"), JS_BOOL(parser.isReusable()));
+	return result;
+}
+
+SHARED_INIT() {
+	v8::HandleScope handle_scope;
+	Buffer_init(require);
+	exports->Set(JS_STR("exchange"), v8::FunctionTemplate::New(_exchange)->GetFunction());
+}
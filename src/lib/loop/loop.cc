@@ -0,0 +1,136 @@
+/**
+ * Event loop library: timers and descriptor watchers. Callbacks run after the main module finishes,
+ * until there is nothing left to wait for (or explicitly via run/runOnce).
+ */
+
+#include <v8.h>
+#include <string.h>
+#include <errno.h>
+#include "macros.h"
+#include "loop.h"
+
+namespace {
+
+v8::Handle<v8::Value> timer(const v8::Arguments& args, bool repeat) {
+	if (args.Length() < 1 || !args[0]->IsFunction()) {
+		return JS_TYPE_ERROR("Invalid call format. Use 'setTimeout(function, [delay])'");
+	}
+	EventLoop * loop = LOOP_PTR;
+	double delay = (args.Length() > 1 ? args[1]->NumberValue() : 0);
+	if (delay != delay) { delay = 0; } /* NaN */
+	return JS_INT(loop->addJSTimer(v8::Handle<v8::Function>::Cast(args[0]), delay, repeat));
+}
+
+/**
+ * Call a function once after a delay
+ * @param {function} callback
+ * @param {int} [delay=0] Milliseconds
+ * @returns {int} Timer ID
+ */
+JS_METHOD(_settimeout) {
+	return timer(args, false);
+}
+
+/**
+ * Call a function repeatedly
+ * @param {function} callback
+ * @param {int} [delay=0] Milliseconds
+ * @returns {int} Timer ID
+ */
+JS_METHOD(_setinterval) {
+	return timer(args, true);
+}
+
+/**
+ * Cancel a timer or watcher
+ * @param {int} id
+ */
+JS_METHOD(_clear) {
+	EventLoop * loop = LOOP_PTR;
+	if (args.Length() > 0 && args[0]->IsNumber()) { loop->remove(args[0]->Int32Value()); }
+	return v8::Undefined();
+}
+
+/**
+ * Watch a descriptor for readiness. Callback receives a bitmask of READ, WRITE, HANGUP.
+ * @param {int} fd
+ * @param {int} events READ | WRITE
+ * @param {function} callback
+ * @returns {int} Watcher ID
+ */
+JS_METHOD(_watch) {
+	if (args.Length() < 3 || !args[2]->IsFunction()) {
+		return JS_TYPE_ERROR("Invalid call format. Use 'watch(fd, events, callback)'");
+	}
+	EventLoop * loop = LOOP_PTR;
+	int id = loop->addJSWatcher(args[0]->Int32Value(), args[1]->Int32Value(), v8::Handle<v8::Function>::Cast(args[2]), v8::Undefined());
+	if (id == -1) { return JS_ERROR(strerror(errno)); }
+	return JS_INT(id);
+}
+
+/**
+ * Change events of an existing watcher
+ * @param {int} id
+ * @param {int} events
+ */
+JS_METHOD(_modify) {
+	if (args.Length() < 2) {
+		return JS_TYPE_ERROR("Invalid call format. Use 'modify(id, events)'");
+	}
+	EventLoop * loop = LOOP_PTR;
+	if (loop->modifyWatcher(args[0]->Int32Value(), args[1]->Int32Value()) != 0) { return JS_ERROR(strerror(errno)); }
+	return v8::Undefined();
+}
+
+/**
+ * Dispatch events until idle
+ */
+JS_METHOD(_run) {
+	EventLoop * loop = LOOP_PTR;
+	loop->run();
+	return v8::Undefined();
+}
+
+/**
+ * Wait for events once
+ * @param {int} [timeout=-1] Milliseconds, -1 waits until the next timer
+ * @returns {bool} Is there anything left to wait for?
+ */
+JS_METHOD(_runonce) {
+	EventLoop * loop = LOOP_PTR;
+	int timeout = (args.Length() > 0 ? args[0]->Int32Value() : -1);
+	return JS_BOOL(loop->runOnce(timeout));
+}
+
+/**
+ * Leave the currently running loop
+ */
+JS_METHOD(_stop) {
+	EventLoop * loop = LOOP_PTR;
+	loop->stop();
+	return v8::Undefined();
+}
+
+}
+
+SHARED_INIT() {
+	v8::HandleScope handle_scope;
+
+	/**
+	 * Constants
+	 */
+	exports->Set(JS_STR("READ"), JS_INT(EventLoop::READ));
+	exports->Set(JS_STR("WRITE"), JS_INT(EventLoop::WRITE));
+	exports->Set(JS_STR("HANGUP"), JS_INT(EventLoop::HANGUP));
+
+	exports->Set(JS_STR("setTimeout"), v8::FunctionTemplate::New(_settimeout)->GetFunction());
+	exports->Set(JS_STR("setInterval"), v8::FunctionTemplate::New(_setinterval)->GetFunction());
+	exports->Set(JS_STR("clearTimeout"), v8::FunctionTemplate::New(_clear)->GetFunction());
+	exports->Set(JS_STR("clearInterval"), v8::FunctionTemplate::New(_clear)->GetFunction());
+	exports->Set(JS_STR("watch"), v8::FunctionTemplate::New(_watch)->GetFunction());
+	exports->Set(JS_STR("modify"), v8::FunctionTemplate::New(_modify)->GetFunction());
+	exports->Set(JS_STR("unwatch"), v8::FunctionTemplate::New(_clear)->GetFunction());
+	exports->Set(JS_STR("run"), v8::FunctionTemplate::New(_run)->GetFunction());
+	exports->Set(JS_STR("runOnce"), v8::FunctionTemplate::New(_runonce)->GetFunction());
+	exports->Set(JS_STR("stop"), v8::FunctionTemplate::New(_stop)->GetFunction());
+}
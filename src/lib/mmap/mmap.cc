@@ -0,0 +1,277 @@
+/**
+ * Memory-mapped files. Contents are exposed as binary-f Buffers which share the mapping (no copying).
+ * Read-only mappings are kept per process and reused by subsequent requests while the file stays unchanged.
+ */
+
+#include <v8.h>
+#include <map>
+#include <string>
+#include "macros.h"
+#include "gc.h"
+#include "lib/binary-f/buffer.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_MMAN_H
+#  include <sys/mman.h>
+#  include <unistd.h>
+#  include <fcntl.h>
+#endif
+
+#define MAPPING_PTR ByteStorage * bs = LOAD_PTR(0, ByteStorage *)
+#define ASSERT_MAPPED if (!bs) { return JS_ERROR("File is not mapped"); }
+
+namespace {
+
+/**
+ * Cached read-only mapping. The cache holds one reference to the storage.
+ */
+typedef struct {
+	ByteStorage * bs;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+} mapping_t;
+
+typedef std::map<std::string, mapping_t> mappings_t;
+mappings_t mappings;
+
+#ifdef HAVE_MMAN_H
+
+void unmap(unsigned char * data, size_t length) {
+	munmap((void *) data, length);
+}
+
+/**
+ * Map a file; returns NULL and sets errno on failure
+ */
+ByteStorage * map_file(const char * name, bool writable, struct stat * st) {
+	int f = open(name, (writable ? O_RDWR : O_RDONLY));
+	if (f == -1) { return NULL; }
+	if (fstat(f, st) != 0) {
+		close(f);
+		return NULL;
+	}
+
+	size_t length = st->st_size;
+	if (!length) { /* empty files cannot be mapped */
+		close(f);
+		return new ByteStorage((size_t) 0);
+	}
+
+	int prot = PROT_READ | (writable ? PROT_WRITE : 0);
+	void * data = mmap(0, length, prot, MAP_SHARED, f, 0);
+	int err = errno;
+	close(f);
+	if (data == MAP_FAILED) {
+		errno = err;
+		return NULL;
+	}
+
+	ByteStorageData * storage = new ByteStorageData((unsigned char *) data, length, unmap);
+	return new ByteStorage(storage, length);
+}
+
+/**
+ * Align a range within the mapping to page boundaries, as required by msync/madvise
+ */
+void page_range(ByteStorage * bs, const v8::Arguments& args, int index, unsigned char ** start, size_t * length) {
+	size_t total = bs->getLength();
+	size_t index1 = (args.Length() > index ? (size_t) args[index]->IntegerValue() : 0);
+	size_t index2 = (args.Length() > index+1 ? (size_t) args[index+1]->IntegerValue() : total);
+	index1 = MIN(index1, total);
+	index2 = MIN(MAX(index2, index1), total);
+
+	size_t page = (size_t) sysconf(_SC_PAGESIZE);
+	size_t aligned = index1 - (index1 % page);
+	*start = bs->getData() + aligned;
+	*length = index2 - aligned;
+}
+
+#endif
+
+void finalize(v8::Handle<v8::Object> obj) {
+	v8::Handle<v8::Function> fun = v8::Handle<v8::Function>::Cast(obj->Get(JS_STR("close")));
+	fun->Call(obj, 0, NULL);
+}
+
+/**
+ * MappedFile constructor
+ * @param {string} name
+ * @param {string} [mode="r"] "r" for read-only (cached) mapping, "rw" for shared writable mapping
+ * Property "cached" tells whether a mapping kept from an earlier request was reused.
+ */
+JS_METHOD(_mappedfile) {
+	ASSERT_CONSTRUCTOR;
+	if (args.Length() < 1) {
+		return JS_TYPE_ERROR("Invalid call format. Use 'new MappedFile(name, [mode])'");
+	}
+	SAVE_PTR(0, NULL);
+
+#ifdef HAVE_MMAN_H
+	v8::String::Utf8Value n(args[0]);
+	std::string name = *n;
+	std::string mode = "r";
+	if (args.Length() > 1) { mode = *(v8::String::Utf8Value(args[1])); }
+	bool writable = (mode == "rw" || mode == "r+");
+
+	ByteStorage * bs = NULL;
+	bool cached = false;
+	struct stat st;
+	if (!writable) {
+		mappings_t::iterator it = mappings.find(name);
+		if (it != mappings.end()) {
+			mapping_t & m = it->second;
+			bool valid = (stat(name.c_str(), &st) == 0 && st.st_dev == m.dev && st.st_ino == m.ino && st.st_size == m.size && st.st_mtime == m.mtime);
+			if (valid) {
+				bs = new ByteStorage(m.bs, 0, m.bs->getLength());
+				cached = true;
+			} else { /* file changed: drop cached mapping, existing views keep the old one alive */
+				delete m.bs;
+				mappings.erase(it);
+			}
+		}
+	}
+
+	if (!bs) {
+		bs = map_file(name.c_str(), writable, &st);
+		if (!bs) { return JS_ERROR(strerror(errno)); }
+		if (!writable) {
+			mapping_t m;
+			m.bs = new ByteStorage(bs, 0, bs->getLength());
+			m.dev = st.st_dev;
+			m.ino = st.st_ino;
+			m.size = st.st_size;
+			m.mtime = st.st_mtime;
+			mappings[name] = m;
+		}
+	}
+
+	SAVE_PTR(0, bs);
+	args.This()->Set(JS_STR("writable"), JS_BOOL(writable));
+	args.This()->Set(JS_STR("cached"), JS_BOOL(cached));
+	GC * gc = GC_PTR;
+	gc->add(args.This(), finalize);
+	return args.This();
+#else
+	return JS_ERROR("Memory mapping is not supported on this platform");
+#endif
+}
+
+/**
+ * Release the mapping. It gets unmapped when all Buffer views are gone as well.
+ */
+JS_METHOD(_close) {
+	MAPPING_PTR;
+	if (bs) {
+		delete bs;
+		SAVE_PTR(0, NULL);
+	}
+	return args.This();
+}
+
+/**
+ * Buffer view of a part of the mapping. No data is copied.
+ * @param {int} [start=0]
+ * @param {int} [end=length]
+ */
+JS_METHOD(_buffer) {
+	MAPPING_PTR;
+	ASSERT_MAPPED;
+	size_t length = bs->getLength();
+	size_t index1 = (args.Length() > 0 ? (size_t) args[0]->IntegerValue() : 0);
+	size_t index2 = (args.Length() > 1 ? (size_t) args[1]->IntegerValue() : length);
+	index1 = MIN(index1, length);
+	index2 = MIN(MAX(index2, index1), length);
+	return Buffer_create(new ByteStorage(bs, index1, index2));
+}
+
+/**
+ * Flush changes to disk
+ * @param {bool} [async=false] Only schedule the writes
+ * @param {int} [start=0]
+ * @param {int} [end=length]
+ */
+JS_METHOD(_sync) {
+	MAPPING_PTR;
+	ASSERT_MAPPED;
+#ifdef HAVE_MMAN_H
+	unsigned char * start;
+	size_t length;
+	page_range(bs, args, 1, &start, &length);
+	if (!length) { return args.This(); }
+
+	int flags = (args.Length() > 0 && args[0]->IsTrue() ? MS_ASYNC : MS_SYNC);
+	if (msync((void *) start, length, flags) != 0) { return JS_ERROR(strerror(errno)); }
+#endif
+	return args.This();
+}
+
+/**
+ * Tell the kernel how the mapping is going to be accessed
+ * @param {int} advice One of MappedFile.NORMAL, RANDOM, SEQUENTIAL, WILLNEED, DONTNEED
+ * @param {int} [start=0]
+ * @param {int} [end=length]
+ */
+JS_METHOD(_advise) {
+	MAPPING_PTR;
+	ASSERT_MAPPED;
+	if (args.Length() < 1) {
+		return JS_TYPE_ERROR("Bad argument count. Use 'mappedFile.advise(advice, [start], [end])'");
+	}
+#ifdef HAVE_MMAN_H
+	unsigned char * start;
+	size_t length;
+	page_range(bs, args, 1, &start, &length);
+	if (!length) { return args.This(); }
+
+	if (madvise((void *) start, length, args[0]->Int32Value()) != 0) { return JS_ERROR(strerror(errno)); }
+#endif
+	return args.This();
+}
+
+v8::Handle<v8::Value> _length(v8::Local<v8::String> property, const v8::AccessorInfo &info) {
+	ByteStorage * bs = reinterpret_cast<ByteStorage *>(info.This()->GetPointerFromInternalField(0));
+	return JS_FLOAT(bs ? (double) bs->getLength() : 0);
+}
+
+} /* end namespace */
+
+SHARED_INIT() {
+	v8::HandleScope handle_scope;
+	Buffer_init(require);
+
+	v8::Handle<v8::FunctionTemplate> ft = v8::FunctionTemplate::New(_mappedfile);
+	ft->SetClassName(JS_STR("MappedFile"));
+
+#ifdef HAVE_MMAN_H
+	/**
+	 * Constants (MappedFile.*)
+	 */
+	ft->Set(JS_STR("NORMAL"), JS_INT(MADV_NORMAL));
+	ft->Set(JS_STR("RANDOM"), JS_INT(MADV_RANDOM));
+	ft->Set(JS_STR("SEQUENTIAL"), JS_INT(MADV_SEQUENTIAL));
+	ft->Set(JS_STR("WILLNEED"), JS_INT(MADV_WILLNEED));
+	ft->Set(JS_STR("DONTNEED"), JS_INT(MADV_DONTNEED));
+#endif
+
+	v8::Handle<v8::ObjectTemplate> ot = ft->InstanceTemplate();
+	ot->SetInternalFieldCount(1); /* ByteStorage */
+	ot->SetAccessor(JS_STR("length"), _length, 0, v8::Handle<v8::Value>(), v8::DEFAULT, static_cast<v8::PropertyAttribute>(v8::DontDelete));
+
+	v8::Handle<v8::ObjectTemplate> pt = ft->PrototypeTemplate();
+
+	/**
+	 * MappedFile prototype methods (new MappedFile().*)
+	 */
+	pt->Set(JS_STR("buffer"), v8::FunctionTemplate::New(_buffer));
+	pt->Set(JS_STR("sync"), v8::FunctionTemplate::New(_sync));
+	pt->Set(JS_STR("advise"), v8::FunctionTemplate::New(_advise));
+	pt->Set(JS_STR("close"), v8::FunctionTemplate::New(_close));
+
+	exports->Set(JS_STR("MappedFile"), ft->GetFunction());
+}
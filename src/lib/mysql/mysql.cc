@@ -1,24 +1,969 @@
 #include <v8.h>
 #include "macros.h"
 #include "gc.h"
+#include "loop.h"
 
 #ifdef windows
 #	include <my_global.h>
 #endif
 
+#include "lib/binary-f/buffer.h"
+#include "lib/db/rows.h"
+
 #include <mysql.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include <string>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+#include <cmath>
+#include <ctime>
+#include <sstream>
+
+#ifdef windows
+#	include <winsock2.h>
+#else
+#	include <sys/select.h>
+#endif
 
-#define MYSQL_ERROR mysql_error(conn)
+#define MYSQL_ERROR mysql_error(conn->mysql)
 #define ASSERT_CONNECTED if (!conn) { return JS_ERROR("No connection established yet."); }
 #define ASSERT_RESULT if (!res) { return JS_ERROR("Result set already closed."); }
-#define MYSQL_PTR MYSQL * conn = LOAD_PTR(0, MYSQL *)
+#define CONN_PTR connection_t * conn = LOAD_PTR(0, connection_t *)
+#define STATEMENT_PTR statement_t * st = LOAD_PTR(0, statement_t *)
+#define ASSERT_STATEMENT if (!st || !st->stmt) { return JS_ERROR("Statement already closed."); }
+#define ASSERT_IDLE if (conn->async) { return JS_ERROR("Connection is busy with an asynchronous query."); }
+
+#define STATEMENT_CACHE_SIZE 32
 
+/**
+ * Flags in MYSQL_BIND and statement attributes: my_bool (char) up to MySQL 5.7 and in MariaDB, 
+ * plain bool since MySQL 8, whose headers no longer define my_bool
+ */
+#if defined(MARIADB_BASE_VERSION) || defined(MARIADB_PACKAGE_VERSION_ID) || MYSQL_VERSION_ID < 80000
+typedef my_bool flag_t;
+#else
+typedef bool flag_t;
+#endif
 
 namespace {
 
 v8::Persistent<v8::FunctionTemplate> rest;
+v8::Persistent<v8::FunctionTemplate> rowst;
+v8::Persistent<v8::FunctionTemplate> stmtt;
+v8::Persistent<v8::FunctionTemplate> cursort;
+
+typedef struct connection_t connection_t;
+typedef struct pool_t pool_t;
+typedef struct async_t async_t;
+
+/**
+ * Server-side prepared statement handed out to JS by prepare() or query(sql, params)
+ */
+typedef struct {
+	MYSQL_STMT * stmt; /* NULL when closed, or when the connection was closed first */
+	connection_t * conn;
+	std::string sql;
+	MYSQL_RES * meta; /* result set metadata; NULL for statements without results */
+} statement_t;
+
+/**
+ * Unbuffered result set (mysql_use_result) read row by row by a Cursor
+ */
+typedef struct {
+	MYSQL_RES * res; /* NULL when exhausted or closed */
+	connection_t * conn;
+} cursor_t;
+
+/**
+ * Connection with its statement cache. Cached statements are keyed by SQL text,
+ * most recently used first; a statement in use is checked out of the cache.
+ */
+struct connection_t {
+	typedef std::pair<std::string, MYSQL_STMT *> entry_t;
+	typedef std::list<entry_t> lru_t;
+
+	MYSQL * mysql;
+	size_t cacheSize;
+	lru_t lru;
+	std::map<std::string, lru_t::iterator> index;
+	std::set<statement_t *> statements;
+	cursor_t * cursor; /* open unbuffered result; blocks other commands until read or freed */
+	async_t * async; /* query in flight; other commands are refused until it completes */
+	lru_t deferred; /* statements released while a query was in flight */
+	pool_t * pool; /* NULL for private connections */
+};
+
+typedef enum {
+	ASYNC_QUERY,
+	ASYNC_STORE,
+	ASYNC_DONE
+} async_phase_t;
+
+/**
+ * Asynchronous query driven by the event loop. With a client library lacking 
+ * the non-blocking API, the query runs at once and only the callback is deferred.
+ */
+struct async_t {
+	connection_t * conn;
+	async_phase_t phase;
+	std::string sql;
+	int code; /* mysql_real_query result */
+	MYSQL_RES * res;
+	int status; /* MYSQL_WAIT_* flags the library waits for */
+	int watcher;
+	int timer;
+	bool cancelled; /* finish without calling back */
+	bool blocking; /* the socket could not be watched: finish by blocking, see async_block */
+	v8::Persistent<v8::Function> callback;
+	v8::Persistent<v8::Object> db;
+};
+
+/**
+ * Asynchronous queries in flight, all connections
+ */
+int pending = 0;
+
+/**
+ * Set when a callback throws; wait() stops and lets the exception propagate
+ */
+bool aborted = false;
+
+/**
+ * Worker-level pool of connections to one DSN. Connections survive requests;
+ * the most recently returned one is handed out first.
+ */
+struct pool_t {
+	typedef std::pair<connection_t *, time_t> idle_t;
+
+	std::string name; /* DSN without password, for stats */
+	int min;
+	int max;
+	int idleTimeout; /* seconds */
+	bool reset; /* mysql_reset_connection instead of rollback on return (client 5.7.3+) */
+	std::list<idle_t> idle;
+	int busy;
+
+	/* stats */
+	int created;
+	int reused;
+	int discarded;
+};
+
+/**
+ * Pools by DSN
+ */
+std::map<std::string, pool_t *> pools;
+
+typedef struct {
+	std::string host;
+	std::string user;
+	std::string pass;
+	std::string db;
+	int port;
+	std::string socket;
+} dsn_t;
+
+/**
+ * Discard the rest of an unbuffered result (and any further results) so that the connection
+ * accepts new commands. The remaining rows are still transferred from the server and read; 
+ * see cursor_abandon for connections which are closed anyway.
+ */
+void cursor_release(cursor_t * cursor) {
+	connection_t * conn = cursor->conn;
+	if (cursor->res) { mysql_free_result(cursor->res); } /* reads remaining rows */
+	cursor->res = NULL;
+	cursor->conn = NULL;
+	if (!conn) { return; }
+
+	conn->cursor = NULL;
+	while (mysql_more_results(conn->mysql) && mysql_next_result(conn->mysql) == 0) {
+		MYSQL_RES * res = mysql_use_result(conn->mysql);
+		if (res) { mysql_free_result(res); }
+	}
+}
+
+/**
+ * Detach a cursor from a connection which is about to close, without reading the remaining rows.
+ * Returns the result, to be freed after mysql_close: closing the socket aborts the query.
+ */
+MYSQL_RES * cursor_abandon(cursor_t * cursor) {
+	MYSQL_RES * res = cursor->res;
+	if (res) { res->handle = NULL; } /* otherwise mysql_free_result reads the rest */
+	cursor->conn->cursor = NULL;
+	cursor->res = NULL;
+	cursor->conn = NULL;
+	return res;
+}
+
+void statement_give(connection_t * conn, const std::string & sql, MYSQL_STMT * stmt);
+
+/**
+ * Completed query: call callback(error, result) with the MySQL object as "this"
+ */
+void async_complete(async_t * a) {
+	v8::HandleScope handle_scope;
+	EventLoop * loop = LOOP_PTR;
+	connection_t * conn = a->conn;
+	if (a->watcher) { loop->remove(a->watcher); }
+	if (a->timer) { loop->remove(a->timer); }
+	conn->async = NULL;
+	pending--;
+	while (conn->deferred.size()) {
+		connection_t::entry_t entry = conn->deferred.front();
+		conn->deferred.pop_front();
+		statement_give(conn, entry.first, entry.second);
+	}
+
+	v8::Handle<v8::Value> argv[2];
+	argv[0] = v8::Null();
+	argv[1] = v8::Undefined();
+	if (a->code || (!a->res && mysql_field_count(conn->mysql))) {
+		argv[0] = JS_STR(MYSQL_ERROR);
+	} else if (a->res && !a->cancelled) {
+		v8::Handle<v8::Value> resargs[] = { v8::External::New((void *) a->res) };
+		argv[1] = rest->GetFunction()->NewInstance(1, resargs);
+	} else {
+		argv[1] = JS_BOOL(true);
+	}
+	if (a->res && a->cancelled) { mysql_free_result(a->res); }
+
+	v8::Handle<v8::Function> fun = v8::Local<v8::Function>::New(a->callback);
+	v8::Handle<v8::Object> db = v8::Local<v8::Object>::New(a->db);
+	bool call = !a->cancelled;
+	a->callback.Dispose();
+	a->db.Dispose();
+	delete a;
+	if (!call) { return; }
+
+	int qc = db->Get(JS_STR("queryCount"))->ToInteger()->Int32Value();
+	db->Set(JS_STR("queryCount"), JS_INT(qc+1));
+	v8::Handle<v8::Value> result = fun->Call(db, 2, argv);
+	if (result.IsEmpty()) {
+		aborted = true;
+		loop->stop();
+	}
+}
+
+void async_ready(EventLoop * loop, int id, int fd, int events, void * data);
+void async_block(async_t * a);
+
+/**
+ * Let the event loop resume the query once the socket (or the library's timeout) is ready
+ */
+void async_wait(async_t * a, int status) {
+	a->status = status;
+#ifdef MYSQL_WAIT_READ
+	if (a->blocking) { return; } /* async_block waits itself */
+	EventLoop * loop = LOOP_PTR;
+	int events = 0;
+	if (status & (MYSQL_WAIT_READ | MYSQL_WAIT_EXCEPT)) { events |= EventLoop::READ; }
+	if (status & MYSQL_WAIT_WRITE) { events |= EventLoop::WRITE; }
+
+	if (!events && a->watcher) {
+		loop->remove(a->watcher);
+		a->watcher = 0;
+	} else if (events && a->watcher) {
+		loop->modifyWatcher(a->watcher, events);
+	} else if (events) {
+		a->watcher = loop->addWatcher(mysql_get_socket(a->conn->mysql), events, async_ready, a, NULL);
+		if (a->watcher == -1) { /* finish by blocking, still calling back from the loop */
+			a->watcher = 0;
+			a->blocking = true;
+		}
+	}
+
+	if (a->timer) { loop->remove(a->timer); }
+	a->timer = 0;
+	if (a->blocking) {
+		a->timer = loop->addTimer(0, false, async_ready, a, NULL);
+		return;
+	}
+	if (status & MYSQL_WAIT_TIMEOUT) {
+		a->timer = loop->addTimer(mysql_get_timeout_value_ms(a->conn->mysql), false, async_ready, a, NULL);
+	}
+#endif
+}
+
+/**
+ * Advance the query; ready holds the MYSQL_WAIT_* flags that are satisfied, -1 to start.
+ * A query that completes when started still calls back from the event loop.
+ */
+void async_step(async_t * a, int ready) {
+	MYSQL * mysql = a->conn->mysql;
+	bool started = (ready == -1);
+
+#ifdef MYSQL_WAIT_READ
+	int status;
+	if (a->phase == ASYNC_QUERY) {
+		if (ready == -1) {
+			status = mysql_real_query_start(&a->code, mysql, a->sql.c_str(), a->sql.length());
+		} else {
+			status = mysql_real_query_cont(&a->code, mysql, ready);
+		}
+		if (status) {
+			async_wait(a, status);
+			return;
+		}
+		if (a->code) { a->phase = ASYNC_DONE; }
+		if (a->phase == ASYNC_QUERY) {
+			a->phase = ASYNC_STORE;
+			ready = -1;
+		}
+	}
+
+	if (a->phase == ASYNC_STORE) {
+		if (ready == -1) {
+			status = mysql_store_result_start(&a->res, mysql);
+		} else {
+			status = mysql_store_result_cont(&a->res, mysql, ready);
+		}
+		if (status) {
+			async_wait(a, status);
+			return;
+		}
+		a->phase = ASYNC_DONE;
+	}
+#else
+	a->code = mysql_real_query(mysql, a->sql.c_str(), a->sql.length());
+	if (!a->code) { a->res = mysql_store_result(mysql); }
+	a->phase = ASYNC_DONE;
+#endif
+
+	if (!started) {
+		async_complete(a);
+		return;
+	}
+	EventLoop * loop = LOOP_PTR;
+	a->timer = loop->addTimer(0, false, async_ready, a, NULL);
+}
+
+/**
+ * Event loop notification: map readiness to MYSQL_WAIT_* flags
+ */
+void async_ready(EventLoop * loop, int id, int fd, int events, void * data) {
+	async_t * a = (async_t *) data;
+	if (fd == -1) { a->timer = 0; } /* expired timers are removed by the loop */
+	if (a->phase == ASYNC_DONE) {
+		async_complete(a);
+		return;
+	}
+	if (a->blocking) {
+		async_block(a);
+		return;
+	}
+
+	int ready = 0;
+#ifdef MYSQL_WAIT_READ
+	if (fd == -1) { ready |= MYSQL_WAIT_TIMEOUT; }
+	if (events & (EventLoop::READ | EventLoop::HANGUP)) { ready |= MYSQL_WAIT_READ; }
+	if (events & EventLoop::WRITE) { ready |= MYSQL_WAIT_WRITE; }
+	if (events & EventLoop::HANGUP) { ready |= MYSQL_WAIT_EXCEPT; }
+#endif
+	async_step(a, ready);
+}
+
+/**
+ * Run a query in flight to completion, blocking on its socket
+ */
+void async_block(async_t * a) {
+#ifdef MYSQL_WAIT_READ
+	connection_t * conn = a->conn;
+	while (conn->async == a) {
+		int fd = mysql_get_socket(conn->mysql);
+		fd_set r, w, e;
+		FD_ZERO(&r);
+		FD_ZERO(&w);
+		FD_ZERO(&e);
+		if (a->status & MYSQL_WAIT_READ) { FD_SET(fd, &r); }
+		if (a->status & MYSQL_WAIT_WRITE) { FD_SET(fd, &w); }
+		if (a->status & MYSQL_WAIT_EXCEPT) { FD_SET(fd, &e); }
+
+		struct timeval tv;
+		struct timeval * timeout = NULL;
+		if (a->status & MYSQL_WAIT_TIMEOUT) {
+			unsigned int ms = mysql_get_timeout_value_ms(conn->mysql);
+			tv.tv_sec = ms / 1000;
+			tv.tv_usec = (ms % 1000) * 1000;
+			timeout = &tv;
+		}
+
+		int count = select(fd + 1, &r, &w, &e, timeout);
+		int ready = 0;
+		if (count == 0) {
+			ready = MYSQL_WAIT_TIMEOUT;
+		} else if (count > 0) {
+			if (FD_ISSET(fd, &r)) { ready |= MYSQL_WAIT_READ; }
+			if (FD_ISSET(fd, &w)) { ready |= MYSQL_WAIT_WRITE; }
+			if (FD_ISSET(fd, &e)) { ready |= MYSQL_WAIT_EXCEPT; }
+		} else {
+			ready = a->status & ~MYSQL_WAIT_TIMEOUT; /* let the library see the error */
+		}
+		async_step(a, ready);
+	}
+#endif
+}
+
+/**
+ * Finish a query in flight without calling back
+ */
+void async_finish(async_t * a) {
+	a->cancelled = true;
+	if (a->phase == ASYNC_DONE) {
+		async_complete(a);
+		return;
+	}
+	async_block(a);
+}
+
+/**
+ * Called before every command: an unfinished cursor is closed, a query in flight completes
+ * without its callback
+ */
+void connection_settle(connection_t * conn) {
+	if (conn->async) { async_finish(conn->async); }
+	if (conn->cursor) { cursor_release(conn->cursor); }
+}
+
+/**
+ * Take a prepared statement for sql: from cache when possible, otherwise prepare it on the server.
+ * Returns NULL on failure (see mysql_error).
+ */
+MYSQL_STMT * statement_take(connection_t * conn, const std::string & sql, std::string & error) {
+	std::map<std::string, connection_t::lru_t::iterator>::iterator it = conn->index.find(sql);
+	if (it != conn->index.end()) {
+		MYSQL_STMT * stmt = it->second->second;
+		conn->lru.erase(it->second);
+		conn->index.erase(it);
+		return stmt;
+	}
+
+	MYSQL_STMT * stmt = mysql_stmt_init(conn->mysql);
+	if (!stmt) {
+		error = mysql_error(conn->mysql);
+		return NULL;
+	}
+	if (mysql_stmt_prepare(stmt, sql.c_str(), sql.length())) {
+		error = mysql_stmt_error(stmt);
+		mysql_stmt_close(stmt);
+		return NULL;
+	}
+	flag_t update = 1; /* compute max_length of columns, used to size result buffers */
+	mysql_stmt_attr_set(stmt, STMT_ATTR_UPDATE_MAX_LENGTH, &update);
+	return stmt;
+}
+
+/**
+ * Close least recently used statements until at most "size" remain
+ */
+void statement_trim(connection_t * conn, size_t size) {
+	while (conn->lru.size() > size) {
+		connection_t::entry_t & last = conn->lru.back();
+		mysql_stmt_close(last.second);
+		conn->index.erase(last.first);
+		conn->lru.pop_back();
+	}
+}
+
+/**
+ * Return a statement to the cache, evicting the least recently used one
+ */
+void statement_give(connection_t * conn, const std::string & sql, MYSQL_STMT * stmt) {
+	mysql_stmt_free_result(stmt);
+	if (!conn->cacheSize || conn->index.find(sql) != conn->index.end() || mysql_stmt_reset(stmt)) {
+		mysql_stmt_close(stmt);
+		return;
+	}
+
+	conn->lru.push_front(connection_t::entry_t(sql, stmt));
+	conn->index[sql] = conn->lru.begin();
+	statement_trim(conn, conn->cacheSize);
+}
+
+/**
+ * Detach a statement from JS; its handle goes back to the connection's cache
+ */
+void statement_release(statement_t * st) {
+	if (st->meta) { mysql_free_result(st->meta); }
+	st->meta = NULL;
+	if (st->conn) {
+		st->conn->statements.erase(st);
+		if (st->stmt && st->conn->async) { /* no commands until the query completes */
+			st->conn->deferred.push_back(connection_t::entry_t(st->sql, st->stmt));
+		} else if (st->stmt) {
+			statement_give(st->conn, st->sql, st->stmt);
+		}
+	} else if (st->stmt) {
+		mysql_stmt_close(st->stmt);
+	}
+	st->stmt = NULL;
+	st->conn = NULL;
+}
+
+/**
+ * Close all statements and the connection; an unfinished cursor is abandoned, not drained
+ */
+void connection_close(connection_t * conn) {
+	MYSQL_RES * unread = (conn->cursor ? cursor_abandon(conn->cursor) : NULL);
+	connection_settle(conn);
+	statement_trim(conn, 0);
+	std::set<statement_t *>::iterator it;
+	for (it = conn->statements.begin(); it != conn->statements.end(); it++) {
+		statement_t * st = *it;
+		if (st->meta) { mysql_free_result(st->meta); }
+		mysql_stmt_close(st->stmt);
+		st->meta = NULL;
+		st->stmt = NULL;
+		st->conn = NULL;
+	}
+	conn->statements.clear();
+	mysql_close(conn->mysql);
+	if (unread) { mysql_free_result(unread); }
+}
+
+/**
+ * Connect to a server. Returns NULL and fills error on failure.
+ */
+connection_t * connection_open(const dsn_t & dsn, std::string & error) {
+	const char * h = dsn.host.c_str();
+	const char * unix_socket = NULL;
+	if (dsn.socket.length()) {
+		unix_socket = dsn.socket.c_str();
+	} else if (h[0] == '/') { /* "localhost" makes libmysqlclient use the Unix socket */
+		unix_socket = h;
+		h = "localhost";
+	}
+
+	MYSQL * mysql = mysql_init(NULL);
+#ifdef MYSQL_WAIT_READ
+	mysql_options(mysql, MYSQL_OPT_NONBLOCK, 0); /* blocking calls keep working */
+#endif
+	if (!mysql_real_connect(mysql, h, dsn.user.c_str(), dsn.pass.c_str(), dsn.db.c_str(), dsn.port, unix_socket, CLIENT_MULTI_STATEMENTS)) {
+		error = mysql_error(mysql);
+		mysql_close(mysql);
+		return NULL;
+	}
+	mysql_query(mysql, "SET NAMES 'utf8'");
+
+	connection_t * conn = new connection_t();
+	conn->mysql = mysql;
+	conn->cacheSize = STATEMENT_CACHE_SIZE;
+	conn->cursor = NULL;
+	conn->async = NULL;
+	conn->pool = NULL;
+	return conn;
+}
+
+void connection_destroy(connection_t * conn) {
+	connection_close(conn);
+	delete conn;
+}
+
+/**
+ * Close connections idle for too long, keeping at least pool->min open
+ */
+void pool_expire(pool_t * pool) {
+	time_t now = time(NULL);
+	while (pool->idle.size() && (int) pool->idle.size() + pool->busy > pool->min) {
+		pool_t::idle_t & oldest = pool->idle.back();
+		if (now - oldest.second < pool->idleTimeout) { break; }
+		connection_destroy(oldest.first);
+		pool->idle.pop_back();
+		pool->discarded++;
+	}
+}
+
+/**
+ * Check out a validated connection, opening a new one when no idle connection is alive
+ */
+connection_t * pool_acquire(pool_t * pool, const dsn_t & dsn, std::string & error) {
+	pool_expire(pool);
+	connection_t * conn = NULL;
+
+	while (!conn && pool->idle.size()) {
+		conn = pool->idle.front().first;
+		pool->idle.pop_front();
+		if (mysql_ping(conn->mysql)) {
+			connection_destroy(conn);
+			pool->discarded++;
+			conn = NULL;
+		} else {
+			pool->reused++;
+		}
+	}
+
+	if (!conn) {
+		if ((int) pool->idle.size() + pool->busy >= pool->max) {
+			error = "Connection pool exhausted";
+			return NULL;
+		}
+		conn = connection_open(dsn, error);
+		if (!conn) { return NULL; }
+		conn->pool = pool;
+		pool->created++;
+	}
+	pool->busy++;
+
+	/* warm up to the minimal size */
+	while ((int) pool->idle.size() + pool->busy < pool->min) {
+		std::string e;
+		connection_t * extra = connection_open(dsn, e);
+		if (!extra) { break; }
+		extra->pool = pool;
+		pool->created++;
+		pool->idle.push_back(pool_t::idle_t(extra, time(NULL)));
+	}
+	return conn;
+}
+
+/**
+ * Return a connection: unfinished results are discarded, statements handed to JS go back 
+ * to the cache and any open transaction is rolled back (or the whole session is reset).
+ * A connection with an unfinished cursor is closed instead, as draining may read a huge result.
+ */
+void pool_release(connection_t * conn) {
+	pool_t * pool = conn->pool;
+	pool->busy--;
+	if (conn->cursor) {
+		connection_destroy(conn);
+		pool->discarded++;
+		return;
+	}
+	connection_settle(conn);
+
+	std::set<statement_t *> statements = conn->statements;
+	std::set<statement_t *>::iterator it;
+	for (it = statements.begin(); it != statements.end(); it++) { statement_release(*it); }
+
+	bool ok;
+#if MYSQL_VERSION_ID >= 50703
+	if (pool->reset) {
+		statement_trim(conn, 0); /* reset deallocates server-side statements */
+		ok = !mysql_reset_connection(conn->mysql);
+	} else {
+		ok = !mysql_rollback(conn->mysql) && !mysql_autocommit(conn->mysql, 1);
+	}
+#else
+	/* no mysql_reset_connection before client 5.7.3: the reset option falls back to rollback */
+	ok = !mysql_rollback(conn->mysql) && !mysql_autocommit(conn->mysql, 1);
+#endif
+
+	if (!ok || (int) pool->idle.size() + pool->busy >= pool->max) {
+		connection_destroy(conn);
+		pool->discarded++;
+		return;
+	}
+	pool->idle.push_front(pool_t::idle_t(conn, time(NULL)));
+	pool_expire(pool);
+}
+
+/**
+ * Storage for one bound parameter; must stay in place until the statement is executed
+ */
+typedef struct {
+	long long integer;
+	double number;
+	std::string text;
+	unsigned long length;
+	flag_t null;
+} param_t;
+
+/**
+ * Bind an array of parameters natively. Returns an error message or empty string.
+ */
+std::string bind_params(MYSQL_STMT * stmt, v8::Handle<v8::Value> params, std::vector<MYSQL_BIND> & binds, std::vector<param_t> & values) {
+	unsigned long count = mysql_stmt_param_count(stmt);
+	if (!count && (params->IsUndefined() || params->IsNull())) { return ""; }
+	if (!params->IsArray()) { return "Parameters must be an array"; }
+	v8::Handle<v8::Array> arr = v8::Handle<v8::Array>::Cast(params);
+	if (arr->Length() != count) { return "Number of parameters does not match the statement"; }
+	if (!count) { return ""; }
+
+	binds.resize(count);
+	values.resize(count);
+	memset(&binds[0], 0, count * sizeof(MYSQL_BIND));
+
+	for (unsigned long i=0; i<count; i++) {
+		v8::Handle<v8::Value> value = arr->Get(JS_INT(i));
+		MYSQL_BIND & b = binds[i];
+		param_t & p = values[i];
+		p.null = 0;
+		b.is_null = &p.null;
+		b.length = &p.length;
+
+		if (value->IsNull() || value->IsUndefined()) {
+			b.buffer_type = MYSQL_TYPE_NULL;
+			p.null = 1;
+		} else if (value->IsBoolean() || value->IsInt32()) {
+			p.integer = value->IsBoolean() ? (value->BooleanValue() ? 1 : 0) : value->Int32Value();
+			b.buffer_type = MYSQL_TYPE_LONGLONG;
+			b.buffer = &p.integer;
+		} else if (value->IsNumber()) {
+			double d = value->NumberValue();
+			if (d == floor(d) && fabs(d) <= 9007199254740992.0) {
+				p.integer = (long long) d;
+				b.buffer_type = MYSQL_TYPE_LONGLONG;
+				b.buffer = &p.integer;
+			} else {
+				p.number = d;
+				b.buffer_type = MYSQL_TYPE_DOUBLE;
+				b.buffer = &p.number;
+			}
+		} else if (Buffer_isBuffer(value)) {
+			ByteStorage * bs = Buffer_storage(value);
+			p.length = bs->getLength();
+			b.buffer_type = MYSQL_TYPE_BLOB;
+			b.buffer = bs->getData();
+			b.buffer_length = p.length;
+		} else {
+			v8::String::Utf8Value str(value);
+			p.text.assign(*str, str.length());
+			p.length = p.text.length();
+			b.buffer_type = MYSQL_TYPE_STRING;
+			b.buffer = (void *) p.text.data();
+			b.buffer_length = p.length;
+		}
+	}
+
+	if (mysql_stmt_bind_param(stmt, &binds[0])) { return mysql_stmt_error(stmt); }
+	return "";
+}
+
+/**
+ * Bind, execute and buffer the results of a statement. Returns an error message or empty string.
+ */
+std::string statement_execute(statement_t * st, v8::Handle<v8::Value> params) {
+	std::vector<MYSQL_BIND> binds;
+	std::vector<param_t> values;
+
+	if (st->meta) { 
+		mysql_free_result(st->meta);
+		st->meta = NULL;
+	}
+	mysql_stmt_free_result(st->stmt);
+
+	std::string error = bind_params(st->stmt, params, binds, values);
+	if (error.length()) { return error; }
+	if (mysql_stmt_execute(st->stmt)) { return mysql_stmt_error(st->stmt); }
+
+	st->meta = mysql_stmt_result_metadata(st->stmt);
+	if (st->meta && mysql_stmt_store_result(st->stmt)) { return mysql_stmt_error(st->stmt); }
+	return "";
+}
+
+/**
+ * Column buffer for binary protocol fetches
+ */
+typedef struct {
+	long long integer;
+	double number;
+	std::vector<char> data;
+	std::vector<char> overflow; /* value longer than max_length, fetched separately */
+	unsigned long length;
+	flag_t null;
+	flag_t error;
+} column_t;
+
+typedef enum { 
+	COLUMN_INTEGER, 
+	COLUMN_NUMBER, 
+	COLUMN_STRING, 
+	COLUMN_DECIMAL, 
+	COLUMN_BINARY, 
+	COLUMN_BIT 
+} column_kind_t;
+
+column_kind_t column_kind(const MYSQL_FIELD & field) {
+	switch (field.type) {
+		case MYSQL_TYPE_TINY:
+		case MYSQL_TYPE_SHORT:
+		case MYSQL_TYPE_LONG:
+		case MYSQL_TYPE_INT24:
+		case MYSQL_TYPE_LONGLONG:
+		case MYSQL_TYPE_YEAR:
+			return COLUMN_INTEGER;
+
+		case MYSQL_TYPE_FLOAT:
+		case MYSQL_TYPE_DOUBLE:
+			return COLUMN_NUMBER;
+
+		case MYSQL_TYPE_DECIMAL:
+		case MYSQL_TYPE_NEWDECIMAL:
+			return COLUMN_DECIMAL;
+
+		case MYSQL_TYPE_BIT:
+			return COLUMN_BIT;
+
+		case MYSQL_TYPE_TINY_BLOB:
+		case MYSQL_TYPE_MEDIUM_BLOB:
+		case MYSQL_TYPE_LONG_BLOB:
+		case MYSQL_TYPE_BLOB:
+		case MYSQL_TYPE_STRING:
+		case MYSQL_TYPE_VAR_STRING:
+		case MYSQL_TYPE_GEOMETRY:
+			return (field.charsetnr == 63 ? COLUMN_BINARY : COLUMN_STRING); /* 63 = binary */
+
+		default:
+			return COLUMN_STRING;
+	}
+}
+
+/**
+ * Prepare result buffers sized by max_length of the buffered result
+ */
+void bind_results(MYSQL_RES * meta, std::vector<MYSQL_BIND> & binds, std::vector<column_t> & columns, std::vector<column_kind_t> & kinds) {
+	unsigned int count = mysql_num_fields(meta);
+	MYSQL_FIELD * fields = mysql_fetch_fields(meta);
+	binds.resize(count);
+	columns.resize(count);
+	kinds.resize(count);
+	memset(&binds[0], 0, count * sizeof(MYSQL_BIND));
+
+	for (unsigned int i=0; i<count; i++) {
+		MYSQL_BIND & b = binds[i];
+		column_t & c = columns[i];
+		kinds[i] = column_kind(fields[i]);
+		b.is_null = &c.null;
+		b.length = &c.length;
+		b.error = &c.error;
+
+		switch (kinds[i]) {
+			case COLUMN_INTEGER:
+				b.buffer_type = MYSQL_TYPE_LONGLONG;
+				b.buffer = &c.integer;
+				b.is_unsigned = (fields[i].flags & UNSIGNED_FLAG ? 1 : 0);
+			break;
+
+			case COLUMN_NUMBER:
+				b.buffer_type = MYSQL_TYPE_DOUBLE;
+				b.buffer = &c.number;
+			break;
+
+			default:
+				c.data.resize(MAX(fields[i].max_length, 64) + 1);
+				b.buffer_type = (kinds[i] == COLUMN_BINARY || kinds[i] == COLUMN_BIT ? MYSQL_TYPE_BLOB : MYSQL_TYPE_STRING);
+				b.buffer = &c.data[0];
+				b.buffer_length = c.data.size();
+			break;
+		}
+	}
+}
+
+/**
+ * Convert a fetched binary protocol value
+ */
+v8::Handle<v8::Value> column_value(column_t & c, column_kind_t kind, bool is_unsigned) {
+	if (c.null) { return v8::Null(); }
+	switch (kind) {
+		case COLUMN_INTEGER: {
+			char str[24];
+			if (is_unsigned) {
+				unsigned long long u = (unsigned long long) c.integer;
+				if (u <= 2147483647ULL) { return JS_INT((int) u); }
+				if (u <= 9007199254740992ULL) { return JS_FLOAT((double) u); }
+				snprintf(str, sizeof(str), "%llu", u);
+				return JS_STR(str); /* beyond 2^53: keep all digits */
+			}
+			if (c.integer >= -2147483647LL-1 && c.integer <= 2147483647LL) { return JS_INT((int) c.integer); }
+			if (c.integer >= -9007199254740992LL && c.integer <= 9007199254740992LL) { return JS_FLOAT((double) c.integer); }
+			snprintf(str, sizeof(str), "%lld", c.integer);
+			return JS_STR(str);
+		}
+
+		case COLUMN_NUMBER:
+			return JS_FLOAT(c.number);
+
+		default: break;
+	}
+
+	char * data = (c.error && c.overflow.size() ? &c.overflow[0] : &c.data[0]);
+	switch (kind) {
+		case COLUMN_DECIMAL: {
+			std::string str(data, c.length);
+			return JS_FLOAT(strtod(str.c_str(), NULL));
+		}
+
+		case COLUMN_BIT: {
+			double value = 0;
+			for (unsigned long i=0; i<c.length; i++) { value = value*256 + (unsigned char) data[i]; }
+			return JS_FLOAT(value);
+		}
+
+		case COLUMN_BINARY:
+			return Buffer_create(new ByteStorage((unsigned char *) data, c.length));
+
+		default:
+			return JS_STR(data, c.length);
+	}
+}
+
+/**
+ * Column names of a result as interned strings, used as property keys of all rows
+ */
+v8::Handle<v8::Array> field_names(MYSQL_RES * res) {
+	unsigned int cols = mysql_num_fields(res);
+	MYSQL_FIELD * fields = mysql_fetch_fields(res);
+	v8::Handle<v8::Array> names = v8::Array::New(cols);
+	for (unsigned int i=0; i<cols; i++) {
+		names->Set(JS_INT(i), RowBuilder::name(fields[i].name));
+	}
+	return names;
+}
+
+/**
+ * Read all buffered rows of an executed statement in the given format
+ */
+v8::Handle<v8::Value> statement_rows(statement_t * st, RowBuilder::format_t format) {
+	std::vector<MYSQL_BIND> binds;
+	std::vector<column_t> columns;
+	std::vector<column_kind_t> kinds;
+	bind_results(st->meta, binds, columns, kinds);
+	if (mysql_stmt_bind_result(st->stmt, &binds[0])) { return JS_ERROR(mysql_stmt_error(st->stmt)); }
+
+	unsigned int cols = columns.size();
+	RowBuilder rows(field_names(st->meta), format);
+	mysql_stmt_data_seek(st->stmt, 0);
+	int status;
+
+	while ((status = mysql_stmt_fetch(st->stmt)) == 0 || status == MYSQL_DATA_TRUNCATED) {
+		for (unsigned int j=0; status == MYSQL_DATA_TRUNCATED && j<cols; j++) {
+			column_t & c = columns[j];
+			if (!c.error || c.null || kinds[j] == COLUMN_INTEGER || kinds[j] == COLUMN_NUMBER) { continue; }
+			c.overflow.resize(c.length + 1);
+			MYSQL_BIND b = binds[j];
+			b.buffer = &c.overflow[0];
+			b.buffer_length = c.overflow.size();
+			b.error = NULL;
+			mysql_stmt_fetch_column(st->stmt, &b, j, 0);
+		}
+
+		rows.start();
+		for (unsigned int j=0; j<cols; j++) {
+			rows.set(j, column_value(columns[j], kinds[j], binds[j].is_unsigned));
+		}
+		rows.end();
+	}
+	if (status != MYSQL_NO_DATA) { return JS_ERROR(mysql_stmt_error(st->stmt)); }
+	return rows.result();
+}
+
+/**
+ * Wrap a taken statement into a JS Statement object
+ */
+v8::Handle<v8::Object> statement_create(connection_t * conn, const std::string & sql, MYSQL_STMT * stmt, MYSQL_RES * meta, v8::Handle<v8::Value> db) {
+	statement_t * st = new statement_t();
+	st->stmt = stmt;
+	st->conn = conn;
+	st->sql = sql;
+	st->meta = meta;
+	conn->statements.insert(st);
+
+	v8::Handle<v8::Value> stargs[] = { v8::External::New((void *) st), db };
+	return stmtt->GetFunction()->NewInstance(2, stargs);
+}
 
 void finalize(v8::Handle<v8::Object> obj) {
 	v8::Handle<v8::Function> fun = v8::Handle<v8::Function>::Cast(obj->Get(JS_STR("close")));
@@ -30,97 +975,349 @@ void result_finalize(v8::Handle<v8::Object> obj) {
 	fun->Call(obj, 0, NULL);
 }
 
-v8::Handle<v8::Value> createResult(MYSQL * conn) {
-	MYSQL_RES * res = mysql_store_result(conn);
-	
-	if (res) {
-		v8::Handle<v8::Value> resargs[] = { v8::External::New((void *) res) };
-		return rest->GetFunction()->NewInstance(1, resargs);
-	} else {
-		if (mysql_field_count(conn)) {
-			return JS_ERROR(MYSQL_ERROR);
-		} else {
-			return JS_BOOL(true);
+v8::Handle<v8::Value> createResult(connection_t * conn) {
+	MYSQL_RES * res = mysql_store_result(conn->mysql);
+	
+	if (res) {
+		v8::Handle<v8::Value> resargs[] = { v8::External::New((void *) res) };
+		return rest->GetFunction()->NewInstance(1, resargs);
+	} else {
+		if (mysql_field_count(conn->mysql)) {
+			return JS_ERROR(MYSQL_ERROR);
+		} else {
+			return JS_BOOL(true);
+		}
+	}
+}
+
+/**
+ * MySQL constructor remembers options for connect() and adds "this.close()" method to global GC.
+ * new MySQL({pool:{min:0, max:10, idleTimeout:60, reset:false}}) makes connect() use 
+ * the worker's connection pool for the DSN; close() then returns the connection.
+ */
+JS_METHOD(_mysql) {
+	ASSERT_CONSTRUCTOR;
+	SAVE_PTR(0, NULL);
+	if (args.Length() > 0) { SAVE_VALUE(1, args[0]); }
+	GC * gc = GC_PTR;
+	gc->add(args.This(), finalize);
+	return args.This();
+}
+
+/**
+ * Close DB connection
+ */ 
+JS_METHOD(_close) {
+	CONN_PTR;
+	if (conn) {
+		if (conn->pool) {
+			pool_release(conn);
+		} else {
+			connection_destroy(conn);
+		}
+		SAVE_PTR(0, NULL);
+	}
+	return args.This();
+}
+
+/**
+ * Should be called ASAP: new MySQL().connect("host", "user", "pass", "db", [port], [socket])
+ * A host starting with "/" is a path to the server's Unix socket.
+ */ 
+JS_METHOD(_connect) {
+	if (args.Length() < 4) {
+		return JS_TYPE_ERROR("Invalid call format. Use 'mysql.connect(host, user, pass, db, [port], [socket])'");
+	}
+	
+	CONN_PTR;
+	if (conn) { return JS_ERROR("Already connected."); }
+
+	dsn_t dsn;
+	dsn.host = *v8::String::Utf8Value(args[0]);
+	dsn.user = *v8::String::Utf8Value(args[1]);
+	dsn.pass = *v8::String::Utf8Value(args[2]);
+	dsn.db = *v8::String::Utf8Value(args[3]);
+	dsn.port = (args.Length() > 4 ? args[4]->Int32Value() : 0);
+	if (args.Length() > 5 && args[5]->IsString()) { dsn.socket = *v8::String::Utf8Value(args[5]); }
+
+	std::string error;
+	v8::Handle<v8::Value> options = LOAD_VALUE(1);
+	v8::Handle<v8::Value> poolopts = (options->IsObject() ? options->ToObject()->Get(JS_STR("pool")) : v8::Handle<v8::Value>(v8::Undefined()));
+
+	if (poolopts->BooleanValue()) {
+		std::ostringstream name;
+		name << dsn.user << "@" << (dsn.socket.length() ? dsn.socket : dsn.host) << ":" << dsn.port << "/" << dsn.db;
+		std::string key = name.str() + "\n" + dsn.pass;
+
+		pool_t * pool;
+		if (pools.find(key) == pools.end()) {
+			pool = new pool_t();
+			pool->name = name.str();
+			pool->min = 0;
+			pool->max = 10;
+			pool->idleTimeout = 60;
+			pool->reset = false;
+			pool->busy = pool->created = pool->reused = pool->discarded = 0;
+			pools[key] = pool;
+		} else {
+			pool = pools[key];
+		}
+
+		/* latest options win */
+		if (poolopts->IsObject()) {
+			v8::Handle<v8::Object> o = poolopts->ToObject();
+			if (o->Has(JS_STR("min"))) { pool->min = o->Get(JS_STR("min"))->Int32Value(); }
+			if (o->Has(JS_STR("max"))) { pool->max = MAX(1, o->Get(JS_STR("max"))->Int32Value()); }
+			if (o->Has(JS_STR("idleTimeout"))) { pool->idleTimeout = o->Get(JS_STR("idleTimeout"))->Int32Value(); }
+			if (o->Has(JS_STR("reset"))) { pool->reset = o->Get(JS_STR("reset"))->BooleanValue(); }
+		}
+		conn = pool_acquire(pool, dsn, error);
+	} else {
+		conn = connection_open(dsn, error);
+	}
+
+	if (!conn) { return JS_ERROR(error.c_str()); }
+	SAVE_PTR(0, conn);
+	return args.This();
+}
+
+/**
+ * Static method: pool statistics, keyed by DSN (without password)
+ */
+JS_METHOD(_poolstats) {
+	v8::Handle<v8::Object> result = v8::Object::New();
+	std::map<std::string, pool_t *>::iterator it;
+	for (it = pools.begin(); it != pools.end(); it++) {
+		pool_t * pool = it->second;
+		v8::Handle<v8::Object> item = v8::Object::New();
+		item->Set(JS_STR("idle"), JS_INT(pool->idle.size()));
+		item->Set(JS_STR("busy"), JS_INT(pool->busy));
+		item->Set(JS_STR("min"), JS_INT(pool->min));
+		item->Set(JS_STR("max"), JS_INT(pool->max));
+		item->Set(JS_STR("created"), JS_INT(pool->created));
+		item->Set(JS_STR("reused"), JS_INT(pool->reused));
+		item->Set(JS_STR("discarded"), JS_INT(pool->discarded));
+		result->Set(JS_STR(pool->name.c_str()), item);
+	}
+	return result;
+}
+
+/**
+ * Static method: close all idle pooled connections. Returns their count.
+ */
+JS_METHOD(_closepool) {
+	int count = 0;
+	std::map<std::string, pool_t *>::iterator it;
+	for (it = pools.begin(); it != pools.end(); it++) {
+		pool_t * pool = it->second;
+		while (pool->idle.size()) {
+			connection_destroy(pool->idle.front().first);
+			pool->idle.pop_front();
+			pool->discarded++;
+			count++;
+		}
+	}
+	return JS_INT(count);
+}
+
+/**
+ * Query takes a string argument and returns an instance of Result object.
+ * With an array of parameters, the query runs as a cached prepared statement whose rows 
+ * are read at once, so the statement goes straight back to the cache; the result is then 
+ * a Rows object (with the same methods as Result) or true.
+ */ 
+JS_METHOD(_query) {
+	CONN_PTR;
+	ASSERT_CONNECTED;
+	ASSERT_IDLE;
+	if (args.Length() < 1) {
+		return JS_ERROR("No query specified");
+	}
+	v8::String::Utf8Value q(args[0]);
+	connection_settle(conn);
+
+	if (args.Length() > 1 && !args[1]->IsUndefined() && !args[1]->IsNull()) {
+		std::string sql(*q, q.length());
+		std::string error;
+		MYSQL_STMT * stmt = statement_take(conn, sql, error);
+		if (!stmt) { return JS_ERROR(error.c_str()); }
+
+		statement_t tmp;
+		tmp.stmt = stmt;
+		tmp.conn = NULL;
+		tmp.meta = NULL;
+		error = statement_execute(&tmp, args[1]);
+		v8::Handle<v8::Value> data;
+		v8::Handle<v8::Value> names;
+		if (!error.length() && tmp.meta) {
+			data = statement_rows(&tmp, RowBuilder::ARRAYS);
+			names = field_names(tmp.meta);
 		}
+		if (tmp.meta) { mysql_free_result(tmp.meta); }
+		statement_give(conn, sql, stmt);
+		if (error.length()) { return JS_ERROR(error.c_str()); }
+		if (tmp.meta && !data->IsArray()) { return data; } /* exception thrown while reading */
+
+		int qc = args.This()->Get(JS_STR("queryCount"))->ToInteger()->Int32Value();
+		args.This()->Set(JS_STR("queryCount"), JS_INT(qc+1));
+		if (!tmp.meta) { return JS_BOOL(true); }
+		v8::Handle<v8::Value> rowsargs[] = { names, data };
+		return rowst->GetFunction()->NewInstance(2, rowsargs);
 	}
+	
+	int code = mysql_real_query(conn->mysql, *q, q.length());
+	if (code != 0) { return JS_ERROR(MYSQL_ERROR); }
+	
+	int qc = args.This()->Get(JS_STR("queryCount"))->ToInteger()->Int32Value();
+	args.This()->Set(JS_STR("queryCount"), JS_INT(qc+1));
+	
+	return createResult(conn);
 }
 
 /**
- * MySQL constructor does basically nothing. It just adds "this.close()" method to global GC
+ * Asynchronous query: mysql.queryAsync(sql, callback) returns immediately; callback(error, result)
+ * is called from the event loop with a Result (or true). Queries on different connections run 
+ * in parallel; until the callback, the connection refuses other commands.
  */
-JS_METHOD(_mysql) {
-	ASSERT_CONSTRUCTOR;
-	SAVE_PTR(0, NULL);
-	GC * gc = GC_PTR;
-	gc->add(args.This(), finalize);
+JS_METHOD(_queryasync) {
+	if (args.Length() < 2 || !args[1]->IsFunction()) {
+		return JS_TYPE_ERROR("Invalid call format. Use 'mysql.queryAsync(sql, callback)'");
+	}
+	CONN_PTR;
+	ASSERT_CONNECTED;
+	ASSERT_IDLE;
+	v8::String::Utf8Value q(args[0]);
+	connection_settle(conn);
+
+	async_t * a = new async_t();
+	a->conn = conn;
+	a->phase = ASYNC_QUERY;
+	a->sql.assign(*q, q.length());
+	a->code = 0;
+	a->res = NULL;
+	a->status = 0;
+	a->watcher = 0;
+	a->timer = 0;
+	a->cancelled = false;
+	a->blocking = false;
+	a->callback = v8::Persistent<v8::Function>::New(v8::Handle<v8::Function>::Cast(args[1]));
+	a->db = v8::Persistent<v8::Object>::New(args.This());
+	conn->async = a;
+	pending++;
+
+	async_step(a, -1);
 	return args.This();
 }
 
 /**
- * Close DB connection
- */ 
-JS_METHOD(_close) {
-	MYSQL_PTR;
-	if (conn) {
-		mysql_close(conn);
-		SAVE_PTR(0, NULL);
+ * Run the event loop until this connection's asynchronous query calls back
+ */
+JS_METHOD(_wait) {
+	EventLoop * loop = LOOP_PTR;
+	aborted = false;
+	while (!aborted) {
+		connection_t * conn = LOAD_PTR(0, connection_t *); /* callbacks may close the connection */
+		if (!conn || !conn->async || !loop->runOnce(-1)) { break; }
 	}
+	if (aborted) { return v8::Handle<v8::Value>(); } /* exception thrown by a callback */
 	return args.This();
 }
 
 /**
- * Should be called ASAP: new MySQL().connect("host", "user", "pass", "db")
- */ 
-JS_METHOD(_connect) {
-	if (args.Length() < 4) {
-		return JS_TYPE_ERROR("Invalid call format. Use 'mysql.connect(host, user, pass, db)'");
+ * Static method: run the event loop until all asynchronous queries call back
+ */
+JS_METHOD(_waitall) {
+	EventLoop * loop = LOOP_PTR;
+	aborted = false;
+	while (!aborted && pending && loop->runOnce(-1)) {}
+	if (aborted) { return v8::Handle<v8::Value>(); }
+	return v8::Undefined();
+}
+
+/**
+ * Prepare a statement: new MySQL().connect(...).prepare("select ... where id = ?").
+ * Statements are cached per connection, so preparing the same SQL again is cheap.
+ */
+JS_METHOD(_prepare) {
+	CONN_PTR;
+	ASSERT_CONNECTED;
+	ASSERT_IDLE;
+	if (args.Length() < 1) {
+		return JS_ERROR("No query specified");
 	}
-	
-	MYSQL * conn;
-	
-	v8::String::Utf8Value host(args[0]);
-	v8::String::Utf8Value user(args[1]);
-	v8::String::Utf8Value pass(args[2]);
-	v8::String::Utf8Value db(args[3]);
-
-	conn = mysql_init(NULL);
-	if (!mysql_real_connect(conn, *host, *user, *pass, *db, 0, NULL, CLIENT_MULTI_STATEMENTS)) {
-		return JS_ERROR(MYSQL_ERROR);
-	} else {
-		mysql_query(conn, "SET NAMES 'utf8'");
-		SAVE_PTR(0, conn);
-		return args.This();
-	}	
+	v8::String::Utf8Value q(args[0]);
+	std::string sql(*q, q.length());
+	std::string error;
+	connection_settle(conn);
+
+	MYSQL_STMT * stmt = statement_take(conn, sql, error);
+	if (!stmt) { return JS_ERROR(error.c_str()); }
+	return statement_create(conn, sql, stmt, NULL, args.This());
 }
 
 /**
- * Query takes a string argument and returns an instance of Result object
- */ 
-JS_METHOD(_query) {
-	MYSQL_PTR;
+ * Cursor runs a query without buffering its result: rows are transferred as they are read.
+ * The connection is busy until the cursor is exhausted or closed; any other command closes it
+ * (reading the remaining rows). Closing the connection abandons the rows without reading them.
+ */
+JS_METHOD(_cursor) {
+	CONN_PTR;
 	ASSERT_CONNECTED;
+	ASSERT_IDLE;
 	if (args.Length() < 1) {
 		return JS_ERROR("No query specified");
 	}
 	v8::String::Utf8Value q(args[0]);
-	
-	int code = mysql_real_query(conn, *q, q.length());
+	connection_settle(conn);
+
+	int code = mysql_real_query(conn->mysql, *q, q.length());
 	if (code != 0) { return JS_ERROR(MYSQL_ERROR); }
-	
+
 	int qc = args.This()->Get(JS_STR("queryCount"))->ToInteger()->Int32Value();
 	args.This()->Set(JS_STR("queryCount"), JS_INT(qc+1));
-	
-	return createResult(conn);
+
+	MYSQL_RES * res = mysql_use_result(conn->mysql);
+	if (!res) {
+		if (mysql_field_count(conn->mysql)) { return JS_ERROR(MYSQL_ERROR); }
+		return JS_ERROR("Query has no result set.");
+	}
+
+	cursor_t * cursor = new cursor_t();
+	cursor->res = res;
+	cursor->conn = conn;
+	conn->cursor = cursor;
+
+	v8::Handle<v8::Value> cargs[] = { v8::External::New((void *) cursor), args.This(), field_names(res) };
+	return cursort->GetFunction()->NewInstance(3, cargs);
+}
+
+/**
+ * Set the maximum number of cached statements; 0 disables the cache
+ */
+JS_METHOD(_setstatementcache) {
+	CONN_PTR;
+	ASSERT_CONNECTED;
+	ASSERT_IDLE;
+	if (args.Length() < 1) {
+		return JS_TYPE_ERROR("Invalid call format. Use 'mysql.setStatementCache(size)'");
+	}
+	int size = args[0]->Int32Value();
+	if (size < 0) { return JS_RANGE_ERROR("Cache size must not be negative"); }
+	conn->cacheSize = size;
+	statement_trim(conn, conn->cacheSize);
+	return args.This();
 }
 
 /**
  * Fetch next result from a multi-result set
  */
 JS_METHOD(_nextresult) {
-	MYSQL_PTR;
+	CONN_PTR;
 	ASSERT_CONNECTED;
+	ASSERT_IDLE;
 	
-	int status = mysql_next_result(conn);
+	connection_settle(conn);
+	int status = mysql_next_result(conn->mysql);
 	
 	if (status == -1) { return JS_NULL; }
 	if (status > 0) { return JS_ERROR(MYSQL_ERROR); }
@@ -128,19 +1325,19 @@ JS_METHOD(_nextresult) {
 }
 
 JS_METHOD(_affectedrows) {
-	MYSQL_PTR;
+	CONN_PTR;
 	ASSERT_CONNECTED;
-	return JS_INT(mysql_affected_rows(conn));
+	return JS_INT(mysql_affected_rows(conn->mysql));
 }
 
 JS_METHOD(_insertid) {
-	MYSQL_PTR;
+	CONN_PTR;
 	ASSERT_CONNECTED;
-	return JS_INT(mysql_insert_id(conn));
+	return JS_INT(mysql_insert_id(conn->mysql));
 }
 
 JS_METHOD(_escape) {
-	MYSQL_PTR;
+	CONN_PTR;
 	ASSERT_CONNECTED;
 	
 	if (args.Length() < 1) {
@@ -152,7 +1349,7 @@ JS_METHOD(_escape) {
 	char * result = new char[2*len + 1];
 	
 
-	int length = mysql_real_escape_string(conn, result, *str, len);
+	int length = mysql_real_escape_string(conn->mysql, result, *str, len);
 	v8::Handle<v8::Value> output = JS_STR(result, length);
 	delete[] result;
 	return output;
@@ -199,15 +1396,7 @@ JS_METHOD(_fetchnames) {
 	MYSQL_RES * res = LOAD_PTR(0, MYSQL_RES *);
 	ASSERT_RESULT;
 
-	int cnt = mysql_num_fields(res);
-	MYSQL_FIELD * fields = mysql_fetch_fields(res);
-	v8::Handle<v8::Array> result = v8::Array::New(cnt);
-	
-	for(int i = 0; i < cnt; i++) {
-		result->Set(JS_INT(i), JS_STR(fields[i].name));
-	}
-	
-	return result;
+	return field_names(res);
 }
 
 /**
@@ -253,29 +1442,33 @@ v8::Handle<v8::Value> _mysqltojs(const char* mysql_value, const MYSQL_FIELD& fie
 }
 
 /**
- * Return result data as an array of JS arrays
- */ 
-JS_METHOD(_fetcharrays) {
-	MYSQL_RES * res = LOAD_PTR(0, MYSQL_RES *);
-	ASSERT_RESULT;
+ * Rows of a buffered result in the given format
+ */
+v8::Handle<v8::Value> result_rows(MYSQL_RES * res, RowBuilder::format_t format) {
 	mysql_data_seek(res, 0);
-
 	int x = mysql_num_fields(res);
 	int y = mysql_num_rows(res);
 	MYSQL_FIELD * fields = mysql_fetch_fields(res);
-	MYSQL_ROW row;
-	v8::Handle<v8::Array> result = v8::Array::New(y);
-	
+	RowBuilder rows(field_names(res), format);
+
 	for (int i = 0; i < y; i++) {
-		row = mysql_fetch_row(res);
-		v8::Handle<v8::Array> item = v8::Array::New(x);
-		result->Set(JS_INT(i), item);
+		MYSQL_ROW row = mysql_fetch_row(res);
+		rows.start();
 		for (int j=0; j<x; j++) {
-			item->Set(JS_INT(j), _mysqltojs(row[j], fields[j]));
-			}
+			rows.set(j, _mysqltojs(row[j], fields[j]));
 		}
-	
-	return result;
+		rows.end();
+	}
+	return rows.result();
+}
+
+/**
+ * Return result data as an array of JS arrays
+ */ 
+JS_METHOD(_fetcharrays) {
+	MYSQL_RES * res = LOAD_PTR(0, MYSQL_RES *);
+	ASSERT_RESULT;
+	return result_rows(res, RowBuilder::ARRAYS);
 }
 
 /**
@@ -284,26 +1477,344 @@ JS_METHOD(_fetcharrays) {
 JS_METHOD(_fetchobjects) {
 	MYSQL_RES * res = LOAD_PTR(0, MYSQL_RES *);
 	ASSERT_RESULT;
-	mysql_data_seek(res, 0);
+	return result_rows(res, RowBuilder::OBJECTS);
+}
 
-	int x = mysql_num_fields(res);
-	int y = mysql_num_rows(res);
-	MYSQL_FIELD * fields = mysql_fetch_fields(res);
-	MYSQL_ROW row;
-	v8::Handle<v8::Array> result = v8::Array::New(y);
-	
-	for (int i = 0; i < y; i++) {
-		row = mysql_fetch_row(res);
-		v8::Handle<v8::Object> item = v8::Object::New();
-		result->Set(JS_INT(i), item);
-		for (int j=0; j<x; j++) {
-			item->Set(JS_STR(fields[j].name), _mysqltojs(row[j], fields[j]));
-			}
+/**
+ * Return result data as one JS object of value arrays, indexed with column names
+ */ 
+JS_METHOD(_fetchcolumns) {
+	MYSQL_RES * res = LOAD_PTR(0, MYSQL_RES *);
+	ASSERT_RESULT;
+	return result_rows(res, RowBuilder::COLUMNS);
+}
+
+/**
+ * Rows is created by query(sql, params) with (column names, rows as arrays)
+ */
+JS_METHOD(_rows) {
+	ASSERT_CONSTRUCTOR;
+	SAVE_VALUE(0, args[0]);
+	SAVE_VALUE(1, args[1]);
+	return args.This();
+}
+
+/**
+ * Rows of a Rows object in the given format; the stored arrays are not handed out
+ */
+v8::Handle<v8::Value> rows_format(const v8::Arguments & args, RowBuilder::format_t format) {
+	v8::Handle<v8::Value> data = LOAD_VALUE(1);
+	if (!data->IsArray()) { return JS_ERROR("Result set already closed."); }
+	v8::Handle<v8::Array> names = v8::Handle<v8::Array>::Cast(LOAD_VALUE(0));
+	v8::Handle<v8::Array> arr = v8::Handle<v8::Array>::Cast(data);
+
+	int cols = names->Length();
+	int count = arr->Length();
+	RowBuilder rows(names, format);
+	for (int i=0; i<count; i++) {
+		v8::Handle<v8::Object> row = arr->Get(JS_INT(i))->ToObject();
+		rows.start();
+		for (int j=0; j<cols; j++) { rows.set(j, row->Get(JS_INT(j))); }
+		rows.end();
+	}
+	return rows.result();
+}
+
+JS_METHOD(_rows_numrows) {
+	v8::Handle<v8::Value> data = LOAD_VALUE(1);
+	if (!data->IsArray()) { return JS_ERROR("Result set already closed."); }
+	return JS_INT(v8::Handle<v8::Array>::Cast(data)->Length());
+}
+
+JS_METHOD(_rows_numfields) {
+	return JS_INT(v8::Handle<v8::Array>::Cast(LOAD_VALUE(0))->Length());
+}
+
+JS_METHOD(_rows_fetchnames) {
+	v8::Handle<v8::Array> names = v8::Handle<v8::Array>::Cast(LOAD_VALUE(0));
+	int cnt = names->Length();
+	v8::Handle<v8::Array> result = v8::Array::New(cnt);
+	for (int i = 0; i < cnt; i++) { result->Set(JS_INT(i), names->Get(JS_INT(i))); }
+	return result;
+}
+
+JS_METHOD(_rows_fetcharrays) {
+	return rows_format(args, RowBuilder::ARRAYS);
+}
+
+JS_METHOD(_rows_fetchobjects) {
+	return rows_format(args, RowBuilder::OBJECTS);
+}
+
+JS_METHOD(_rows_fetchcolumns) {
+	return rows_format(args, RowBuilder::COLUMNS);
+}
+
+/**
+ * Drop the rows; nothing is held on the server
+ */
+JS_METHOD(_rows_close) {
+	if (!LOAD_VALUE(1)->IsArray()) { return JS_BOOL(false); }
+	SAVE_VALUE(1, v8::Null());
+	return JS_BOOL(true);
+}
+
+/**
+ * Read next row of an unbuffered result. Returns NULL at the end (cursor released) or on error.
+ */
+MYSQL_ROW cursor_fetch(cursor_t * cursor, std::string & error) {
+	if (!cursor->res) { return NULL; }
+	MYSQL_ROW row = mysql_fetch_row(cursor->res);
+	if (row) { return row; }
+	if (mysql_errno(cursor->conn->mysql)) { error = mysql_error(cursor->conn->mysql); }
+	cursor_release(cursor);
+	return NULL;
+}
+
+/**
+ * Row read by a cursor into a row builder
+ */
+void cursor_row(cursor_t * cursor, MYSQL_ROW row, RowBuilder & rows) {
+	unsigned int cols = mysql_num_fields(cursor->res);
+	MYSQL_FIELD * fields = mysql_fetch_fields(cursor->res);
+	rows.start();
+	for (unsigned int j=0; j<cols; j++) {
+		rows.set(j, _mysqltojs(row[j], fields[j]));
+	}
+}
+
+/**
+ * Object rows of a Cursor, using the column names and row shape kept in its internal fields
+ */
+RowBuilder cursor_rows(v8::Handle<v8::Object> obj) {
+	v8::Handle<v8::Array> names = v8::Handle<v8::Array>::Cast(obj->GetInternalField(2));
+	v8::Handle<v8::Object> shape = obj->GetInternalField(3)->ToObject();
+	return RowBuilder(names, RowBuilder::OBJECTS, shape);
+}
+
+/**
+ * Cursor is created by cursor() with (External cursor, connection object, column names)
+ */
+JS_METHOD(_cursorinit) {
+	ASSERT_CONSTRUCTOR;
+	if (args.Length() < 3 || !args[0]->IsExternal()) {
+		return JS_TYPE_ERROR("Use 'mysql.cursor(sql)' to create cursors");
+	}
+	cursor_t * cursor = reinterpret_cast<cursor_t *>(v8::Handle<v8::External>::Cast(args[0])->Value());
+	SAVE_PTR(0, cursor);
+	SAVE_VALUE(1, args[1]); /* keeps the connection alive */
+	SAVE_VALUE(2, args[2]);
+	SAVE_VALUE(3, RowBuilder::shape(v8::Handle<v8::Array>::Cast(args[2])));
+	GC * gc = GC_PTR;
+	gc->add(args.This(), finalize);
+	return args.This();
+}
+
+/**
+ * Next row as an object, or false when there are no more rows
+ */
+JS_METHOD(_next) {
+	cursor_t * cursor = LOAD_PTR(0, cursor_t *);
+	if (!cursor) { return JS_ERROR("Cursor already closed."); }
+	std::string error;
+	MYSQL_ROW row = cursor_fetch(cursor, error);
+	if (error.length()) { return JS_ERROR(error.c_str()); }
+	if (!row) { return JS_BOOL(false); }
+	RowBuilder rows = cursor_rows(args.This());
+	cursor_row(cursor, row, rows);
+	return rows.row();
+}
+
+/**
+ * Up to "count" next rows; an empty array when there are no more rows
+ */
+JS_METHOD(_fetch) {
+	cursor_t * cursor = LOAD_PTR(0, cursor_t *);
+	if (!cursor) { return JS_ERROR("Cursor already closed."); }
+	if (args.Length() < 1) {
+		return JS_TYPE_ERROR("Invalid call format. Use 'cursor.fetch(count)'");
+	}
+	int count = args[0]->Int32Value();
+	RowBuilder rows = cursor_rows(args.This());
+	std::string error;
+
+	for (int i=0; i<count; i++) {
+		MYSQL_ROW row = cursor_fetch(cursor, error);
+		if (error.length()) { return JS_ERROR(error.c_str()); }
+		if (!row) { break; }
+		cursor_row(cursor, row, rows);
+		rows.end();
+	}
+	return rows.result();
+}
+
+/**
+ * Call fn(row, index) for every remaining row; an exception thrown by fn closes the cursor.
+ * Stopping early (by throwing or closing the cursor) still reads the rest of the rows, see close().
+ */
+JS_METHOD(_foreach) {
+	cursor_t * cursor = LOAD_PTR(0, cursor_t *);
+	if (!cursor) { return JS_ERROR("Cursor already closed."); }
+	if (args.Length() < 1 || !args[0]->IsFunction()) {
+		return JS_TYPE_ERROR("Invalid call format. Use 'cursor.forEach(function)'");
+	}
+	v8::Handle<v8::Function> fun = v8::Handle<v8::Function>::Cast(args[0]);
+	v8::Handle<v8::Object> self = (args.Length() > 1 && args[1]->IsObject() ? args[1]->ToObject() : v8::Context::GetCurrent()->Global());
+	RowBuilder rows = cursor_rows(args.This());
+	std::string error;
+
+	for (int i=0; cursor; i++) {
+		v8::HandleScope scope;
+		MYSQL_ROW row = cursor_fetch(cursor, error);
+		if (!row) { break; }
+		cursor_row(cursor, row, rows);
+		v8::Handle<v8::Value> fargs[] = { rows.row(), JS_INT(i) };
+		v8::Handle<v8::Value> r = fun->Call(self, 2, fargs);
+		cursor = LOAD_PTR(0, cursor_t *); /* callback may have closed the cursor */
+		if (r.IsEmpty()) {
+			if (cursor) { cursor_release(cursor); }
+			return r;
 		}
-	
+	}
+	if (error.length()) { return JS_ERROR(error.c_str()); }
+	return args.This();
+}
+
+JS_METHOD(_cursornames) {
+	v8::Handle<v8::Array> names = v8::Handle<v8::Array>::Cast(LOAD_VALUE(2));
+	int cols = names->Length();
+	v8::Handle<v8::Array> result = v8::Array::New(cols);
+	for (int i=0;i<cols;i++) {
+		result->Set(JS_INT(i), names->Get(JS_INT(i)));
+	}
+	return result;
+}
+
+JS_METHOD(_cursorfields) {
+	return JS_INT(v8::Handle<v8::Array>::Cast(LOAD_VALUE(2))->Length());
+}
+
+/**
+ * Stop reading; remaining rows are discarded and the connection is usable again. The server 
+ * still sends them all, so this costs as much as reading them: to abandon a large result, 
+ * close the connection instead (a pooled one is then discarded, not returned).
+ */
+JS_METHOD(_cursorclose) {
+	cursor_t * cursor = LOAD_PTR(0, cursor_t *);
+	if (cursor) {
+		cursor_release(cursor);
+		delete cursor;
+		SAVE_PTR(0, NULL);
+		return JS_BOOL(true);
+	} else {
+		return JS_BOOL(false);
+	}
+}
+
+/**
+ * Statement is created by prepare() with (External statement, connection object)
+ */
+JS_METHOD(_statement) {
+	ASSERT_CONSTRUCTOR;
+	if (args.Length() < 2 || !args[0]->IsExternal()) {
+		return JS_TYPE_ERROR("Use 'mysql.prepare(sql)' to create statements");
+	}
+	statement_t * st = reinterpret_cast<statement_t *>(v8::Handle<v8::External>::Cast(args[0])->Value());
+	SAVE_PTR(0, st);
+	SAVE_VALUE(1, args[1]); /* keeps the connection alive */
+	GC * gc = GC_PTR;
+	gc->add(args.This(), finalize);
+	return args.This();
+}
+
+/**
+ * Execute with an optional array of parameters. Results are buffered and read with fetch*().
+ */
+JS_METHOD(_execute) {
+	STATEMENT_PTR;
+	ASSERT_STATEMENT;
+	if (st->conn->async) { return JS_ERROR("Connection is busy with an asynchronous query."); }
+	connection_settle(st->conn);
+	std::string error = statement_execute(st, (args.Length() > 0 ? args[0] : v8::Handle<v8::Value>(v8::Undefined())));
+	if (error.length()) { return JS_ERROR(error.c_str()); }
+
+	v8::Handle<v8::Object> db = LOAD_VALUE(1)->ToObject();
+	int qc = db->Get(JS_STR("queryCount"))->ToInteger()->Int32Value();
+	db->Set(JS_STR("queryCount"), JS_INT(qc+1));
+	return args.This();
+}
+
+JS_METHOD(_stmt_numrows) {
+	STATEMENT_PTR;
+	ASSERT_STATEMENT;
+	return JS_INT(st->meta ? mysql_stmt_num_rows(st->stmt) : 0);
+}
+
+JS_METHOD(_stmt_numfields) {
+	STATEMENT_PTR;
+	ASSERT_STATEMENT;
+	return JS_INT(mysql_stmt_field_count(st->stmt));
+}
+
+JS_METHOD(_stmt_affectedrows) {
+	STATEMENT_PTR;
+	ASSERT_STATEMENT;
+	return JS_INT(mysql_stmt_affected_rows(st->stmt));
+}
+
+JS_METHOD(_stmt_insertid) {
+	STATEMENT_PTR;
+	ASSERT_STATEMENT;
+	return JS_INT(mysql_stmt_insert_id(st->stmt));
+}
+
+JS_METHOD(_stmt_fetchnames) {
+	STATEMENT_PTR;
+	ASSERT_STATEMENT;
+	MYSQL_RES * meta = st->meta ? st->meta : mysql_stmt_result_metadata(st->stmt);
+	if (!meta) { return v8::Array::New(0); }
+
+	v8::Handle<v8::Array> result = field_names(meta);
+	if (meta != st->meta) { mysql_free_result(meta); }
 	return result;
 }
 
+JS_METHOD(_stmt_fetcharrays) {
+	STATEMENT_PTR;
+	ASSERT_STATEMENT;
+	if (!st->meta) { return JS_ERROR("Statement has no result set."); }
+	return statement_rows(st, RowBuilder::ARRAYS);
+}
+
+JS_METHOD(_stmt_fetchobjects) {
+	STATEMENT_PTR;
+	ASSERT_STATEMENT;
+	if (!st->meta) { return JS_ERROR("Statement has no result set."); }
+	return statement_rows(st, RowBuilder::OBJECTS);
+}
+
+JS_METHOD(_stmt_fetchcolumns) {
+	STATEMENT_PTR;
+	ASSERT_STATEMENT;
+	if (!st->meta) { return JS_ERROR("Statement has no result set."); }
+	return statement_rows(st, RowBuilder::COLUMNS);
+}
+
+/**
+ * Free results and return the statement to the connection's cache
+ */
+JS_METHOD(_stmt_close) {
+	STATEMENT_PTR;
+	if (st) {
+		statement_release(st);
+		delete st;
+		SAVE_PTR(0, NULL);
+		return JS_BOOL(true);
+	} else {
+		return JS_BOOL(false);
+	}
+}
+
 JS_METHOD(_result_close) {
 	MYSQL_RES * res = LOAD_PTR(0, MYSQL_RES *);
 	if (res) {
@@ -319,11 +1830,13 @@ JS_METHOD(_result_close) {
 
 SHARED_INIT() {
 	v8::HandleScope handle_scope;
+	Buffer_init(require);
+
 	v8::Handle<v8::FunctionTemplate> ft = v8::FunctionTemplate::New(_mysql);
 	ft->SetClassName(JS_STR("MySQL"));
 
 	v8::Handle<v8::ObjectTemplate> ot = ft->InstanceTemplate();
-	ot->SetInternalFieldCount(1); /* connection */
+	ot->SetInternalFieldCount(2); /* connection, options */
 	
 	/**
 	 * Static property, useful for stats gathering
@@ -343,6 +1856,11 @@ SHARED_INIT() {
 	pt->Set(JS_STR("escape"), v8::FunctionTemplate::New(_escape));
 	pt->Set(JS_STR("qualify"), v8::FunctionTemplate::New(_qualify));
 	pt->Set(JS_STR("insertId"), v8::FunctionTemplate::New(_insertid));
+	pt->Set(JS_STR("prepare"), v8::FunctionTemplate::New(_prepare));
+	pt->Set(JS_STR("setStatementCache"), v8::FunctionTemplate::New(_setstatementcache));
+	pt->Set(JS_STR("cursor"), v8::FunctionTemplate::New(_cursor));
+	pt->Set(JS_STR("queryAsync"), v8::FunctionTemplate::New(_queryasync));
+	pt->Set(JS_STR("wait"), v8::FunctionTemplate::New(_wait));
 	
 	rest = v8::Persistent<v8::FunctionTemplate>::New(v8::FunctionTemplate::New(_result));
 	rest->SetClassName(JS_STR("Result"));
@@ -360,7 +1878,65 @@ SHARED_INIT() {
 	resproto->Set(JS_STR("fetchNames"), v8::FunctionTemplate::New(_fetchnames));
 	resproto->Set(JS_STR("fetchArrays"), v8::FunctionTemplate::New(_fetcharrays));
 	resproto->Set(JS_STR("fetchObjects"), v8::FunctionTemplate::New(_fetchobjects));
+	resproto->Set(JS_STR("fetchColumns"), v8::FunctionTemplate::New(_fetchcolumns));
 	resproto->Set(JS_STR("close"), v8::FunctionTemplate::New(_result_close));
 
+	rowst = v8::Persistent<v8::FunctionTemplate>::New(v8::FunctionTemplate::New(_rows));
+	rowst->SetClassName(JS_STR("Rows"));
+	rowst->InstanceTemplate()->SetInternalFieldCount(2); /* column names, rows as arrays */
+
+	/**
+	 * Rows prototype methods (new MySQL().query(sql, params).*)
+	 */
+	v8::Handle<v8::ObjectTemplate> rowsproto = rowst->PrototypeTemplate();
+	rowsproto->Set(JS_STR("numRows"), v8::FunctionTemplate::New(_rows_numrows));
+	rowsproto->Set(JS_STR("numFields"), v8::FunctionTemplate::New(_rows_numfields));
+	rowsproto->Set(JS_STR("fetchNames"), v8::FunctionTemplate::New(_rows_fetchnames));
+	rowsproto->Set(JS_STR("fetchArrays"), v8::FunctionTemplate::New(_rows_fetcharrays));
+	rowsproto->Set(JS_STR("fetchObjects"), v8::FunctionTemplate::New(_rows_fetchobjects));
+	rowsproto->Set(JS_STR("fetchColumns"), v8::FunctionTemplate::New(_rows_fetchcolumns));
+	rowsproto->Set(JS_STR("close"), v8::FunctionTemplate::New(_rows_close));
+
+	stmtt = v8::Persistent<v8::FunctionTemplate>::New(v8::FunctionTemplate::New(_statement));
+	stmtt->SetClassName(JS_STR("Statement"));
+	stmtt->InstanceTemplate()->SetInternalFieldCount(2); /* statement, connection */
+
+	/**
+	 * Statement prototype methods (new MySQL().prepare().*)
+	 */
+	v8::Handle<v8::ObjectTemplate> stproto = stmtt->PrototypeTemplate();
+	stproto->Set(JS_STR("execute"), v8::FunctionTemplate::New(_execute));
+	stproto->Set(JS_STR("numRows"), v8::FunctionTemplate::New(_stmt_numrows));
+	stproto->Set(JS_STR("numFields"), v8::FunctionTemplate::New(_stmt_numfields));
+	stproto->Set(JS_STR("affectedRows"), v8::FunctionTemplate::New(_stmt_affectedrows));
+	stproto->Set(JS_STR("insertId"), v8::FunctionTemplate::New(_stmt_insertid));
+	stproto->Set(JS_STR("fetchNames"), v8::FunctionTemplate::New(_stmt_fetchnames));
+	stproto->Set(JS_STR("fetchArrays"), v8::FunctionTemplate::New(_stmt_fetcharrays));
+	stproto->Set(JS_STR("fetchObjects"), v8::FunctionTemplate::New(_stmt_fetchobjects));
+	stproto->Set(JS_STR("fetchColumns"), v8::FunctionTemplate::New(_stmt_fetchcolumns));
+	stproto->Set(JS_STR("close"), v8::FunctionTemplate::New(_stmt_close));
+
+	/**
+	 * Static methods (MySQL.*)
+	 */
+	ft->Set(JS_STR("poolStats"), v8::FunctionTemplate::New(_poolstats));
+	ft->Set(JS_STR("closePool"), v8::FunctionTemplate::New(_closepool));
+	ft->Set(JS_STR("wait"), v8::FunctionTemplate::New(_waitall));
+
+	cursort = v8::Persistent<v8::FunctionTemplate>::New(v8::FunctionTemplate::New(_cursorinit));
+	cursort->SetClassName(JS_STR("Cursor"));
+	cursort->InstanceTemplate()->SetInternalFieldCount(4); /* cursor, connection, names, row shape */
+
+	/**
+	 * Cursor prototype methods (new MySQL().cursor().*)
+	 */
+	v8::Handle<v8::ObjectTemplate> cproto = cursort->PrototypeTemplate();
+	cproto->Set(JS_STR("next"), v8::FunctionTemplate::New(_next));
+	cproto->Set(JS_STR("fetch"), v8::FunctionTemplate::New(_fetch));
+	cproto->Set(JS_STR("forEach"), v8::FunctionTemplate::New(_foreach));
+	cproto->Set(JS_STR("fetchNames"), v8::FunctionTemplate::New(_cursornames));
+	cproto->Set(JS_STR("numFields"), v8::FunctionTemplate::New(_cursorfields));
+	cproto->Set(JS_STR("close"), v8::FunctionTemplate::New(_cursorclose));
+
 	exports->Set(JS_STR("MySQL"), ft->GetFunction());
 }
@@ -20,6 +20,7 @@
 #include <v8.h>
 #include "macros.h"
 #include "gc.h"
+#include "lib/db/rows.h"
 
 #ifndef HAVE_SLEEP
 #	include <windows.h>
@@ -152,6 +153,7 @@ void destroy_pgsql(v8::Handle<v8::Object> obj) {
   /**
    *	CONNECT method
    *	- call format: new PostgreSQL().connect("host", "user", "pass", "db")
+   *	- a host starting with "/" is the directory of the server's Unix socket (libpq skips TCP then)
    */ 
   JS_METHOD(_connect) {
     if (args.Length() < 1 and args.Length() != 5)
@@ -580,14 +582,47 @@ JS_METHOD(_query) {
     return JS_INT(atoi(pq::PQcmdTuples(res)));
   }
 
+  /**
+   * Column names as interned strings, used as property keys of all rows
+   */
+  v8::Handle<v8::Array> field_names(pq::PGresult * res) {
+    int cnt = pq::PQnfields(res);
+    v8::Handle<v8::Array> names = v8::Array::New(cnt);
+    for (int i = 0; i < cnt; i++)
+      names->Set(JS_INT(i), RowBuilder::name(pq::PQfname(res, i)));
+    return names;
+  }
+
+  /**
+   * One row into a row builder
+   */
+  void row_read(pq::PGresult * res, int i, RowBuilder & rows) {
+    int x = pq::PQnfields(res);
+    rows.start();
+    for (int j=0; j<x; j++)
+      if (pq::PQgetisnull(res, i, j))
+	rows.set(j, v8::Null());
+      else
+	rows.set(j, JS_STR(pq::PQgetvalue(res, i, j)));
+  }
+
+  /**
+   * All rows of a result in the given format
+   */
+  v8::Handle<v8::Value> result_rows(pq::PGresult * res, RowBuilder::format_t format) {
+    int y = pq::PQntuples(res);
+    RowBuilder rows(field_names(res), format);
+    for (int i = 0; i < y; i++) {
+      row_read(res, i, rows);
+      rows.end();
+    }
+    return rows.result();
+  }
+
   JS_METHOD(_fetchnames) {
     PGSQL_RES_LOAD(res);
     ASSERT_RESULT;
-    int cnt = pq::PQnfields(res);
-    v8::Handle<v8::Array> result = v8::Array::New(cnt);
-    for(int i = 0; i < cnt; i++)
-      result->Set(JS_INT(i), JS_STR(pq::PQfname(res, i)));
-    return result;
+    return field_names(res);
   }
 
   /**
@@ -634,19 +669,7 @@ JS_METHOD(_query) {
   JS_METHOD(_fetchall) {
     PGSQL_RES_LOAD(res);
     ASSERT_RESULT;
-    int x = pq::PQnfields(res);
-    int y = pq::PQntuples(res);
-    v8::Handle<v8::Array> result = v8::Array::New(y);
-    for (int i = 0; i < y; i++) {
-      v8::Handle<v8::Array> item = v8::Array::New(x);
-      result->Set(JS_INT(i), item);
-      for (int j=0; j<x; j++)
-	if (pq::PQgetisnull(res, i, j))
-	  item->Set(JS_INT(j), v8::Null());
-	else
-	  item->Set(JS_INT(j), JS_STR(pq::PQgetvalue(res, i, j)));
-    }
-    return result;
+    return result_rows(res, RowBuilder::ARRAYS);
   }
 
   /**
@@ -655,20 +678,14 @@ JS_METHOD(_query) {
   JS_METHOD(_fetchrow) {
     PGSQL_RES_LOAD(res);
     ASSERT_RESULT;
-    int x = pq::PQnfields(res);
-    int y = pq::PQntuples(res);
     int i = 0;
     if (args.Length() > 0) {
       v8::String::Utf8Value a(args[0]);
       i = atoi(*a);
     }
-    v8::Handle<v8::Array> result = v8::Array::New(y);
-    for (int j=0; j<x; j++)
-      if (pq::PQgetisnull(res, i, j))
-	result->Set(JS_INT(j), v8::Null());
-      else
-	result->Set(JS_INT(j), JS_STR(pq::PQgetvalue(res, i, j)));
-    return result;
+    RowBuilder rows(field_names(res), RowBuilder::ARRAYS);
+    row_read(res, i, rows);
+    return rows.row();
   }
 
   /**
@@ -678,50 +695,40 @@ JS_METHOD(_query) {
   JS_METHOD(_fetchallobjects) {
     PGSQL_RES_LOAD(res);
     ASSERT_RESULT;
-    int x = pq::PQnfields(res);
-    int y = pq::PQntuples(res);
-    int cnt = pq::PQnfields(res);
-    v8::Handle<v8::Array> fieldnames = v8::Array::New(cnt);
-    for(int u = 0; u < cnt; u++)
-      fieldnames->Set(JS_INT(u), JS_STR(pq::PQfname(res, u)));
-    v8::Handle<v8::Array> result = v8::Array::New(y);
-    for (int i = 0; i < y; i++) {
-      v8::Handle<v8::Object> item = v8::Object::New();
-      result->Set(JS_INT(i), item);
-      for (int j=0; j<x; j++)
-	if (pq::PQgetisnull(res, i, j))
-	  item->Set(fieldnames->Get(JS_INT(j)), v8::Null());
-	else
-	  item->Set(fieldnames->Get(JS_INT(j)), JS_STR(pq::PQgetvalue(res, i, j)));
-    }
-    return result;
+    return result_rows(res, RowBuilder::OBJECTS);
   }
 
   /**
-   * Return one row of result data as a JS hash object,
+   * Return all columns of result data as a JS hash object of value arrays,
    * indexed by column name
    */ 
+  JS_METHOD(_fetchallcolumns) {
+    PGSQL_RES_LOAD(res);
+    ASSERT_RESULT;
+    return result_rows(res, RowBuilder::COLUMNS);
+  }
+
+  /**
+   * Return one row of result data as a JS hash object,
+   * indexed by column name. Names and row shape are kept in the result
+   * for subsequent rows (see nextRow).
+   */ 
   JS_METHOD(_fetchrowobject) {
     PGSQL_RES_LOAD(res);
     ASSERT_RESULT;
-    int x = pq::PQnfields(res);
-    int y = pq::PQntuples(res);
-    int cnt = pq::PQnfields(res);
     int i = 0;
     if (args.Length() > 0) {
       v8::String::Utf8Value a(args[0]);
       i = atoi(*a);
     }
-    v8::Handle<v8::Array> fieldnames = v8::Array::New(cnt);
-    for(int u = 0; u < cnt; u++)
-      fieldnames->Set(JS_INT(u), JS_STR(pq::PQfname(res, u)));
-    v8::Handle<v8::Array> result = v8::Array::New(y);
-    for (int j=0; j<x; j++)
-      if (pq::PQgetisnull(res, i, j))
-	result->Set(fieldnames->Get(JS_INT(j)), v8::Null());
-      else
-	result->Set(fieldnames->Get(JS_INT(j)), JS_STR(pq::PQgetvalue(res, i, j)));
-    return result;
+    if (!LOAD_VALUE(3)->IsObject()) {
+      v8::Handle<v8::Array> names = field_names(res);
+      SAVE_VALUE(2, names);
+      SAVE_VALUE(3, RowBuilder::shape(names));
+    }
+    RowBuilder rows(v8::Handle<v8::Array>::Cast(LOAD_VALUE(2)), RowBuilder::OBJECTS, LOAD_VALUE(3)->ToObject());
+    row_read(res, i, rows);
+    return rows.row();
   }
 
   JS_METHOD(_reset) {
@@ -1481,7 +1488,7 @@ SHARED_INIT() {
   pgsql::rslt->SetClassName(JS_STR("Result"));
 
   v8::Handle<v8::ObjectTemplate> resinst = pgsql::rslt->InstanceTemplate();
-  resinst->SetInternalFieldCount(2);
+  resinst->SetInternalFieldCount(4); /* result, position, names, row shape */
 
   // Set handler for virtual "error" property:
   resinst->SetAccessor(pgsql::v8_str("error"),pgsql::rslt_error);
@@ -1513,6 +1520,7 @@ SHARED_INIT() {
   resproto->Set(JS_STR("fetchRowObject"), v8::FunctionTemplate::New(pgsql::_fetchrowobject));
   resproto->Set(JS_STR("fetchAll"), v8::FunctionTemplate::New(pgsql::_fetchall));
   resproto->Set(JS_STR("fetchAllObjects"), v8::FunctionTemplate::New(pgsql::_fetchallobjects));
+  resproto->Set(JS_STR("fetchAllColumns"), v8::FunctionTemplate::New(pgsql::_fetchallcolumns));
   resproto->Set(JS_STR("unescapeBytea"), v8::FunctionTemplate::New(pgsql::_unescapebytea));
   resproto->Set(JS_STR("clear"), v8::FunctionTemplate::New(pgsql::_clear));
   resproto->Set(JS_STR("reset"), v8::FunctionTemplate::New(pgsql::_reset));
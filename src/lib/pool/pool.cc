@@ -0,0 +1,491 @@
+/**
+ * Outbound TCP connection pool. Connections are kept per worker process (they survive requests
+ * in FastCGI/Apache workers) and keyed by "host:port". Leased connections are plain Socket instances.
+ */
+
+#include <v8.h>
+#include <map>
+#include <list>
+#include <string>
+#include <sstream>
+#include "macros.h"
+#include "gc.h"
+#include "lib/socket/resolver.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/time.h>
+
+#ifdef windows
+#  include <winsock2.h>
+#  include <ws2tcpip.h>
+#  define close(s) closesocket(s)
+#else
+#  include <unistd.h>
+#  include <fcntl.h>
+#  include <poll.h>
+#  include <sys/socket.h>
+#  include <sys/un.h>
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#  include <netdb.h>
+#endif
+
+#ifndef INVALID_SOCKET
+#  define INVALID_SOCKET -1
+#endif
+
+namespace {
+
+typedef struct {
+	int fd;
+	int family;
+	uint64_t since; /* idle since, ms */
+} idle_t;
+
+typedef struct {
+	std::list<idle_t> idle; /* most recently used last */
+	int active;
+	int created;
+	int reused;
+} host_t;
+
+typedef struct {
+	std::string key;
+	int fd;
+} lease_t;
+
+typedef std::map<std::string, host_t> hosts_t;
+typedef std::map<int, lease_t> leases_t;
+
+hosts_t hosts;
+leases_t leases;
+int leaseCounter = 0;
+
+/* configuration */
+double idleTimeout = 30000;
+int maxPerHost = 16;
+double connectTimeout = 0;
+bool keepAlive = true;
+
+v8::Persistent<v8::Function> socketFunc;
+
+uint64_t now() {
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t) tv.tv_sec * 1000 + (uint64_t) tv.tv_usec / 1000;
+#endif
+}
+
+void set_blocking(int fd, bool blocking) {
+#ifdef windows
+	u_long mode = (blocking ? 0 : 1);
+	ioctlsocket(fd, FIONBIO, &mode);
+#else
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags != -1) { fcntl(fd, F_SETFL, (blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK)); }
+#endif
+}
+
+/**
+ * Wait for a descriptor; returns 1 when ready, 0 on timeout
+ */
+int wait_fd(int fd, bool write, int timeout) {
+#ifdef windows
+	fd_set set;
+	FD_ZERO(&set);
+	FD_SET(fd, &set);
+	struct timeval tv;
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+	return select(0, (write ? NULL : &set), (write ? &set : NULL), NULL, &tv);
+#else
+	struct pollfd p;
+	p.fd = fd;
+	p.events = (write ? POLLOUT : POLLIN);
+	p.revents = 0;
+	return poll(&p, 1, timeout);
+#endif
+}
+
+/**
+ * An idle connection is healthy when it has no pending error and nothing to read:
+ * readability means the peer closed it or sent unexpected data.
+ */
+bool healthy(int fd) {
+	int error = 0;
+	socklen_t len = sizeof(error);
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, (char *) &error, &len) != 0 || error) { return false; }
+	return (wait_fd(fd, false, 0) == 0);
+}
+
+/**
+ * Drop idle connections which exceeded the idle timeout
+ */
+void purge() {
+	uint64_t limit = now() - (uint64_t) idleTimeout;
+	for (hosts_t::iterator it = hosts.begin(); it != hosts.end(); it++) {
+		std::list<idle_t> & idle = it->second.idle;
+		while (!idle.empty() && idle.front().since < limit) {
+			close(idle.front().fd);
+			idle.pop_front();
+		}
+	}
+}
+
+/**
+ * Connect to one resolved address, honoring connectTimeout
+ */
+int connect_addr(struct addrinfo * ai, int * family, std::string & error) {
+	int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (fd == INVALID_SOCKET) {
+		error = strerror(errno);
+		return INVALID_SOCKET;
+	}
+
+	int status;
+	if (connectTimeout > 0) {
+		set_blocking(fd, false);
+		status = connect(fd, ai->ai_addr, ai->ai_addrlen);
+#ifdef windows
+		bool pending = (status != 0 && WSAGetLastError() == WSAEWOULDBLOCK);
+#else
+		bool pending = (status != 0 && errno == EINPROGRESS);
+#endif
+		if (pending && wait_fd(fd, true, (int) connectTimeout) == 1) {
+			int err = 0;
+			socklen_t len = sizeof(err);
+			getsockopt(fd, SOL_SOCKET, SO_ERROR, (char *) &err, &len);
+			status = (err ? -1 : 0);
+			errno = err;
+		} else if (pending) {
+			errno = ETIMEDOUT;
+		}
+		set_blocking(fd, true);
+	} else {
+		status = connect(fd, ai->ai_addr, ai->ai_addrlen);
+	}
+
+	if (status == 0) {
+		*family = ai->ai_family;
+		return fd;
+	}
+	error = strerror(errno);
+	close(fd);
+	return INVALID_SOCKET;
+}
+
+/**
+ * Local (PF_UNIX) endpoint: a path, or "@name" for the Linux abstract namespace
+ */
+bool is_local(const char * host) {
+#ifdef windows
+	return false;
+#else
+	return (host[0] == '/' || host[0] == '@');
+#endif
+}
+
+#ifndef windows
+int open_local(const char * path, std::string & error) {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	size_t length = strlen(path);
+	if (length >= sizeof(addr.sun_path)) {
+		error = "Unix socket path too long";
+		return INVALID_SOCKET;
+	}
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, path, length);
+	socklen_t len = offsetof(struct sockaddr_un, sun_path) + length + 1;
+	if (path[0] == '@') { /* abstract: leading NUL, no terminator */
+		addr.sun_path[0] = '\0';
+		len--;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == INVALID_SOCKET || connect(fd, (struct sockaddr *) &addr, len) != 0) {
+		error = strerror(errno);
+		if (fd != INVALID_SOCKET) { close(fd); }
+		return INVALID_SOCKET;
+	}
+	return fd;
+}
+#endif
+
+/**
+ * Open a new connection; tries all resolved addresses, IPv4 first. Returns INVALID_SOCKET and fills error on failure.
+ */
+int open_connection(const char * host, int port, int * family, std::string & error) {
+#ifndef windows
+	if (is_local(host)) {
+		*family = AF_UNIX;
+		return open_local(host, error);
+	}
+#endif
+
+	std::stringstream ss;
+	ss << port;
+
+	Resolver::addresses_t addresses;
+	if (!Resolver::resolve(host, addresses, error)) { return INVALID_SOCKET; }
+	Resolver::preferIPv4(addresses);
+
+	int fd = INVALID_SOCKET;
+	error = "No address to connect to";
+	for (size_t i=0; i<addresses.size() && fd == INVALID_SOCKET; i++) {
+		struct addrinfo hints, * ai;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_NUMERICHOST;
+		if (getaddrinfo(addresses[i].c_str(), ss.str().c_str(), &hints, &ai) != 0) { continue; }
+		fd = connect_addr(ai, family, error);
+		freeaddrinfo(ai);
+	}
+
+	if (fd != INVALID_SOCKET && keepAlive) {
+		int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, (char *) &one, sizeof(int));
+	}
+	return fd;
+}
+
+
+/**
+ * Does the Socket still own the leased descriptor? Socket.close() resets its descriptor,
+ * and the number may already belong to an unrelated connection.
+ */
+bool owns(v8::Handle<v8::Object> socket, lease_t & lease) {
+	return (socket->GetInternalField(0)->Int32Value() == lease.fd);
+}
+
+/**
+ * Drop the Socket's event loop callbacks: its watcher would fire them for the pooled descriptor
+ * (and keep the object alive)
+ */
+void unwatch(v8::Handle<v8::Object> socket) {
+	const char * names[] = { "onReadable", "onWritable" };
+	for (int i=0; i<2; i++) {
+		v8::Handle<v8::Value> fun = socket->Get(JS_STR(names[i]));
+		if (!fun->IsFunction()) { continue; }
+		v8::Handle<v8::Value> argv[1] = { v8::Null() };
+		v8::Handle<v8::Function>::Cast(fun)->Call(socket, 1, argv);
+	}
+}
+
+/**
+ * Leased Socket died without being released: its state is unknown, close it
+ */
+void finalize(v8::Handle<v8::Object> obj) {
+	v8::Handle<v8::Value> id = obj->GetHiddenValue(JS_STR("pool"));
+	if (id.IsEmpty()) { return; }
+	leases_t::iterator it = leases.find(id->Int32Value());
+	if (it == leases.end()) { return; }
+	if (owns(obj, it->second)) { close(it->second.fd); }
+	hosts[it->second.key].active--;
+	leases.erase(it);
+}
+
+/**
+ * Get a connected Socket
+ * @param {string} host Host name, or a local socket: "/path" or "@abstract-name"
+ * @param {int} [port] Not used for local sockets
+ * @returns {Socket} with "reused" property
+ */
+JS_METHOD(_acquire) {
+	if (args.Length() < 1) {
+		return JS_TYPE_ERROR("Bad argument count. Use 'pool.acquire(host, port)'");
+	}
+	if (socketFunc.IsEmpty()) { return JS_ERROR("Socket module is not available"); }
+	v8::String::Utf8Value host(args[0]);
+	int port = args[1]->Int32Value();
+	std::string key = *host;
+	if (!is_local(*host)) {
+		if (args.Length() < 2) { return JS_TYPE_ERROR("Bad argument count. Use 'pool.acquire(host, port)'"); }
+		std::stringstream ss;
+		ss << *host << ":" << port;
+		key = ss.str();
+	}
+
+	purge();
+	host_t & h = hosts[key];
+
+	int fd = INVALID_SOCKET;
+	int family = AF_INET;
+	bool reused = false;
+	while (!h.idle.empty()) {
+		idle_t item = h.idle.back();
+		h.idle.pop_back();
+		if (healthy(item.fd)) {
+			fd = item.fd;
+			family = item.family;
+			reused = true;
+			break;
+		}
+		close(item.fd);
+	}
+
+	if (fd == INVALID_SOCKET) {
+		if (h.active >= maxPerHost) {
+			std::string error = "Too many connections to " + key;
+			return JS_ERROR(error.c_str());
+		}
+		std::string error;
+		fd = open_connection(*host, port, &family, error);
+		if (fd == INVALID_SOCKET) { return JS_ERROR(error.c_str()); }
+		h.created++;
+	} else {
+		h.reused++;
+	}
+
+	v8::Handle<v8::Value> argv[4];
+	argv[0] = v8::External::New(&fd);
+	argv[1] = JS_INT(family);
+	argv[2] = JS_INT(SOCK_STREAM);
+	argv[3] = JS_INT(family == AF_INET || family == AF_INET6 ? IPPROTO_TCP : 0);
+	v8::Handle<v8::Object> socket = socketFunc->NewInstance(4, argv);
+
+	lease_t lease;
+	lease.key = key;
+	lease.fd = fd;
+	int id = ++leaseCounter;
+	leases[id] = lease;
+	h.active++;
+
+	socket->SetHiddenValue(JS_STR("pool"), JS_INT(id));
+	socket->Set(JS_STR("reused"), JS_BOOL(reused));
+	GC * gc = GC_PTR;
+	gc->add(socket, finalize);
+	return socket;
+}
+
+/**
+ * Return a Socket to the pool. The Socket object must not be used afterwards.
+ * @param {Socket} socket
+ * @param {bool} [reuse=true] false when the connection state is unknown (e.g. after an error)
+ */
+JS_METHOD(_release) {
+	if (args.Length() < 1 || !args[0]->IsObject()) {
+		return JS_TYPE_ERROR("Bad argument count. Use 'pool.release(socket, [reuse])'");
+	}
+	v8::Handle<v8::Object> socket = args[0]->ToObject();
+	v8::Handle<v8::Value> id = socket->GetHiddenValue(JS_STR("pool"));
+	leases_t::iterator it = (id.IsEmpty() ? leases.end() : leases.find(id->Int32Value()));
+	if (it == leases.end()) { return JS_ERROR("Socket was not acquired from the pool"); }
+
+	lease_t lease = it->second;
+	leases.erase(it);
+	host_t & h = hosts[lease.key];
+	h.active--;
+
+	if (!owns(socket, lease)) { return v8::Undefined(); } /* already closed by the script */
+	/* detach from the JS object */
+	unwatch(socket);
+	socket->SetInternalField(0, JS_INT(INVALID_SOCKET));
+
+	bool reuse = (args.Length() < 2 || args[1]->ToBoolean()->IsTrue());
+	if (reuse && (int) h.idle.size() < maxPerHost) {
+		set_blocking(lease.fd, true);
+		reuse = healthy(lease.fd);
+	} else {
+		reuse = false;
+	}
+
+	if (reuse) {
+		idle_t item;
+		item.fd = lease.fd;
+		item.family = socket->Get(JS_STR("family"))->Int32Value();
+		item.since = now();
+		h.idle.push_back(item);
+	} else {
+		close(lease.fd);
+	}
+	purge();
+	return v8::Undefined();
+}
+
+/**
+ * Change pool settings
+ * @param {object} options idleTimeout (ms), maxPerHost, connectTimeout (ms, 0 = system default), keepAlive (SO_KEEPALIVE)
+ */
+JS_METHOD(_configure) {
+	if (args.Length() < 1 || !args[0]->IsObject()) {
+		return JS_TYPE_ERROR("Bad argument count. Use 'pool.configure(options)'");
+	}
+	v8::Handle<v8::Object> options = args[0]->ToObject();
+	v8::Handle<v8::Value> value;
+
+	value = options->Get(JS_STR("idleTimeout"));
+	if (value->IsNumber()) { idleTimeout = value->NumberValue(); }
+	value = options->Get(JS_STR("maxPerHost"));
+	if (value->IsNumber()) { maxPerHost = value->Int32Value(); }
+	value = options->Get(JS_STR("connectTimeout"));
+	if (value->IsNumber()) { connectTimeout = value->NumberValue(); }
+	value = options->Get(JS_STR("keepAlive"));
+	if (!value->IsUndefined()) { keepAlive = value->ToBoolean()->IsTrue(); }
+	return v8::Undefined();
+}
+
+/**
+ * Pool statistics
+ * @returns {object} "host:port" => {idle, active, created, reused}
+ */
+JS_METHOD(_stats) {
+	purge();
+	v8::Handle<v8::Object> result = v8::Object::New();
+	for (hosts_t::iterator it = hosts.begin(); it != hosts.end(); it++) {
+		v8::Handle<v8::Object> item = v8::Object::New();
+		item->Set(JS_STR("idle"), JS_INT(it->second.idle.size()));
+		item->Set(JS_STR("active"), JS_INT(it->second.active));
+		item->Set(JS_STR("created"), JS_INT(it->second.created));
+		item->Set(JS_STR("reused"), JS_INT(it->second.reused));
+		result->Set(JS_STR(it->first.c_str()), item);
+	}
+	return result;
+}
+
+/**
+ * Close all idle connections
+ */
+JS_METHOD(_clear) {
+	for (hosts_t::iterator it = hosts.begin(); it != hosts.end(); it++) {
+		std::list<idle_t> & idle = it->second.idle;
+		while (!idle.empty()) {
+			close(idle.front().fd);
+			idle.pop_front();
+		}
+	}
+	return v8::Undefined();
+}
+
+}
+
+SHARED_INIT() {
+	v8::HandleScope handle_scope;
+
+	/* Socket constructor of this request */
+	if (!socketFunc.IsEmpty()) {
+		socketFunc.Dispose();
+		socketFunc.Clear();
+	}
+	v8::Handle<v8::Value> params[] = { JS_STR("socket") };
+	v8::Handle<v8::Value> socket = require->Call(JS_GLOBAL, 1, params);
+	if (socket->IsObject()) {
+		v8::Handle<v8::Value> ctor = socket->ToObject()->Get(JS_STR("Socket"));
+		if (ctor->IsFunction()) { socketFunc = v8::Persistent<v8::Function>::New(v8::Handle<v8::Function>::Cast(ctor)); }
+	}
+
+	exports->Set(JS_STR("acquire"), v8::FunctionTemplate::New(_acquire)->GetFunction());
+	exports->Set(JS_STR("release"), v8::FunctionTemplate::New(_release)->GetFunction());
+	exports->Set(JS_STR("configure"), v8::FunctionTemplate::New(_configure)->GetFunction());
+	exports->Set(JS_STR("stats"), v8::FunctionTemplate::New(_stats)->GetFunction());
+	exports->Set(JS_STR("clear"), v8::FunctionTemplate::New(_clear)->GetFunction());
+}
@@ -0,0 +1,760 @@
+#include <map>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "macros.h"
+#include "resolver.h"
+
+#ifdef windows
+#  include <winsock2.h>
+#  include <ws2tcpip.h>
+#  include <process.h>
+#  define close(s) closesocket(s)
+#else
+#  include <unistd.h>
+#  include <fcntl.h>
+#  include <poll.h>
+#  include <sys/socket.h>
+#  include <arpa/inet.h>
+#  include <netinet/in.h>
+#  include <netdb.h>
+#endif
+
+#ifndef INVALID_SOCKET
+#  define INVALID_SOCKET -1
+#endif
+
+#define DNS_PORT 53
+#define DNS_TYPE_A 1
+#define DNS_TYPE_AAAA 28
+#define DNS_PACKET 1500
+#define CACHE_MAX 4096
+
+namespace {
+
+typedef struct {
+	Resolver::addresses_t addresses;
+	std::string error;
+	uint64_t expires; /* ms */
+} entry_t;
+
+typedef std::map<std::string, entry_t> cache_t;
+typedef std::map<std::string, Resolver::addresses_t> stub_t;
+
+cache_t cache;
+stub_t stub;
+time_t stubMtime = 0;
+uint64_t stubChecked = 0;
+std::string stubName;
+
+/**
+ * One A+AAAA lookup in progress
+ */
+typedef struct {
+	std::string name;
+	int fd;
+	unsigned int server;
+	int attempt;
+	unsigned short ids[2]; /* A, AAAA */
+	bool done[2];
+	Resolver::addresses_t found[2]; /* IPv4, IPv6 */
+	unsigned int ttl;
+	bool nxdomain;
+	bool truncated; /* answer did not fit into UDP: handed over to the system resolver */
+	std::string error;
+} query_t;
+
+/* xorshift state for query IDs, seeded from /dev/urandom */
+uint32_t idState = 0;
+
+uint64_t now() {
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t) tv.tv_sec * 1000 + (uint64_t) tv.tv_usec / 1000;
+#endif
+}
+
+std::string lowercase(const std::string & str) {
+	std::string result = str;
+	for (size_t i=0; i<result.length(); i++) { result[i] = tolower(result[i]); }
+	if (result.length() && result[result.length()-1] == '.') { result.erase(result.length()-1); }
+	return result;
+}
+
+/**
+ * Happy eyeballs order: IPv6 first, families interleaved
+ */
+Resolver::addresses_t interleave(const Resolver::addresses_t & v4, const Resolver::addresses_t & v6) {
+	Resolver::addresses_t result;
+	size_t count = MAX(v4.size(), v6.size());
+	for (size_t i=0; i<count; i++) {
+		if (i < v6.size()) { result.push_back(v6[i]); }
+		if (i < v4.size()) { result.push_back(v4[i]); }
+	}
+	return result;
+}
+
+/**
+ * Parse a numeric address (no DNS)
+ */
+bool parse_numeric(const std::string & host, int port, struct sockaddr_storage * addr, socklen_t * len) {
+	struct addrinfo hints, * info;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_flags = AI_NUMERICHOST;
+	if (getaddrinfo(host.c_str(), NULL, &hints, &info) != 0) { return false; }
+	memcpy(addr, info->ai_addr, info->ai_addrlen);
+	*len = info->ai_addrlen;
+	freeaddrinfo(info);
+	if (addr->ss_family == AF_INET) { ((struct sockaddr_in *) addr)->sin_port = htons(port); }
+	if (addr->ss_family == AF_INET6) { ((struct sockaddr_in6 *) addr)->sin6_port = htons(port); }
+	return true;
+}
+
+bool is_literal(const std::string & name) {
+	struct sockaddr_storage addr;
+	socklen_t len;
+	return parse_numeric(name, 0, &addr, &len);
+}
+
+/**
+ * Format a raw IPv4 (4 bytes) or IPv6 (16 bytes) address
+ */
+std::string format_addr(int family, const void * raw) {
+	struct sockaddr_storage addr;
+	memset(&addr, 0, sizeof(addr));
+	socklen_t len;
+	if (family == AF_INET) {
+		struct sockaddr_in * in = (struct sockaddr_in *) &addr;
+		in->sin_family = AF_INET;
+		memcpy(&in->sin_addr, raw, 4);
+		len = sizeof(*in);
+	} else {
+		struct sockaddr_in6 * in6 = (struct sockaddr_in6 *) &addr;
+		in6->sin6_family = AF_INET6;
+		memcpy(&in6->sin6_addr, raw, 16);
+		len = sizeof(*in6);
+	}
+	char buf[NI_MAXHOST];
+	if (getnameinfo((struct sockaddr *) &addr, len, buf, sizeof(buf), NULL, 0, NI_NUMERICHOST) != 0) { return ""; }
+	return buf;
+}
+
+/**
+ * (Re)load the hosts-format stub file when it changes; checked at most once per second
+ */
+void load_stub() {
+	Resolver::options_t & o = Resolver::options();
+	uint64_t t = now();
+	if (stubName == o.stubFile && t - stubChecked < 1000) { return; }
+	stubChecked = t;
+
+	struct stat st;
+	if (!o.stubFile.length() || stat(o.stubFile.c_str(), &st) != 0) {
+		stub.clear();
+		stubName = o.stubFile;
+		return;
+	}
+	if (stubName == o.stubFile && st.st_mtime == stubMtime) { return; }
+	stubName = o.stubFile;
+	stubMtime = st.st_mtime;
+	stub.clear();
+
+	std::ifstream file(o.stubFile.c_str());
+	std::string line;
+	while (std::getline(file, line)) {
+		size_t hash = line.find('#');
+		if (hash != std::string::npos) { line.erase(hash); }
+		std::istringstream ss(line);
+		std::string address, name;
+		if (!(ss >> address)) { continue; }
+		if (!is_literal(address)) { continue; }
+		while (ss >> name) { stub[lowercase(name)].push_back(address); }
+	}
+}
+
+/**
+ * Local answers: literal, stub file, cache
+ */
+bool lookup_local(const std::string & name, Resolver::addresses_t & addresses, std::string & error) {
+	if (is_literal(name)) {
+		addresses.push_back(name);
+		return true;
+	}
+
+	load_stub();
+	stub_t::iterator s = stub.find(name);
+	if (s != stub.end()) {
+		Resolver::addresses_t v4, v6;
+		for (size_t i=0; i<s->second.size(); i++) {
+			(s->second[i].find(':') == std::string::npos ? v4 : v6).push_back(s->second[i]);
+		}
+		addresses = interleave(v4, v6);
+		return true;
+	}
+
+	cache_t::iterator c = cache.find(name);
+	if (c != cache.end()) {
+		if (c->second.expires > now()) {
+			addresses = c->second.addresses;
+			error = c->second.error;
+			return true;
+		}
+		cache.erase(c);
+	}
+	return false;
+}
+
+void store(const std::string & name, const Resolver::addresses_t & addresses, const std::string & error, double ttl) {
+	if (cache.size() >= CACHE_MAX) {
+		uint64_t t = now();
+		for (cache_t::iterator it = cache.begin(); it != cache.end(); ) {
+			if (it->second.expires <= t) { cache.erase(it++); } else { it++; }
+		}
+		if (cache.size() >= CACHE_MAX) { cache.clear(); }
+	}
+	entry_t entry;
+	entry.addresses = addresses;
+	entry.error = error;
+	entry.expires = now() + (uint64_t) (ttl * 1000);
+	cache[name] = entry;
+}
+
+/**
+ * Unpredictable 16-bit query ID
+ */
+unsigned short query_id() {
+	if (!idState) {
+#ifndef windows
+		int fd = open("/dev/urandom", O_RDONLY);
+		if (fd != -1) {
+			if (read(fd, &idState, sizeof(idState)) != sizeof(idState)) { idState = 0; }
+			close(fd);
+		}
+#endif
+		if (!idState) { idState = (uint32_t) now() ^ ((uint32_t) getpid() << 16) ^ (uint32_t) rand(); }
+		if (!idState) { idState = 1; }
+	}
+	idState ^= idState << 13;
+	idState ^= idState >> 17;
+	idState ^= idState << 5;
+	return (unsigned short) (idState >> 8);
+}
+
+/**
+ * Fallback when no nameserver is known (and for names the system resolver expands or answers
+ * better: search domains, nsswitch, truncated answers): system resolver, default TTL
+ */
+bool resolve_system(const std::string & name, Resolver::addresses_t & addresses, std::string & error) {
+	struct addrinfo hints, * servinfo;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	int result = getaddrinfo(name.c_str(), NULL, &hints, &servinfo);
+	if (result != 0) {
+		error = gai_strerror(result);
+		store(name, addresses, error, Resolver::options().negativeTtl);
+		return false;
+	}
+
+	Resolver::addresses_t v4, v6;
+	for (struct addrinfo * ai = servinfo; ai; ai = ai->ai_next) {
+		if (ai->ai_family == AF_INET) {
+			v4.push_back(format_addr(AF_INET, &((struct sockaddr_in *) ai->ai_addr)->sin_addr));
+		} else if (ai->ai_family == AF_INET6) {
+			v6.push_back(format_addr(AF_INET6, &((struct sockaddr_in6 *) ai->ai_addr)->sin6_addr));
+		}
+	}
+	freeaddrinfo(servinfo);
+
+	addresses = interleave(v4, v6);
+	store(name, addresses, "", Resolver::options().stubTtl);
+	return true;
+}
+
+/**
+ * Nameservers and ndots from resolv.conf
+ */
+void load_resolvconf(std::vector<std::string> & servers, int * ndots) {
+#ifndef windows
+	std::ifstream file("/etc/resolv.conf");
+	std::string line;
+	while (std::getline(file, line)) {
+		std::istringstream ss(line);
+		std::string key, value;
+		if (!(ss >> key)) { continue; }
+		if (key == "nameserver" && ss >> value) { servers.push_back(value); }
+		if (key != "options") { continue; }
+		while (ss >> value) {
+			if (value.compare(0, 6, "ndots:") == 0) { *ndots = atoi(value.c_str() + 6); }
+		}
+	}
+#endif
+}
+
+/**
+ * Names with fewer dots than ndots are subject to resolv.conf search domains (and nsswitch);
+ * only the system resolver knows how to expand them
+ */
+bool needs_system(const std::string & name) {
+	int dots = 0;
+	for (size_t i=0; i<name.length(); i++) {
+		if (name[i] == '.') { dots++; }
+	}
+	return (dots < Resolver::options().ndots);
+}
+
+/**
+ * "ip", "ip:port" or "[ip6]:port"
+ */
+bool server_addr(const std::string & server, struct sockaddr_storage * addr, socklen_t * len) {
+	std::string host = server;
+	int port = DNS_PORT;
+	size_t colon = server.rfind(':');
+	if (server.length() && server[0] == '[') {
+		size_t end = server.find(']');
+		if (end == std::string::npos) { return false; }
+		host = server.substr(1, end-1);
+		if (end+1 < server.length() && server[end+1] == ':') { port = atoi(server.c_str() + end + 2); }
+	} else if (colon != std::string::npos && server.find(':') == colon) { /* exactly one colon: IPv4 with port */
+		host = server.substr(0, colon);
+		port = atoi(server.c_str() + colon + 1);
+	}
+
+	return parse_numeric(host, port, addr, len);
+}
+
+/**
+ * Build a recursive query; returns packet length or 0
+ */
+size_t build_query(const std::string & name, unsigned short id, unsigned short type, unsigned char * buf) {
+	memset(buf, 0, 12);
+	buf[0] = id >> 8;
+	buf[1] = id & 0xFF;
+	buf[2] = 0x01; /* RD */
+	buf[5] = 1; /* QDCOUNT */
+	size_t pos = 12;
+
+	size_t start = 0;
+	while (start < name.length()) {
+		size_t dot = name.find('.', start);
+		if (dot == std::string::npos) { dot = name.length(); }
+		size_t length = dot - start;
+		if (!length || length > 63 || pos + length + 6 >= DNS_PACKET) { return 0; }
+		buf[pos++] = (unsigned char) length;
+		memcpy(buf + pos, name.data() + start, length);
+		pos += length;
+		start = dot + 1;
+	}
+	buf[pos++] = 0;
+	buf[pos++] = type >> 8;
+	buf[pos++] = type & 0xFF;
+	buf[pos++] = 0;
+	buf[pos++] = 1; /* IN */
+	return pos;
+}
+
+int skip_name(const unsigned char * buf, int length, int pos) {
+	while (pos < length) {
+		unsigned char c = buf[pos];
+		if (c == 0) { return pos + 1; }
+		if ((c & 0xC0) == 0xC0) { return pos + 2; }
+		pos += c + 1;
+	}
+	return -1;
+}
+
+/**
+ * Does the (single) question repeat what we asked? Returns position after it, or -1.
+ */
+int match_question(const unsigned char * buf, int length, const std::string & name, unsigned short type) {
+	if (((buf[4] << 8) | buf[5]) != 1) { return -1; }
+	int pos = 12;
+	size_t start = 0;
+	while (start < name.length()) {
+		size_t dot = name.find('.', start);
+		if (dot == std::string::npos) { dot = name.length(); }
+		size_t label = dot - start;
+		if (pos + 1 + (int) label > length || buf[pos] != label) { return -1; }
+		for (size_t i=0; i<label; i++) {
+			if (tolower(buf[pos + 1 + i]) != name[start + i]) { return -1; }
+		}
+		pos += 1 + label;
+		start = dot + 1;
+	}
+	if (pos + 5 > length || buf[pos] != 0) { return -1; }
+	pos++;
+	unsigned short qtype = (buf[pos] << 8) | buf[pos+1];
+	unsigned short qclass = (buf[pos+2] << 8) | buf[pos+3];
+	if (qtype != type || qclass != 1) { return -1; }
+	return pos + 4;
+}
+
+/**
+ * Parse a response into the query. Returns false for packets which do not belong to it.
+ */
+bool parse_response(query_t * q, const unsigned char * buf, int length) {
+	if (length < 12) { return false; }
+	unsigned short id = (buf[0] << 8) | buf[1];
+	int index = (id == q->ids[0] ? 0 : (id == q->ids[1] ? 1 : -1));
+	if (index == -1 || q->done[index] || !(buf[2] & 0x80)) { return false; }
+	unsigned short want = (index == 0 ? DNS_TYPE_A : DNS_TYPE_AAAA);
+	int pos = match_question(buf, length, q->name, want);
+	if (pos == -1) { return false; } /* spoofed or stale */
+
+	if (buf[2] & 0x02) { /* TC: the full answer needs TCP */
+		q->truncated = true;
+		q->done[0] = q->done[1] = true;
+		return true;
+	}
+
+	int rcode = buf[3] & 0x0F;
+	if (rcode == 3) { /* NXDOMAIN */
+		q->nxdomain = true;
+		q->done[index] = true;
+		return true;
+	}
+	if (rcode != 0) {
+		q->error = "Nameserver failure";
+		return true; /* not done: try another server */
+	}
+
+	int ancount = (buf[6] << 8) | buf[7];
+	for (int i=0; i<ancount && pos != -1; i++) {
+		pos = skip_name(buf, length, pos);
+		if (pos == -1 || pos + 10 > length) { break; }
+		unsigned short type = (buf[pos] << 8) | buf[pos+1];
+		unsigned short cls = (buf[pos+2] << 8) | buf[pos+3];
+		unsigned int ttl = (buf[pos+4] << 24) | (buf[pos+5] << 16) | (buf[pos+6] << 8) | buf[pos+7];
+		unsigned short rdlength = (buf[pos+8] << 8) | buf[pos+9];
+		pos += 10;
+		if (pos + rdlength > length) { break; }
+
+		if (cls == 1) { q->ttl = MIN(q->ttl, ttl); } /* includes CNAMEs on the way */
+		if (cls == 1 && type == want) {
+			if (type == DNS_TYPE_A && rdlength == 4) {
+				q->found[0].push_back(format_addr(AF_INET, buf + pos));
+			} else if (type == DNS_TYPE_AAAA && rdlength == 16) {
+				q->found[1].push_back(format_addr(AF_INET6, buf + pos));
+			}
+		}
+		pos += rdlength;
+	}
+	q->done[index] = true;
+	return true;
+}
+
+/**
+ * Send both queries to the current server; returns false when there is nothing left to try
+ */
+bool send_queries(query_t * q) {
+	Resolver::options_t & o = Resolver::options();
+	if (q->fd != INVALID_SOCKET) {
+		close(q->fd);
+		q->fd = INVALID_SOCKET;
+	}
+
+	unsigned int total = o.nameservers.size() * MAX(o.attempts, 1);
+	while ((unsigned int) q->attempt < total) {
+		const std::string & server = o.nameservers[q->server % o.nameservers.size()];
+		q->server++;
+		q->attempt++;
+
+		struct sockaddr_storage addr;
+		socklen_t len;
+		if (!server_addr(server, &addr, &len)) { continue; }
+		q->fd = socket(addr.ss_family, SOCK_DGRAM, 0);
+		if (q->fd == INVALID_SOCKET) { continue; }
+		if (connect(q->fd, (struct sockaddr *) &addr, len) != 0) {
+			close(q->fd);
+			q->fd = INVALID_SOCKET;
+			continue;
+		}
+
+		unsigned char buf[DNS_PACKET];
+		bool ok = true;
+		for (int i=0; i<2 && ok; i++) {
+			if (q->done[i]) { continue; }
+			q->ids[i] = query_id();
+			size_t length = build_query(q->name, q->ids[i], (i == 0 ? DNS_TYPE_A : DNS_TYPE_AAAA), buf);
+			if (!length) {
+				q->error = "Invalid host name";
+				return false;
+			}
+			ok = (send(q->fd, (const char *) buf, length, 0) == (ssize_t) length);
+		}
+		if (ok) { return true; }
+		close(q->fd);
+		q->fd = INVALID_SOCKET;
+	}
+	if (!q->error.length()) { q->error = "DNS lookup timed out"; }
+	return false;
+}
+
+/**
+ * Read all pending responses
+ */
+void receive_responses(query_t * q) {
+	unsigned char buf[DNS_PACKET];
+	while (1) {
+#ifdef windows
+		u_long pending = 0;
+		ioctlsocket(q->fd, FIONREAD, &pending);
+		if (!pending) { return; }
+		int length = recv(q->fd, (char *) buf, sizeof(buf), 0);
+#else
+		int length = recv(q->fd, buf, sizeof(buf), MSG_DONTWAIT);
+#endif
+		if (length <= 0) { return; }
+		parse_response(q, buf, length);
+	}
+}
+
+bool finished(query_t * q) {
+	return q->done[0] && q->done[1];
+}
+
+void init_query(query_t * q, const std::string & name) {
+	q->name = name;
+	q->fd = INVALID_SOCKET;
+	q->server = 0;
+	q->attempt = 0;
+	q->done[0] = q->done[1] = false;
+	q->ttl = 0xFFFFFFFF;
+	q->nxdomain = false;
+	q->truncated = false;
+}
+
+/**
+ * Store the result of a finished (or failed) query
+ */
+bool complete(query_t * q, Resolver::addresses_t & addresses, std::string & error) {
+	Resolver::options_t & o = Resolver::options();
+	if (q->fd != INVALID_SOCKET) {
+		close(q->fd);
+		q->fd = INVALID_SOCKET;
+	}
+
+	if (q->truncated) { return resolve_system(q->name, addresses, error); }
+	if (finished(q)) {
+		addresses = interleave(q->found[0], q->found[1]);
+		if (addresses.size()) {
+			double ttl = MIN((double) q->ttl, o.maxTtl);
+			store(q->name, addresses, "", ttl);
+			return true;
+		}
+		error = (q->nxdomain ? "Host not found" : "No address associated with hostname");
+		store(q->name, addresses, error, o.negativeTtl);
+		return false;
+	}
+	error = q->error;
+	return false;
+}
+
+/**
+ * Asynchronous lookup state
+ */
+typedef struct {
+	query_t q;
+	EventLoop * loop;
+	int watcher;
+	int timer;
+	int registered; /* watchers and timers in the loop; releasing the last one frees the lookup */
+	bool finished; /* done was called */
+	Resolver::done_t done;
+	Resolver::release_t release;
+	void * data;
+	Resolver::addresses_t addresses;
+	std::string error;
+} async_t;
+
+/**
+ * The loop dropped a watcher or timer of a lookup. When the loop is cleared before the lookup 
+ * finished (exit, uncaught exception), its socket and data are released as well.
+ */
+void async_release(void * data) {
+	async_t * a = (async_t *) data;
+	if (--a->registered) { return; }
+	if (!a->finished) {
+		if (a->q.fd != INVALID_SOCKET) { close(a->q.fd); }
+		if (a->release) { a->release(a->data); }
+	}
+	delete a;
+}
+
+/**
+ * Call done, then drop the remaining watcher and timer; the last one released frees the lookup
+ */
+void async_finish(async_t * a) {
+	a->finished = true;
+	a->done(a->q.name, a->addresses, a->error, a->data);
+	EventLoop * loop = a->loop;
+	int watcher = a->watcher;
+	int timer = a->timer;
+	if (watcher) { loop->remove(watcher); }
+	if (timer) { loop->remove(timer); }
+}
+
+void async_deliver(EventLoop * loop, int id, int fd, int events, void * data) {
+	async_finish((async_t *) data);
+}
+
+void async_timeout(EventLoop * loop, int id, int fd, int events, void * data);
+void async_readable(EventLoop * loop, int id, int fd, int events, void * data);
+
+/**
+ * (Re)send queries and wait for responses or a timeout
+ */
+bool async_send(async_t * a) {
+	if (a->watcher) {
+		a->loop->remove(a->watcher);
+		a->watcher = 0;
+	}
+	if (!send_queries(&a->q)) { return false; }
+	a->watcher = a->loop->addWatcher(a->q.fd, EventLoop::READ, async_readable, a, async_release);
+	if (a->watcher == -1) {
+		a->watcher = 0;
+		a->q.error = strerror(errno);
+		return false;
+	}
+	a->registered++;
+	a->timer = a->loop->addTimer(Resolver::options().timeout, false, async_timeout, a, async_release);
+	a->registered++;
+	return true;
+}
+
+void async_readable(EventLoop * loop, int id, int fd, int events, void * data) {
+	async_t * a = (async_t *) data;
+	receive_responses(&a->q);
+	if (!finished(&a->q)) { return; }
+	a->loop->remove(a->watcher);
+	a->watcher = 0;
+	complete(&a->q, a->addresses, a->error);
+	async_finish(a);
+}
+
+void async_timeout(EventLoop * loop, int id, int fd, int events, void * data) {
+	async_t * a = (async_t *) data;
+	a->timer = 0; /* the loop removes this one-shot timer after the callback */
+	if (async_send(a)) { return; }
+	complete(&a->q, a->addresses, a->error);
+	async_finish(a);
+}
+
+}
+
+Resolver::options_t & Resolver::options() {
+	static options_t o;
+	static bool initialized = false;
+	if (!initialized) {
+		initialized = true;
+#ifdef windows
+		o.stubFile = "";
+#else
+		o.stubFile = "/etc/hosts";
+#endif
+		o.stubTtl = 60;
+		o.timeout = 2000;
+		o.attempts = 2;
+		o.negativeTtl = 10;
+		o.maxTtl = 3600;
+		o.ndots = 1;
+		load_resolvconf(o.nameservers, &o.ndots);
+	}
+	return o;
+}
+
+bool Resolver::resolve(const std::string & host, addresses_t & addresses, std::string & error) {
+	std::string name = lowercase(host);
+	addresses.clear();
+	if (lookup_local(name, addresses, error)) { return !error.length(); }
+	if (!options().nameservers.size() || needs_system(name)) { return resolve_system(name, addresses, error); }
+
+	query_t q;
+	init_query(&q, name);
+	while (send_queries(&q)) {
+		uint64_t deadline = now() + (uint64_t) options().timeout;
+		while (!finished(&q)) {
+			uint64_t t = now();
+			if (t >= deadline) { break; }
+#ifdef windows
+			fd_set set;
+			FD_ZERO(&set);
+			FD_SET(q.fd, &set);
+			struct timeval tv;
+			tv.tv_sec = (deadline - t) / 1000;
+			tv.tv_usec = ((deadline - t) % 1000) * 1000;
+			int ready = select(0, &set, NULL, NULL, &tv);
+#else
+			struct pollfd p;
+			p.fd = q.fd;
+			p.events = POLLIN;
+			p.revents = 0;
+			int ready = poll(&p, 1, (int) (deadline - t));
+#endif
+			if (ready > 0) { receive_responses(&q); }
+		}
+		if (finished(&q)) { break; }
+	}
+	return complete(&q, addresses, error);
+}
+
+void Resolver::resolve(EventLoop * loop, const std::string & host, done_t done, void * data, release_t release) {
+	async_t * a = new async_t();
+	a->loop = loop;
+	a->watcher = 0;
+	a->timer = 0;
+	a->registered = 0;
+	a->finished = false;
+	a->done = done;
+	a->release = release;
+	a->data = data;
+	std::string name = lowercase(host);
+	init_query(&a->q, name);
+
+	bool local = lookup_local(name, a->addresses, a->error);
+	if (!local && (!options().nameservers.size() || needs_system(name))) { /* system resolver blocks */
+		resolve_system(name, a->addresses, a->error);
+		local = true;
+	}
+	if (!local && !async_send(a)) {
+		complete(&a->q, a->addresses, a->error);
+		local = true;
+	}
+	if (local) {
+		a->timer = loop->addTimer(0, false, async_deliver, a, async_release);
+		a->registered++;
+	}
+}
+
+void Resolver::preferIPv4(addresses_t & addresses) {
+	addresses_t v6;
+	size_t count = 0;
+	for (size_t i=0; i<addresses.size(); i++) {
+		if (addresses[i].find(':') == std::string::npos) {
+			addresses[count++] = addresses[i];
+		} else {
+			v6.push_back(addresses[i]);
+		}
+	}
+	for (size_t i=0; i<v6.size(); i++) { addresses[count++] = v6[i]; }
+}
+
+void Resolver::clear() {
+	cache.clear();
+	stubChecked = 0;
+	stubName = "";
+}
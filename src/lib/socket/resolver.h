@@ -0,0 +1,56 @@
+/**
+ * Caching DNS resolver. Answers come from IP literals, a hosts-format stub file, the in-process cache
+ * or A+AAAA queries sent to nameservers from resolv.conf; cached entries respect record TTLs.
+ * Short names (fewer dots than resolv.conf ndots) and truncated answers go to the system resolver,
+ * which applies search domains and nsswitch.
+ * State is per process (module), so the cache is shared by all requests of a worker.
+ */
+
+#ifndef _RESOLVER_H
+#define _RESOLVER_H
+
+#include <string>
+#include <vector>
+#include "loop.h"
+
+class Resolver {
+public:
+	typedef std::vector<std::string> addresses_t;
+	/* async completion; error is empty on success */
+	typedef void (*done_t)(const std::string & name, const addresses_t & addresses, const std::string & error, void * data);
+	/* frees data of a lookup abandoned before done was called (event loop cleared) */
+	typedef void (*release_t)(void * data);
+
+	typedef struct {
+		std::string stubFile; /* hosts(5) format */
+		double stubTtl; /* seconds */
+		std::vector<std::string> nameservers; /* "ip" or "ip:port"; empty = system getaddrinfo */
+		double timeout; /* ms per attempt */
+		int attempts;
+		double negativeTtl; /* seconds */
+		double maxTtl; /* seconds */
+		int ndots; /* names with fewer dots use the system resolver */
+	} options_t;
+
+	static options_t & options();
+
+	/**
+	 * Blocking resolution. Addresses are ordered for happy eyeballs: IPv6 and IPv4 interleaved.
+	 * Returns false and fills error on failure.
+	 */
+	static bool resolve(const std::string & name, addresses_t & addresses, std::string & error);
+
+	/**
+	 * Non-blocking resolution using the event loop; done is always called from the loop,
+	 * unless the loop is cleared first: then release (if any) is called instead
+	 */
+	static void resolve(EventLoop * loop, const std::string & name, done_t done, void * data, release_t release);
+
+	/* reorder for blocking connects: IPv4 first, as getaddrinfo() does, so a black-holed IPv6 route does not stall */
+	static void preferIPv4(addresses_t & addresses);
+
+	/* drop cached answers */
+	static void clear();
+};
+
+#endif
@@ -5,10 +5,16 @@
 #include <v8.h>
 #include "macros.h"
 #include "common.h"
+#include "loop.h"
+#include "resolver.h"
+#include "lib/binary-f/buffer.h"
 
+#include <vector>
+#include <string>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <stddef.h>
 
 #ifdef windows
 #  include <winsock2.h>
@@ -22,8 +28,34 @@
 #  include <arpa/inet.h>
 #  include <netinet/in.h>
 #  include <netdb.h>
+#  include <fcntl.h>
+#  include <sys/uio.h>
+#  include <sys/stat.h>
+#  include <netinet/tcp.h>
 #endif 
 
+#ifdef __linux__
+#  define HAVE_MMSG
+#  include <sys/sendfile.h>
+#endif
+
+#ifdef windows
+#  include <io.h>
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  define open _open
+#  define fileno _fileno
+#  define close_file _close
+#else
+#  define close_file close
+#endif
+
+#ifndef O_BINARY
+#  define O_BINARY 0
+#endif
+
+#define SENDFILE_CHUNK 65536
+
 
 #ifndef MAXHOSTNAMELEN
 #  define MAXHOSTNAMELEN 64
@@ -37,6 +69,12 @@
 #  define SOCKET_ERROR -1
 #endif
 
+#ifdef windows
+#  define WOULD_BLOCK (WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+#  define WOULD_BLOCK (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS)
+#endif
+
 
 namespace {
 
@@ -74,6 +112,12 @@ inline int create_addr(char * address, int port, int family, sock_addr_t * resul
 			memcpy(addr->sun_path, address, length);
 			addr->sun_path[length] = '\0';
 			*len = length + (sizeof(*addr) - sizeof(addr->sun_path));
+#ifdef __linux__
+			if (address[0] == '@') { /* "@name" = abstract namespace, no file is created */
+				addr->sun_path[0] = '\0';
+				*len = length + offsetof(struct sockaddr_un, sun_path);
+			}
+#endif
 		} break;
 #endif
 		case PF_INET: {
@@ -116,16 +160,24 @@ inline int create_addr(char * address, int port, int family, sock_addr_t * resul
 
 /**
  * Returns JS array with values describing remote address.
- * For UNIX socket, only one item is present. For AF_INET and
+ * For UNIX socket, only one item is present (abstract names start with "@"). For AF_INET and
  * AF_INET6, array contains [address, port].
  */
-inline v8::Handle<v8::Value> create_peer(sockaddr * addr) {
+inline v8::Handle<v8::Value> create_peer(sockaddr * addr, socklen_t len = sizeof(sock_addr_t)) {
     switch (addr->sa_family) {
 #ifndef windows
 		case AF_UNIX: {
 			v8::Handle<v8::Array> result = v8::Array::New(1);
 			sockaddr_un * addr_un = (sockaddr_un *) addr;
-			result->Set(JS_INT(0), JS_STR(addr_un->sun_path));
+			size_t offset = offsetof(struct sockaddr_un, sun_path);
+			size_t max = (len > offset ? MIN(len - offset, sizeof(addr_un->sun_path)) : 0);
+			std::string path;
+			if (max && addr_un->sun_path[0] == '\0') {
+				if (len < sizeof(sock_addr_t)) { path = "@" + std::string(addr_un->sun_path + 1, max - 1); }
+			} else {
+				path.assign(addr_un->sun_path, strnlen(addr_un->sun_path, max));
+			}
+			result->Set(JS_INT(0), JS_STR(path.c_str()));
 			return result;
 		} break;
 #endif
@@ -166,15 +218,185 @@ inline v8::Handle<v8::Value> create_peer(sockaddr * addr) {
     return v8::Undefined();
 }
 
+/**
+ * Raw bytes of a Buffer, byte array or string. Converted data is kept in holder.
+ */
+void get_bytes(v8::Handle<v8::Value> value, std::string & holder, const char ** data, size_t * length) {
+	if (Buffer_isBuffer(value)) {
+		ByteStorage * bs = Buffer_storage(value);
+		*data = (const char *) bs->getData();
+		*length = bs->getLength();
+		return;
+	}
+
+	if (value->IsArray()) {
+		v8::Handle<v8::Array> arr = v8::Handle<v8::Array>::Cast(value);
+		uint32_t arrlen = arr->Length();
+		holder.resize(arrlen);
+		for (unsigned int i=0;i<arrlen;i++) {
+			holder[i] = (char) arr->Get(JS_INT(i))->IntegerValue();
+		}
+	} else {
+		v8::String::Utf8Value str(value);
+		holder.assign(*str, str.length());
+	}
+	*data = holder.data();
+	*length = holder.length();
+}
+
+/**
+ * Received data type requested by the caller: true = array of bytes, "buffer" = Buffer, otherwise string
+ */
+typedef enum { RECV_STRING, RECV_ARRAY, RECV_BUFFER } recv_type_t;
+
+recv_type_t get_recv_type(v8::Handle<v8::Value> value) {
+	if (value->IsTrue()) { return RECV_ARRAY; }
+	if (value->IsString() && strcmp(*(v8::String::Utf8Value(value)), "buffer") == 0) { return RECV_BUFFER; }
+	return RECV_STRING;
+}
+
+/**
+ * Trim a receive buffer to the received size: share the storage unless most of it would be wasted
+ */
+ByteStorage * shrink(ByteStorage * bs, size_t received) {
+	size_t count = bs->getLength();
+	if (received >= count) { return bs; }
+	ByteStorage * tmp = (received < count/2 ? new ByteStorage(bs->getData(), received) : new ByteStorage(bs, 0, received));
+	delete bs;
+	return tmp;
+}
+
+/**
+ * Hold back partial segments (TCP_CORK / TCP_NOPUSH) so that header and file data go out in full segments
+ */
+void cork(int sock, int value) {
+#if defined(TCP_CORK)
+	setsockopt(sock, IPPROTO_TCP, TCP_CORK, (char *) &value, sizeof(int));
+#elif defined(TCP_NOPUSH)
+	setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, (char *) &value, sizeof(int));
+#endif
+}
+
+/**
+ * Send a part of a file; returns bytes sent or -1. Stops early on a non-blocking socket.
+ */
+ssize_t send_file(int sock, int fd, off_t offset, size_t length) {
+	size_t total = 0;
+	while (total < length) {
+#if defined(__linux__)
+		ssize_t result = sendfile(sock, fd, &offset, length - total);
+		if (result == 0) { break; } /* file shorter than expected */
+#elif defined(darwin)
+		off_t len = length - total;
+		int status = sendfile(fd, sock, offset, &len, NULL, 0);
+		ssize_t result = (status == -1 && !(errno == EAGAIN && len > 0) ? -1 : len); /* EAGAIN may come with a partial write */
+		if (result == 0) { break; }
+		if (result > 0) { offset += result; }
+#else
+		char buf[SENDFILE_CHUNK];
+		if (lseek(fd, offset, SEEK_SET) == -1) { return -1; }
+		ssize_t count = read(fd, buf, MIN((size_t) SENDFILE_CHUNK, length - total));
+		if (count <= 0) {
+			if (count == 0) { break; }
+			return -1;
+		}
+		ssize_t result = send(sock, buf, count, 0);
+		if (result > 0) { offset += result; }
+#endif
+		if (result == SOCKET_ERROR) {
+			if (WOULD_BLOCK && total) { break; }
+			return -1;
+		}
+		total += result;
+	}
+	return total;
+}
+
+/**
+ * Readiness notification from the event loop: call the respective callbacks
+ */
+void ready(EventLoop * loop, int id, int fd, int events, void * data) {
+	v8::HandleScope handle_scope;
+	/* local handle: a callback which closes the socket or removes itself releases the persistent one */
+	v8::Handle<v8::Object> socket = v8::Local<v8::Object>::New(* ((v8::Persistent<v8::Object> *) data));
+	v8::Handle<v8::Value> argv[1] = { JS_INT(events) };
+	v8::Handle<v8::Value> result;
+
+	if (events & (EventLoop::READ | EventLoop::HANGUP)) {
+		v8::Handle<v8::Value> fun = socket->GetHiddenValue(JS_STR("onreadable"));
+		if (!fun.IsEmpty() && fun->IsFunction()) {
+			result = v8::Handle<v8::Function>::Cast(fun)->Call(socket, 1, argv);
+			if (result.IsEmpty()) { loop->stop(); return; }
+
+			/* still watched by this watcher? (not closed, not unwatched) */
+			v8::Handle<v8::Value> watcher = socket->GetHiddenValue(JS_STR("watcher"));
+			if (watcher.IsEmpty() || watcher->Int32Value() != id) { return; }
+		}
+	}
+
+	if (events & (EventLoop::WRITE | EventLoop::HANGUP)) {
+		v8::Handle<v8::Value> fun = socket->GetHiddenValue(JS_STR("onwritable"));
+		if (!fun.IsEmpty() && fun->IsFunction()) {
+			result = v8::Handle<v8::Function>::Cast(fun)->Call(socket, 1, argv);
+			if (result.IsEmpty()) { loop->stop(); }
+		}
+	}
+}
+
+void release(void * data) {
+	v8::Persistent<v8::Object> * socket = (v8::Persistent<v8::Object> *) data;
+	socket->Dispose();
+	delete socket;
+}
+
+/**
+ * Synchronize the event loop watcher with currently set callbacks
+ */
+int rewatch(v8::Handle<v8::Object> socket) {
+	EventLoop * loop = LOOP_PTR;
+	int sock = socket->GetInternalField(0)->Int32Value();
+	v8::Handle<v8::Value> r = socket->GetHiddenValue(JS_STR("onreadable"));
+	v8::Handle<v8::Value> w = socket->GetHiddenValue(JS_STR("onwritable"));
+	v8::Handle<v8::Value> watcher = socket->GetHiddenValue(JS_STR("watcher"));
+	int id = (watcher.IsEmpty() ? 0 : watcher->Int32Value());
+
+	int events = 0;
+	if (!r.IsEmpty() && r->IsFunction()) { events |= EventLoop::READ; }
+	if (!w.IsEmpty() && w->IsFunction()) { events |= EventLoop::WRITE; }
+
+	if (!events) {
+		if (id) { loop->remove(id); }
+		socket->DeleteHiddenValue(JS_STR("watcher"));
+		return 0;
+	}
+	if (id) { return loop->modifyWatcher(id, events); }
+
+	v8::Persistent<v8::Object> * data = new v8::Persistent<v8::Object>(v8::Persistent<v8::Object>::New(socket));
+	id = loop->addWatcher(sock, events, ready, data, release);
+	if (id == -1) {
+		release(data);
+		return -1;
+	}
+	socket->SetHiddenValue(JS_STR("watcher"), JS_INT(id));
+	return 0;
+}
+
+void unwatch(v8::Handle<v8::Object> socket) {
+	socket->DeleteHiddenValue(JS_STR("onreadable"));
+	socket->DeleteHiddenValue(JS_STR("onwritable"));
+	rewatch(socket);
+}
+
 /**
  * Socket constructor
  * @param {int} family
  * @param {int} type
  * @param {int} [proto]
+ * @param {int} [fd] Existing descriptor to wrap (e.g. from receiveFd)
  */
 JS_METHOD(_socket) {
 	ASSERT_CONSTRUCTOR;
-	if (args.Length() < 2) { return JS_TYPE_ERROR("Invalid call format. Use 'new Socket(family, type, [proto])'"); }						
+	if (args.Length() < 2) { return JS_TYPE_ERROR("Invalid call format. Use 'new Socket(family, type, [proto], [fd])'"); }						
 	
 	int offset = (args[0]->IsExternal() ? 1 : 0);
 	int family = args[offset + 0]->Int32Value();
@@ -185,6 +407,8 @@ JS_METHOD(_socket) {
 	if (args[0]->IsExternal()) {	
 		v8::Handle<v8::External> tmp = v8::Handle<v8::External>::Cast(args[0]);
 		s = *((int *) tmp->Value());
+	} else if (args.Length() > 3 && args[3]->IsNumber()) {
+		s = args[3]->Int32Value();
 	} else {
 		s = socket(family, type, proto);
 	}
@@ -211,22 +435,125 @@ JS_METHOD(_getprotobyname) {
 	}
 }
 
+/**
+ * Resolve a host name to one address; uses the caching resolver
+ * @param {string} name
+ * @param {int} [family] 0 (IPv4 preferred), PF_INET or PF_INET6
+ */
 JS_METHOD(_getaddrinfo) {
 	v8::String::Utf8Value name(args[0]);
 	int family = args[1]->IntegerValue();
 	
-	struct addrinfo hints, * servinfo;
-	memset(&hints, 0, sizeof(hints));
-	hints.ai_family = family;
+	Resolver::addresses_t addresses;
+	std::string error;
+	if (!Resolver::resolve(*name, addresses, error)) {
+		return JS_ERROR(error.c_str());
+	}
 
-	int result = getaddrinfo(*name, NULL, &hints, &servinfo);
-	if (result != 0) {
-		return JS_ERROR(gai_strerror(result));
+	/* without an explicit family, IPv4 wins for compatibility */
+	int wanted = (family == 0 ? PF_INET : family);
+	for (size_t i=0; i<addresses.size(); i++) {
+		bool v6 = (addresses[i].find(':') != std::string::npos);
+		if (v6 == (wanted == PF_INET6)) { return JS_STR(addresses[i].c_str()); }
+	}
+	if (family == 0 && addresses.size()) { return JS_STR(addresses[0].c_str()); }
+	return JS_ERROR("No address associated with hostname");
+}
+
+v8::Handle<v8::Value> create_addresses(const Resolver::addresses_t & addresses) {
+	v8::Handle<v8::Array> result = v8::Array::New(addresses.size());
+	for (size_t i=0; i<addresses.size(); i++) {
+		result->Set(JS_INT(i), JS_STR(addresses[i].c_str()));
+	}
+	return result;
+}
+
+/**
+ * Async resolution finished: call callback(error, addresses)
+ */
+void resolved(const std::string & name, const Resolver::addresses_t & addresses, const std::string & error, void * data) {
+	v8::HandleScope handle_scope;
+	v8::Persistent<v8::Function> * fun = (v8::Persistent<v8::Function> *) data;
+	v8::Handle<v8::Value> argv[2];
+	argv[0] = (error.length() ? JS_STR(error.c_str()) : v8::Null());
+	argv[1] = create_addresses(addresses);
+	v8::Handle<v8::Value> result = (*fun)->Call(JS_GLOBAL, 2, argv);
+	fun->Dispose();
+	delete fun;
+	if (result.IsEmpty()) {
+		EventLoop * loop = LOOP_PTR;
+		loop->stop();
 	}
-	
-	v8::Local<v8::Object> item = create_peer(servinfo->ai_addr)->ToObject();
-	freeaddrinfo(servinfo);
-	return item->Get(JS_INT(0));
+}
+
+/**
+ * Async resolution abandoned by the event loop: drop the callback
+ */
+void unresolved(void * data) {
+	v8::Persistent<v8::Function> * fun = (v8::Persistent<v8::Function> *) data;
+	fun->Dispose();
+	delete fun;
+}
+
+/**
+ * All addresses of a host, IPv6 and IPv4 interleaved (happy eyeballs order)
+ * @param {string} name
+ * @param {function} [callback] callback(error, addresses) called from the event loop; without it, resolution blocks
+ * @returns {string[]} when no callback is given
+ */
+JS_METHOD(_resolve) {
+	if (args.Length() < 1) { return JS_TYPE_ERROR("Bad argument count. Use 'Socket.resolve(name, [callback])'"); }
+	v8::String::Utf8Value name(args[0]);
+
+	if (args.Length() > 1 && args[1]->IsFunction()) {
+		v8::Persistent<v8::Function> * fun = new v8::Persistent<v8::Function>(v8::Persistent<v8::Function>::New(v8::Handle<v8::Function>::Cast(args[1])));
+		EventLoop * loop = LOOP_PTR;
+		Resolver::resolve(loop, *name, resolved, fun, unresolved);
+		return v8::Undefined();
+	}
+
+	Resolver::addresses_t addresses;
+	std::string error;
+	if (!Resolver::resolve(*name, addresses, error)) { return JS_ERROR(error.c_str()); }
+	return create_addresses(addresses);
+}
+
+/**
+ * Resolver options; changes apply to the whole worker
+ * @param {object} options {stubFile, stubTtl, nameservers, timeout, attempts, negativeTtl, maxTtl, ndots}
+ */
+JS_METHOD(_configureresolver) {
+	if (args.Length() < 1 || !args[0]->IsObject()) { return JS_TYPE_ERROR("Bad argument. Use 'Socket.configureResolver(options)'"); }
+	v8::Handle<v8::Object> options = args[0]->ToObject();
+	Resolver::options_t & o = Resolver::options();
+
+	if (options->Has(JS_STR("stubFile"))) {
+		v8::Handle<v8::Value> value = options->Get(JS_STR("stubFile"));
+		o.stubFile = (value->IsString() ? *v8::String::Utf8Value(value) : "");
+	}
+	if (options->Has(JS_STR("stubTtl"))) { o.stubTtl = options->Get(JS_STR("stubTtl"))->NumberValue(); }
+	if (options->Has(JS_STR("timeout"))) { o.timeout = options->Get(JS_STR("timeout"))->NumberValue(); }
+	if (options->Has(JS_STR("attempts"))) { o.attempts = options->Get(JS_STR("attempts"))->Int32Value(); }
+	if (options->Has(JS_STR("negativeTtl"))) { o.negativeTtl = options->Get(JS_STR("negativeTtl"))->NumberValue(); }
+	if (options->Has(JS_STR("maxTtl"))) { o.maxTtl = options->Get(JS_STR("maxTtl"))->NumberValue(); }
+	if (options->Has(JS_STR("ndots"))) { o.ndots = options->Get(JS_STR("ndots"))->Int32Value(); }
+	if (options->Has(JS_STR("nameservers"))) {
+		o.nameservers.clear();
+		v8::Handle<v8::Value> value = options->Get(JS_STR("nameservers"));
+		if (value->IsArray()) {
+			v8::Handle<v8::Array> arr = v8::Handle<v8::Array>::Cast(value);
+			for (unsigned int i=0; i<arr->Length(); i++) {
+				o.nameservers.push_back(*v8::String::Utf8Value(arr->Get(JS_INT(i))));
+			}
+		}
+	}
+	Resolver::clear();
+	return v8::Undefined();
+}
+
+JS_METHOD(_clearresolvercache) {
+	Resolver::clear();
+	return v8::Undefined();
 }
 
 JS_METHOD(_getnameinfo) {
@@ -281,7 +608,7 @@ JS_METHOD(_connect) {
 	}
 	
 	result = connect(sock, (sockaddr *) &addr, len);
-    if (result) {
+    if (result && !WOULD_BLOCK) { /* non-blocking connect completes when writable */
         return JS_ERROR(strerror(errno));
     } else {
 		return args.This();
@@ -331,6 +658,7 @@ JS_METHOD(_accept) {
 	int sock = LOAD_VALUE(0)->Int32Value();
 	int sock2 = accept(sock, NULL, NULL);
 	if (sock2 == INVALID_SOCKET) {
+		if (WOULD_BLOCK) { return JS_NULL; }
 		return JS_ERROR(strerror(errno));
 	} else {
 		v8::Handle<v8::Value> argv[4];
@@ -342,6 +670,13 @@ JS_METHOD(_accept) {
 	}
 }
 
+/**
+ * Send data
+ * @param {string || int[] || Buffer} data
+ * @param {string} [address] Target address for unconnected sockets
+ * @param {int} [port]
+ * @returns {int} Number of bytes sent; less than the data length (possibly 0) when a non-blocking socket is full
+ */
 JS_METHOD(_send) {
 	int sock = LOAD_VALUE(0)->Int32Value();
 
@@ -354,6 +689,7 @@ JS_METHOD(_send) {
 	sockaddr * target = NULL;
 	socklen_t len = 0;
 	ssize_t result;
+	size_t length = 0;
 	
 	if (args.Length() > 1) {
 		int family = args.This()->Get(JS_STR("family"))->Int32Value();
@@ -366,59 +702,415 @@ JS_METHOD(_send) {
 		target = (sockaddr *) &taddr;
 	}
 	
-	if (args[0]->IsArray()) {
-		v8::Handle<v8::Array> arr = v8::Handle<v8::Array>::Cast(args[0]);
-		uint32_t arrlen = arr->Length();
-		char * buf = new char[arrlen];
-
-		for (unsigned int i=0;i<arrlen;i++) {
-			buf[i] = (char) arr->Get(JS_INT(i))->IntegerValue();
-		}
-		result = sendto(sock, buf, arrlen, 0, target, len);
-		delete[] buf;
-	} else {
-		v8::String::Utf8Value data(args[0]);
-		result = sendto(sock, *data, data.length(), 0, target, len);
-	}	
+	std::string holder;
+	const char * data;
+	get_bytes(args[0], holder, &data, &length);
+	result = sendto(sock, data, length, 0, target, len);
 	
     if (result == SOCKET_ERROR) {
+		if (WOULD_BLOCK) { return JS_INT(0); }
         return JS_ERROR(strerror(errno));
-    } else {
-		return args.This();
     }
+	return JS_INT(result);
 }
 
+/**
+ * Receive data
+ * @param {int} count Maximum number of bytes
+ * @param {bool || string} [type] true = array of bytes, "buffer" = binary-f Buffer, otherwise a string
+ * @returns {string || int[] || Buffer} Empty on EOF, null when a non-blocking socket has nothing to read
+ */
 JS_METHOD(_receive) {
 	int sock = LOAD_VALUE(0)->Int32Value();
 	int count = args[0]->Int32Value();
 	int type = args.This()->Get(JS_STR("type"))->Int32Value();
-	
-	char * data = new char[count];
-    sock_addr_t addr;
-    socklen_t len = 0;
+	if (count < 0) { return JS_RANGE_ERROR("Invalid byte count"); }
+
+	recv_type_t rtype = (args.Length() > 1 ? get_recv_type(args[1]) : RECV_STRING);
+	ByteStorage * bs = NULL;
+	char * data;
+	if (rtype == RECV_BUFFER) { /* receive directly into the Buffer's storage */
+		bs = new ByteStorage((size_t) count);
+		data = (char *) bs->getData();
+	} else {
+		data = new char[count];
+	}
+
+	sock_addr_t addr;
+	socklen_t len = sizeof(sock_addr_t);
 
 	ssize_t result = recvfrom(sock, data, count, 0, (sockaddr *) &addr, &len);
-    if (result == SOCKET_ERROR) {
-		delete[] data;
-        return JS_ERROR(strerror(errno));
-    } else {
-		v8::Handle<v8::Value> output;
-		
-		if (args.Length() > 1 && args[1]->IsTrue()) {
-			output = JS_CHARARRAY((char *) data, result);
+	if (result == SOCKET_ERROR) {
+		if (bs) { delete bs; } else { delete[] data; }
+		if (WOULD_BLOCK) { return JS_NULL; }
+		return JS_ERROR(strerror(errno));
+	}
+
+	if (type == SOCK_DGRAM) { SAVE_VALUE(1, create_peer((sockaddr *) &addr, len)); }
+
+	if (bs) { return Buffer_create(shrink(bs, result)); }
+
+	v8::Handle<v8::Value> output;
+	if (rtype == RECV_ARRAY) {
+		output = JS_CHARARRAY((char *) data, result);
+	} else {
+		output = JS_STR(data, result);
+	}
+	delete[] data;
+	return output;
+}
+
+/**
+ * Receive data into an existing Buffer
+ * @param {Buffer} buffer
+ * @param {int} [offset=0]
+ * @param {int} [count] Defaults to the rest of the buffer
+ * @returns {int} Number of bytes received, 0 on EOF, null when a non-blocking socket has nothing to read
+ */
+JS_METHOD(_receiveinto) {
+	int sock = LOAD_VALUE(0)->Int32Value();
+	int type = args.This()->Get(JS_STR("type"))->Int32Value();
+	if (args.Length() < 1 || !Buffer_isBuffer(args[0])) {
+		return JS_TYPE_ERROR("Invalid call format. Use 'socket.receiveInto(buffer, [offset], [count])'");
+	}
+
+	ByteStorage * bs = Buffer_storage(args[0]);
+	size_t length = bs->getLength();
+	size_t offset = (args.Length() > 1 ? (size_t) args[1]->IntegerValue() : 0);
+	if (offset > length) { return JS_RANGE_ERROR("Offset out of range"); }
+	size_t count = length - offset;
+	if (args.Length() > 2) { count = MIN(count, (size_t) args[2]->IntegerValue()); }
+
+	sock_addr_t addr;
+	socklen_t len = sizeof(sock_addr_t);
+
+	ssize_t result = recvfrom(sock, (char *) bs->getData() + offset, count, 0, (sockaddr *) &addr, &len);
+	if (result == SOCKET_ERROR) {
+		if (WOULD_BLOCK) { return JS_NULL; }
+		return JS_ERROR(strerror(errno));
+	}
+
+	if (type == SOCK_DGRAM) { SAVE_VALUE(1, create_peer((sockaddr *) &addr, len)); }
+	return JS_INT(result);
+}
+
+/**
+ * Send several chunks with one system call (writev/sendmsg)
+ * @param {Buffer[] || string[]} chunks
+ * @param {string} [address]
+ * @param {int} [port]
+ * @returns {int} Number of bytes sent; less than the total (possibly 0) when a non-blocking socket is full
+ */
+JS_METHOD(_sendv) {
+	int sock = LOAD_VALUE(0)->Int32Value();
+	if (args.Length() < 1 || !args[0]->IsArray()) {
+		return JS_TYPE_ERROR("Bad argument count. Use 'socket.sendv(chunks, [address], [port])'");
+	}
+
+	sock_addr_t taddr;
+	sockaddr * target = NULL;
+	socklen_t len = 0;
+	if (args.Length() > 1) {
+		int family = args.This()->Get(JS_STR("family"))->Int32Value();
+		v8::String::Utf8Value address(args[1]);
+		if (create_addr(*address, args[2]->Int32Value(), family, &taddr, &len) != 0) {
+			return JS_ERROR("Malformed address");
+		}
+		target = (sockaddr *) &taddr;
+	}
+
+	v8::Handle<v8::Array> arr = v8::Handle<v8::Array>::Cast(args[0]);
+	uint32_t count = arr->Length();
+	std::vector<std::string> holders(count);
+	ssize_t result;
+
+#ifdef windows
+	std::string all;
+	for (uint32_t i=0; i<count; i++) {
+		const char * data;
+		size_t size;
+		get_bytes(arr->Get(JS_INT(i)), holders[i], &data, &size);
+		all.append(data, size);
+	}
+	result = sendto(sock, all.data(), all.length(), 0, target, len);
+#else
+	std::vector<struct iovec> iov(count);
+	for (uint32_t i=0; i<count; i++) {
+		const char * data;
+		get_bytes(arr->Get(JS_INT(i)), holders[i], &data, &iov[i].iov_len);
+		iov[i].iov_base = (void *) data;
+	}
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = target;
+	msg.msg_namelen = len;
+	msg.msg_iov = (count ? &iov[0] : NULL);
+	msg.msg_iovlen = count;
+	result = sendmsg(sock, &msg, 0);
+#endif
+
+	if (result == SOCKET_ERROR) {
+		if (WOULD_BLOCK) { return JS_INT(0); }
+		return JS_ERROR(strerror(errno));
+	}
+	return JS_INT(result);
+}
+
+/**
+ * Send several datagrams with one system call (sendmmsg)
+ * @param {array} messages Items are data (Buffer, string) or [data, address, port]
+ * @returns {int} Number of messages sent
+ */
+JS_METHOD(_sendmany) {
+	int sock = LOAD_VALUE(0)->Int32Value();
+	if (args.Length() < 1 || !args[0]->IsArray()) {
+		return JS_TYPE_ERROR("Bad argument count. Use 'socket.sendMany(messages)'");
+	}
+	int family = args.This()->Get(JS_STR("family"))->Int32Value();
+
+	v8::Handle<v8::Array> arr = v8::Handle<v8::Array>::Cast(args[0]);
+	uint32_t count = arr->Length();
+	if (!count) { return JS_INT(0); }
+
+	std::vector<std::string> holders(count);
+	std::vector<sock_addr_t> addrs(count);
+	std::vector<socklen_t> lens(count, 0);
+	std::vector<const char *> datas(count);
+	std::vector<size_t> sizes(count);
+
+	for (uint32_t i=0; i<count; i++) {
+		v8::Handle<v8::Value> item = arr->Get(JS_INT(i));
+		if (item->IsArray() && !Buffer_isBuffer(item)) {
+			v8::Handle<v8::Array> parts = v8::Handle<v8::Array>::Cast(item);
+			if (parts->Length() > 1) {
+				v8::String::Utf8Value address(parts->Get(JS_INT(1)));
+				if (create_addr(*address, parts->Get(JS_INT(2))->Int32Value(), family, &addrs[i], &lens[i]) != 0) {
+					return JS_ERROR("Malformed address");
+				}
+			}
+			item = parts->Get(JS_INT(0));
+		}
+		get_bytes(item, holders[i], &datas[i], &sizes[i]);
+	}
+
+	int sent = 0;
+#ifdef HAVE_MMSG
+	std::vector<struct iovec> iov(count);
+	std::vector<struct mmsghdr> msgs(count);
+	memset(&msgs[0], 0, count * sizeof(struct mmsghdr));
+	for (uint32_t i=0; i<count; i++) {
+		iov[i].iov_base = (void *) datas[i];
+		iov[i].iov_len = sizes[i];
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		if (lens[i]) {
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = lens[i];
+		}
+	}
+
+	while ((uint32_t) sent < count) {
+		int result = sendmmsg(sock, &msgs[sent], count - sent, 0);
+		if (result <= 0) { break; }
+		sent += result;
+	}
+#else
+	for (; (uint32_t) sent < count; sent++) {
+		sockaddr * target = (lens[sent] ? (sockaddr *) &addrs[sent] : NULL);
+		if (sendto(sock, datas[sent], sizes[sent], 0, target, lens[sent]) == SOCKET_ERROR) { break; }
+	}
+#endif
+
+	if ((uint32_t) sent < count && !sent && !WOULD_BLOCK) { return JS_ERROR(strerror(errno)); }
+	return JS_INT(sent);
+}
+
+/**
+ * Receive several datagrams with one system call (recvmmsg). Waits for the first one only.
+ * @param {int} count Maximum number of messages
+ * @param {int} size Maximum size of one message
+ * @param {bool || string} [type] As in receive()
+ * @returns {array} Items are [data, address, port]; null when a non-blocking socket has nothing to read
+ */
+JS_METHOD(_receivemany) {
+	int sock = LOAD_VALUE(0)->Int32Value();
+	if (args.Length() < 2) {
+		return JS_TYPE_ERROR("Bad argument count. Use 'socket.receiveMany(count, size, [type])'");
+	}
+	int count = args[0]->Int32Value();
+	int size = args[1]->Int32Value();
+	if (count <= 0 || size < 0) { return JS_RANGE_ERROR("Invalid message count or size"); }
+	recv_type_t rtype = (args.Length() > 2 ? get_recv_type(args[2]) : RECV_STRING);
+
+	std::vector<ByteStorage *> storages(count);
+	std::vector<sock_addr_t> addrs(count);
+	std::vector<size_t> sizes(count);
+	std::vector<socklen_t> lens(count, sizeof(sock_addr_t)); /* address lengths, abstract names need them */
+	for (int i=0; i<count; i++) { storages[i] = new ByteStorage((size_t) size); }
+
+	int received = 0;
+#ifdef HAVE_MMSG
+	std::vector<struct iovec> iov(count);
+	std::vector<struct mmsghdr> msgs(count);
+	memset(&msgs[0], 0, count * sizeof(struct mmsghdr));
+	for (int i=0; i<count; i++) {
+		iov[i].iov_base = storages[i]->getData();
+		iov[i].iov_len = size;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &addrs[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(sock_addr_t);
+	}
+	received = recvmmsg(sock, &msgs[0], count, MSG_WAITFORONE, NULL);
+	for (int i=0; i<received; i++) {
+		sizes[i] = msgs[i].msg_len;
+		lens[i] = msgs[i].msg_hdr.msg_namelen;
+	}
+#else
+	for (; received < count; received++) {
+		socklen_t len = sizeof(sock_addr_t);
+#ifdef MSG_DONTWAIT
+		int flags = (received ? MSG_DONTWAIT : 0);
+#else
+		if (received) { break; }
+		int flags = 0;
+#endif
+		ssize_t result = recvfrom(sock, (char *) storages[received]->getData(), size, flags, (sockaddr *) &addrs[received], &len);
+		if (result == SOCKET_ERROR) {
+			if (!received) { received = -1; }
+			break;
+		}
+		sizes[received] = result;
+		lens[received] = len;
+	}
+#endif
+
+	if (received == SOCKET_ERROR) {
+		int err = errno;
+		bool wouldblock = WOULD_BLOCK;
+		for (int i=0; i<count; i++) { delete storages[i]; }
+		if (wouldblock) { return JS_NULL; }
+		return JS_ERROR(strerror(err));
+	}
+
+	v8::Handle<v8::Array> output = v8::Array::New(received);
+	for (int i=0; i<count; i++) {
+		if (i >= received) {
+			delete storages[i];
+			continue;
+		}
+
+		v8::Handle<v8::Value> data;
+		if (rtype == RECV_BUFFER) {
+			data = Buffer_create(shrink(storages[i], sizes[i]));
 		} else {
-			output = JS_STR(data, result);
+			if (rtype == RECV_ARRAY) {
+				data = JS_CHARARRAY((char *) storages[i]->getData(), sizes[i]);
+			} else {
+				data = JS_STR((const char *) storages[i]->getData(), sizes[i]);
+			}
+			delete storages[i];
 		}
-		
-		v8::Handle<v8::Value> text = JS_STR(data, result);
-		delete[] data;
-		if (type == SOCK_DGRAM) { SAVE_VALUE(1, create_peer((sockaddr *) &addr)); }
-		return output;
-    }
+
+		v8::Handle<v8::Array> item = v8::Array::New(3);
+		item->Set(JS_INT(0), data);
+		v8::Handle<v8::Value> peer = create_peer((sockaddr *) &addrs[i], lens[i]);
+		if (peer->IsArray()) {
+			v8::Handle<v8::Array> p = v8::Handle<v8::Array>::Cast(peer);
+			item->Set(JS_INT(1), p->Get(JS_INT(0)));
+			item->Set(JS_INT(2), p->Get(JS_INT(1)));
+		}
+		output->Set(JS_INT(i), item);
+	}
+	return output;
+}
+
+/**
+ * Send a file (or its part) without copying it through JS
+ * @param {string || File} file Name or a File instance (an opened File is used directly)
+ * @param {int} [offset=0]
+ * @param {int} [length] Defaults to the rest of the file
+ * @param {Buffer || string} [header] Sent before the file, corked together with it
+ * @returns {int} Number of bytes sent, header included. On a non-blocking socket this can be less than
+ * header + length: resume with the unsent rest of the header, or with the file at offset + (sent - header length)
+ */
+JS_METHOD(_sendfile) {
+	int sock = LOAD_VALUE(0)->Int32Value();
+	if (args.Length() < 1) {
+		return JS_TYPE_ERROR("Bad argument count. Use 'socket.sendFile(file, [offset], [length], [header])'");
+	}
+
+	int fd = -1;
+	bool owned = true;
+	v8::Handle<v8::Value> name = args[0];
+	v8::Handle<v8::Value> fileFunc = JS_GLOBAL->Get(JS_STR("File"));
+	if (args[0]->IsObject() && fileFunc->IsFunction()) {
+		v8::Handle<v8::Object> obj = args[0]->ToObject();
+		v8::Handle<v8::Value> proto = fileFunc->ToObject()->Get(JS_STR("prototype"));
+		if (obj->InternalFieldCount() == 2 && obj->GetPrototype()->StrictEquals(proto)) {
+			name = obj->GetInternalField(0);
+			if (!obj->GetInternalField(1)->IsFalse()) { /* opened File */
+				FILE * f = reinterpret_cast<FILE *>(obj->GetPointerFromInternalField(1));
+				fflush(f);
+				fd = fileno(f);
+				owned = false;
+			}
+		}
+	}
+	if (fd == -1) {
+		v8::String::Utf8Value n(name);
+		fd = open(*n, O_RDONLY | O_BINARY);
+		if (fd == -1) { return JS_ERROR(strerror(errno)); }
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		int err = errno;
+		if (owned) { close_file(fd); }
+		return JS_ERROR(strerror(err));
+	}
+	off_t offset = (args.Length() > 1 ? (off_t) args[1]->IntegerValue() : 0);
+	if (offset < 0 || offset > st.st_size) { offset = st.st_size; }
+	size_t length = st.st_size - offset;
+	if (args.Length() > 2 && !args[2]->IsUndefined()) { length = MIN(length, (size_t) args[2]->IntegerValue()); }
+
+	bool header = (args.Length() > 3 && !args[3]->IsUndefined() && !args[3]->IsNull());
+	ssize_t result = 0;
+	size_t done = 0; /* header bytes sent */
+	if (header) {
+		cork(sock, 1);
+		std::string holder;
+		const char * data;
+		size_t size;
+		get_bytes(args[3], holder, &data, &size);
+		while (done < size && result != SOCKET_ERROR) {
+			result = send(sock, data + done, size - done, 0);
+			if (result > 0) { done += result; }
+		}
+	}
+	if (result != SOCKET_ERROR) { result = send_file(sock, fd, offset, length); }
+
+	int err = errno;
+	if (header) { cork(sock, 0); }
+	if (owned) { close_file(fd); }
+
+	if (result == SOCKET_ERROR) {
+		errno = err;
+		if (WOULD_BLOCK) { return JS_FLOAT((double) done); }
+		return JS_ERROR(strerror(err));
+	}
+	return JS_FLOAT((double) (done + result));
 }
 
+/**
+ * Close the socket. The descriptor is forgotten, so the number (which the kernel may hand out again)
+ * is never used through this object later; the pool relies on this.
+ */
 JS_METHOD(_socketclose) {
 	int sock = LOAD_VALUE(0)->Int32Value();
+	unwatch(args.This());
+	SAVE_VALUE(0, JS_INT(INVALID_SOCKET));
 	
 	int result = close(sock);
     if (result == SOCKET_ERROR) {
@@ -428,62 +1120,298 @@ JS_METHOD(_socketclose) {
     }
 }
 
+/**
+ * Set a socket option. Timeouts (SO_RCVTIMEO, SO_SNDTIMEO) are in milliseconds,
+ * SO_LINGER takes a number of seconds or false.
+ * @param {int} name
+ * @param {int || bool} value
+ * @param {int} [level=SOL_SOCKET] SOL_SOCKET, IPPROTO_TCP, ...
+ */
 JS_METHOD(_setoption) {
-	if (args.Length() != 2) {
-		return JS_TYPE_ERROR("Bad argument count. Use 'socket.setOption(name, value)'");
+	if (args.Length() < 2 || args.Length() > 3) {
+		return JS_TYPE_ERROR("Bad argument count. Use 'socket.setOption(name, value, [level])'");
 	}
 	int sock = LOAD_VALUE(0)->Int32Value();
 	int name = args[0]->Int32Value();
-	int value = args[1]->Int32Value();
+	int level = (args.Length() > 2 ? args[2]->Int32Value() : SOL_SOCKET);
+	int result;
+
+	if (level == SOL_SOCKET && (name == SO_RCVTIMEO || name == SO_SNDTIMEO)) {
+		double ms = args[1]->NumberValue();
+#ifdef windows
+		DWORD value = (DWORD) ms;
+#else
+		struct timeval value;
+		value.tv_sec = (time_t) (ms / 1000);
+		value.tv_usec = (suseconds_t) ((ms - value.tv_sec * 1000) * 1000);
+#endif
+		result = setsockopt(sock, level, name, (char *) &value, sizeof(value));
+	} else if (level == SOL_SOCKET && name == SO_LINGER) {
+		struct linger value;
+		value.l_onoff = (args[1]->IsFalse() || args[1]->IsNull() ? 0 : 1);
+		value.l_linger = (value.l_onoff ? args[1]->Int32Value() : 0);
+		result = setsockopt(sock, level, name, (char *) &value, sizeof(value));
+	} else {
+		int value = args[1]->Int32Value();
+		result = setsockopt(sock, level, name, (char *) &value, sizeof(int));
+	}
 
-    int result = setsockopt(sock, SOL_SOCKET, name, (char *) &value, sizeof(int));
 	if (result == 0) {
-        return args.This();
-    } else {
-        return JS_ERROR(strerror(errno));
-    }
+		return args.This();
+	} else {
+		return JS_ERROR(strerror(errno));
+	}
 }
 
+/**
+ * Get a socket option; value types as in setOption()
+ * @param {int} name
+ * @param {int} [length] Retrieve raw option data of this size as a string
+ * @param {int} [level=SOL_SOCKET]
+ */
 JS_METHOD(_getoption) {
 	if (args.Length() < 1) {
-		return JS_TYPE_ERROR("Bad argument count. Use 'socket.getOption(name, [length])'");
+		return JS_TYPE_ERROR("Bad argument count. Use 'socket.getOption(name, [length], [level])'");
 	}
 	int sock = LOAD_VALUE(0)->Int32Value();
 	int name = args[0]->Int32Value();
+	int level = (args.Length() > 2 ? args[2]->Int32Value() : SOL_SOCKET);
+	int length = (args.Length() > 1 ? args[1]->Int32Value() : 0);
+	int result;
 
-    if (args.Length() == 2) {
-		int length = args[1]->Int32Value();
-        char * buf = new char[length];
-		int result = getsockopt(sock, SOL_SOCKET, name, buf, (socklen_t *) &length);
+	if (length > 0) {
+		char * buf = new char[length];
+		result = getsockopt(sock, level, name, buf, (socklen_t *) &length);
 		if (result == 0) {
 			v8::Handle<v8::Value> response = JS_STR(buf, length);
 			delete[] buf;
-            return response;
-        } else {
+			return response;
+		} else {
 			delete[] buf;
 			return JS_ERROR(strerror(errno));
-        }
-    } else {
-        unsigned int buf;
-        int length = sizeof(buf);
-		int result = getsockopt(sock, SOL_SOCKET, name, (char *) &buf, (socklen_t *) &length);
+		}
+	}
+
+	if (level == SOL_SOCKET && (name == SO_RCVTIMEO || name == SO_SNDTIMEO)) {
+#ifdef windows
+		DWORD value;
+		length = sizeof(value);
+		result = getsockopt(sock, level, name, (char *) &value, (socklen_t *) &length);
+		if (result == 0) { return JS_FLOAT((double) value); }
+#else
+		struct timeval value;
+		length = sizeof(value);
+		result = getsockopt(sock, level, name, (char *) &value, (socklen_t *) &length);
+		if (result == 0) { return JS_FLOAT(value.tv_sec * 1000.0 + value.tv_usec / 1000.0); }
+#endif
+	} else if (level == SOL_SOCKET && name == SO_LINGER) {
+		struct linger value;
+		length = sizeof(value);
+		result = getsockopt(sock, level, name, (char *) &value, (socklen_t *) &length);
 		if (result == 0) {
-            return JS_INT(buf);
-        } else {
-			return JS_ERROR(strerror(errno));
-        }
-    }
+			if (!value.l_onoff) { return JS_BOOL(false); }
+			return JS_INT(value.l_linger);
+		}
+	} else {
+		unsigned int value;
+		length = sizeof(value);
+		result = getsockopt(sock, level, name, (char *) &value, (socklen_t *) &length);
+		if (result == 0) { return JS_INT(value); }
+	}
+	return JS_ERROR(strerror(errno));
+}
+
+/**
+ * Switch between blocking and non-blocking mode
+ * @param {bool} blocking
+ */
+JS_METHOD(_setblocking) {
+	int sock = LOAD_VALUE(0)->Int32Value();
+	bool blocking = (args.Length() == 0 || args[0]->ToBoolean()->IsTrue());
+
+#ifdef windows
+	u_long mode = (blocking ? 0 : 1);
+	int result = ioctlsocket(sock, FIONBIO, &mode);
+#else
+	int flags = fcntl(sock, F_GETFL, 0);
+	int result = -1;
+	if (flags != -1) { result = fcntl(sock, F_SETFL, (blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK)); }
+#endif
+
+	if (result == SOCKET_ERROR) {
+		return JS_ERROR(strerror(errno));
+	} else {
+		return args.This();
+	}
+}
+
+v8::Handle<v8::Value> set_callback(const v8::Arguments& args, const char * name) {
+	if (args.Length() < 1 || !(args[0]->IsFunction() || args[0]->IsNull())) {
+		return JS_TYPE_ERROR("Invalid call format. Pass a function or null");
+	}
+	if (args[0]->IsNull()) {
+		args.This()->DeleteHiddenValue(JS_STR(name));
+	} else {
+		args.This()->SetHiddenValue(JS_STR(name), args[0]);
+	}
+	if (rewatch(args.This()) != 0) { return JS_ERROR(strerror(errno)); }
+	return args.This();
 }
 
+/**
+ * Call a function (with the socket as "this") whenever data can be received, null to stop
+ * @param {function || null} callback
+ */
+JS_METHOD(_onreadable) {
+	return set_callback(args, "onreadable");
+}
+
+/**
+ * Call a function whenever data can be sent (or a pending connect finishes), null to stop
+ * @param {function || null} callback
+ */
+JS_METHOD(_onwritable) {
+	return set_callback(args, "onwritable");
+}
+
+#ifndef windows
+/**
+ * Pair of connected local sockets
+ * @param {int} [type=SOCK_STREAM]
+ * @returns {Socket[]}
+ */
+JS_METHOD(_socketpair) {
+	int type = (args.Length() > 0 ? args[0]->Int32Value() : SOCK_STREAM);
+	int fds[2];
+	if (socketpair(AF_UNIX, type, 0, fds) != 0) { return JS_ERROR(strerror(errno)); }
+
+	v8::Handle<v8::Array> result = v8::Array::New(2);
+	for (int i=0; i<2; i++) {
+		v8::Handle<v8::Value> argv[4];
+		argv[0] = v8::External::New(&fds[i]);
+		argv[1] = JS_INT(PF_UNIX);
+		argv[2] = JS_INT(type);
+		argv[3] = JS_INT(0);
+		result->Set(JS_INT(i), socketFunc->NewInstance(4, argv));
+	}
+	return result;
+}
+
+/**
+ * Pass a descriptor to the peer of a local (PF_UNIX) socket
+ * @param {Socket || int} descriptor Socket instance or a raw descriptor
+ * @param {string || Buffer} [data] Payload sent along (at least one byte is always sent)
+ */
+JS_METHOD(_sendfd) {
+	int sock = LOAD_VALUE(0)->Int32Value();
+	if (args.Length() < 1) { return JS_TYPE_ERROR("Bad argument count. Use 'socket.sendFd(descriptor, [data])'"); }
+
+	int fd = -1;
+	if (args[0]->IsObject()) {
+		v8::Handle<v8::Object> obj = args[0]->ToObject();
+		if (obj->InternalFieldCount() == 2 && obj->GetInternalField(0)->IsNumber()) { fd = obj->GetInternalField(0)->Int32Value(); }
+	} else {
+		fd = args[0]->Int32Value();
+	}
+	if (fd < 0) { return JS_ERROR("Invalid descriptor"); }
+
+	std::string holder = " ";
+	const char * data = holder.data();
+	size_t length = 1;
+	if (args.Length() > 1) { get_bytes(args[1], holder, &data, &length); }
+	if (!length) { return JS_ERROR("Data must not be empty"); }
+
+	struct iovec iov;
+	iov.iov_base = (void *) data;
+	iov.iov_len = length;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	memset(&control, 0, sizeof(control));
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	ssize_t result = sendmsg(sock, &msg, 0);
+	if (result == SOCKET_ERROR) {
+		if (WOULD_BLOCK) { return JS_INT(0); }
+		return JS_ERROR(strerror(errno));
+	}
+	return JS_INT(result);
+}
+
+/**
+ * Receive a descriptor sent by sendFd. The payload is available as the "data" property of the socket.
+ * @param {int} [count=1] Maximum payload size
+ * @returns {int} New descriptor (wrap it with new Socket(family, type, proto, fd)), null when it would block, false on EOF
+ */
+JS_METHOD(_receivefd) {
+	int sock = LOAD_VALUE(0)->Int32Value();
+	int count = (args.Length() > 0 ? args[0]->Int32Value() : 1);
+	if (count < 1) { return JS_RANGE_ERROR("Invalid byte count"); }
+
+	std::string data(count, '\0');
+	struct iovec iov;
+	iov.iov_base = (void *) data.data();
+	iov.iov_len = count;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+	flags |= MSG_CMSG_CLOEXEC;
+#endif
+	ssize_t result = recvmsg(sock, &msg, flags);
+	if (result == SOCKET_ERROR) {
+		if (WOULD_BLOCK) { return JS_NULL; }
+		return JS_ERROR(strerror(errno));
+	}
+	if (result == 0) { return JS_BOOL(false); }
+	args.This()->Set(JS_STR("data"), JS_STR(data.data(), result));
+
+	for (struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			int fd;
+			memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+			return JS_INT(fd);
+		}
+	}
+	if (msg.msg_flags & MSG_CTRUNC) { return JS_ERROR("Control data truncated"); }
+	return JS_ERROR("No descriptor received");
+}
+#endif
+
+/**
+ * Address of the peer: cached after the first call, or the sender of the last datagram received
+ */
 JS_METHOD(_getpeername) {
 	int sock = LOAD_VALUE(0)->Int32Value();
 
-	if (!LOAD_VALUE(1)->IsTrue()) {
+	if (!LOAD_VALUE(1)->IsArray()) {
 	    sock_addr_t addr;
 		socklen_t len = sizeof(sock_addr_t);
 		int result = getpeername(sock, (sockaddr *) &addr, &len);
 		if (result == 0) {
-			SAVE_VALUE(1, create_peer((sockaddr *) &addr));
+			SAVE_VALUE(1, create_peer((sockaddr *) &addr, len));
 		} else {
 			return JS_ERROR(strerror(errno));
 		}
@@ -496,6 +1424,7 @@ JS_METHOD(_getpeername) {
 
 SHARED_INIT() {
 	v8::HandleScope handle_scope;
+	Buffer_init(require);
 
 #ifdef windows
     WSADATA wsaData;
@@ -520,11 +1449,45 @@ SHARED_INIT() {
 	ft->Set(JS_STR("SO_REUSEADDR"), JS_INT(SO_REUSEADDR)); 
 	ft->Set(JS_STR("SO_BROADCAST"), JS_INT(SO_BROADCAST)); 
 	ft->Set(JS_STR("SO_KEEPALIVE"), JS_INT(SO_KEEPALIVE)); 
+	ft->Set(JS_STR("SO_RCVBUF"), JS_INT(SO_RCVBUF)); 
+	ft->Set(JS_STR("SO_SNDBUF"), JS_INT(SO_SNDBUF)); 
+	ft->Set(JS_STR("SO_RCVTIMEO"), JS_INT(SO_RCVTIMEO)); 
+	ft->Set(JS_STR("SO_SNDTIMEO"), JS_INT(SO_SNDTIMEO)); 
+	ft->Set(JS_STR("SO_LINGER"), JS_INT(SO_LINGER)); 
+	ft->Set(JS_STR("SO_ERROR"), JS_INT(SO_ERROR)); 
+#ifdef SO_REUSEPORT
+	ft->Set(JS_STR("SO_REUSEPORT"), JS_INT(SO_REUSEPORT)); 
+#endif
+
+	/* option levels */
+	ft->Set(JS_STR("SOL_SOCKET"), JS_INT(SOL_SOCKET)); 
+	ft->Set(JS_STR("IPPROTO_IP"), JS_INT(IPPROTO_IP)); 
+	ft->Set(JS_STR("IPPROTO_IPV6"), JS_INT(IPPROTO_IPV6)); 
+
+	/* IPPROTO_TCP options */
+	ft->Set(JS_STR("TCP_NODELAY"), JS_INT(TCP_NODELAY)); 
+#ifdef TCP_CORK
+	ft->Set(JS_STR("TCP_CORK"), JS_INT(TCP_CORK)); 
+#endif
+#ifdef TCP_NOPUSH
+	ft->Set(JS_STR("TCP_NOPUSH"), JS_INT(TCP_NOPUSH)); 
+#endif
+#ifdef TCP_KEEPIDLE
+	ft->Set(JS_STR("TCP_KEEPIDLE"), JS_INT(TCP_KEEPIDLE)); 
+	ft->Set(JS_STR("TCP_KEEPINTVL"), JS_INT(TCP_KEEPINTVL)); 
+	ft->Set(JS_STR("TCP_KEEPCNT"), JS_INT(TCP_KEEPCNT)); 
+#endif
 	
 	ft->Set(JS_STR("getProtoByName"), v8::FunctionTemplate::New(_getprotobyname)->GetFunction()); 
 	ft->Set(JS_STR("getAddrInfo"), v8::FunctionTemplate::New(_getaddrinfo)->GetFunction()); 
+	ft->Set(JS_STR("resolve"), v8::FunctionTemplate::New(_resolve)->GetFunction()); 
+	ft->Set(JS_STR("configureResolver"), v8::FunctionTemplate::New(_configureresolver)->GetFunction()); 
+	ft->Set(JS_STR("clearResolverCache"), v8::FunctionTemplate::New(_clearresolvercache)->GetFunction()); 
 	ft->Set(JS_STR("getNameInfo"), v8::FunctionTemplate::New(_getnameinfo)->GetFunction()); 
 	ft->Set(JS_STR("getHostName"), v8::FunctionTemplate::New(_gethostname)->GetFunction()); 
+#ifndef windows
+	ft->Set(JS_STR("socketPair"), v8::FunctionTemplate::New(_socketpair)->GetFunction()); 
+#endif
 	
 	v8::Handle<v8::ObjectTemplate> it = ft->InstanceTemplate();
 	it->SetInternalFieldCount(2); /* sock, peername */
@@ -537,6 +1500,11 @@ SHARED_INIT() {
 	pt->Set("connect", v8::FunctionTemplate::New(_connect));
 	pt->Set("send", v8::FunctionTemplate::New(_send));
 	pt->Set("receive", v8::FunctionTemplate::New(_receive));
+	pt->Set("receiveInto", v8::FunctionTemplate::New(_receiveinto));
+	pt->Set("sendv", v8::FunctionTemplate::New(_sendv));
+	pt->Set("sendMany", v8::FunctionTemplate::New(_sendmany));
+	pt->Set("receiveMany", v8::FunctionTemplate::New(_receivemany));
+	pt->Set("sendFile", v8::FunctionTemplate::New(_sendfile));
 	pt->Set("bind", v8::FunctionTemplate::New(_bind));
 	pt->Set("listen", v8::FunctionTemplate::New(_listen));
 	pt->Set("accept", v8::FunctionTemplate::New(_accept));
@@ -544,6 +1512,13 @@ SHARED_INIT() {
 	pt->Set("setOption", v8::FunctionTemplate::New(_setoption));
 	pt->Set("getOption", v8::FunctionTemplate::New(_getoption));
 	pt->Set("getPeerName", v8::FunctionTemplate::New(_getpeername));
+	pt->Set("setBlocking", v8::FunctionTemplate::New(_setblocking));
+	pt->Set("onReadable", v8::FunctionTemplate::New(_onreadable));
+	pt->Set("onWritable", v8::FunctionTemplate::New(_onwritable));
+#ifndef windows
+	pt->Set("sendFd", v8::FunctionTemplate::New(_sendfd));
+	pt->Set("receiveFd", v8::FunctionTemplate::New(_receivefd));
+#endif
 
 
 	exports->Set(JS_STR("Socket"), ft->GetFunction());
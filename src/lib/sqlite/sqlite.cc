@@ -1,16 +1,480 @@
 #include <v8.h>
 #include "macros.h"
 #include "gc.h"
+#include "lib/binary-f/buffer.h"
+#include "lib/db/rows.h"
 
 #include <sqlite3.h>
+#include <string>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+#include <cmath>
+#include <sstream>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
 
-#define SQLITE_PTR sqlite3 * db = LOAD_PTR(0, sqlite3 *)
-#define SQLITE_ERRMSG sqlite3_errmsg(db)
-#define ASSERT_CONNECTED if (!db) { return JS_ERROR("No database opened yet."); }
+#ifdef windows
+#	define realpath(in, out) _fullpath(out, in, PATH_MAX)
+#endif
+
+#define CONN_PTR connection_t * conn = LOAD_PTR(0, connection_t *)
+#define SQLITE_ERRMSG sqlite3_errmsg(conn->db)
+#define ASSERT_CONNECTED if (!conn) { return JS_ERROR("No database opened yet."); }
+#define STATEMENT_PTR statement_t * st = LOAD_PTR(0, statement_t *)
+#define ASSERT_PREPARED if (!st || !st->stmt) { return JS_ERROR("Statement is finalized."); }
+
+#define STATEMENT_CACHE_SIZE 32
 
 namespace {
 
 v8::Persistent<v8::FunctionTemplate> rest;
+v8::Persistent<v8::FunctionTemplate> stmtt;
+v8::Persistent<v8::FunctionTemplate> cursort;
+
+typedef struct connection_t connection_t;
+
+/**
+ * Statement created by db.prepare() or db.cursor(); lives until finalized by user or GC
+ */
+typedef struct {
+	sqlite3_stmt * stmt; /* NULL when finalized or when a cursor is exhausted */
+	connection_t * conn; /* NULL when the connection was closed first */
+	std::string sql; /* cache key of a cursor statement; empty for prepared statements */
+} statement_t;
+
+/**
+ * Opened database with its statement cache. Cached statements are keyed by SQL text,
+ * most recently used first; a statement in use is checked out of the cache.
+ */
+struct connection_t {
+	typedef std::pair<std::string, sqlite3_stmt *> entry_t;
+	typedef std::list<entry_t> lru_t;
+
+	sqlite3 * db;
+	size_t cacheSize;
+	int depth; /* nesting of db.transaction() calls */
+	bool shared;
+	int refs; /* SQLite objects using a shared connection */
+	lru_t lru;
+	std::map<std::string, lru_t::iterator> index;
+	std::set<statement_t *> statements;
+};
+
+/**
+ * Shared connections of this worker, keyed by open flags and real path (see registry_name). They outlive requests.
+ */
+std::map<std::string, connection_t *> registry;
+
+/**
+ * Name of a database file in the registry: its absolute path, because every script runs in its own
+ * directory. A file which does not exist yet is resolved through its directory; ":memory:",
+ * "" (temporary database) and URIs are kept as they are.
+ */
+std::string registry_name(const std::string & filename) {
+	if (!filename.length() || filename == ":memory:" || filename.compare(0, 5, "file:") == 0) { return filename; }
+	char buf[PATH_MAX];
+	if (realpath(filename.c_str(), buf)) { return buf; }
+
+	size_t slash = filename.find_last_of("/\\");
+	std::string dir = ".";
+	if (slash != std::string::npos) { dir = filename.substr(0, slash ? slash : 1); }
+	if (!realpath(dir.c_str(), buf)) { return filename; }
+	std::string result = buf;
+	if (result[result.length()-1] != '/') { result += "/"; }
+	result += filename.substr(slash == std::string::npos ? 0 : slash + 1);
+	return result;
+}
+
+/**
+ * Take a prepared statement for sql: from cache when possible, otherwise parse it.
+ * Sets "single" to false when the sql contains more than one statement.
+ */
+int statement_take(connection_t * conn, const std::string & sql, sqlite3_stmt ** stmt, bool * single) {
+	std::map<std::string, connection_t::lru_t::iterator>::iterator it = conn->index.find(sql);
+	*single = true;
+	if (it != conn->index.end()) {
+		*stmt = it->second->second;
+		conn->lru.erase(it->second);
+		conn->index.erase(it);
+		return SQLITE_OK;
+	}
+
+	const char * tail = NULL;
+	int result = sqlite3_prepare_v2(conn->db, sql.c_str(), sql.length(), stmt, &tail);
+	if (result != SQLITE_OK) { return result; }
+	while (tail && *tail && isspace((unsigned char) *tail)) { tail++; }
+	if (tail && *tail) { *single = false; }
+	return SQLITE_OK;
+}
+
+/**
+ * Finalize least recently used statements until at most "size" remain
+ */
+void statement_trim(connection_t * conn, size_t size) {
+	while (conn->lru.size() > size) {
+		connection_t::entry_t & last = conn->lru.back();
+		sqlite3_finalize(last.second);
+		conn->index.erase(last.first);
+		conn->lru.pop_back();
+	}
+}
+
+/**
+ * Return a statement to the cache, evicting the least recently used one
+ */
+void statement_give(connection_t * conn, const std::string & sql, sqlite3_stmt * stmt) {
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+	if (!conn->cacheSize || conn->index.find(sql) != conn->index.end()) {
+		sqlite3_finalize(stmt);
+		return;
+	}
+
+	conn->lru.push_front(connection_t::entry_t(sql, stmt));
+	conn->index[sql] = conn->lru.begin();
+	statement_trim(conn, conn->cacheSize);
+}
+
+/**
+ * Detach a statement from its connection; cursor statements go back to the cache
+ */
+void statement_release(statement_t * st) {
+	if (st->conn) {
+		st->conn->statements.erase(st);
+		if (st->stmt && st->sql.length()) {
+			statement_give(st->conn, st->sql, st->stmt);
+			st->stmt = NULL;
+		}
+	}
+	if (st->stmt) { sqlite3_finalize(st->stmt); }
+	st->stmt = NULL;
+	st->conn = NULL;
+}
+
+/**
+ * Finalize statements handed out to JS (prepared statements, cursors)
+ */
+void connection_orphan(connection_t * conn) {
+	std::set<statement_t *>::iterator it;
+	for (it = conn->statements.begin(); it != conn->statements.end(); it++) {
+		sqlite3_finalize((*it)->stmt);
+		(*it)->stmt = NULL;
+		(*it)->conn = NULL;
+	}
+	conn->statements.clear();
+}
+
+/**
+ * Finalize all statements and close the database
+ */
+int connection_close(connection_t * conn) {
+	statement_trim(conn, 0);
+	connection_orphan(conn);
+	return sqlite3_close(conn->db);
+}
+
+/**
+ * Last user of a shared connection is gone: drop its statements and any unfinished transaction.
+ * Cached statements stay prepared for the next request.
+ */
+void connection_reset(connection_t * conn) {
+	connection_orphan(conn);
+	if (!sqlite3_get_autocommit(conn->db)) {
+		sqlite3_exec(conn->db, "ROLLBACK", NULL, NULL, NULL);
+	}
+	conn->depth = 0;
+}
+
+/**
+ * Apply constructor options: journalMode, synchronous, busyTimeout, statementCache
+ */
+std::string connection_configure(connection_t * conn, v8::Handle<v8::Value> options) {
+	if (!options->IsObject()) { return ""; }
+	v8::Handle<v8::Object> opts = options->ToObject();
+	std::string pragma;
+
+	v8::Handle<v8::Value> journal = opts->Get(JS_STR("journalMode"));
+	if (!journal->IsUndefined()) {
+		std::string mode = *v8::String::Utf8Value(journal);
+		for (size_t i=0; i<mode.length(); i++) { mode[i] = tolower(mode[i]); }
+		if (mode != "delete" && mode != "truncate" && mode != "persist" && mode != "memory" && mode != "wal" && mode != "off") {
+			return "Unknown journal mode '" + mode + "'";
+		}
+		pragma += "PRAGMA journal_mode=" + mode + ";";
+	}
+
+	v8::Handle<v8::Value> sync = opts->Get(JS_STR("synchronous"));
+	if (!sync->IsUndefined()) {
+		std::string level = *v8::String::Utf8Value(sync);
+		for (size_t i=0; i<level.length(); i++) { level[i] = tolower(level[i]); }
+		if (level != "off" && level != "normal" && level != "full" && level != "extra" && 
+			level != "0" && level != "1" && level != "2" && level != "3") {
+			return "Unknown synchronous level '" + level + "'";
+		}
+		pragma += "PRAGMA synchronous=" + level + ";";
+	}
+
+	v8::Handle<v8::Value> timeout = opts->Get(JS_STR("busyTimeout"));
+	if (!timeout->IsUndefined()) { sqlite3_busy_timeout(conn->db, timeout->Int32Value()); }
+
+	v8::Handle<v8::Value> cache = opts->Get(JS_STR("statementCache"));
+	if (!cache->IsUndefined()) { conn->cacheSize = MAX(0, cache->Int32Value()); }
+
+	if (pragma.length() && sqlite3_exec(conn->db, pragma.c_str(), NULL, NULL, NULL) != SQLITE_OK) {
+		return sqlite3_errmsg(conn->db);
+	}
+	return "";
+}
+
+/**
+ * Start a transaction; when one is already active, a savepoint is created instead
+ */
+int transaction_begin(connection_t * conn, const std::string & mode, std::string & savepoint) {
+	std::string sql;
+	if (sqlite3_get_autocommit(conn->db)) {
+		savepoint = "";
+		sql = "BEGIN " + mode;
+	} else {
+		std::ostringstream name;
+		name << "v8cgi_" << conn->depth;
+		savepoint = name.str();
+		sql = "SAVEPOINT " + savepoint;
+	}
+	int result = sqlite3_exec(conn->db, sql.c_str(), NULL, NULL, NULL);
+	if (result == SQLITE_OK) { conn->depth++; }
+	return result;
+}
+
+/**
+ * Commit (release) or roll back what transaction_begin started. Returns an error message or empty string.
+ */
+std::string transaction_end(connection_t * conn, const std::string & savepoint, bool commit) {
+	conn->depth--;
+	std::string sql;
+	if (savepoint.length()) {
+		sql = (commit ? "" : "ROLLBACK TO " + savepoint + ";") + "RELEASE " + savepoint;
+	} else {
+		sql = (commit ? "COMMIT" : "ROLLBACK");
+	}
+	if (sqlite3_exec(conn->db, sql.c_str(), NULL, NULL, NULL) == SQLITE_OK) { return ""; }
+
+	std::string error = sqlite3_errmsg(conn->db);
+	if (commit && !savepoint.length() && !sqlite3_get_autocommit(conn->db)) {
+		sqlite3_exec(conn->db, "ROLLBACK", NULL, NULL, NULL);
+	}
+	return error;
+}
+
+/**
+ * "schema.table" => "schema"."table"
+ */
+std::string quote_name(const std::string & name) {
+	std::string result = "\"";
+	for (size_t i=0; i<name.length(); i++) {
+		char ch = name[i];
+		if (ch == '"') {
+			result += "\"\"";
+		} else if (ch == '.') {
+			result += "\".\"";
+		} else {
+			result += ch;
+		}
+	}
+	return result + "\"";
+}
+
+/**
+ * Bind one JS value according to its type
+ */
+int bind_value(sqlite3_stmt * stmt, int index, v8::Handle<v8::Value> value) {
+	if (value->IsNull() || value->IsUndefined()) {
+		return sqlite3_bind_null(stmt, index);
+	} else if (value->IsBoolean()) {
+		return sqlite3_bind_int(stmt, index, value->BooleanValue() ? 1 : 0);
+	} else if (value->IsInt32()) {
+		return sqlite3_bind_int(stmt, index, value->Int32Value());
+	} else if (value->IsNumber()) {
+		double d = value->NumberValue();
+		if (d == floor(d) && fabs(d) <= 9007199254740992.0) {
+			return sqlite3_bind_int64(stmt, index, (sqlite3_int64) d);
+		}
+		return sqlite3_bind_double(stmt, index, d);
+	} else if (Buffer_isBuffer(value)) {
+		ByteStorage * bs = Buffer_storage(value);
+		return sqlite3_bind_blob(stmt, index, bs->getData(), bs->getLength(), SQLITE_TRANSIENT);
+	} else {
+		v8::String::Utf8Value str(value);
+		return sqlite3_bind_text(stmt, index, *str, str.length(), SQLITE_TRANSIENT);
+	}
+}
+
+/**
+ * Find a named parameter; bare names match ":name", "@name" and "$name"
+ */
+int bind_index(sqlite3_stmt * stmt, v8::Handle<v8::Value> name) {
+	v8::String::Utf8Value str(name);
+	int index = sqlite3_bind_parameter_index(stmt, *str);
+	const char * prefixes = ":@$";
+	for (int i=0; !index && i<3; i++) {
+		std::string prefixed(1, prefixes[i]);
+		prefixed += *str;
+		index = sqlite3_bind_parameter_index(stmt, prefixed.c_str());
+	}
+	return index;
+}
+
+/**
+ * Bind an array (positional) or an object (named) of parameters. Returns an error message or empty string.
+ */
+std::string bind_params(sqlite3_stmt * stmt, v8::Handle<v8::Value> params) {
+	if (!params->IsObject()) { return "Parameters must be an array or an object"; }
+	int result = SQLITE_OK;
+
+	if (params->IsArray()) {
+		v8::Handle<v8::Array> arr = v8::Handle<v8::Array>::Cast(params);
+		int len = arr->Length();
+		if (len > sqlite3_bind_parameter_count(stmt)) { return "Too many parameters"; }
+		for (int i=0; i<len && result == SQLITE_OK; i++) {
+			result = bind_value(stmt, i+1, arr->Get(JS_INT(i)));
+		}
+	} else {
+		v8::Handle<v8::Object> obj = params->ToObject();
+		v8::Handle<v8::Array> names = obj->GetPropertyNames();
+		int len = names->Length();
+		for (int i=0; i<len && result == SQLITE_OK; i++) {
+			v8::Handle<v8::Value> name = names->Get(JS_INT(i));
+			int index = bind_index(stmt, name);
+			if (!index) { return std::string("Unknown parameter '") + *v8::String::Utf8Value(name) + "'"; }
+			result = bind_value(stmt, index, obj->Get(name));
+		}
+	}
+
+	if (result != SQLITE_OK) { return sqlite3_errmsg(sqlite3_db_handle(stmt)); }
+	return "";
+}
+
+/**
+ * Convert one column using its storage class. Integers beyond 2^53 are returned as strings.
+ */
+v8::Handle<v8::Value> column_typed(sqlite3_stmt * stmt, int index) {
+	switch (sqlite3_column_type(stmt, index)) {
+		case SQLITE_NULL:
+			return v8::Null();
+
+		case SQLITE_INTEGER: {
+			sqlite3_int64 i = sqlite3_column_int64(stmt, index);
+			if (i >= -2147483647LL-1 && i <= 2147483647LL) { return JS_INT((int) i); }
+			if (i >= -9007199254740992LL && i <= 9007199254740992LL) { return JS_FLOAT((double) i); }
+			const char * text = (const char *) sqlite3_column_text(stmt, index);
+			return JS_STR(text);
+		}
+
+		case SQLITE_FLOAT:
+			return JS_FLOAT(sqlite3_column_double(stmt, index));
+
+		case SQLITE_BLOB: {
+			const void * data = sqlite3_column_blob(stmt, index);
+			size_t length = sqlite3_column_bytes(stmt, index);
+			return Buffer_create(new ByteStorage((unsigned char *) data, length));
+		}
+
+		default: {
+			const char * text = (const char *) sqlite3_column_text(stmt, index);
+			if (!text) { return JS_STR(""); }
+			return JS_STR(text, sqlite3_column_bytes(stmt, index));
+		}
+	}
+}
+
+/**
+ * Column names of a statement as interned strings (symbols), used as property keys of all rows
+ */
+v8::Handle<v8::Array> column_names(sqlite3_stmt * stmt) {
+	int cols = sqlite3_column_count(stmt);
+	v8::Handle<v8::Array> names = v8::Array::New(cols);
+	for (int i=0;i<cols;i++) {
+		names->Set(JS_INT(i), RowBuilder::name(sqlite3_column_name(stmt, i)));
+	}
+	return names;
+}
+
+/**
+ * Current row into a row builder
+ */
+void row_read(sqlite3_stmt * stmt, RowBuilder & rows) {
+	int cols = sqlite3_column_count(stmt);
+	rows.start();
+	for (int i=0;i<cols;i++) {
+		rows.set(i, column_typed(stmt, i));
+	}
+}
+
+/**
+ * Object rows of a Statement or Cursor, using the column names and row shape kept in its internal fields
+ */
+RowBuilder object_rows(v8::Handle<v8::Object> obj) {
+	v8::Handle<v8::Array> names = v8::Handle<v8::Array>::Cast(obj->GetInternalField(2));
+	v8::Handle<v8::Object> shape = obj->GetInternalField(3)->ToObject();
+	return RowBuilder(names, RowBuilder::OBJECTS, shape);
+}
+
+/**
+ * Run a statement to completion, collecting names and rows into a Result.
+ * Returns an empty handle (with exception thrown) on failure.
+ */
+v8::Handle<v8::Value> statement_result(connection_t * conn, sqlite3_stmt * stmt) {
+	int cols = sqlite3_column_count(stmt);
+	int rows = 0;
+	v8::Handle<v8::Array> names = column_names(stmt);
+	v8::Handle<v8::Array> data = v8::Array::New(cols);
+	for (int i=0;i<cols;i++) {
+		data->Set(JS_INT(i), names->Get(JS_INT(i)));
+	}
+
+	int index = cols;
+	int result;
+	while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+		for (int i=0;i<cols;i++) {
+			data->Set(JS_INT(index++), column_typed(stmt, i));
+		}
+		rows++;
+	}
+	if (result != SQLITE_DONE) {
+		JS_ERROR(SQLITE_ERRMSG);
+		return v8::Handle<v8::Value>();
+	}
+
+	v8::Handle<v8::Value> resargs[] = { data, JS_INT(rows), JS_INT(cols) };
+	return rest->GetFunction()->NewInstance(3, resargs);
+}
+
+/**
+ * Multiple statements in one string are executed one by one, without caching.
+ * Result of the last statement is returned.
+ */
+v8::Handle<v8::Value> query_script(connection_t * conn, const char * sql) {
+	const char * tail = sql;
+	v8::Handle<v8::Value> r;
+
+	while (tail && *tail) {
+		sqlite3_stmt * stmt = NULL;
+		int result = sqlite3_prepare_v2(conn->db, tail, -1, &stmt, &tail);
+		if (result != SQLITE_OK) { return JS_ERROR(SQLITE_ERRMSG); }
+		if (!stmt) { continue; } /* whitespace or comment */
+		r = statement_result(conn, stmt);
+		sqlite3_finalize(stmt);
+		if (r.IsEmpty()) { return r; }
+	}
+
+	if (r.IsEmpty()) {
+		v8::Handle<v8::Value> resargs[] = { v8::Array::New(0), JS_INT(0), JS_INT(0) };
+		r = rest->GetFunction()->NewInstance(3, resargs);
+	}
+	return r;
+}
 
 void destroy(v8::Handle<v8::Object> obj) {
 	v8::Handle<v8::Function> fun = v8::Handle<v8::Function>::Cast(obj->Get(JS_STR("close")));
@@ -18,13 +482,32 @@ void destroy(v8::Handle<v8::Object> obj) {
 }
 
 /**
- * SQLite constructor does basically nothing. It just adds "this.close()" method to global GC
+ * Step a cursor. Returns SQLITE_ROW, SQLITE_DONE (statement released) or an error code.
+ */
+int cursor_step(statement_t * st, std::string & error) {
+	if (!st->stmt) { return SQLITE_DONE; }
+	int result = sqlite3_step(st->stmt);
+	if (result == SQLITE_ROW) { return result; }
+	if (result != SQLITE_DONE) { error = sqlite3_errmsg(st->conn->db); }
+	statement_release(st);
+	return result;
+}
+
+void destroy_statement(v8::Handle<v8::Object> obj) {
+	v8::Handle<v8::Function> fun = v8::Handle<v8::Function>::Cast(obj->Get(JS_STR("finalize")));
+	fun->Call(obj, 0, NULL);
+}
+
+/**
+ * SQLite constructor remembers options for open() and adds "this.close()" method to global GC:
+ * new SQLite({journalMode:"wal", synchronous:"normal", busyTimeout:1000, statementCache:32})
  */
 JS_METHOD(_sqlite) {
 	ASSERT_CONSTRUCTOR;
-	sqlite3 * db = NULL;
+	connection_t * conn = NULL;
 
-	SAVE_PTR(0, db);
+	SAVE_PTR(0, conn);
+	if (args.Length() > 0) { SAVE_VALUE(1, args[0]); }
 	GC * gc = GC_PTR;
 	gc->add(args.This(), destroy);
 	return args.This();
@@ -34,81 +517,572 @@ JS_METHOD(_sqlite) {
  * Close DB connection
  */ 
 JS_METHOD(_close) {
-	SQLITE_PTR;
+	CONN_PTR;
 	
-	if (db) {
-		int result = sqlite3_close(db);
-		if (result != SQLITE_OK) { return JS_ERROR(SQLITE_ERRMSG); }
+	if (conn) {
+		if (conn->shared) {
+			conn->refs--;
+			if (!conn->refs) { connection_reset(conn); }
+		} else {
+			int result = connection_close(conn);
+			if (result != SQLITE_OK) { return JS_ERROR(SQLITE_ERRMSG); }
+			delete conn;
+		}
 		SAVE_PTR(0, NULL);
 	}
 	return args.This();
 }
 
 /**
- * Should be called ASAP: new SQLite().open("dbfile")
+ * Should be called ASAP: new SQLite().open("dbfile").
+ * With {shared:true} in constructor options, the connection is taken from (or added to) 
+ * the worker's registry and close() only detaches from it. Options are applied when the
+ * shared connection is opened for the first time.
  */ 
 JS_METHOD(_open) {
 	if (args.Length() < 1) {
 		return JS_TYPE_ERROR("Invalid call format. Use 'sqlite.open(filename)'");
 	}
 	v8::String::Utf8Value filename(args[0]);
-	SQLITE_PTR;
+	CONN_PTR;
+	if (conn) { return JS_ERROR("Database already opened."); }
 
-	int result = sqlite3_open(*filename, &db);
-	
-	if (result != SQLITE_OK) { return JS_ERROR(SQLITE_ERRMSG); }
+	v8::Handle<v8::Value> options = LOAD_VALUE(1);
+	bool shared = false;
+	int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+	if (options->IsObject()) {
+		shared = options->ToObject()->Get(JS_STR("shared"))->BooleanValue();
+		if (options->ToObject()->Get(JS_STR("readOnly"))->BooleanValue()) { flags = SQLITE_OPEN_READONLY; }
+	}
+
+	std::ostringstream key;
+	key << flags << ":" << registry_name(*filename);
+	if (shared && registry.find(key.str()) != registry.end()) {
+		conn = registry[key.str()];
+		if (!conn->refs) { connection_reset(conn); }
+		conn->refs++;
+		SAVE_PTR(0, conn);
+		return args.This();
+	}
+
+	sqlite3 * db = NULL;
+	int result = sqlite3_open_v2(*filename, &db, flags, NULL);
+	if (result != SQLITE_OK) {
+		v8::Handle<v8::Value> error = JS_ERROR(sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return error;
+	}
 
-	SAVE_PTR(0, db);
+	conn = new connection_t();
+	conn->db = db;
+	conn->cacheSize = STATEMENT_CACHE_SIZE;
+	conn->depth = 0;
+	conn->shared = shared;
+	conn->refs = 1;
+
+	std::string error = connection_configure(conn, options);
+	if (error.length()) {
+		sqlite3_close(db);
+		delete conn;
+		return JS_ERROR(error.c_str());
+	}
+
+	if (shared) { registry[key.str()] = conn; }
+	SAVE_PTR(0, conn);
 	return args.This();
 }
 
 /**
- * Query takes a string argument and returns an instance of Result object
+ * Static method: close shared connections not used by any SQLite object. Returns their count.
+ */
+JS_METHOD(_closeshared) {
+	int count = 0;
+	std::map<std::string, connection_t *>::iterator it = registry.begin();
+	while (it != registry.end()) {
+		connection_t * conn = it->second;
+		if (conn->refs) { 
+			it++;
+			continue; 
+		}
+		connection_close(conn);
+		delete conn;
+		registry.erase(it++);
+		count++;
+	}
+	return JS_INT(count);
+}
+
+/**
+ * Query takes a string argument and returns an instance of Result object.
+ * Optional second argument (array or object) is bound to statement parameters.
+ * Single statements are prepared once and kept in the statement cache.
  */ 
 JS_METHOD(_query) {
-	SQLITE_PTR;
+	CONN_PTR;
 	ASSERT_CONNECTED;
 	if (args.Length() < 1) {
 		return JS_TYPE_ERROR("No query specified");
 	}
 	v8::String::Utf8Value q(args[0]);
+	std::string sql(*q, q.length());
+	bool params = args.Length() > 1 && !args[1]->IsUndefined() && !args[1]->IsNull();
 
-	char ** results;
-	int rows;
-	int cols;
-	char * someerror;
-	
-	int result = sqlite3_get_table(db, *q, &results, &rows, &cols, &someerror);
+	sqlite3_stmt * stmt = NULL;
+	bool single;
+	int result = statement_take(conn, sql, &stmt, &single);
 	if (result != SQLITE_OK) { return JS_ERROR(SQLITE_ERRMSG); }
-	
+
 	int qc = args.This()->Get(JS_STR("queryCount"))->ToInteger()->Int32Value();
 	args.This()->Set(JS_STR("queryCount"), JS_INT(qc+1));
-	
-	int items = cols * (rows+1);
-	v8::Handle<v8::Array> data = v8::Array::New(items);
-	for (int i=0;i<items;i++) {
-		if (results[i] == NULL) {
-			data->Set(JS_INT(i), v8::Null());
+
+	if (!single || !stmt) {
+		sqlite3_finalize(stmt);
+		if (params) { return JS_ERROR("Parameters can be bound only to a single statement."); }
+		return query_script(conn, *q);
+	}
+
+	if (params) {
+		std::string error = bind_params(stmt, args[1]);
+		if (error.length()) {
+			statement_give(conn, sql, stmt);
+			return JS_ERROR(error.c_str());
+		}
+	}
+
+	v8::Handle<v8::Value> r = statement_result(conn, stmt);
+	statement_give(conn, sql, stmt);
+	return r;
+}
+
+/**
+ * Prepare a statement: new SQLite().open(...).prepare("select ...")
+ */
+JS_METHOD(_prepare) {
+	CONN_PTR;
+	ASSERT_CONNECTED;
+	if (args.Length() < 1) {
+		return JS_TYPE_ERROR("No query specified");
+	}
+	v8::String::Utf8Value q(args[0]);
+
+	sqlite3_stmt * stmt = NULL;
+	int result = sqlite3_prepare_v2(conn->db, *q, q.length(), &stmt, NULL);
+	if (result != SQLITE_OK) { return JS_ERROR(SQLITE_ERRMSG); }
+	if (!stmt) { return JS_ERROR("Empty statement."); }
+
+	statement_t * st = new statement_t();
+	st->stmt = stmt;
+	st->conn = conn;
+	conn->statements.insert(st);
+
+	v8::Handle<v8::Value> stargs[] = { v8::External::New((void *) st), args.This(), column_names(stmt) };
+	v8::Handle<v8::Object> obj = stmtt->GetFunction()->NewInstance(3, stargs);
+	obj->Set(JS_STR("sql"), args[0]->ToString());
+	return obj;
+}
+
+/**
+ * Cursor takes a query and optional parameters; rows are read one at a time
+ */
+JS_METHOD(_cursor) {
+	CONN_PTR;
+	ASSERT_CONNECTED;
+	if (args.Length() < 1) {
+		return JS_TYPE_ERROR("No query specified");
+	}
+	v8::String::Utf8Value q(args[0]);
+	std::string sql(*q, q.length());
+
+	sqlite3_stmt * stmt = NULL;
+	bool single;
+	int result = statement_take(conn, sql, &stmt, &single);
+	if (result != SQLITE_OK) { return JS_ERROR(SQLITE_ERRMSG); }
+	if (!stmt) { return JS_ERROR("Empty statement."); }
+	if (!single) {
+		sqlite3_finalize(stmt);
+		return JS_ERROR("Cursor can be opened only for a single statement.");
+	}
+
+	if (args.Length() > 1 && !args[1]->IsUndefined() && !args[1]->IsNull()) {
+		std::string error = bind_params(stmt, args[1]);
+		if (error.length()) {
+			statement_give(conn, sql, stmt);
+			return JS_ERROR(error.c_str());
+		}
+	}
+
+	int qc = args.This()->Get(JS_STR("queryCount"))->ToInteger()->Int32Value();
+	args.This()->Set(JS_STR("queryCount"), JS_INT(qc+1));
+
+	statement_t * st = new statement_t();
+	st->stmt = stmt;
+	st->conn = conn;
+	st->sql = sql;
+	conn->statements.insert(st);
+
+	v8::Handle<v8::Value> cargs[] = { v8::External::New((void *) st), args.This(), column_names(stmt) };
+	return cursort->GetFunction()->NewInstance(3, cargs);
+}
+
+/**
+ * Set the maximum number of cached statements; 0 disables the cache
+ */
+JS_METHOD(_setstatementcache) {
+	CONN_PTR;
+	ASSERT_CONNECTED;
+	if (args.Length() < 1) {
+		return JS_TYPE_ERROR("Invalid call format. Use 'sqlite.setStatementCache(size)'");
+	}
+	int size = args[0]->Int32Value();
+	if (size < 0) { return JS_RANGE_ERROR("Cache size must not be negative"); }
+	conn->cacheSize = size;
+	statement_trim(conn, conn->cacheSize);
+	return args.This();
+}
+
+/**
+ * Run fn(db) inside a transaction (or a savepoint, when nested) and return its result.
+ * Exception thrown by fn rolls the changes back and is rethrown.
+ * Optional mode is "deferred", "immediate" or "exclusive".
+ */
+JS_METHOD(_transaction) {
+	CONN_PTR;
+	ASSERT_CONNECTED;
+	if (args.Length() < 1 || !args[0]->IsFunction()) {
+		return JS_TYPE_ERROR("Invalid call format. Use 'sqlite.transaction(function, [mode])'");
+	}
+	std::string mode = "";
+	if (args.Length() > 1) {
+		mode = *v8::String::Utf8Value(args[1]);
+		for (size_t i=0; i<mode.length(); i++) { mode[i] = tolower(mode[i]); }
+		if (mode != "deferred" && mode != "immediate" && mode != "exclusive") {
+			return JS_RANGE_ERROR("Unknown transaction mode");
+		}
+	}
+
+	std::string savepoint;
+	if (transaction_begin(conn, mode, savepoint) != SQLITE_OK) { return JS_ERROR(SQLITE_ERRMSG); }
+
+	v8::Handle<v8::Function> fun = v8::Handle<v8::Function>::Cast(args[0]);
+	v8::Handle<v8::Value> fargs[] = { args.This() };
+	v8::Handle<v8::Value> r = fun->Call(args.This(), 1, fargs);
+
+	conn = LOAD_PTR(0, connection_t *); /* callback may have closed the database */
+	if (!conn) { return r; }
+	std::string error = transaction_end(conn, savepoint, !r.IsEmpty());
+	if (r.IsEmpty()) { return r; }
+	if (error.length()) { return JS_ERROR(error.c_str()); }
+	return r;
+}
+
+/**
+ * Insert many rows with one statement in one transaction.
+ * First argument is a table name or a prepared Statement; rows are arrays or objects.
+ * For a table, columns are taken from keys of the first row (objects) or its length (arrays).
+ * Returns the number of inserted rows.
+ */
+JS_METHOD(_insertmany) {
+	CONN_PTR;
+	ASSERT_CONNECTED;
+	if (args.Length() < 2 || !args[1]->IsArray()) {
+		return JS_TYPE_ERROR("Invalid call format. Use 'sqlite.insertMany(table|statement, rows)'");
+	}
+	v8::Handle<v8::Array> rows = v8::Handle<v8::Array>::Cast(args[1]);
+	int count = rows->Length();
+	sqlite3_stmt * stmt = NULL;
+	std::string sql;
+	std::vector<v8::Handle<v8::Value> > keys;
+
+	if (stmtt->HasInstance(args[0])) {
+		statement_t * st = reinterpret_cast<statement_t *>(args[0]->ToObject()->GetPointerFromInternalField(0));
+		if (!st || !st->stmt) { return JS_ERROR("Statement is finalized."); }
+		if (st->conn != conn) { return JS_ERROR("Statement belongs to another database."); }
+		stmt = st->stmt;
+		sqlite3_reset(stmt);
+	} else {
+		if (!count) { return JS_INT(0); }
+		v8::Handle<v8::Value> first = rows->Get(JS_INT(0));
+		if (!first->IsObject()) { return JS_TYPE_ERROR("Rows must be arrays or objects"); }
+
+		std::string columns, values;
+		int cols;
+		if (first->IsArray()) {
+			cols = v8::Handle<v8::Array>::Cast(first)->Length();
 		} else {
-			data->Set(JS_INT(i), JS_STR(results[i]));
+			v8::Handle<v8::Array> names = first->ToObject()->GetPropertyNames();
+			cols = names->Length();
+			for (int i=0; i<cols; i++) {
+				keys.push_back(names->Get(JS_INT(i)));
+				columns += (i ? "," : "(") + quote_name(*v8::String::Utf8Value(keys[i])) + (i+1 == cols ? ") " : "");
+			}
 		}
+		if (!cols) { return JS_ERROR("Rows have no columns"); }
+		for (int i=0; i<cols; i++) { values += (i ? ",?" : "?"); }
+		sql = "INSERT INTO " + quote_name(*v8::String::Utf8Value(args[0])) + " " + columns + "VALUES (" + values + ")";
+
+		bool single;
+		if (statement_take(conn, sql, &stmt, &single) != SQLITE_OK) { return JS_ERROR(SQLITE_ERRMSG); }
 	}
-	sqlite3_free_table(results);
-	
-	v8::Handle<v8::Value> resargs[] = { data, JS_INT(rows), JS_INT(cols) };
-	return rest->GetFunction()->NewInstance(3, resargs);
+
+	std::string savepoint;
+	std::string error;
+	if (transaction_begin(conn, "", savepoint) != SQLITE_OK) { error = SQLITE_ERRMSG; }
+
+	for (int i=0; i<count && !error.length(); i++) {
+		v8::HandleScope scope;
+		v8::Handle<v8::Value> row = rows->Get(JS_INT(i));
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+
+		if (keys.size()) {
+			if (!row->IsObject()) {
+				error = "Rows must be objects";
+			} else {
+				v8::Handle<v8::Object> obj = row->ToObject();
+				for (size_t j=0; j<keys.size() && !error.length(); j++) {
+					if (bind_value(stmt, j+1, obj->Get(keys[j])) != SQLITE_OK) { error = SQLITE_ERRMSG; }
+				}
+			}
+		} else if (sql.length() && (!row->IsArray() || (int) v8::Handle<v8::Array>::Cast(row)->Length() != sqlite3_bind_parameter_count(stmt))) {
+			error = "Rows must be arrays of the same length";
+		} else {
+			error = bind_params(stmt, row);
+		}
+
+		if (!error.length()) {
+			int result;
+			while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {}
+			if (result != SQLITE_DONE) { error = SQLITE_ERRMSG; }
+		}
+
+		if (error.length()) {
+			std::ostringstream msg;
+			msg << "Row " << i << ": " << error;
+			error = msg.str();
+			transaction_end(conn, savepoint, false);
+		}
+	}
+
+	if (sql.length()) {
+		statement_give(conn, sql, stmt);
+	} else {
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+	}
+
+	if (!error.length()) { error = transaction_end(conn, savepoint, true); }
+	if (error.length()) { return JS_ERROR(error.c_str()); }
+	return JS_INT(count);
 }
 
 JS_METHOD(_changes) {
-	SQLITE_PTR;
+	CONN_PTR;
 	ASSERT_CONNECTED;
-	return JS_INT(sqlite3_changes(db));
+	return JS_INT(sqlite3_changes(conn->db));
 }
 
 JS_METHOD(_insertid) {
-	SQLITE_PTR;
+	CONN_PTR;
 	ASSERT_CONNECTED;
-	return JS_INT(sqlite3_last_insert_rowid(db));
+	return JS_INT(sqlite3_last_insert_rowid(conn->db));
+}
+
+/**
+ * Statement is created by db.prepare() with (External statement, database object, column names)
+ */
+JS_METHOD(_statement) {
+	ASSERT_CONSTRUCTOR;
+	if (args.Length() < 3 || !args[0]->IsExternal()) {
+		return JS_TYPE_ERROR("Use 'sqlite.prepare(sql)' to create statements");
+	}
+	statement_t * st = reinterpret_cast<statement_t *>(v8::Handle<v8::External>::Cast(args[0])->Value());
+	SAVE_PTR(0, st);
+	SAVE_VALUE(1, args[1]); /* keeps the database alive */
+	SAVE_VALUE(2, args[2]);
+	SAVE_VALUE(3, RowBuilder::shape(v8::Handle<v8::Array>::Cast(args[2])));
+	GC * gc = GC_PTR;
+	gc->add(args.This(), destroy_statement);
+	return args.This();
+}
+
+/**
+ * bind(index|name, value) or bind(array|object). Indexes are 1-based.
+ */
+JS_METHOD(_bind) {
+	STATEMENT_PTR;
+	ASSERT_PREPARED;
+	if (args.Length() < 1) {
+		return JS_TYPE_ERROR("Invalid call format. Use 'statement.bind(index, value)' or 'statement.bind(params)'");
+	}
+
+	if (args.Length() == 1) {
+		std::string error = bind_params(st->stmt, args[0]);
+		if (error.length()) { return JS_ERROR(error.c_str()); }
+		return args.This();
+	}
+
+	int index = (args[0]->IsNumber() ? args[0]->Int32Value() : bind_index(st->stmt, args[0]));
+	if (index < 1 || index > sqlite3_bind_parameter_count(st->stmt)) {
+		return JS_RANGE_ERROR("Unknown parameter");
+	}
+	int result = bind_value(st->stmt, index, args[1]);
+	if (result != SQLITE_OK) { return JS_ERROR(sqlite3_errmsg(st->conn->db)); }
+	return args.This();
+}
+
+/**
+ * Execute one step; returns the next row as an object, or false when done
+ */
+JS_METHOD(_step) {
+	STATEMENT_PTR;
+	ASSERT_PREPARED;
+
+	int result = sqlite3_step(st->stmt);
+	if (result == SQLITE_DONE) { return JS_BOOL(false); }
+	if (result != SQLITE_ROW) {
+		v8::Handle<v8::Value> error = JS_ERROR(sqlite3_errmsg(st->conn->db));
+		sqlite3_reset(st->stmt);
+		return error;
+	}
+
+	RowBuilder rows = object_rows(args.This());
+	row_read(st->stmt, rows);
+	return rows.row();
+}
+
+/**
+ * Rewind the statement; bound values are kept
+ */
+JS_METHOD(_reset) {
+	STATEMENT_PTR;
+	ASSERT_PREPARED;
+	sqlite3_reset(st->stmt);
+	return args.This();
+}
+
+JS_METHOD(_finalize) {
+	STATEMENT_PTR;
+	if (st) {
+		statement_release(st);
+		delete st;
+		SAVE_PTR(0, NULL);
+	}
+	return args.This();
+}
+
+/**
+ * Cursor is created by db.cursor() with (External statement, database object, column names)
+ */
+JS_METHOD(_cursorinit) {
+	ASSERT_CONSTRUCTOR;
+	if (args.Length() < 3 || !args[0]->IsExternal()) {
+		return JS_TYPE_ERROR("Use 'sqlite.cursor(sql)' to create cursors");
+	}
+	statement_t * st = reinterpret_cast<statement_t *>(v8::Handle<v8::External>::Cast(args[0])->Value());
+	SAVE_PTR(0, st);
+	SAVE_VALUE(1, args[1]); /* keeps the database alive */
+	SAVE_VALUE(2, args[2]);
+	SAVE_VALUE(3, RowBuilder::shape(v8::Handle<v8::Array>::Cast(args[2])));
+	GC * gc = GC_PTR;
+	gc->add(args.This(), destroy);
+	return args.This();
+}
+
+/**
+ * Next row as an object, or false when there are no more rows
+ */
+JS_METHOD(_next) {
+	STATEMENT_PTR;
+	if (!st) { return JS_ERROR("Cursor is closed."); }
+	std::string error;
+	int result = cursor_step(st, error);
+	if (result == SQLITE_DONE) { return JS_BOOL(false); }
+	if (result != SQLITE_ROW) { return JS_ERROR(error.c_str()); }
+	RowBuilder rows = object_rows(args.This());
+	row_read(st->stmt, rows);
+	return rows.row();
+}
+
+/**
+ * Up to "count" next rows; an empty array when there are no more rows
+ */
+JS_METHOD(_fetch) {
+	STATEMENT_PTR;
+	if (!st) { return JS_ERROR("Cursor is closed."); }
+	if (args.Length() < 1) {
+		return JS_TYPE_ERROR("Invalid call format. Use 'cursor.fetch(count)'");
+	}
+	int count = args[0]->Int32Value();
+	RowBuilder rows = object_rows(args.This());
+	std::string error;
+
+	for (int i=0; i<count; i++) {
+		int result = cursor_step(st, error);
+		if (result == SQLITE_DONE) { break; }
+		if (result != SQLITE_ROW) { return JS_ERROR(error.c_str()); }
+		row_read(st->stmt, rows);
+		rows.end();
+	}
+	return rows.result();
+}
+
+/**
+ * Call fn(row, index) for every remaining row; an exception thrown by fn closes the cursor
+ */
+JS_METHOD(_foreach) {
+	STATEMENT_PTR;
+	if (!st) { return JS_ERROR("Cursor is closed."); }
+	if (args.Length() < 1 || !args[0]->IsFunction()) {
+		return JS_TYPE_ERROR("Invalid call format. Use 'cursor.forEach(function)'");
+	}
+	v8::Handle<v8::Function> fun = v8::Handle<v8::Function>::Cast(args[0]);
+	v8::Handle<v8::Object> self = (args.Length() > 1 && args[1]->IsObject() ? args[1]->ToObject() : v8::Context::GetCurrent()->Global());
+	RowBuilder rows = object_rows(args.This());
+	std::string error;
+
+	int result = SQLITE_ROW;
+	for (int i=0; st; i++) {
+		v8::HandleScope scope;
+		result = cursor_step(st, error);
+		if (result != SQLITE_ROW) { break; }
+		row_read(st->stmt, rows);
+		v8::Handle<v8::Value> fargs[] = { rows.row(), JS_INT(i) };
+		v8::Handle<v8::Value> r = fun->Call(self, 2, fargs);
+		st = LOAD_PTR(0, statement_t *); /* callback may have closed the cursor */
+		if (r.IsEmpty()) { 
+			if (st) { statement_release(st); }
+			return r; 
+		}
+	}
+	if (result != SQLITE_ROW && result != SQLITE_DONE) { return JS_ERROR(error.c_str()); }
+	return args.This();
+}
+
+JS_METHOD(_cursornames) {
+	v8::Handle<v8::Array> names = v8::Handle<v8::Array>::Cast(LOAD_VALUE(2));
+	int cols = names->Length();
+	v8::Handle<v8::Array> result = v8::Array::New(cols);
+	for (int i=0;i<cols;i++) {
+		result->Set(JS_INT(i), names->Get(JS_INT(i)));
+	}
+	return result;
+}
+
+JS_METHOD(_cursorfields) {
+	return JS_INT(v8::Handle<v8::Array>::Cast(LOAD_VALUE(2))->Length());
+}
+
+/**
+ * Stop reading; the statement returns to the connection's cache
+ */
+JS_METHOD(_cursorclose) {
+	STATEMENT_PTR;
+	if (st) {
+		statement_release(st);
+		delete st;
+		SAVE_PTR(0, NULL);
+	}
+	return args.This();
 }
 
 JS_METHOD(_result) {
@@ -140,68 +1114,62 @@ JS_METHOD(_fetchnames) {
 }
 
 /**
- * Return result data as an array of JS arrays
- */ 
-JS_METHOD(_fetcharrays) {
+ * Rows of a Result in the given format; column names (interned) head the data array
+ */
+v8::Handle<v8::Value> result_rows(const v8::Arguments & args, RowBuilder::format_t format) {
 	v8::Handle<v8::Array> data = v8::Handle<v8::Array>::Cast(LOAD_VALUE(0));
-	v8::Handle<v8::Value> rows = LOAD_VALUE(1);
-	v8::Handle<v8::Value> cols = LOAD_VALUE(2);
-	
-	int r = rows->ToInteger()->Int32Value();
-	int c = cols->ToInteger()->Int32Value();
-	int index;
-	
-	v8::Handle<v8::Array> result = v8::Array::New(r);
+	int r = LOAD_VALUE(1)->ToInteger()->Int32Value();
+	int c = LOAD_VALUE(2)->ToInteger()->Int32Value();
+	int index = c;
+
+	v8::Handle<v8::Array> names = v8::Array::New(c);
+	for (int j=0; j<c; j++) {
+		names->Set(JS_INT(j), data->Get(JS_INT(j)));
+	}
+
+	RowBuilder rows(names, format);
 	for (int i=0;i<r;i++) {
-		v8::Handle<v8::Array> item = v8::Array::New(c);
-		result->Set(JS_INT(i), item);
+		rows.start();
 		for (int j=0; j<c; j++) {
-			index = j + (i+1)*c;
-			item->Set(JS_INT(j), data->Get(JS_INT(index)));
+			rows.set(j, data->Get(JS_INT(index++)));
 		}
+		rows.end();
 	}
-	return result;
+	return rows.result();
+}
+
+/**
+ * Return result data as an array of JS arrays
+ */ 
+JS_METHOD(_fetcharrays) {
+	return result_rows(args, RowBuilder::ARRAYS);
 }
 
 /**
  * Return result data as an array of JS objects, indexed with column names
  */ 
 JS_METHOD(_fetchobjects) {
-	v8::Handle<v8::Array> data = v8::Handle<v8::Array>::Cast(LOAD_VALUE(0));
-	v8::Handle<v8::Value> rows = LOAD_VALUE(1);
-	v8::Handle<v8::Value> cols = LOAD_VALUE(2);
-	
-	int r = rows->ToInteger()->Int32Value();
-	int c = cols->ToInteger()->Int32Value();
-	int index;
-
-	v8::Handle<v8::Array> result = v8::Array::New(r);
-	if (c == 0) { return result; }
-
-	v8::Handle<v8::Value> f = args.This()->Get(JS_STR("fetchNames"));
-	v8::Handle<v8::Function> fun = v8::Handle<v8::Function>::Cast(f);
-	v8::Handle<v8::Array> names = v8::Handle<v8::Array>::Cast(fun->Call(args.This(), 0, NULL));
+	return result_rows(args, RowBuilder::OBJECTS);
+}
 
-	for (int i=0;i<r;i++) {
-		v8::Handle<v8::Object> item = v8::Object::New();
-		result->Set(JS_INT(i), item);
-		for (int j=0; j<c; j++) {
-			index = j + (i+1)*c;
-			item->Set(names->Get(JS_INT(j)), data->Get(JS_INT(index)));
-		}
-	}
-	return result;
+/**
+ * Return result data as one JS object of value arrays, indexed with column names
+ */ 
+JS_METHOD(_fetchcolumns) {
+	return result_rows(args, RowBuilder::COLUMNS);
 }
 
 } /* end namespace */
 
 SHARED_INIT() {
 	v8::HandleScope handle_scope;
+	Buffer_init(require);
+
 	v8::Handle<v8::FunctionTemplate> ft = v8::FunctionTemplate::New(_sqlite);
 	ft->SetClassName(JS_STR("SQLite"));
 
 	v8::Handle<v8::ObjectTemplate> ot = ft->InstanceTemplate();
-	ot->SetInternalFieldCount(1); /* database */
+	ot->SetInternalFieldCount(2); /* connection, options */
 	
 	/**
 	 * Static property, useful for stats gathering
@@ -218,6 +1186,39 @@ SHARED_INIT() {
 	pt->Set(JS_STR("query"), v8::FunctionTemplate::New(_query));
 	pt->Set(JS_STR("changes"), v8::FunctionTemplate::New(_changes));
 	pt->Set(JS_STR("insertId"), v8::FunctionTemplate::New(_insertid));
+	pt->Set(JS_STR("prepare"), v8::FunctionTemplate::New(_prepare));
+	pt->Set(JS_STR("setStatementCache"), v8::FunctionTemplate::New(_setstatementcache));
+	pt->Set(JS_STR("cursor"), v8::FunctionTemplate::New(_cursor));
+	pt->Set(JS_STR("transaction"), v8::FunctionTemplate::New(_transaction));
+	pt->Set(JS_STR("insertMany"), v8::FunctionTemplate::New(_insertmany));
+
+	stmtt = v8::Persistent<v8::FunctionTemplate>::New(v8::FunctionTemplate::New(_statement));
+	stmtt->SetClassName(JS_STR("Statement"));
+	stmtt->InstanceTemplate()->SetInternalFieldCount(4); /* statement, database, names, row shape */
+
+	/**
+	 * Statement prototype methods (new SQLite().prepare().*)
+	 */
+	v8::Handle<v8::ObjectTemplate> stproto = stmtt->PrototypeTemplate();
+	stproto->Set(JS_STR("bind"), v8::FunctionTemplate::New(_bind));
+	stproto->Set(JS_STR("step"), v8::FunctionTemplate::New(_step));
+	stproto->Set(JS_STR("reset"), v8::FunctionTemplate::New(_reset));
+	stproto->Set(JS_STR("finalize"), v8::FunctionTemplate::New(_finalize));
+
+	cursort = v8::Persistent<v8::FunctionTemplate>::New(v8::FunctionTemplate::New(_cursorinit));
+	cursort->SetClassName(JS_STR("Cursor"));
+	cursort->InstanceTemplate()->SetInternalFieldCount(4); /* statement, database, names, row shape */
+
+	/**
+	 * Cursor prototype methods (new SQLite().cursor().*)
+	 */
+	v8::Handle<v8::ObjectTemplate> cproto = cursort->PrototypeTemplate();
+	cproto->Set(JS_STR("next"), v8::FunctionTemplate::New(_next));
+	cproto->Set(JS_STR("fetch"), v8::FunctionTemplate::New(_fetch));
+	cproto->Set(JS_STR("forEach"), v8::FunctionTemplate::New(_foreach));
+	cproto->Set(JS_STR("fetchNames"), v8::FunctionTemplate::New(_cursornames));
+	cproto->Set(JS_STR("numFields"), v8::FunctionTemplate::New(_cursorfields));
+	cproto->Set(JS_STR("close"), v8::FunctionTemplate::New(_cursorclose));
 	
 	rest = v8::Persistent<v8::FunctionTemplate>::New(v8::FunctionTemplate::New(_result));
 	rest->SetClassName(JS_STR("Result"));
@@ -235,6 +1236,12 @@ SHARED_INIT() {
 	resproto->Set(JS_STR("fetchNames"), v8::FunctionTemplate::New(_fetchnames));
 	resproto->Set(JS_STR("fetchArrays"), v8::FunctionTemplate::New(_fetcharrays));
 	resproto->Set(JS_STR("fetchObjects"), v8::FunctionTemplate::New(_fetchobjects));
+	resproto->Set(JS_STR("fetchColumns"), v8::FunctionTemplate::New(_fetchcolumns));
+
+	/**
+	 * Static methods (SQLite.*)
+	 */
+	ft->Set(JS_STR("closeShared"), v8::FunctionTemplate::New(_closeshared));
 
 	exports->Set(JS_STR("SQLite"), ft->GetFunction());
 }
@@ -0,0 +1,361 @@
+#include <vector>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include "macros.h"
+#include "loop.h"
+
+#ifdef __linux__
+#  define HAVE_EPOLL
+#  include <sys/epoll.h>
+#  include <unistd.h>
+#elif defined(windows)
+#  include <winsock2.h>
+#  define POLLIN 1
+#  define POLLOUT 4
+#  define POLLERR 8
+#  define POLLHUP 16
+#  define POLLNVAL 32
+struct pollfd {
+	SOCKET fd;
+	short events;
+	short revents;
+};
+#else
+#  include <poll.h>
+#endif
+
+#define EPOLL_EVENTS 64
+
+namespace {
+
+/**
+ * Monotonic time in milliseconds
+ */
+uint64_t now() {
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t) tv.tv_sec * 1000 + (uint64_t) tv.tv_usec / 1000;
+#endif
+}
+
+/**
+ * JS callback: function + its "this"
+ */
+typedef struct {
+	v8::Persistent<v8::Function> fun;
+	v8::Persistent<v8::Value> self;
+} js_callback_t;
+
+void js_call(EventLoop * loop, int id, int fd, int events, void * data) {
+	v8::HandleScope handle_scope;
+	js_callback_t * cb = (js_callback_t *) data;
+	v8::Handle<v8::Object> self = (cb->self->IsObject() ? cb->self->ToObject() : JS_GLOBAL);
+	v8::Handle<v8::Function> fun = v8::Local<v8::Function>::New(cb->fun); /* callback may remove itself, releasing cb */
+	v8::Handle<v8::Value> argv[1] = { JS_INT(events) };
+	v8::Handle<v8::Value> result = fun->Call(self, (fd == -1 ? 0 : 1), argv);
+	/* exception or exit(): leave the loop, caller reports the error */
+	if (result.IsEmpty()) { loop->stop(); }
+}
+
+void js_release(void * data) {
+	js_callback_t * cb = (js_callback_t *) data;
+	cb->fun.Dispose();
+	cb->self.Dispose();
+	delete cb;
+}
+
+#ifdef windows
+/**
+ * poll() emulation; WSAPoll is not available before Vista
+ */
+int select_poll(struct pollfd * fds, size_t count, int timeout) {
+	fd_set r, w, e;
+	FD_ZERO(&r);
+	FD_ZERO(&w);
+	FD_ZERO(&e);
+	for (size_t i=0; i<count; i++) {
+		if (fds[i].events & POLLIN) { FD_SET(fds[i].fd, &r); }
+		if (fds[i].events & POLLOUT) { FD_SET(fds[i].fd, &w); }
+		FD_SET(fds[i].fd, &e);
+	}
+	struct timeval tv;
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+	int result = select(0, &r, &w, &e, (timeout < 0 ? NULL : &tv));
+	if (result <= 0) { return result; }
+	for (size_t i=0; i<count; i++) {
+		fds[i].revents = 0;
+		if (FD_ISSET(fds[i].fd, &r)) { fds[i].revents |= POLLIN; }
+		if (FD_ISSET(fds[i].fd, &w)) { fds[i].revents |= POLLOUT; }
+		if (FD_ISSET(fds[i].fd, &e)) { fds[i].revents |= POLLERR; }
+	}
+	return result;
+}
+#  define poll select_poll
+#endif
+
+#ifdef HAVE_EPOLL
+uint32_t to_epoll(int events) {
+	uint32_t result = 0;
+	if (events & EventLoop::READ) { result |= EPOLLIN; }
+	if (events & EventLoop::WRITE) { result |= EPOLLOUT; }
+	return result;
+}
+#endif
+
+}
+
+EventLoop::EventLoop() {
+	this->counter = 0;
+	this->watchers = 0;
+	this->stopped = false;
+#ifdef HAVE_EPOLL
+	this->backend = epoll_create(EPOLL_EVENTS);
+#else
+	this->backend = -1;
+#endif
+}
+
+EventLoop::~EventLoop() {
+	this->clear();
+#ifdef HAVE_EPOLL
+	if (this->backend != -1) { close(this->backend); }
+#endif
+}
+
+int EventLoop::addTimer(double delay, bool repeat, callback_t callback, void * data, release_t release) {
+	if (delay < 0) { delay = 0; }
+	item_t item;
+	item.fd = -1;
+	item.events = 0;
+	item.repeat = repeat;
+	item.interval = delay;
+	item.callback = callback;
+	item.data = data;
+	item.release = release;
+
+	int id = ++this->counter;
+	this->items[id] = item;
+	this->timers.insert(std::pair<uint64_t, int>(now() + (uint64_t) delay, id));
+	return id;
+}
+
+int EventLoop::addWatcher(int fd, int events, callback_t callback, void * data, release_t release) {
+	if (this->fds.find(fd) != this->fds.end()) {
+		errno = EEXIST;
+		return -1;
+	}
+
+#ifdef HAVE_EPOLL
+	struct epoll_event ev;
+	ev.events = to_epoll(events);
+	ev.data.fd = fd;
+	if (epoll_ctl(this->backend, EPOLL_CTL_ADD, fd, &ev) != 0) { return -1; }
+#endif
+
+	item_t item;
+	item.fd = fd;
+	item.events = events;
+	item.repeat = true;
+	item.interval = 0;
+	item.callback = callback;
+	item.data = data;
+	item.release = release;
+
+	int id = ++this->counter;
+	this->items[id] = item;
+	this->fds[fd] = id;
+	this->watchers++;
+	return id;
+}
+
+int EventLoop::modifyWatcher(int id, int events) {
+	items_t::iterator it = this->items.find(id);
+	if (it == this->items.end() || it->second.fd == -1) {
+		errno = ENOENT;
+		return -1;
+	}
+
+#ifdef HAVE_EPOLL
+	struct epoll_event ev;
+	ev.events = to_epoll(events);
+	ev.data.fd = it->second.fd;
+	if (epoll_ctl(this->backend, EPOLL_CTL_MOD, it->second.fd, &ev) != 0) { return -1; }
+#endif
+	it->second.events = events;
+	return 0;
+}
+
+void EventLoop::remove(int id) {
+	items_t::iterator it = this->items.find(id);
+	if (it == this->items.end()) { return; }
+	item_t item = it->second;
+	this->items.erase(it);
+
+	if (item.fd == -1) {
+		for (timers_t::iterator t = this->timers.begin(); t != this->timers.end(); t++) {
+			if (t->second == id) {
+				this->timers.erase(t);
+				break;
+			}
+		}
+	} else {
+#ifdef HAVE_EPOLL
+		struct epoll_event ev; /* non-NULL for older kernels */
+		epoll_ctl(this->backend, EPOLL_CTL_DEL, item.fd, &ev);
+#endif
+		this->fds.erase(item.fd);
+		this->watchers--;
+	}
+
+	if (item.release) { item.release(item.data); }
+}
+
+int EventLoop::addJSTimer(v8::Handle<v8::Function> fun, double delay, bool repeat) {
+	js_callback_t * cb = new js_callback_t();
+	cb->fun = v8::Persistent<v8::Function>::New(fun);
+	cb->self = v8::Persistent<v8::Value>::New(v8::Undefined());
+	return this->addTimer(delay, repeat, js_call, cb, js_release);
+}
+
+int EventLoop::addJSWatcher(int fd, int events, v8::Handle<v8::Function> fun, v8::Handle<v8::Value> self) {
+	js_callback_t * cb = new js_callback_t();
+	cb->fun = v8::Persistent<v8::Function>::New(fun);
+	cb->self = v8::Persistent<v8::Value>::New(self);
+	int id = this->addWatcher(fd, events, js_call, cb, js_release);
+	if (id == -1) { js_release(cb); }
+	return id;
+}
+
+bool EventLoop::isIdle() {
+	return this->items.empty();
+}
+
+void EventLoop::stop() {
+	this->stopped = true;
+}
+
+void EventLoop::run() {
+	this->stopped = false;
+	while (!this->stopped && this->runOnce(-1)) {}
+}
+
+void EventLoop::clear() {
+	while (!this->items.empty()) {
+		this->remove(this->items.begin()->first);
+	}
+}
+
+bool EventLoop::runOnce(int timeout) {
+	if (this->isIdle()) { return false; }
+
+	if (!this->timers.empty()) {
+		uint64_t t = now();
+		uint64_t due = this->timers.begin()->first;
+		int wait = (due > t ? (int) (due - t) : 0);
+		if (timeout < 0 || wait < timeout) { timeout = wait; }
+	}
+
+	if (this->wait(timeout) == -1 && errno != EINTR) {
+		this->stop();
+		return false;
+	}
+	if (!this->stopped) { this->dispatchTimers(); }
+	return !this->isIdle();
+}
+
+/**
+ * Wait for descriptors and dispatch their callbacks
+ */
+int EventLoop::wait(int timeout) {
+#ifdef HAVE_EPOLL
+	struct epoll_event events[EPOLL_EVENTS];
+	int count = epoll_wait(this->backend, events, EPOLL_EVENTS, timeout);
+	for (int i=0; i<count && !this->stopped; i++) {
+		std::map<int, int>::iterator it = this->fds.find(events[i].data.fd);
+		if (it == this->fds.end()) { continue; } /* removed by a previous callback */
+		int ev = 0;
+		if (events[i].events & EPOLLIN) { ev |= READ; }
+		if (events[i].events & EPOLLOUT) { ev |= WRITE; }
+		if (events[i].events & (EPOLLERR | EPOLLHUP)) { ev |= HANGUP; }
+		this->fire(it->second, ev);
+	}
+	return count;
+#else
+	std::vector<struct pollfd> pfds;
+	for (std::map<int, int>::iterator it = this->fds.begin(); it != this->fds.end(); it++) {
+		struct pollfd p;
+		int events = this->items[it->second].events;
+		p.fd = it->first;
+		p.events = ((events & READ) ? POLLIN : 0) | ((events & WRITE) ? POLLOUT : 0);
+		p.revents = 0;
+		pfds.push_back(p);
+	}
+	int count = 0;
+	if (pfds.size()) {
+		count = ::poll(&pfds[0], pfds.size(), timeout);
+	} else if (timeout > 0) {
+#ifdef windows
+		Sleep(timeout);
+#else
+		::poll(NULL, 0, timeout);
+#endif
+	}
+	for (size_t i=0; i<pfds.size() && count > 0 && !this->stopped; i++) {
+		if (!pfds[i].revents) { continue; }
+		std::map<int, int>::iterator it = this->fds.find(pfds[i].fd);
+		if (it == this->fds.end()) { continue; }
+		int ev = 0;
+		if (pfds[i].revents & POLLIN) { ev |= READ; }
+		if (pfds[i].revents & POLLOUT) { ev |= WRITE; }
+		if (pfds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) { ev |= HANGUP; }
+		this->fire(it->second, ev);
+	}
+	return count;
+#endif
+}
+
+/**
+ * Fire all expired timers. Timers added by callbacks wait for the next iteration.
+ */
+void EventLoop::dispatchTimers() {
+	uint64_t t = now();
+	std::vector<int> expired;
+	for (timers_t::iterator it = this->timers.begin(); it != this->timers.end() && it->first <= t; it++) {
+		expired.push_back(it->second);
+	}
+
+	for (size_t i=0; i<expired.size() && !this->stopped; i++) {
+		int id = expired[i];
+		if (this->items.find(id) == this->items.end()) { continue; } /* cleared meanwhile */
+		for (timers_t::iterator it = this->timers.begin(); it != this->timers.end(); it++) {
+			if (it->second == id) {
+				this->timers.erase(it);
+				break;
+			}
+		}
+
+		this->fire(id, 0);
+
+		items_t::iterator it = this->items.find(id);
+		if (it == this->items.end()) { continue; }
+		if (it->second.repeat) {
+			this->timers.insert(std::pair<uint64_t, int>(now() + (uint64_t) it->second.interval, id));
+		} else {
+			this->remove(id);
+		}
+	}
+}
+
+void EventLoop::fire(int id, int events) {
+	items_t::iterator it = this->items.find(id);
+	if (it == this->items.end()) { return; }
+	item_t item = it->second;
+	item.callback(this, id, item.fd, events, item.data);
+}
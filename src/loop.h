@@ -0,0 +1,85 @@
+/**
+ * Event loop: timers and file descriptor watchers, backed by epoll (poll elsewhere).
+ * One loop exists per application; it runs until idle at the end of every request.
+ * Native modules register plain C callbacks, JS callbacks are wrapped by addJS*().
+ */
+
+#ifndef _JS_LOOP_H
+#define _JS_LOOP_H
+
+#include <map>
+#include <v8.h>
+
+#ifdef _MSC_VER
+typedef unsigned __int64 uint64_t;
+#else
+#  include <stdint.h>
+#endif
+
+class EventLoop {
+public:
+	/* readiness flags */
+	static const int READ = 1;
+	static const int WRITE = 2;
+	static const int HANGUP = 4;
+
+	/* called when a timer expires (fd = -1) or a descriptor is ready */
+	typedef void (*callback_t)(EventLoop * loop, int id, int fd, int events, void * data);
+	/* called when a timer/watcher is removed */
+	typedef void (*release_t)(void * data);
+
+	EventLoop();
+	virtual ~EventLoop();
+
+	/* timer after delay (ms), optionally repeating; returns id */
+	int addTimer(double delay, bool repeat, callback_t callback, void * data, release_t release);
+	/* watch descriptor for READ/WRITE readiness; returns id or -1 on error (errno set) */
+	int addWatcher(int fd, int events, callback_t callback, void * data, release_t release);
+	/* change watched events */
+	int modifyWatcher(int id, int events);
+	/* remove a timer or watcher */
+	void remove(int id);
+
+	/* JS function wrappers; function is called with (events) for watchers, no arguments for timers */
+	int addJSTimer(v8::Handle<v8::Function> fun, double delay, bool repeat);
+	int addJSWatcher(int fd, int events, v8::Handle<v8::Function> fun, v8::Handle<v8::Value> self);
+
+	/* wait at most timeout ms (-1 = until next timer) and dispatch; returns false when idle */
+	bool runOnce(int timeout);
+	/* dispatch until idle or stopped */
+	void run();
+	/* break out of run() */
+	void stop();
+	/* nothing to wait for */
+	bool isIdle();
+	/* remove everything (end of request) */
+	void clear();
+
+private:
+	typedef struct {
+		int fd; /* -1 for timers */
+		int events;
+		bool repeat;
+		double interval;
+		callback_t callback;
+		void * data;
+		release_t release;
+	} item_t;
+
+	typedef std::map<int, item_t> items_t;
+	typedef std::multimap<uint64_t, int> timers_t;
+
+	items_t items;
+	timers_t timers;
+	std::map<int, int> fds; /* fd => watcher id */
+	int counter;
+	int watchers;
+	bool stopped;
+	int backend; /* epoll descriptor */
+
+	int wait(int timeout);
+	void fire(int id, int events);
+	void dispatchTimers();
+};
+
+#endif
@@ -50,15 +50,30 @@ public:
 		return true; /* FIXME? */
 	}
 
+	/**
+	 * Environment is read directly from request's subprocess_env table
+	 */
+	const char * envValue(const char * name) {
+		return apr_table_get(this->request->subprocess_env, name);
+	}
+
+	void envNames(std::vector<std::string> & names) {
+		const apr_array_header_t * arr = apr_table_elts(this->request->subprocess_env);
+		const apr_table_entry_t * elts = (const apr_table_entry_t *) arr->elts;
+		for (int i=0;i<arr->nelts;i++) {
+			names.push_back(std::string(elts[i].key));
+		}
+	}
+
 	/** 
 	 * Remember apache request structure and continue as usually
 	 */
-	int execute(request_rec * request, char ** envp) {
+	int execute(request_rec * request) {
 		this->request = request;
 		this->mainfile = std::string(request->filename);
 		int chdir_result = path_chdir(path_dirname(this->mainfile));
 		if (chdir_result == -1) { return chdir_result; }
-		return v8cgi_App::execute(envp);
+		return v8cgi_App::execute(NULL);
 	}
 	
 	void init(v8cgi_config * cfg) { 
@@ -131,9 +146,6 @@ static v8cgi_Module app;
  * This is called from Apache every time request arrives
  */
 static int mod_v8cgi_handler(request_rec *r) {
-	const apr_array_header_t *arr;
-	const apr_table_entry_t *elts;
-
 	if (!r->handler || strcmp(r->handler, "v8cgi-script")) { return DECLINED; }
 
 	ap_setup_client_block(r, REQUEST_CHUNKED_DECHUNK);
@@ -167,35 +179,8 @@ static int mod_v8cgi_handler(request_rec *r) {
 		} 
     }
 	
-	/* extract the CGI environment  */
-	arr = apr_table_elts(r->subprocess_env);
-	elts = (const apr_table_entry_t*) arr->elts;
-	
-	char ** envp = new char *[arr->nelts + 1];
-	envp[arr->nelts] = NULL;
-	
-	size_t size = 0;
-	size_t len1 = 0;
-	size_t len2 = 0;
-	for (int i=0;i<arr->nelts;i++) {
-		len1 = strlen(elts[i].key);
-		len2 = strlen(elts[i].val);
-		size = len1 + len2 + 2;
-		
-		envp[i] = new char[size];
-		envp[i][size-1] = '\0';
-		envp[i][len1] = '=';
-		
-		strncpy(envp[i], elts[i].key, len1);
-		strncpy(&(envp[i][len1+1]), elts[i].val, len2);
-	}
-
-	app.execute(r, envp);
-	
-	for (int i=0;i<arr->nelts;i++) {
-		delete[] envp[i];
-	}
-	delete[] envp;
+	/* CGI environment stays in r->subprocess_env, see v8cgi_Module::envValue */
+	app.execute(r);
 	
 //  Ok is safer, because HTTP_INTERNAL_SERVER_ERROR overwrites any content already generated
 //	if (result) {
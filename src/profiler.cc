@@ -0,0 +1,373 @@
+#include <string>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <v8.h>
+#include <v8-profiler.h>
+#include "macros.h"
+#include "profiler.h"
+
+#ifdef __linux__
+#  define NATIVE_SAMPLING
+#  include <signal.h>
+#  include <time.h>
+#  include <ucontext.h>
+#  include <dlfcn.h>
+#  include <pthread.h>
+#  include <sys/syscall.h>
+#  ifndef sigev_notify_thread_id
+#    define sigev_notify_thread_id _sigev_un._tid
+#  endif
+#endif
+
+#define PROFILE_TITLE "v8cgi"
+
+namespace {
+
+#ifdef NATIVE_SAMPLING
+
+/* native sampling period, nanoseconds of CPU time; matches V8's profiler tick */
+const long NATIVE_INTERVAL = 1000000;
+const int NATIVE_MAX = 65536;
+const int NATIVE_SIGNAL = SIGRTMIN + 3;
+
+void * native_samples[NATIVE_MAX];
+volatile sig_atomic_t native_count = 0;
+timer_t native_timer;
+struct sigaction native_old;
+/* timer and handler are installed */
+bool native_active = false;
+
+/**
+ * Signal handler: record the interrupted program counter only (async-signal-safe)
+ */
+void native_handler(int sig, siginfo_t * info, void * context) {
+	if (native_count >= NATIVE_MAX) { return; }
+	ucontext_t * uc = (ucontext_t *) context;
+	void * pc = NULL;
+#if defined(__x86_64__)
+	pc = (void *) uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__)
+	pc = (void *) uc->uc_mcontext.gregs[REG_EIP];
+#elif defined(__aarch64__)
+	pc = (void *) uc->uc_mcontext.pc;
+#elif defined(__arm__)
+	pc = (void *) uc->uc_mcontext.arm_pc;
+#endif
+	native_samples[native_count++] = pc;
+}
+
+#endif
+
+/**
+ * Uniform random number in [0, 1). Seeded once per process, so forked workers sample different requests.
+ */
+double sample_random() {
+	static int seeded = 0;
+	int pid = (int) getpid();
+	if (seeded != pid) {
+		seeded = pid;
+		srand((unsigned int) pid ^ (unsigned int) time(NULL));
+	}
+	return (double) rand() / ((double) RAND_MAX + 1);
+}
+
+/**
+ * Frame name in collapsed-stack notation: "function (file:line)"
+ */
+std::string frame_name(const v8::CpuProfileNode * node) {
+	v8::String::Utf8Value fname(node->GetFunctionName());
+	v8::String::Utf8Value rname(node->GetScriptResourceName());
+	std::string name = (fname.length() ? *fname : "(anonymous)");
+	if (rname.length()) {
+		std::stringstream ss;
+		ss << " (" << *rname << ":" << node->GetLineNumber() << ")";
+		name += ss.str();
+	}
+	/* ";" separates frames */
+	for (size_t i=0; i<name.length(); i++) {
+		if (name[i] == ';') { name[i] = ','; }
+	}
+	return name;
+}
+
+/**
+ * Walk the top-down call tree, collecting self samples per stack
+ */
+void collapse(const v8::CpuProfileNode * node, std::string prefix, Profiler::stacks_t & stacks) {
+	std::string stack = prefix;
+	if (stack.length()) { stack += ";"; }
+	stack += frame_name(node);
+
+	double self = node->GetSelfSamplesCount();
+	if (self > 0) { stacks[stack] += self; }
+
+	int count = node->GetChildrenCount();
+	for (int i=0; i<count; i++) {
+		collapse(node->GetChild(i), stack, stacks);
+	}
+}
+
+std::string json_escape(std::string str) {
+	std::string result = "\"";
+	char buf[8];
+	for (size_t i=0; i<str.length(); i++) {
+		unsigned char ch = str[i];
+		if (ch == '"' || ch == '\\') {
+			result += '\\';
+			result += ch;
+		} else if (ch < 0x20) {
+			snprintf(buf, sizeof(buf), "\\u%04x", ch);
+			result += buf;
+		} else {
+			result += ch;
+		}
+	}
+	result += "\"";
+	return result;
+}
+
+/**
+ * One node of the legacy .cpuprofile tree ("head" format, as understood by Chrome DevTools)
+ */
+void cpuprofile_node(std::stringstream & ss, std::string name, std::string url, int line, unsigned int uid, double hits) {
+	ss << "{\"functionName\":" << json_escape(name) << ",\"url\":" << json_escape(url);
+	ss << ",\"lineNumber\":" << line << ",\"callUID\":" << uid << ",\"hitCount\":" << (long) hits << ",\"children\":[";
+}
+
+void cpuprofile_tree(std::stringstream & ss, const v8::CpuProfileNode * node) {
+	v8::String::Utf8Value fname(node->GetFunctionName());
+	v8::String::Utf8Value rname(node->GetScriptResourceName());
+	cpuprofile_node(ss, (fname.length() ? *fname : "(anonymous)"), *rname, node->GetLineNumber(), node->GetCallUid(), node->GetSelfSamplesCount());
+	int count = node->GetChildrenCount();
+	for (int i=0; i<count; i++) {
+		if (i) { ss << ","; }
+		cpuprofile_tree(ss, node->GetChild(i));
+	}
+	ss << "]}";
+}
+
+/**
+ * Native samples as a tree: "(native)" -> shared object -> symbol
+ */
+void cpuprofile_native(std::stringstream & ss, Profiler::stacks_t & native) {
+	unsigned int uid = 0xF0000000;
+	cpuprofile_node(ss, "(native)", "", 0, uid++, 0);
+	std::string module = "";
+	bool open = false, first = true;
+	for (Profiler::stacks_t::iterator it = native.begin(); it != native.end(); it++) {
+		/* key is "(native);module;symbol", sorted by module */
+		std::string key = it->first;
+		size_t s1 = key.find(';');
+		size_t s2 = key.find(';', s1+1);
+		std::string mod = key.substr(s1+1, s2-s1-1);
+		std::string sym = key.substr(s2+1);
+		if (!open || mod != module) {
+			if (open) { ss << "]},"; }
+			cpuprofile_node(ss, mod, mod, 0, uid++, 0);
+			module = mod;
+			open = true;
+			first = true;
+		}
+		if (!first) { ss << ","; }
+		cpuprofile_node(ss, sym, mod, 0, uid++, it->second);
+		ss << "]}";
+		first = false;
+	}
+	if (open) { ss << "]}"; }
+	ss << "]}";
+}
+
+}
+
+Profiler::Profiler() {
+	this->running = false;
+	this->requests = 0;
+	this->aggregate = false;
+}
+
+bool Profiler::isRunning() {
+	return this->running;
+}
+
+/**
+ * Read the configuration and start sampling if this request is selected
+ */
+void Profiler::start(v8::Handle<v8::Value> config) {
+	v8::HandleScope handle_scope;
+	if (this->running || !config->IsObject()) { return; }
+	v8::Handle<v8::Object> cfg = config->ToObject();
+
+	double rate = cfg->Get(JS_STR("profileRate"))->NumberValue();
+	if (!(rate > 0)) { return; }
+	if (rate < 1 && sample_random() >= rate) { return; }
+
+	v8::Handle<v8::Value> path = cfg->Get(JS_STR("profilePath"));
+	this->path = (path->IsString() ? *(v8::String::Utf8Value(path)) : ".");
+	v8::Handle<v8::Value> format = cfg->Get(JS_STR("profileFormat"));
+	this->format = (format->IsString() ? *(v8::String::Utf8Value(format)) : "collapsed");
+	this->aggregate = cfg->Get(JS_STR("profileAggregate"))->IsTrue();
+
+	this->running = true;
+	this->requests++;
+	v8::CpuProfiler::StartProfiling(JS_STR(PROFILE_TITLE));
+	this->nativeStart();
+}
+
+/**
+ * Stop sampling, convert the profile and write it out
+ */
+std::string Profiler::stop() {
+	v8::HandleScope handle_scope;
+	if (!this->running) { return ""; }
+	this->running = false;
+
+	stacks_t native;
+	this->nativeStop(native);
+	const v8::CpuProfile * profile = v8::CpuProfiler::StopProfiling(JS_STR(PROFILE_TITLE));
+	if (!profile) { return "V8 CPU profiler is not available"; }
+
+	std::string error = "";
+	if (this->format == "cpuprofile") {
+		std::stringstream ss;
+		const v8::CpuProfileNode * root = profile->GetTopDownRoot();
+		ss << "{\"head\":";
+		cpuprofile_node(ss, "(root)", "", 0, root->GetCallUid(), root->GetSelfSamplesCount());
+		for (int i=0; i<root->GetChildrenCount(); i++) {
+			if (i) { ss << ","; }
+			cpuprofile_tree(ss, root->GetChild(i));
+		}
+		ss << "]},\"startTime\":0,\"endTime\":0,\"samples\":[]}\n";
+		error = this->writeFile(this->outputName("cpuprofile"), ss.str());
+
+		if (error.empty() && native.size()) {
+			std::stringstream ns;
+			ns << "{\"head\":";
+			cpuprofile_node(ns, "(root)", "", 0, 0, 0);
+			cpuprofile_native(ns, native);
+			ns << "]},\"startTime\":0,\"endTime\":0,\"samples\":[]}\n";
+			error = this->writeFile(this->outputName("native.cpuprofile"), ns.str());
+		}
+	} else {
+		stacks_t stacks;
+		const v8::CpuProfileNode * root = profile->GetTopDownRoot();
+		for (int i=0; i<root->GetChildrenCount(); i++) {
+			collapse(root->GetChild(i), "", stacks);
+		}
+
+		error = this->writeCollapsed(stacks, this->totals, "collapsed");
+		if (error.empty() && (native.size() || this->nativeTotals.size())) {
+			error = this->writeCollapsed(native, this->nativeTotals, "native.collapsed");
+		}
+	}
+
+	v8::CpuProfiler::DeleteAllProfiles();
+	return error;
+}
+
+/**
+ * Write collapsed stacks of this request, or add them to the per-worker totals and write those
+ */
+std::string Profiler::writeCollapsed(stacks_t & stacks, stacks_t & totals, std::string suffix) {
+	stacks_t * output = &stacks;
+	if (this->aggregate) {
+		for (stacks_t::iterator it = stacks.begin(); it != stacks.end(); it++) {
+			totals[it->first] += it->second;
+		}
+		output = &totals;
+	}
+
+	std::stringstream ss;
+	for (stacks_t::iterator it = output->begin(); it != output->end(); it++) {
+		ss << it->first << " " << (long) (it->second + 0.5) << "\n";
+	}
+	return this->writeFile(this->outputName(suffix), ss.str());
+}
+
+/**
+ * Output file: one per request, or one per worker when aggregating
+ */
+std::string Profiler::outputName(std::string suffix) {
+	std::stringstream ss;
+	ss << this->path << "/v8cgi-" << getpid();
+	bool collapsed = (suffix == "collapsed" || suffix == "native.collapsed");
+	if (!this->aggregate || !collapsed) { ss << "-" << this->requests; }
+	ss << "." << suffix;
+	return ss.str();
+}
+
+std::string Profiler::writeFile(std::string name, std::string data) {
+	FILE * f = fopen(name.c_str(), "wb");
+	if (!f) { return "Cannot open profile file '" + name + "'"; }
+	fwrite(data.data(), sizeof(char), data.length(), f);
+	fclose(f);
+	return "";
+}
+
+/**
+ * Sample the native program counter on a per-thread CPU-time timer. V8's own sampler uses SIGPROF,
+ * so a realtime signal is used here to stay out of its way.
+ */
+void Profiler::nativeStart() {
+#ifdef NATIVE_SAMPLING
+	native_count = 0;
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = native_handler;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(NATIVE_SIGNAL, &sa, &native_old);
+
+	clockid_t clock;
+	if (pthread_getcpuclockid(pthread_self(), &clock) != 0) { clock = CLOCK_PROCESS_CPUTIME_ID; }
+
+	struct sigevent sev;
+	memset(&sev, 0, sizeof(sev));
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = NATIVE_SIGNAL;
+	sev.sigev_notify_thread_id = syscall(SYS_gettid);
+	if (timer_create(clock, &sev, &native_timer) != 0) {
+		sigaction(NATIVE_SIGNAL, &native_old, NULL);
+		return;
+	}
+
+	struct itimerspec its;
+	its.it_interval.tv_sec = 0;
+	its.it_interval.tv_nsec = NATIVE_INTERVAL;
+	its.it_value = its.it_interval;
+	if (timer_settime(native_timer, 0, &its, NULL) != 0) {
+		timer_delete(native_timer);
+		sigaction(NATIVE_SIGNAL, &native_old, NULL);
+		return;
+	}
+	native_active = true;
+#endif
+}
+
+/**
+ * Stop native sampling and resolve samples to "(native);shared object;symbol". Samples outside
+ * any shared object are JIT-compiled JavaScript, already covered by V8's profile.
+ */
+void Profiler::nativeStop(stacks_t & stacks) {
+#ifdef NATIVE_SAMPLING
+	if (!native_active) { return; }
+	native_active = false;
+	timer_delete(native_timer);
+	sigaction(NATIVE_SIGNAL, &native_old, NULL);
+
+	int count = native_count;
+	for (int i=0; i<count; i++) {
+		Dl_info info;
+		if (!native_samples[i] || !dladdr(native_samples[i], &info) || !info.dli_fname) { continue; }
+		std::string module = info.dli_fname;
+		size_t slash = module.find_last_of('/');
+		if (slash != std::string::npos) { module = module.substr(slash+1); }
+		std::string symbol = (info.dli_sname ? info.dli_sname : "?");
+		stacks["(native);" + module + ";" + symbol] += 1;
+	}
+#endif
+}
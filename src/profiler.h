@@ -0,0 +1,53 @@
+/**
+ * Sampling CPU profiler. Selected requests are profiled with V8's CPU profiler; on Linux, a CPU-time timer
+ * additionally samples the native program counter so time spent in native modules (DB clients, gd, xdom, ...)
+ * is attributed to the shared object and symbol. Results are written as collapsed stacks (flame graphs)
+ * or .cpuprofile (Chrome DevTools), per request or aggregated per worker. Both samplers cover the same
+ * wall time, so native samples go to a separate "native.*" file instead of being added to the JS profile.
+ *
+ * Configuration (Config.*):
+ *   profileRate      - fraction of requests to profile, 0 (default) disables the profiler, 1 profiles all
+ *   profilePath      - output directory
+ *   profileFormat    - "collapsed" (default) or "cpuprofile"
+ *   profileAggregate - collapsed stacks of all profiled requests are summed into one file per worker
+ */
+
+#ifndef _JS_PROFILER_H
+#define _JS_PROFILER_H
+
+#include <string>
+#include <map>
+#include <v8.h>
+
+class Profiler {
+public:
+	typedef std::map<std::string, double> stacks_t;
+
+	Profiler();
+	virtual ~Profiler() {};
+
+	/* decide whether to profile this request; start if so */
+	void start(v8::Handle<v8::Value> config);
+	/* stop profiling and write results; returns error message, empty on success */
+	std::string stop();
+	/* is the current request being profiled? */
+	bool isRunning();
+
+private:
+	bool running;
+	unsigned int requests;
+	std::string path;
+	std::string format;
+	bool aggregate;
+	/* collapsed stacks summed over profiled requests */
+	stacks_t totals;
+	stacks_t nativeTotals;
+
+	void nativeStart();
+	void nativeStop(stacks_t & stacks);
+	std::string writeCollapsed(stacks_t & stacks, stacks_t & totals, std::string suffix);
+	std::string outputName(std::string suffix);
+	std::string writeFile(std::string name, std::string data);
+};
+
+#endif
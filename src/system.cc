@@ -10,7 +10,9 @@
 #include "app.h"
 #include "system.h"
 #include "path.h"
+#include "timeline.h"
 #include <sys/time.h>
+#include <unistd.h>
 
 #ifndef HAVE_SLEEP
 #	include <windows.h>
@@ -93,6 +95,16 @@ JS_METHOD(_getcwd) {
 	return JS_STR(path_getcwd().c_str());
 }
 
+/**
+ * Change current working directory
+ */
+JS_METHOD(_chdir) {
+	if (args.Length() < 1) { return JS_TYPE_ERROR("Bad argument count. Use 'system.chdir(dir)'"); }
+	v8::String::Utf8Value dir(args[0]);
+	if (path_chdir(*dir) != 0) { return JS_ERROR("Cannot change directory"); }
+	return v8::Undefined();
+}
+
 /**
  * Sleep for a given number of seconds
  */
@@ -118,9 +130,75 @@ JS_METHOD(_usleep) {
 JS_METHOD(_getTimeInMicroseconds) {
 	struct timeval tv;
 	gettimeofday(&tv, 0);
-	char buffer[24];
-	sprintf(buffer, "%lu%06lu", tv.tv_sec, tv.tv_usec);
-	return JS_STR(buffer)->ToNumber();
+	return JS_FLOAT((double) tv.tv_sec * 1e6 + (double) tv.tv_usec);
+}
+
+/**
+ * Return monotonic time as [seconds, nanoseconds], suitable for measuring intervals.
+ * Kept as two integers: a double holds whole nanoseconds only up to ~104 days of uptime.
+ */
+JS_METHOD(_hrtime) {
+	uint64_t now = Timeline::now();
+	v8::Handle<v8::Array> result = v8::Array::New(2);
+	result->Set(JS_INT(0), JS_INT((int32_t) (now / 1000000000)));
+	result->Set(JS_INT(1), JS_INT((int32_t) (now % 1000000000)));
+	return result;
+}
+
+/**
+ * system.timeline.mark(name)
+ */
+JS_METHOD(_mark) {
+	if (args.Length() < 1) { return JS_TYPE_ERROR("Bad argument count. Use 'system.timeline.mark(name)'"); }
+	v8cgi_App * app = APP_PTR;
+	v8::String::Utf8Value name(args[0]);
+	app->timeline.mark(*name);
+	return v8::Undefined();
+}
+
+/**
+ * system.timeline.measure(name, [startMark], [endMark])
+ */
+JS_METHOD(_measure) {
+	if (args.Length() < 1) { return JS_TYPE_ERROR("Bad argument count. Use 'system.timeline.measure(name, [startMark], [endMark])'"); }
+	v8cgi_App * app = APP_PTR;
+	v8::String::Utf8Value name(args[0]);
+	std::string startMark = "";
+	std::string endMark = "";
+	if (args.Length() > 1 && !args[1]->IsUndefined() && !args[1]->IsNull()) { startMark = *(v8::String::Utf8Value(args[1])); }
+	if (args.Length() > 2 && !args[2]->IsUndefined() && !args[2]->IsNull()) { endMark = *(v8::String::Utf8Value(args[2])); }
+	if (!app->timeline.measure(*name, startMark, endMark)) { return JS_ERROR("Unknown mark"); }
+	return v8::Undefined();
+}
+
+/**
+ * system.timeline.entries() - array of {name, type, start, duration}; nanoseconds since request start
+ */
+JS_METHOD(_entries) {
+	v8cgi_App * app = APP_PTR;
+	Timeline::entries_t & entries = app->timeline.getEntries();
+	uint64_t origin = app->timeline.origin();
+	v8::Handle<v8::Array> result = v8::Array::New(entries.size());
+	for (size_t i=0; i<entries.size(); i++) {
+		v8::Handle<v8::Object> item = v8::Object::New();
+		item->Set(JS_STR("name"), JS_STR(entries[i].name.c_str()));
+		item->Set(JS_STR("type"), JS_STR(entries[i].instant ? "mark" : "measure"));
+		item->Set(JS_STR("start"), JS_FLOAT((double) (entries[i].start - origin)));
+		item->Set(JS_STR("duration"), JS_FLOAT((double) entries[i].duration));
+		result->Set(JS_INT(i), item);
+	}
+	return result;
+}
+
+/**
+ * system.timeline.toTrace() - Trace Event Format JSON (chrome://tracing)
+ */
+JS_METHOD(_totrace) {
+	v8cgi_App * app = APP_PTR;
+	std::string result = "[";
+	result += app->timeline.toTrace(getpid());
+	result += "]";
+	return JS_STR(result.c_str());
 }
 
 JS_METHOD(_flush) {
@@ -129,12 +207,39 @@ JS_METHOD(_flush) {
 	return v8::Undefined();
 }
 
+v8::Persistent<v8::ObjectTemplate> envTemplate;
+
+/**
+ * system.env property lookup. Variables are resolved on demand, values assigned from JS take precedence.
+ */
+v8::Handle<v8::Value> _envget(v8::Local<v8::String> property, const v8::AccessorInfo &info) {
+	if (info.Holder()->HasRealNamedProperty(property)) { return v8::Handle<v8::Value>(); }
+	v8cgi_App * app = APP_PTR;
+	v8::String::Utf8Value name(property);
+	const char * value = app->envValue(*name);
+	if (!value) { return v8::Handle<v8::Value>(); }
+	return JS_STR(value);
 }
 
-void setup_system(v8::Handle<v8::Object> global, char ** envp, std::string mainfile, std::vector<std::string> args) {
+/**
+ * system.env enumeration
+ */
+v8::Handle<v8::Array> _envenum(const v8::AccessorInfo &info) {
+	v8cgi_App * app = APP_PTR;
+	std::vector<std::string> names;
+	app->envNames(names);
+	v8::Handle<v8::Array> result = v8::Array::New(names.size());
+	for (size_t i=0; i<names.size(); i++) {
+		result->Set(JS_INT(i), JS_STR(names[i].c_str()));
+	}
+	return result;
+}
+
+}
+
+void setup_system(v8::Handle<v8::Object> global, std::string mainfile, std::vector<std::string> args) {
 	v8::HandleScope handle_scope;
 	v8::Handle<v8::Object> system = v8::Object::New();
-	v8::Handle<v8::Object> env = v8::Object::New();
 	global->Set(JS_STR("system"), system);
 	
 	/**
@@ -154,33 +259,26 @@ void setup_system(v8::Handle<v8::Object> global, char ** envp, std::string mainf
 	system->Set(JS_STR("stdin"), v8::FunctionTemplate::New(_stdin)->GetFunction());
 	system->Set(JS_STR("stderr"), v8::FunctionTemplate::New(_stderr)->GetFunction());
 	system->Set(JS_STR("getcwd"), v8::FunctionTemplate::New(_getcwd)->GetFunction());
+	system->Set(JS_STR("chdir"), v8::FunctionTemplate::New(_chdir)->GetFunction());
 	system->Set(JS_STR("sleep"), v8::FunctionTemplate::New(_sleep)->GetFunction());
 	system->Set(JS_STR("usleep"), v8::FunctionTemplate::New(_usleep)->GetFunction());
 	system->Set(JS_STR("getTimeInMicroseconds"), v8::FunctionTemplate::New(_getTimeInMicroseconds)->GetFunction());
-	system->Set(JS_STR("env"), env);
-	
-	std::string name, value;
-	bool done;
-	int i,j;
-	char ch;
-	
-	/* extract environment variables and create JS object */
-	for (i = 0; envp[i] != NULL; i++) {
-		done = false;
-		name = "";
-		value = "";
-		for (j = 0; envp[i][j] != '\0'; j++) {
-			ch = envp[i][j];
-			if (!done) {
-				if (ch == '=') {
-					done = true;
-				} else {
-					name += ch;
-				}
-			} else {
-				value += ch;
-			}
-		}
-		env->Set(JS_STR(name.c_str()), JS_STR(value.c_str()));
+	system->Set(JS_STR("hrtime"), v8::FunctionTemplate::New(_hrtime)->GetFunction());
+
+	v8::Handle<v8::Object> timeline = v8::Object::New();
+	timeline->Set(JS_STR("mark"), v8::FunctionTemplate::New(_mark)->GetFunction());
+	timeline->Set(JS_STR("measure"), v8::FunctionTemplate::New(_measure)->GetFunction());
+	timeline->Set(JS_STR("entries"), v8::FunctionTemplate::New(_entries)->GetFunction());
+	timeline->Set(JS_STR("toJSON"), v8::FunctionTemplate::New(_entries)->GetFunction());
+	timeline->Set(JS_STR("toTrace"), v8::FunctionTemplate::New(_totrace)->GetFunction());
+	system->Set(JS_STR("timeline"), timeline);
+
+	/**
+	 * system.env does not copy the environment; variables are looked up when accessed
+	 */
+	if (envTemplate.IsEmpty()) {
+		envTemplate = v8::Persistent<v8::ObjectTemplate>::New(v8::ObjectTemplate::New());
+		envTemplate->SetNamedPropertyHandler(_envget, 0, 0, 0, _envenum);
 	}
+	system->Set(JS_STR("env"), envTemplate->NewInstance());
 }
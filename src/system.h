@@ -1,3 +1,3 @@
 #include <v8.h>
 
-void setup_system(v8::Handle<v8::Object> global, char ** envp, std::string mainfile, std::vector<std::string> args);
+void setup_system(v8::Handle<v8::Object> global, std::string mainfile, std::vector<std::string> args);
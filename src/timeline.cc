@@ -0,0 +1,127 @@
+#include <string>
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+#include "timeline.h"
+
+namespace {
+
+/**
+ * Escape a string for use in JSON output
+ */
+std::string json_escape(std::string str) {
+	std::string result = "\"";
+	char buf[8];
+	for (size_t i=0; i<str.length(); i++) {
+		unsigned char ch = str[i];
+		switch (ch) {
+			case '"': result += "\\\""; break;
+			case '\\': result += "\\\\"; break;
+			case '\n': result += "\\n"; break;
+			case '\r': result += "\\r"; break;
+			case '\t': result += "\\t"; break;
+			default:
+				if (ch < 0x20) {
+					snprintf(buf, sizeof(buf), "\\u%04x", ch);
+					result += buf;
+				} else {
+					result += ch;
+				}
+			break;
+		}
+	}
+	result += "\"";
+	return result;
+}
+
+}
+
+Timeline::Timeline() {
+	this->start = Timeline::now();
+}
+
+uint64_t Timeline::now() {
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t) tv.tv_sec * 1000000000ULL + (uint64_t) tv.tv_usec * 1000ULL;
+#endif
+}
+
+void Timeline::reset() {
+	this->entries.clear();
+	this->start = Timeline::now();
+}
+
+uint64_t Timeline::origin() {
+	return this->start;
+}
+
+void Timeline::mark(std::string name) {
+	entry_t entry;
+	entry.name = name;
+	entry.instant = true;
+	entry.start = Timeline::now();
+	entry.duration = 0;
+	this->entries.push_back(entry);
+}
+
+bool Timeline::measure(std::string name, std::string startMark, std::string endMark) {
+	uint64_t t1 = this->start;
+	uint64_t t2 = Timeline::now();
+	if (startMark.length() && !this->findMark(startMark, &t1)) { return false; }
+	if (endMark.length() && !this->findMark(endMark, &t2)) { return false; }
+	this->add(name, t1, t2);
+	return true;
+}
+
+void Timeline::add(std::string name, uint64_t start, uint64_t end) {
+	entry_t entry;
+	entry.name = name;
+	entry.instant = false;
+	entry.start = start;
+	entry.duration = (end > start ? end - start : 0);
+	this->entries.push_back(entry);
+}
+
+Timeline::entries_t & Timeline::getEntries() {
+	return this->entries;
+}
+
+/**
+ * Most recent mark with a given name
+ */
+bool Timeline::findMark(std::string name, uint64_t * time) {
+	for (size_t i=this->entries.size(); i>0; i--) {
+		entry_t & entry = this->entries[i-1];
+		if (entry.instant && entry.name == name) {
+			*time = entry.start;
+			return true;
+		}
+	}
+	return false;
+}
+
+std::string Timeline::toTrace(int pid) {
+	std::string result = "";
+	char buf[160];
+	for (size_t i=0; i<this->entries.size(); i++) {
+		entry_t & entry = this->entries[i];
+		if (i) { result += ",\n"; }
+		result += "{\"name\":";
+		result += json_escape(entry.name);
+		if (entry.instant) {
+			snprintf(buf, sizeof(buf), ",\"cat\":\"v8cgi\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+				entry.start / 1000.0, pid, pid);
+		} else {
+			snprintf(buf, sizeof(buf), ",\"cat\":\"v8cgi\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+				entry.start / 1000.0, entry.duration / 1000.0, pid, pid);
+		}
+		result += buf;
+	}
+	return result;
+}
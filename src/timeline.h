@@ -0,0 +1,52 @@
+/**
+ * Per-request timeline. The runtime records its own phases (prepare, autoload, require, main, finish),
+ * scripts add marks and measures via system.timeline. Times are monotonic nanoseconds.
+ */
+
+#ifndef _JS_TIMELINE_H
+#define _JS_TIMELINE_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+class Timeline {
+public:
+	typedef struct {
+		std::string name;
+		bool instant; /* mark (true) or measure (false) */
+		uint64_t start;
+		uint64_t duration;
+	} entry_t;
+	typedef std::vector<entry_t> entries_t;
+
+	Timeline();
+
+	/* monotonic clock, nanoseconds */
+	static uint64_t now();
+
+	/* start of request: forget all entries */
+	void reset();
+	/* request start time */
+	uint64_t origin();
+
+	/* record an instant */
+	void mark(std::string name);
+	/* record a duration between two marks; empty start = request start, empty end = now */
+	bool measure(std::string name, std::string startMark, std::string endMark);
+	/* record a duration */
+	void add(std::string name, uint64_t start, uint64_t end);
+
+	entries_t & getEntries();
+
+	/* Trace Event Format array items (without brackets), timestamps in microseconds */
+	std::string toTrace(int pid);
+
+private:
+	uint64_t start;
+	entries_t entries;
+
+	bool findMark(std::string name, uint64_t * time);
+};
+
+#endif
@@ -0,0 +1,227 @@
+/**
+ * This file tests the cache clients. Protocol tests run against mock servers (cache/server.js)
+ * started as separate processes on abstract local sockets.
+ */
+
+var assert = require("assert");
+var Memcached = require("cache").Memcached;
+var Redis = require("cache").Redis;
+var Socket = require("socket").Socket;
+var Process = require("process").Process;
+
+var serverScript = module.id.replace(/[^\/]*$/, "") + "cache/server.js";
+
+/**
+ * Start a mock server, wait until it accepts connections
+ */
+var start = function(protocol) {
+	var address = "@v8cgi-mock-" + protocol + "-" + Math.random().toString().substring(2);
+	new Process().fork(v8cgi.executableName + " " + serverScript + " " + address + " " + protocol);
+	for (var i=0; i<500; i++) {
+		var probe = new Socket(Socket.PF_UNIX, Socket.SOCK_STREAM, 0);
+		try {
+			probe.connect(address);
+			probe.close();
+			return address;
+		} catch (e) {
+			probe.close();
+		}
+		system.usleep(10000);
+	}
+	throw new Error("Mock " + protocol + " server did not start");
+}
+
+var stop = function(address, protocol) {
+	var socket = new Socket(Socket.PF_UNIX, Socket.SOCK_STREAM, 0);
+	socket.connect(address);
+	socket.send(protocol == "redis" ? "*1\r\n$8\r\nSHUTDOWN\r\n" : "shutdown\r\n");
+	socket.receive(1); /* server closes */
+	socket.close();
+}
+
+/**
+ * A key (with a given prefix) owned by a given server
+ */
+var keyFor = function(client, server, prefix) {
+	for (var i=0; i<10000; i++) {
+		if (client.server(prefix + i) == server) { return prefix + i; }
+	}
+	throw new Error("No key for " + server);
+}
+
+var testMemcached = function(protocol) {
+	var address = start("memcached");
+	var mc = new Memcached(address, {protocol:protocol});
+
+	assert.equal(mc.set("a", "1"), true, "set");
+	assert.equal(mc.get("a"), "1", "get");
+	assert.equal(mc.get("missing"), null, "miss");
+	assert.equal(mc.add("a", "x"), false, "add existing");
+	assert.equal(mc.replace("a", "22"), true, "replace");
+	assert.equal(mc.get("a"), "22", "replaced value");
+	assert.equal(mc.replace("missing", "x"), false, "replace missing");
+
+	assert.equal(mc.increment("n"), null, "increment missing");
+	mc.set("n", 5);
+	assert.equal(mc.increment("n", 3), 8, "increment");
+	assert.equal(mc.decrement("n"), 7, "decrement");
+	assert.equal(mc.remove("n"), true, "remove");
+	assert.equal(mc.remove("n"), false, "remove missing");
+
+	assert.equal(mc.setMulti({x:"1", y:"2"}), 2, "setMulti");
+	var values = mc.getMulti(["x", "missing", "y"]);
+	assert.equal(values.x, "1", "getMulti first");
+	assert.equal(values.y, "2", "getMulti second");
+	assert.equal("missing" in values, false, "getMulti skips misses");
+
+	var buffers = new Memcached(address, {protocol:protocol, type:"buffer"});
+	assert.equal(buffers.get("a").toString("utf-8"), "22", "Buffer value");
+	buffers.close();
+
+	mc.disconnect();
+	mc.close();
+	stop(address, "memcached");
+}
+
+exports.testMemcachedText = function() {
+	testMemcached("text");
+
+	var address = start("memcached");
+	var mc = new Memcached(address);
+	mc.set("s", "abc");
+	assert.throws(function() { mc.increment("s"); }, Error, "non-numeric value");
+	assert.equal(mc.get("s"), "abc", "connection usable after a client error");
+	mc.disconnect();
+	stop(address, "memcached");
+}
+
+exports.testMemcachedMeta = function() {
+	testMemcached("meta");
+}
+
+exports.testRedis = function() {
+	var address = start("redis");
+	var redis = new Redis(address);
+
+	assert.equal(redis.set("a", "1"), true, "set");
+	assert.equal(redis.get("a"), "1", "bulk reply");
+	assert.equal(redis.get("missing"), null, "null bulk reply");
+	assert.equal(redis.increment("n", 5), 5, "integer reply");
+	assert.equal(redis.command("PING"), "PONG", "status reply");
+	assert.equal(redis.command("BLPOP", "list", "0"), null, "null array reply");
+
+	var arr = redis.command("MGET", "a", "missing");
+	assert.equal(arr.length, 2, "array reply");
+	assert.equal(arr[0], "1", "array item");
+	assert.equal(arr[1], null, "null array item");
+
+	assert.throws(function() { redis.command("BOGUS"); }, Error, "error reply");
+	var replies = redis.pipeline([["SET", "p", "1"], ["BOGUS"], ["GET", "p"]]);
+	assert.equal(replies[0], "OK", "pipelined status");
+	assert.equal(replies[1] instanceof Error, true, "pipelined error reply");
+	assert.equal(replies[2], "1", "reply after an error reply");
+
+	var values = redis.getMulti(["a", "missing"]);
+	assert.equal(values.a, "1", "getMulti");
+	assert.equal("missing" in values, false, "getMulti skips misses");
+	assert.equal(redis.remove("a"), true, "remove");
+	assert.equal(redis.remove("a"), false, "remove missing");
+
+	redis.disconnect();
+	stop(address, "redis");
+}
+
+exports.testPipelineOrder = function() {
+	var a1 = start("redis");
+	var a2 = start("redis");
+	var redis = new Redis([a1, a2]);
+	var k1 = keyFor(redis, a1, "k");
+	var k2 = keyFor(redis, a2, "k");
+
+	var replies = redis.pipeline([["SET", k1, "one"], ["SET", k2, "two"], ["GET", k2], ["GET", k1], ["GET", k2]]);
+	assert.equal(replies.join(","), "OK,OK,two,one,two", "replies in command order");
+	var values = redis.getMulti([k2, k1]);
+	assert.equal(values[k1], "one", "getMulti first server");
+	assert.equal(values[k2], "two", "getMulti second server");
+	redis.disconnect();
+	stop(a1, "redis");
+	stop(a2, "redis");
+
+	var m1 = start("memcached");
+	var m2 = start("memcached");
+	var mc = new Memcached([m1, m2]);
+	k1 = keyFor(mc, m1, "k");
+	k2 = keyFor(mc, m2, "k");
+	var items = {};
+	items[k1] = "one";
+	items[k2] = "two";
+	assert.equal(mc.setMulti(items), 2, "setMulti over servers");
+	values = mc.getMulti([k2, k1]);
+	assert.equal(values[k1], "one", "getMulti first server");
+	assert.equal(values[k2], "two", "getMulti second server");
+	mc.disconnect();
+	stop(m1, "memcached");
+	stop(m2, "memcached");
+}
+
+exports.testReconnect = function() {
+	var a1 = start("redis");
+	var a2 = start("redis");
+	var redis = new Redis([a1, a2]);
+	var k1 = keyFor(redis, a1, "k");
+	var k2 = keyFor(redis, a2, "k");
+	var broken = keyFor(redis, a2, "fail");
+	redis.set(k1, "one");
+	redis.set(k2, "two");
+
+	/* the second server drops the connection while the first one's reply is still unread */
+	assert.throws(function() { redis.pipeline([["GET", broken], ["GET", k1]]); }, Error, "connection closed");
+	assert.equal(redis.get(k2), "two", "reconnected");
+	assert.equal(redis.get(k1), "one", "no stale reply");
+	redis.disconnect();
+	stop(a1, "redis");
+	stop(a2, "redis");
+
+	var address = start("memcached");
+	var mc = new Memcached(address);
+	mc.set("a", "1");
+	assert.throws(function() { mc.get("fail"); }, Error, "connection closed");
+	assert.equal(mc.get("a"), "1", "reconnected");
+	mc.disconnect();
+	stop(address, "memcached");
+}
+
+exports.testConsistentHashing = function() {
+	var servers = ["10.0.0.1:11211", "10.0.0.2:11211", "10.0.0.3:11211"];
+	var mc1 = new Memcached(servers);
+	var mc2 = new Memcached(servers.concat("10.0.0.4:11211"));
+
+	var counts = {};
+	var moved = 0;
+	for (var i=0; i<1000; i++) {
+		var key = "key" + i;
+		var server = mc1.server(key);
+		counts[server] = (counts[server] || 0) + 1;
+		assert.equal(mc1.server(key), server, "stable mapping");
+		var server2 = mc2.server(key);
+		if (server2 != server) {
+			assert.equal(server2, "10.0.0.4:11211", "keys only move to the new server");
+			moved++;
+		}
+	}
+	for (var i=0; i<servers.length; i++) {
+		assert.equal(counts[servers[i]] > 200, true, "keys are spread over " + servers[i]);
+	}
+	assert.equal(moved > 100 && moved < 400, true, "about a quarter of keys moved");
+}
+
+exports.testErrors = function() {
+	var mc = new Memcached("127.0.0.1:10010", {timeout:100});
+	assert.throws(function() { mc.get("invalid key"); }, Error, "key with a space");
+	assert.throws(function() { mc.get("valid"); }, Error, "no server listening");
+
+	var redis = new Redis(["127.0.0.1:10010"], {protocol:"resp"});
+	assert.throws(function() { redis.get("key"); }, Error, "no server listening");
+	redis.close();
+	assert.throws(function() { redis.get("key"); }, Error, "closed client");
+}
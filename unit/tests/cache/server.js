@@ -0,0 +1,271 @@
+/**
+ * Mock cache server for cache.js: memcached (text and meta protocol) or Redis (RESP) on a local socket.
+ * Usage: v8cgi server.js <address> <memcached || redis>
+ * Keys starting with "fail" make the server close the connection instead of replying.
+ */
+
+var Socket = require("socket").Socket;
+var loop = require("loop");
+
+var address = system.args[1];
+var protocol = system.args[2];
+var data = {};
+var connections = [];
+
+var Memcached = {
+	/**
+	 * @returns {object || null} {consumed, output, close, quit}, null for incomplete input
+	 */
+	handle: function(input) {
+		var end = input.indexOf("\r\n");
+		if (end == -1) { return null; }
+		var parts = input.substring(0, end).split(" ");
+		var result = {consumed:end+2, output:"", close:false, quit:false};
+		var key = parts[1];
+		if (key && key.indexOf("fail") == 0) {
+			result.close = true;
+			return result;
+		}
+
+		switch (parts[0]) {
+			case "get":
+				for (var i=1; i<parts.length; i++) {
+					if (!(parts[i] in data)) { continue; }
+					result.output += "VALUE " + parts[i] + " 0 " + data[parts[i]].length + "\r\n" + data[parts[i]] + "\r\n";
+				}
+				result.output += "END\r\n";
+			break;
+
+			case "set":
+			case "add":
+			case "replace":
+				var value = this.block(input, result, parseInt(parts[4], 10));
+				if (value === null) { return null; }
+				result.output = (this.store(parts[0], key, value) ? "STORED" : "NOT_STORED") + "\r\n";
+			break;
+
+			case "delete":
+				result.output = (key in data ? "DELETED" : "NOT_FOUND") + "\r\n";
+				delete data[key];
+			break;
+
+			case "incr":
+			case "decr":
+				result.output = this.arithmetic(key, parseInt(parts[2], 10) * (parts[0] == "incr" ? 1 : -1), false);
+			break;
+
+			case "mg":
+				if (key in data) {
+					result.output = "VA " + data[key].length + " k" + key + "\r\n" + data[key] + "\r\n";
+				} else {
+					result.output = "EN\r\n";
+				}
+			break;
+
+			case "mn":
+				result.output = "MN\r\n";
+			break;
+
+			case "ms":
+				var value = this.block(input, result, parseInt(parts[2], 10));
+				if (value === null) { return null; }
+				var modes = {S:"set", E:"add", R:"replace"};
+				var mode = "set";
+				for (var i=3; i<parts.length; i++) {
+					if (parts[i].charAt(0) == "M") { mode = modes[parts[i].charAt(1)]; }
+				}
+				result.output = (this.store(mode, key, value) ? "HD" : "NS") + "\r\n";
+			break;
+
+			case "md":
+				result.output = (key in data ? "HD" : "NF") + "\r\n";
+				delete data[key];
+			break;
+
+			case "ma":
+				var delta = 1, sign = 1;
+				for (var i=2; i<parts.length; i++) {
+					if (parts[i].charAt(0) == "D") { delta = parseInt(parts[i].substring(1), 10); }
+					if (parts[i] == "MD") { sign = -1; }
+				}
+				result.output = this.arithmetic(key, delta * sign, true);
+			break;
+
+			case "shutdown":
+				result.quit = true;
+			break;
+
+			default:
+				result.output = "ERROR\r\n";
+			break;
+		}
+		return result;
+	},
+
+	/**
+	 * Data block following the command line
+	 */
+	block: function(input, result, length) {
+		if (input.length < result.consumed + length + 2) { return null; }
+		var value = input.substring(result.consumed, result.consumed + length);
+		result.consumed += length + 2;
+		return value;
+	},
+
+	store: function(mode, key, value) {
+		if (mode == "add" && key in data) { return false; }
+		if (mode == "replace" && !(key in data)) { return false; }
+		data[key] = value;
+		return true;
+	},
+
+	arithmetic: function(key, delta, meta) {
+		if (!(key in data)) { return (meta ? "NF" : "NOT_FOUND") + "\r\n"; }
+		if (!data[key].match(/^\d+$/)) { return "CLIENT_ERROR cannot increment or decrement non-numeric value\r\n"; }
+		var value = Math.max(0, parseInt(data[key], 10) + delta).toString();
+		data[key] = value;
+		return (meta ? "VA " + value.length + "\r\n" : "") + value + "\r\n";
+	}
+}
+
+var Redis = {
+	handle: function(input) {
+		var command = this.parse(input);
+		if (!command) { return null; }
+		var args = command.args;
+		var result = {consumed:command.consumed, output:"", close:false, quit:false};
+		var key = args[1];
+		if (key && key.indexOf("fail") == 0) {
+			result.close = true;
+			return result;
+		}
+
+		switch (args[0].toUpperCase()) {
+			case "PING":
+				result.output = "+PONG\r\n";
+			break;
+
+			case "GET":
+				result.output = this.bulk(key in data ? data[key] : null);
+			break;
+
+			case "MGET":
+				result.output = "*" + (args.length-1) + "\r\n";
+				for (var i=1; i<args.length; i++) { result.output += this.bulk(args[i] in data ? data[args[i]] : null); }
+			break;
+
+			case "SET":
+				data[key] = args[2];
+				result.output = "+OK\r\n";
+			break;
+
+			case "DEL":
+				result.output = ":" + (key in data ? 1 : 0) + "\r\n";
+				delete data[key];
+			break;
+
+			case "INCRBY":
+				var value = (key in data ? data[key] : "0");
+				if (!value.match(/^-?\d+$/)) {
+					result.output = "-ERR value is not an integer or out of range\r\n";
+				} else {
+					data[key] = (parseInt(value, 10) + parseInt(args[2], 10)).toString();
+					result.output = ":" + data[key] + "\r\n";
+				}
+			break;
+
+			case "BLPOP": /* lists are always empty: timeout */
+				result.output = "*-1\r\n";
+			break;
+
+			case "SHUTDOWN":
+				result.quit = true;
+			break;
+
+			default:
+				result.output = "-ERR unknown command '" + args[0] + "'\r\n";
+			break;
+		}
+		return result;
+	},
+
+	/**
+	 * One array of bulk strings
+	 */
+	parse: function(input) {
+		var end = input.indexOf("\r\n");
+		if (end == -1 || input.charAt(0) != "*") { return null; }
+		var count = parseInt(input.substring(1, end), 10);
+		var pos = end + 2;
+		var args = [];
+		for (var i=0; i<count; i++) {
+			end = input.indexOf("\r\n", pos);
+			if (end == -1) { return null; }
+			var length = parseInt(input.substring(pos+1, end), 10);
+			pos = end + 2;
+			if (input.length < pos + length + 2) { return null; }
+			args.push(input.substring(pos, pos + length));
+			pos += length + 2;
+		}
+		return {args:args, consumed:pos};
+	},
+
+	bulk: function(value) {
+		if (value === null) { return "$-1\r\n"; }
+		return "$" + value.length + "\r\n" + value + "\r\n";
+	}
+}
+
+var handler = (protocol == "redis" ? Redis : Memcached);
+
+var quit = function() {
+	server.onReadable(null);
+	server.close();
+	for (var i=0; i<connections.length; i++) {
+		connections[i].onReadable(null);
+		connections[i].close();
+	}
+	connections = [];
+}
+
+var drop = function(connection) {
+	connection.onReadable(null);
+	connection.close();
+	for (var i=0; i<connections.length; i++) {
+		if (connections[i] == connection) { connections.splice(i, 1); }
+	}
+}
+
+var server = new Socket(Socket.PF_UNIX, Socket.SOCK_STREAM, 0);
+server.bind(address);
+server.listen(16);
+server.onReadable(function() {
+	var connection = this.accept();
+	connections.push(connection);
+	var input = "";
+
+	connection.onReadable(function() {
+		var chunk = this.receive(16384);
+		if (!chunk) {
+			drop(this);
+			return;
+		}
+		input += chunk;
+		while (input.length) {
+			var result = handler.handle(input);
+			if (!result) { return; }
+			input = input.substring(result.consumed);
+			if (result.quit) {
+				quit();
+				return;
+			}
+			if (result.close) {
+				drop(this);
+				return;
+			}
+			this.send(result.output);
+		}
+	});
+});
+
+loop.run();
@@ -0,0 +1,87 @@
+/**
+ * This file tests the native HTTP client.
+ */
+
+var assert = require("assert");
+var client = require("httpclient");
+var Socket = require("socket").Socket;
+var Buffer = require("binary-f").Buffer;
+
+/* returns [client, peer]; the peer queues each response before the client reads it */
+var connect = function(port) {
+	var server = new Socket(Socket.PF_INET, Socket.SOCK_STREAM, Socket.IPPROTO_TCP);
+	server.setOption(Socket.SO_REUSEADDR, true);
+	server.bind("127.0.0.1", port);
+	server.listen(1);
+	var s = new Socket(Socket.PF_INET, Socket.SOCK_STREAM, Socket.IPPROTO_TCP);
+	s.connect("127.0.0.1", port);
+	var peer = server.accept();
+	server.close();
+	return [s, peer];
+}
+
+exports.testKeepAlive = function() {
+	var pair = connect(10007);
+	var request = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+	pair[1].send("HTTP/1.1 200 OK\r\nContent-Length: 5\r\nX-Test: a\r\n\r\nhello");
+	var r = client.exchange(pair[0], request);
+	assert.equal(r.status, 200, "status");
+	assert.equal(r.reason, "OK", "reason");
+	assert.equal(r.headers[1][0], "X-Test", "header name");
+	assert.equal(r.headers[1][1], "a", "header value");
+	assert.equal(r.body, "hello", "length-delimited body");
+	assert.equal(r.reusable, true, "keep-alive");
+
+	pair[1].send("HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 201 Created\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n2;ext\r\nde\r\n0\r\n\r\n");
+	r = client.exchange(pair[0], request, null, {type:"buffer"});
+	assert.equal(r.status, 201, "interim response skipped");
+	assert.equal(r.body instanceof Buffer, true, "Buffer body");
+	assert.equal(r.body.toString("utf-8"), "abcde", "chunked body");
+	assert.equal(r.reusable, true, "chunked keep-alive");
+
+	pair[1].send("HTTP/1.1 204 No Content\r\n\r\nHTTP/1.1 200 OK\r\n");
+	r = client.exchange(pair[0], request);
+	assert.equal(r.status, 204, "response without body");
+	assert.equal(r.reusable, false, "unexpected bytes after the response");
+
+	pair[0].close();
+	pair[1].close();
+}
+
+exports.testStale = function() {
+	var pair = connect(10010);
+	pair[1].setOption(Socket.SO_LINGER, 0);
+	pair[1].close(); /* reset */
+
+	var error = null;
+	try {
+		client.exchange(pair[0], "GET / HTTP/1.1\r\n\r\n");
+	} catch (e) {
+		error = e;
+	}
+	assert.equal(error && error.stale, true, "connection closed by the server may be retried");
+	pair[0].close();
+}
+
+exports.testGzipStream = function() {
+	var pair = connect(10008);
+	var gz = [31, 139, 8, 0, 0, 0, 0, 0, 2, 3, 203, 72, 205, 201, 201, 87, 72, 175, 202, 44, 0, 0, 25, 106, 210, 223, 10, 0, 0, 0];
+	pair[1].send("HTTP/1.1 200 OK\r\nContent-Encoding: gzip\r\nConnection: close\r\n\r\n");
+	pair[1].send(new Buffer(gz));
+	pair[1].close();
+
+	var chunks = [];
+	var r = client.exchange(pair[0], "GET / HTTP/1.1\r\n\r\n", null, {onData:function(chunk) { chunks.push(chunk); }});
+	assert.equal(r.body, null, "streamed body is not collected");
+	assert.equal(chunks.join(""), "hello gzip", "inflated body");
+	assert.equal(r.reusable, false, "read until close");
+	pair[0].close();
+}
+
+exports.testTimeout = function() {
+	var pair = connect(10009);
+	assert.throws(function() { client.exchange(pair[0], "GET / HTTP/1.1\r\n\r\n", null, {timeout:50}); }, Error, "timeout");
+	pair[0].close();
+	pair[1].close();
+}
@@ -6,6 +6,7 @@
  */
 
 var assert = require("assert");
+var Process = require("process").Process;
 
 exports.testFile = function() {
 	var n1 = "n1_testfile_"+Math.random();
@@ -43,6 +44,32 @@ exports.testFile = function() {
 	assert.equal(n.exists(), false, "deleted file #2");
 }
 
+exports.testWriteAtomic = function() {
+	var n = "testatomic_"+Math.random();
+	var f = new File(n);
+
+	f.writeAtomic("abc");
+	assert.equal(f.open("rb").read(), "abc", "atomic write");
+	f.close();
+
+	f.writeAtomic([100,101], {fsync:true});
+	assert.equal(f.open("rb").read(), "de", "synced atomic write");
+	f.close();
+
+	f.writeAtomic("xyz", {fsync:true, batch:true});
+	assert.equal(f.open("rb").read(), "de", "batched write not yet visible");
+	f.close();
+	File.syncBatch();
+	assert.equal(f.open("rb").read(), "xyz", "batched write visible after sync");
+	f.close();
+
+	new Process().system("chmod 600 " + n);
+	f.writeAtomic("mode");
+	assert.equal(f.stat().mode & 0777, 0600, "mode of replaced file kept");
+
+	f.remove();
+}
+
 exports.testDirectory = function() {
 	var n = "testdir_"+Math.random();
 	
@@ -0,0 +1,63 @@
+/**
+ * This file tests the event loop and non-blocking sockets.
+ */
+
+var assert = require("assert");
+var loop = require("loop");
+var Socket = require("socket").Socket;
+
+exports.testTimers = function() {
+	var order = [];
+	loop.setTimeout(function() { order.push(2); }, 20);
+	loop.setTimeout(function() { order.push(1); }, 0);
+	var cleared = loop.setTimeout(function() { order.push(3); }, 10);
+	loop.clearTimeout(cleared);
+
+	var count = 0;
+	var interval = loop.setInterval(function() {
+		count++;
+		if (count == 3) { loop.clearInterval(interval); }
+	}, 1);
+
+	loop.run();
+	assert.equal(order.join(","), "1,2", "timer order");
+	assert.equal(count, 3, "interval count");
+	assert.equal(loop.runOnce(0), false, "loop is idle");
+}
+
+exports.testNonBlockingSocket = function() {
+	var server = new Socket(Socket.PF_INET, Socket.SOCK_STREAM, Socket.IPPROTO_TCP);
+	server.setOption(Socket.SO_REUSEADDR, true);
+	server.bind("127.0.0.1", 10002);
+	server.listen(5);
+	server.setBlocking(false);
+	assert.equal(server.accept(), null, "no pending connection");
+
+	var received = "";
+	server.onReadable(function() {
+		var connection = this.accept();
+		this.onReadable(null);
+		connection.setBlocking(false);
+		connection.onReadable(function() {
+			var data = this.receive(100);
+			if (data) {
+				received += data;
+			} else if (data === "") {
+				this.close();
+			}
+		});
+	});
+
+	var client = new Socket(Socket.PF_INET, Socket.SOCK_STREAM, Socket.IPPROTO_TCP);
+	client.setBlocking(false);
+	client.connect("127.0.0.1", 10002);
+	client.onWritable(function() {
+		this.onWritable(null);
+		this.send("hello");
+		this.close();
+	});
+
+	loop.run();
+	server.close();
+	assert.equal(received, "hello", "data received");
+}
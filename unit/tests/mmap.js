@@ -0,0 +1,69 @@
+/**
+ * This file tests the mmap module.
+ * It is necessary to have write access to current directory.
+ */
+
+var assert = require("assert");
+var MappedFile = require("mmap").MappedFile;
+var Process = require("process").Process;
+
+var create = function(data) {
+	var f = new File("mmap_testfile_"+Math.random());
+	f.open("wb").write(data).close();
+	return f;
+}
+
+exports.testMap = function() {
+	var f = create("hello world");
+	var m = new MappedFile(f.toString());
+	assert.equal(m.length, 11, "mapping length");
+	assert.equal(m.writable, false, "read-only by default");
+	assert.equal(m.cached, false, "first mapping is not cached");
+
+	var b = m.buffer();
+	assert.equal(b.length, 11, "buffer view length");
+	assert.equal(b.toString("utf-8"), "hello world", "buffer view contents");
+	assert.equal(m.buffer(6).toString("utf-8"), "world", "partial view");
+	assert.equal(m.buffer(0, 5).toString("utf-8"), "hello", "ranged view");
+	m.close();
+	assert.throws(function() { m.buffer(); }, Error, "closed mapping");
+	f.remove();
+}
+
+exports.testCache = function() {
+	var f = create("abc");
+	var name = f.toString();
+	var m1 = new MappedFile(name);
+	var m2 = new MappedFile(name);
+	assert.equal(m2.cached, true, "unchanged file is served from cache");
+	assert.equal(m2.buffer().toString("utf-8"), "abc", "cached contents");
+	m1.close();
+	m2.close();
+
+	f.open("ab").write("def").close();
+	var m3 = new MappedFile(name);
+	assert.equal(m3.cached, false, "size change invalidates");
+	assert.equal(m3.length, 6, "new length");
+	assert.equal(m3.buffer().toString("utf-8"), "abcdef", "new contents");
+	m3.close();
+
+	new Process().system("touch -d '2001-01-01' " + name);
+	var m4 = new MappedFile(name);
+	assert.equal(m4.cached, false, "mtime change invalidates");
+	m4.close();
+	f.remove();
+}
+
+exports.testSync = function() {
+	var f = create("xyz");
+	var m = new MappedFile(f.toString(), "rw");
+	assert.equal(m.writable, true, "writable mapping");
+	assert.equal(m.cached, false, "writable mappings are not cached");
+	m.buffer().fill(65, 0, 1);
+	m.sync();
+	m.close();
+	var data = f.open("rb").read();
+	f.close();
+	assert.equal(data, "Ayz", "synced contents");
+	f.remove();
+}
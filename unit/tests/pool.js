@@ -0,0 +1,82 @@
+/**
+ * This file tests the TCP connection pool.
+ */
+
+var assert = require("assert");
+var pool = require("pool");
+var Socket = require("socket").Socket;
+
+exports.testReuse = function() {
+	var server = new Socket(Socket.PF_INET, Socket.SOCK_STREAM, Socket.IPPROTO_TCP);
+	server.setOption(Socket.SO_REUSEADDR, true);
+	server.bind("127.0.0.1", 10006);
+	server.listen(5);
+
+	var s1 = pool.acquire("127.0.0.1", 10006);
+	assert.equal(s1.reused, false, "first connection is new");
+	pool.release(s1);
+
+	var s2 = pool.acquire("127.0.0.1", 10006);
+	assert.equal(s2.reused, true, "second connection is reused");
+	assert.equal(pool.stats()["127.0.0.1:10006"].active, 1, "one active connection");
+	assert.throws(function() { pool.release(s1); }, Error, "double release");
+
+	/* peer closes an idle connection -> it is not handed out again */
+	var peer = server.accept();
+	pool.release(s2);
+	peer.close();
+	var s3 = pool.acquire("127.0.0.1", 10006);
+	assert.equal(s3.reused, false, "closed connection is not reused");
+	pool.release(s3, false);
+
+	pool.clear();
+	assert.equal(pool.stats()["127.0.0.1:10006"].idle, 0, "idle connections closed");
+	server.close();
+}
+
+exports.testClosedLease = function() {
+	var server = new Socket(Socket.PF_INET, Socket.SOCK_STREAM, Socket.IPPROTO_TCP);
+	server.setOption(Socket.SO_REUSEADDR, true);
+	server.bind("127.0.0.1", 10007);
+	server.listen(5);
+
+	/* the script closes a leased socket; its descriptor number is then reused by another socket */
+	var s = pool.acquire("127.0.0.1", 10007);
+	s.close();
+	var pair = Socket.socketPair();
+	pool.release(s);
+	var stats = pool.stats()["127.0.0.1:10007"];
+	assert.equal(stats.active, 0, "lease dropped");
+	assert.equal(stats.idle, 0, "closed socket is not pooled");
+
+	pair[0].send("alive");
+	assert.equal(pair[1].receive(5), "alive", "unrelated descriptor left open");
+	pair[0].close();
+	pair[1].close();
+	server.close();
+}
+
+exports.testWatchedRelease = function() {
+	var server = new Socket(Socket.PF_INET, Socket.SOCK_STREAM, Socket.IPPROTO_TCP);
+	server.setOption(Socket.SO_REUSEADDR, true);
+	server.bind("127.0.0.1", 10011);
+	server.listen(5);
+
+	/* callbacks of a released socket must not fire for (or block) the pooled descriptor */
+	var calls = 0;
+	var s1 = pool.acquire("127.0.0.1", 10011);
+	s1.onReadable(function() { calls++; });
+	pool.release(s1);
+
+	var s2 = pool.acquire("127.0.0.1", 10011);
+	assert.equal(s2.reused, true, "watched connection is reused");
+	var peer = server.accept();
+	peer.send("x");
+	s2.onReadable(function() { this.onReadable(null); });
+	require("loop").run();
+	assert.equal(calls, 0, "previous callback dropped");
+
+	pool.release(s2, false);
+	peer.close();
+	server.close();
+}
@@ -0,0 +1,219 @@
+/**
+ * This file tests the Socket module.
+ */
+
+var assert = require("assert");
+var Socket = require("socket").Socket;
+var Buffer = require("binary-f").Buffer;
+
+exports.testBufferSendReceive = function() {
+	var receiver = new Socket(Socket.PF_INET, Socket.SOCK_DGRAM, Socket.IPPROTO_UDP);
+	receiver.bind("127.0.0.1", 10003);
+	var sender = new Socket(Socket.PF_INET, Socket.SOCK_DGRAM, Socket.IPPROTO_UDP);
+
+	sender.send(new Buffer("hello", "utf-8"), "127.0.0.1", 10003);
+	var data = receiver.receive(100, "buffer");
+	assert.equal(data instanceof Buffer, true, "receive returns a Buffer");
+	assert.equal(data.length, 5, "received length");
+	assert.equal(data.toString("utf-8"), "hello", "received data");
+
+	sender.send(new Buffer("world", "utf-8"), "127.0.0.1", 10003);
+	var target = new Buffer(10, 32);
+	var count = receiver.receiveInto(target, 2);
+	assert.equal(count, 5, "receiveInto count");
+	assert.equal(target.toString("utf-8"), "  world   ", "receiveInto data");
+
+	sender.close();
+	receiver.close();
+}
+
+exports.testBatchedDatagrams = function() {
+	var receiver = new Socket(Socket.PF_INET, Socket.SOCK_DGRAM, Socket.IPPROTO_UDP);
+	receiver.bind("127.0.0.1", 10004);
+	var sender = new Socket(Socket.PF_INET, Socket.SOCK_DGRAM, Socket.IPPROTO_UDP);
+
+	var sent = sender.sendMany([["a", "127.0.0.1", 10004], [new Buffer("bb", "utf-8"), "127.0.0.1", 10004]]);
+	assert.equal(sent, 2, "messages sent");
+	assert.equal(sender.sendv(["c", new Buffer("dd", "utf-8")], "127.0.0.1", 10004), 3, "gathered bytes sent");
+
+	var messages = [];
+	while (messages.length < 3) {
+		messages = messages.concat(receiver.receiveMany(10, 100));
+	}
+	assert.equal(messages[0][0], "a", "first message");
+	assert.equal(messages[1][0], "bb", "second message");
+	assert.equal(messages[2][0], "cdd", "gathered message");
+	assert.equal(messages[0][1], "127.0.0.1", "peer address");
+
+	sender.close();
+	receiver.close();
+}
+
+exports.testSendFile = function() {
+	var name = "sendfile.tmp";
+	var f = new File(name);
+	f.open("w").write("0123456789").close();
+
+	var server = new Socket(Socket.PF_INET, Socket.SOCK_STREAM, Socket.IPPROTO_TCP);
+	server.setOption(Socket.SO_REUSEADDR, true);
+	server.bind("127.0.0.1", 10005);
+	server.listen(1);
+	var client = new Socket(Socket.PF_INET, Socket.SOCK_STREAM, Socket.IPPROTO_TCP);
+	client.connect("127.0.0.1", 10005);
+	var connection = server.accept();
+
+	assert.equal(connection.sendFile(name, 2, 5, "head:"), 10, "header and file bytes sent");
+	assert.equal(connection.sendFile(f, 8), 2, "File instance");
+	connection.close();
+
+	var data = "", chunk;
+	while ((chunk = client.receive(100))) { data += chunk; }
+	assert.equal(data, "head:2345689", "received data");
+
+	client.close();
+	server.close();
+	f.remove();
+}
+
+exports.testOptions = function() {
+	var socket = new Socket(Socket.PF_INET, Socket.SOCK_STREAM, Socket.IPPROTO_TCP);
+
+	socket.setOption(Socket.TCP_NODELAY, true, Socket.IPPROTO_TCP);
+	assert.equal(socket.getOption(Socket.TCP_NODELAY, 0, Socket.IPPROTO_TCP) != 0, true, "TCP_NODELAY");
+
+	socket.setOption(Socket.SO_RCVTIMEO, 1500);
+	assert.equal(socket.getOption(Socket.SO_RCVTIMEO), 1500, "SO_RCVTIMEO in milliseconds");
+
+	socket.setOption(Socket.SO_LINGER, 5);
+	assert.equal(socket.getOption(Socket.SO_LINGER), 5, "SO_LINGER on");
+	socket.setOption(Socket.SO_LINGER, false);
+	assert.equal(socket.getOption(Socket.SO_LINGER), false, "SO_LINGER off");
+
+	socket.close();
+}
+
+exports.testResolver = function() {
+	var name = "hosts.tmp";
+	var f = new File(name);
+	f.open("w").write("10.1.2.3 stub.test\n::1 stub.test other.test # comment\n").close();
+	Socket.configureResolver({stubFile:name});
+
+	var addresses = Socket.resolve("STUB.test");
+	assert.equal(addresses.length, 2, "both families");
+	assert.equal(addresses[0], "::1", "IPv6 first");
+	assert.equal(addresses[1], "10.1.2.3", "IPv4 second");
+	assert.equal(Socket.getAddrInfo("stub.test"), "10.1.2.3", "getAddrInfo prefers IPv4");
+	assert.equal(Socket.getAddrInfo("stub.test", Socket.PF_INET6), "::1", "getAddrInfo with family");
+	assert.equal(Socket.resolve("127.0.0.1")[0], "127.0.0.1", "literal");
+
+	var result = null;
+	Socket.resolve("other.test", function(error, addresses) { result = [error, addresses]; });
+	assert.equal(result, null, "callback is asynchronous");
+	require("loop").run();
+	assert.equal(result[0], null, "no error");
+	assert.equal(result[1][0], "::1", "async result");
+
+	f.remove();
+	Socket.configureResolver({stubFile:"/etc/hosts"});
+}
+
+exports.testResolverNameserver = function() {
+	var loop = require("loop");
+	var server = new Socket(Socket.PF_INET, Socket.SOCK_DGRAM, Socket.IPPROTO_UDP);
+	server.bind("127.0.0.1", 10053);
+	server.setBlocking(false);
+
+	/* fake nameserver: spoofed question first, then the real answer; "localhost" is truncated */
+	var queries = 0;
+	var answer = function(q) {
+		queries++;
+		var peer = this.getPeerName();
+		var question = q.slice(12);
+		var a = (question[question.length-3] == 1);
+		var truncated = (question[1] == 108); /* "l" */
+		var header = [q[0], q[1], (truncated ? 0x83 : 0x81), 0x80, 0, 1, 0, (a && !truncated ? 1 : 0), 0, 0, 0, 0];
+		if (a && !truncated) {
+			var spoof = [4, 101, 118, 105, 108, 4, 116, 101, 115, 116, 0, 0, 1, 0, 1]; /* evil.test */
+			this.send(header.concat(spoof, [0xC0, 12, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4, 6, 6, 6, 6]), peer[0], peer[1]);
+		}
+		var records = (a && !truncated ? [0xC0, 12, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4, 10, 9, 8, 7] : []);
+		this.send(header.concat(question, records), peer[0], peer[1]);
+	}
+	server.onReadable(function() {
+		var q;
+		while ((q = this.receive(512, true))) { answer.call(this, q); }
+	});
+	Socket.configureResolver({stubFile:"", nameservers:["127.0.0.1:10053"], timeout:500, attempts:1, ndots:1});
+
+	var results = {};
+	var done = function(name) {
+		return function(error, addresses) {
+			results[name] = [error, addresses];
+			for (var p in {"dns.test":1, "localhost":1}) { if (!(p in results)) { return; } }
+			server.onReadable(null);
+		};
+	}
+	Socket.resolve("dns.test", done("dns.test"));
+	Socket.resolve("localhost", done("localhost"));
+	loop.run();
+
+	assert.equal(results["dns.test"][0], null, "answered");
+	assert.equal(results["dns.test"][1].join(","), "10.9.8.7", "spoofed answer ignored");
+	assert.equal(queries, 2, "short name goes to the system resolver");
+
+	Socket.configureResolver({ndots:0});
+	var local = null;
+	Socket.resolve("localhost", function(error, addresses) { local = [error, addresses]; server.onReadable(null); });
+	loop.run();
+	assert.equal(queries, 4, "ndots:0 sends short names to the nameserver");
+	assert.equal(local[0], null, "truncated answer falls back to the system resolver");
+	assert.equal(local[1].length > 0, true, "fallback addresses");
+
+	server.close();
+	Socket.configureResolver({stubFile:"/etc/hosts", nameservers:[], ndots:1});
+}
+
+exports.testLocalSockets = function() {
+	var pair = Socket.socketPair();
+	assert.equal(pair[0].send("ping"), 4, "bytes sent");
+	assert.equal(pair[1].receive(4), "ping", "socketPair");
+
+	/* pass one end of a second pair over the first one */
+	var inner = Socket.socketPair();
+	pair[0].sendFd(inner[1], "x");
+	var fd = pair[1].receiveFd();
+	assert.equal(typeof(fd), "number", "descriptor received");
+	assert.equal(pair[1].data, "x", "payload");
+	var passed = new Socket(Socket.PF_UNIX, Socket.SOCK_STREAM, 0, fd);
+	inner[0].send("through");
+	assert.equal(passed.receive(7), "through", "passed descriptor works");
+
+	inner[0].close();
+	inner[1].close();
+	passed.close();
+	pair[0].close();
+	pair[1].close();
+
+	var server = new Socket(Socket.PF_UNIX, Socket.SOCK_STREAM, 0);
+	server.bind("@v8cgi-test");
+	server.listen(1);
+	var client = new Socket(Socket.PF_UNIX, Socket.SOCK_STREAM, 0);
+	client.connect("@v8cgi-test");
+	var peer = server.accept();
+	peer.send("abstract");
+	assert.equal(client.receive(8), "abstract", "abstract namespace");
+	peer.close();
+	client.close();
+	server.close();
+
+	var rx = new Socket(Socket.PF_UNIX, Socket.SOCK_DGRAM, 0);
+	rx.bind("@v8cgi-test-rx");
+	var tx = new Socket(Socket.PF_UNIX, Socket.SOCK_DGRAM, 0);
+	tx.bind("@v8cgi-test-tx");
+	tx.send("dgram", "@v8cgi-test-rx");
+	var messages = rx.receiveMany(1, 100);
+	assert.equal(messages[0][0], "dgram", "abstract datagram");
+	assert.equal(messages[0][1], "@v8cgi-test-tx", "abstract peer address");
+	tx.close();
+	rx.close();
+}
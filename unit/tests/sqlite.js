@@ -1,10 +1,11 @@
 /**
  * This file tests the SQLite module.
- * Database is created in memory, so no intermediate files are created.
+ * Databases are mostly created in memory; testSharedPaths needs write access to current directory.
  */
 
 var assert = require("assert");
 var SQLite = require("sqlite").SQLite;
+var Buffer = require("binary-f").Buffer;
 
 exports.testSQLite = function() {
 	var db = new SQLite().open(":memory:");
@@ -23,11 +24,245 @@ exports.testSQLite = function() {
 	assert.equal(names.join(","), "two", "fetch names");
 
 	var arr = r.fetchArrays();
-	assert.equal(arr[1][0], "2", "fetch arrays");
+	assert.strictEqual(arr[1][0], 2, "fetch arrays");
 	
 	var obj = r.fetchObjects();
-	assert.equal(obj[1]["two"], "2", "fetch objects");
+	assert.strictEqual(obj[1]["two"], 2, "fetch objects");
 
 	db.close();
 }
 
+
+exports.testPrepared = function() {
+	var db = new SQLite().open(":memory:");
+	db.query("create table test(id integer primary key, name varchar(10))");
+
+	var st = db.prepare("insert into test (name) values (?)");
+	st.bind(1, "a").step();
+	st.reset().bind(["b"]).step();
+	st.finalize();
+	assert.equal(db.insertId(), 2, "insert through prepared statement");
+
+	st = db.prepare("select id, name from test where name = :name");
+	var row = st.bind({name:"b"}).step();
+	assert.strictEqual(row.id, 2, "named parameter");
+	assert.equal(st.step(), false, "end of rows");
+	assert.equal(st.reset().step().name, "b", "reset keeps bindings");
+	st.finalize();
+	assert.throws(function(){ st.step(); }, Error, "finalized statement");
+
+	var r = db.query("select name from test where id > ? order by id", [0]);
+	assert.equal(r.numRows(), 2, "query with parameters");
+	r = db.query("select name from test where id > ? order by id", [1]);
+	assert.equal(r.fetchArrays()[0][0], "b", "cached statement rebound");
+	assert.strictEqual(db.query("select ? is null as n", [null]).fetchObjects()[0].n, 1, "null parameter");
+	assert.throws(function(){ db.query("select :x", {y:1}); }, Error, "unknown parameter name");
+	assert.throws(function(){ db.query("select 1; select 2", [1]); }, Error, "parameters for multiple statements");
+
+	st = db.prepare("select 1");
+	db.close();
+	assert.throws(function(){ st.step(); }, Error, "statement of closed database");
+}
+
+exports.testStatementCache = function() {
+	var db = new SQLite().open(":memory:");
+	db.setStatementCache(2);
+	db.query("create table test(a integer)");
+	for (var i=0;i<5;i++) { db.query("insert into test values (?)", [i]); }
+	db.query("select 1");
+	db.query("select 2");
+	db.query("select 3");
+	assert.strictEqual(db.query("select count(*) from test").fetchArrays()[0][0], 5, "statements evicted and re-prepared");
+	db.query("alter table test add column b integer");
+	assert.equal(db.query("select * from test").numFields(), 2, "cached statement after schema change");
+	db.setStatementCache(0);
+	assert.strictEqual(db.query("select count(*) from test where a < ?", [3]).fetchArrays()[0][0], 3, "cache disabled");
+	db.close();
+}
+
+exports.testCursor = function() {
+	var db = new SQLite().open(":memory:");
+	db.query("create table test(i integer, f real, t text, b blob, n integer)");
+	db.query("insert into test values (?, ?, ?, ?, ?)", [1, 1.5, "x", new Buffer([1, 2, 3]), null]);
+	for (var i=2;i<=10;i++) { db.query("insert into test (i) values (?)", [i]); }
+
+	var c = db.cursor("select * from test order by i");
+	assert.equal(c.fetchNames().join(","), "i,f,t,b,n", "cursor names");
+	var row = c.next();
+	assert.strictEqual(row.i, 1, "integer column");
+	assert.strictEqual(row.f, 1.5, "real column");
+	assert.strictEqual(row.t, "x", "text column");
+	assert.ok(row.b instanceof Buffer, "blob column");
+	assert.equal(row.b.length, 3, "blob length");
+	assert.strictEqual(row.n, null, "null column");
+
+	var batch = c.fetch(4);
+	assert.equal(batch.length, 4, "fetch batch");
+	assert.equal(batch[3].i, 5, "fetch order");
+
+	var sum = 0;
+	c.forEach(function(row, index) { sum += row.i; });
+	assert.equal(sum, 6+7+8+9+10, "forEach over remaining rows");
+	assert.equal(c.next(), false, "exhausted cursor");
+	assert.equal(c.fetch(10).length, 0, "exhausted fetch");
+	c.close();
+	assert.throws(function(){ c.next(); }, Error, "closed cursor");
+
+	c = db.cursor("select i from test where i > ?", [8]);
+	assert.throws(function(){ c.forEach(function() { throw new Error("stop"); }); }, Error, "exception from callback");
+	assert.equal(c.next(), false, "cursor released after exception");
+
+	c = db.cursor("select i from test");
+	c.next();
+	db.close();
+	assert.equal(c.next(), false, "cursor of closed database");
+}
+
+exports.testTypes = function() {
+	var db = new SQLite().open(":memory:");
+	var r = db.query("create table test(i integer, f real, t text, b blob); insert into test values (9007199254740993, 0.25, '3', x'00ff'); select * from test");
+	var row = r.fetchObjects()[0];
+	assert.strictEqual(row.i, "9007199254740993", "64-bit integer as string");
+	assert.strictEqual(row.f, 0.25, "real column");
+	assert.strictEqual(row.t, "3", "text column stays a string");
+	assert.ok(row.b instanceof Buffer, "blob column");
+	assert.equal(row.b[1], 255, "blob contents");
+	assert.strictEqual(r.fetchArrays()[0][1], 0.25, "typed arrays");
+
+	var st = db.prepare("select count(*) as c, null as n from test");
+	row = st.step();
+	assert.strictEqual(row.c, 1, "typed statement row");
+	assert.strictEqual(row.n, null, "null in statement row");
+	st.finalize();
+	db.close();
+}
+
+exports.testTransaction = function() {
+	var db = new SQLite({journalMode:"memory", synchronous:"off", busyTimeout:100}).open(":memory:");
+	db.query("create table test(a integer, b text)");
+
+	var r = db.transaction(function(db) {
+		db.query("insert into test values (1, 'x')");
+		try {
+			db.transaction(function() {
+				db.query("insert into test values (2, 'y')");
+				throw new Error("inner");
+			});
+		} catch (e) {}
+		return 42;
+	});
+	assert.strictEqual(r, 42, "transaction result");
+	assert.strictEqual(db.query("select count(*) from test").fetchArrays()[0][0], 1, "savepoint rolled back");
+
+	assert.throws(function(){ 
+		db.transaction(function() {
+			db.query("insert into test values (3, 'z')");
+			throw new Error("outer");
+		});
+	}, Error, "exception is rethrown");
+	assert.strictEqual(db.query("select count(*) from test").fetchArrays()[0][0], 1, "transaction rolled back");
+
+	assert.strictEqual(db.insertMany("test", [[4, "a"], [5, "b"], [6, null]]), 3, "insert arrays");
+	assert.strictEqual(db.insertMany("test", [{b:"c", a:7}, {a:8, b:"d"}]), 2, "insert objects");
+	var st = db.prepare("insert into test (a) values (:a)");
+	assert.strictEqual(db.insertMany(st, [{a:9}, [10]]), 2, "insert through statement");
+	st.finalize();
+	assert.strictEqual(db.query("select sum(a) from test").fetchArrays()[0][0], 1+4+5+6+7+8+9+10, "inserted rows");
+
+	assert.throws(function(){ db.insertMany("test", [[11, "e"], [12]]); }, Error, "bad row");
+	assert.throws(function(){ db.insertMany("test", [[11, "e"], [12, "f", 13]]); }, Error, "too many values");
+	assert.strictEqual(db.query("select count(*) from test where a > 10").fetchArrays()[0][0], 0, "failed batch rolled back");
+
+	assert.throws(function(){ new SQLite({journalMode:"bogus"}).open(":memory:"); }, Error, "bad journal mode");
+	db.close();
+}
+
+exports.testShared = function() {
+	var a = new SQLite({shared:true}).open(":memory:");
+	a.query("create table test(a integer)");
+	var st = a.prepare("select 1");
+	a.query("begin");
+	a.query("insert into test values (1)");
+	a.close();
+	assert.throws(function(){ st.step(); }, Error, "statements finalized on detach");
+
+	var b = new SQLite({shared:true}).open(":memory:");
+	assert.strictEqual(b.query("select count(*) from test").fetchArrays()[0][0], 0, "connection reused, transaction rolled back");
+	var c = new SQLite({shared:true}).open(":memory:");
+	c.close();
+	assert.strictEqual(SQLite.closeShared(), 0, "connection in use is kept");
+	b.close();
+	assert.strictEqual(SQLite.closeShared(), 1, "idle connection closed");
+
+	var d = new SQLite({shared:true}).open(":memory:");
+	assert.throws(function(){ d.query("select * from test"); }, Error, "new connection after closeShared");
+	d.close();
+	SQLite.closeShared();
+}
+
+exports.testSharedPaths = function() {
+	var cwd = system.getcwd();
+	var n = "testdir_"+Math.random();
+	var dirA = new Directory(n+"_a").create();
+	var dirB = new Directory(n+"_b").create();
+
+	try {
+		system.chdir(n+"_a");
+		var a = new SQLite({shared:true}).open("data.db");
+		a.query("create table test(a integer)");
+		system.chdir(cwd);
+
+		system.chdir(n+"_b");
+		var b = new SQLite({shared:true}).open("data.db");
+		assert.throws(function(){ b.query("select * from test"); }, Error, "same relative path in another directory");
+		system.chdir(cwd);
+
+		var c = new SQLite({shared:true}).open(n+"_a/data.db");
+		assert.strictEqual(c.query("select count(*) from test").fetchArrays()[0][0], 0, "other spelling of the same file");
+
+		a.close();
+		b.close();
+		c.close();
+		SQLite.closeShared();
+	} finally {
+		system.chdir(cwd);
+		new File(n+"_a/data.db").remove();
+		new File(n+"_b/data.db").remove();
+		dirA.remove();
+		dirB.remove();
+	}
+}
+
+exports.testRowFormats = function() {
+	var keys = function(obj) {
+		var result = [];
+		for (var p in obj) { result.push(p); }
+		return result;
+	}
+	var db = new SQLite().open(":memory:");
+	db.query("create table test(a integer, b varchar(10))");
+	db.query("insert into test values (1, 'x')");
+	db.query("insert into test values (2, null)");
+
+	var r = db.query("select a, b from test order by a");
+	var rows = r.fetchObjects();
+	assert.strictEqual(rows[1].a, 2, "object rows");
+	assert.strictEqual(rows[1].b, null, "null value");
+	assert.equal(keys(rows[0]).join(","), "a,b", "column order");
+	rows[0].a = 5;
+	assert.strictEqual(rows[1].a, 2, "rows are independent");
+
+	var cols = r.fetchColumns();
+	assert.equal(cols.a.join(","), "1,2", "columnar values");
+	assert.strictEqual(cols.b[0], "x", "columnar strings");
+	assert.equal(keys(db.query("select a from test where a > 5").fetchColumns()).join(","), "a", "empty columns");
+
+	var cursor = db.cursor("select a, b from test order by a");
+	var first = cursor.next();
+	var rest = cursor.fetch(5);
+	assert.strictEqual(first.b, "x", "cursor row");
+	assert.strictEqual(rest[0].a, 2, "cursor rows");
+	assert.equal(keys(rest[0]).join(","), "a,b", "cursor row shape");
+	cursor.close();
+	db.close();
+}
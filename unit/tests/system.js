@@ -0,0 +1,28 @@
+/**
+ * This file tests the built-in system object.
+ */
+
+var assert = require("assert");
+
+exports.testHrtime = function() {
+	var t1 = system.hrtime();
+	var t2 = system.hrtime();
+	assert.equal(t1.length, 2, "hrtime is [sec, nsec]");
+	assert.equal(t1[1] >= 0 && t1[1] < 1e9, true, "nanoseconds in range");
+	var d = (t2[0] - t1[0]) * 1e9 + (t2[1] - t1[1]);
+	assert.equal(d >= 0, true, "hrtime is monotonic");
+}
+
+exports.testTimeline = function() {
+	system.timeline.mark("a");
+	system.timeline.mark("b");
+	system.timeline.measure("a-b", "a", "b");
+
+	var entries = system.timeline.entries();
+	var measure = entries[entries.length-1];
+	assert.equal(measure.name, "a-b", "measure name");
+	assert.equal(measure.type, "measure", "measure type");
+	assert.equal(measure.duration >= 0, true, "measure duration");
+	assert.throws(function() { system.timeline.measure("x", "nonexistent"); }, Error, "unknown mark");
+	assert.equal(JSON.parse(system.timeline.toTrace()).length, entries.length, "trace events");
+}